@@ -2,15 +2,69 @@
 #include <assert.h>
 #include "FBaseStream.h"
 #include "FCompressor.h"
+#include "FG18G15.h"
 
 using namespace fal;
 
 //------------------------------------------------------------------------------
 #pragma intrinsic(memset,memcpy)
 //------------------------------------------------------------------------------
+// G18 layout:
+//   G18_MAGIC:         [magic][packed Data][I stream][A stream]
+//   G18_BLOCKED_MAGIC: [magic][packed Data][blocks number][block headers]
+//                      [I stream, A stream] per block
+// Data holds frames infos, squares and palette and is the same in both variants
+//------------------------------------------------------------------------------
+struct G18BlockHeader {
+   unsigned FramesNumber;
+   unsigned InLenI;
+   unsigned InLenA;
+};
+//------------------------------------------------------------------------------
+// - Frames description, shared by all blocks of the package
+//------------------------------------------------------------------------------
+struct G18FramesInfo {
+   unsigned FramesNumber;
+   unsigned X1, Y1;
+   unsigned BWidth, BHeight;
+   unsigned Width, Height;
+   unsigned G15FileSize;
+   unsigned Directions;
+   unsigned char palRGB[1024];
+   unsigned char* FramesInfos;   // - squares number per frame
+   unsigned char* Squares;       // - RCXY per square
+   unsigned SquaresLen;
+};
+//------------------------------------------------------------------------------
+// - Range of frames, coded with the own models
+//------------------------------------------------------------------------------
+struct G18Block {
+   unsigned FirstFrame, FramesNumber;
+   unsigned SquaresPos;          // - offset of the first square in G18FramesInfo::Squares
+   unsigned PixelsNumber;
+   unsigned char* InI;
+   unsigned InLenI;
+   unsigned char* InA;
+   unsigned InLenA;
+   unsigned char* Out;           // - GU15 squares of the block
+   unsigned OutLen;
+   unsigned OutSize;
+   unsigned* FrameOffsets;       // - frame offsets in the block output
+   bool isOK;
+};
+//------------------------------------------------------------------------------
+class FGA_G18Unpacker;
+struct G18Job {
+   FGA_G18Unpacker* Unpacker;
+   const G18FramesInfo* Info;
+   G18Block* Blocks;
+   unsigned BlocksNumber;
+   volatile LONG* NextBlock;
+};
+//------------------------------------------------------------------------------
 // Realtime unpacker
 //------------------------------------------------------------------------------
-static class FGA_G18Unpacker {
+class FGA_G18Unpacker {
    //---------------------------------------------------------------------------
    FCompressor* Compressor;
    unsigned char *FrameAI;
@@ -36,10 +90,17 @@ static class FGA_G18Unpacker {
    //---------------------------------------------------------------------------
    // -     ,      
    //---------------------------------------------------------------------------
-   static unsigned short FreqsA[ContextsNumberA+1][CharsNumberA];
-   static unsigned short FreqsI[ContextsNumberI+1][CharsNumberI];
-   static unsigned SummFreqsA[ContextsNumberA+1];
-   static unsigned SummFreqsI[ContextsNumberI+1];
+   unsigned short (*FreqsA)[CharsNumberA];
+   unsigned short (*FreqsI)[CharsNumberI];
+   unsigned* SummFreqsA;
+   unsigned* SummFreqsI;
+   //---------------------------------------------------------------------------
+   // - contexts are initialized on the first use after ResetModels, the stamp
+   //   tells if the context belongs to the current model
+   //---------------------------------------------------------------------------
+   unsigned* StampsA;
+   unsigned* StampsI;
+   unsigned Stamp;
    //---------------------------------------------------------------------------
     // -    
    //---------------------------------------------------------------------------
@@ -47,6 +108,8 @@ static class FGA_G18Unpacker {
    unsigned short *FreqI;
    unsigned *SummFreqA;
    unsigned *SummFreqI;
+   //---------------------------------------------------------------------------
+   FGA_G18Unpacker* Workers[G18_MAX_THREADS];
 
    #define GETC(In) ((In)->_getc())
    //---------------------------------------------------------------------------
@@ -66,6 +129,42 @@ static class FGA_G18Unpacker {
 
         memset(FrameAI, 0, Size);
    }
+   //---------------------------------------------------------------------------
+   void ResetModels(void)
+   {
+      if(++Stamp == 0)
+      {
+         memset(StampsA, 0, (ContextsNumberA+1)*sizeof(unsigned));
+         memset(StampsI, 0, (ContextsNumberI+1)*sizeof(unsigned));
+         Stamp = 1;
+      }
+      for(unsigned i = 0; i < CharsNumberA; i++)
+         FreqsA[ContextsNumberA][i] = 1;
+      for(unsigned i = 0; i < CharsNumberI; i++)
+         FreqsI[ContextsNumberI][i] = 1;
+      SummFreqsA[ContextsNumberA] = CharsNumberA;
+      SummFreqsI[ContextsNumberI] = CharsNumberI;
+      StampsA[ContextsNumberA] = Stamp;
+      StampsI[ContextsNumberI] = Stamp;
+   }
+   //---------------------------------------------------------------------------
+   __forceinline void TouchContextA(unsigned idx)
+   {
+      if(StampsA[idx] == Stamp) return;
+      memset(FreqsA[idx], 0, sizeof(FreqsA[idx]));
+      FreqsA[idx][ESC_A] = 1;
+      SummFreqsA[idx] = 1;
+      StampsA[idx] = Stamp;
+   }
+   //---------------------------------------------------------------------------
+   __forceinline void TouchContextI(unsigned idx)
+   {
+      if(StampsI[idx] == Stamp) return;
+      memset(FreqsI[idx], 0, sizeof(FreqsI[idx]));
+      FreqsI[idx][ESC_I] = 1;
+      SummFreqsI[idx] = 1;
+      StampsI[idx] = Stamp;
+   }
    //---------------------------------------------------------------------------
     __forceinline unsigned GetContextIndexA()
     {
@@ -104,6 +203,7 @@ static class FGA_G18Unpacker {
       cnt_chLA = (chL)>>4;
       cnt_chUA = (chU)>>4;
       unsigned idx = GetContextIndexA();
+      TouchContextA(idx);
       FreqA = GetContextFreqA(idx);
       SummFreqA = GetContextSummFreqA(idx);
    }
@@ -113,6 +213,7 @@ static class FGA_G18Unpacker {
       cnt_ch1I = ch1&0x3F;
       cnt_ch0I = ch0&0x3F;
       unsigned idx = GetContextIndexI();
+      TouchContextI(idx);
       FreqI = GetContextFreqI(idx);
       SummFreqI = GetContextSummFreqI(idx);
    }
@@ -222,8 +323,96 @@ static class FGA_G18Unpacker {
       }
    }
    //---------------------------------------------------------------------------
+   // - encoder side of the same carryless range coder, used by the recoding
+   //---------------------------------------------------------------------------
+   __forceinline void RangeEncodeSymbol(unsigned& low, unsigned& range, unsigned short* Freq,
+                                        unsigned SummFreq, unsigned sym, FOutStream* Out)
+   {
+      unsigned cumFreq = 0;
+      for(unsigned i = 0; i < sym; i++)
+         cumFreq += Freq[i];
+      assert(Freq[sym] && cumFreq + Freq[sym] <= SummFreq);
+      low += cumFreq*(range /= SummFreq);
+      range *= Freq[sym];
+       while((low^(low + range)) < TOP || range < BOT && ((range = -(int)low & BOT-1), 1))
+         Out->putc(low>>24), range <<= 8, low <<= 8;
+   }
+   //---------------------------------------------------------------------------
+   void FlushEncoder(unsigned& low, FOutStream* Out)
+   {
+      for(int i = 0; i < 4; i++)
+         Out->putc(low>>24), low <<= 8;
+   }
+   //---------------------------------------------------------------------------
+   // - symbols unseen in the context and the escape symbol itself go through
+   //   the escape and the order 0 model, as DecodeSymbolA expects
+   //---------------------------------------------------------------------------
+   __forceinline void EncodeSymbolA(unsigned int sym, FOutStream* Out)
+   {
+      sym >>= 4;
+      if(sym != ESC_A && FreqA[sym])
+      {
+         RangeEncodeSymbol(lowA, rangeA, FreqA, *SummFreqA, sym, Out);
+         UpdateModelA(sym);
+         return;
+      }
+      RangeEncodeSymbol(lowA, rangeA, FreqA, *SummFreqA, ESC_A, Out);
+      UpdateModelA(ESC_A);
+
+      unsigned short* _FreqA = FreqA;
+      unsigned* _SummFreqA = SummFreqA;
+
+      FreqA = GetContextFreqA(ContextsNumberA);
+      SummFreqA = GetContextSummFreqA(ContextsNumberA);
+
+      RangeEncodeSymbol(lowA, rangeA, FreqA, *SummFreqA, sym, Out);
+      UpdateModelA(sym);
+
+      FreqA = _FreqA;
+      SummFreqA = _SummFreqA;
+
+      UpdateModelA(sym);
+   }
+   //---------------------------------------------------------------------------
+   __forceinline void EncodeSymbolI(unsigned int sym, FOutStream* Out)
+   {
+      if(sym != ESC_I && FreqI[sym])
+      {
+         RangeEncodeSymbol(lowI, rangeI, FreqI, *SummFreqI, sym, Out);
+         UpdateModelI(sym);
+         return;
+      }
+      RangeEncodeSymbol(lowI, rangeI, FreqI, *SummFreqI, ESC_I, Out);
+      UpdateModelI(ESC_I);
+
+      unsigned short* _FreqI = FreqI;
+      unsigned* _SummFreqI = SummFreqI;
+
+      FreqI = GetContextFreqI(ContextsNumberI);
+      SummFreqI = GetContextSummFreqI(ContextsNumberI);
+
+      RangeEncodeSymbol(lowI, rangeI, FreqI, *SummFreqI, sym, Out);
+      UpdateModelI(sym);
+
+      FreqI = _FreqI;
+      SummFreqI = _SummFreqI;
+
+      UpdateModelI(sym);
+   }
+   //---------------------------------------------------------------------------
+   bool ReadData(FInStream& InStream, FInStream& InStreamData, G18FramesInfo& Info);
+   unsigned GetSquaresPixels(const G18FramesInfo& Info, unsigned SquaresPos, unsigned FirstFrame,
+                             unsigned FramesNumber, unsigned* pOutLen);
+   bool CodeBlock(const G18FramesInfo& Info, G18Block& Block, unsigned char* Symbols,
+                  FOutStream* OutI, FOutStream* OutA);
+   void DecodeBlocks(G18Job& Job);
+   static DWORD WINAPI ThreadProc(void* pParam);
+   //---------------------------------------------------------------------------
 public:
-   bool ProcessMemory(unsigned char** pOutData, unsigned* pOutLen, unsigned char* InData, unsigned InLen);
+   bool ProcessMemory(unsigned char** pOutData, unsigned* pOutLen, unsigned char* InData, unsigned InLen,
+                      int ThreadsNumber = 1);
+   bool MakeBlocked(unsigned char** pOutData, unsigned* pOutLen, unsigned char* InData, unsigned InLen,
+                    unsigned FramesPerBlock);
    unsigned ProcessFile(char* InFileName, char* OutFileName);
    //---------------------------------------------------------------------------
    FGA_G18Unpacker()
@@ -232,20 +421,34 @@ public:
       Size = 0;
       Compressor = new FCompressor;
       Compressor->Initialize();
+
+      FreqsA = new unsigned short[ContextsNumberA+1][CharsNumberA];
+      FreqsI = new unsigned short[ContextsNumberI+1][CharsNumberI];
+      SummFreqsA = new unsigned[ContextsNumberA+1];
+      SummFreqsI = new unsigned[ContextsNumberI+1];
+      StampsA = new unsigned[ContextsNumberA+1];
+      StampsI = new unsigned[ContextsNumberI+1];
+      memset(StampsA, 0, (ContextsNumberA+1)*sizeof(unsigned));
+      memset(StampsI, 0, (ContextsNumberI+1)*sizeof(unsigned));
+      Stamp = 0;
+      memset(Workers, 0, sizeof(Workers));
    }
    //---------------------------------------------------------------------------
    ~FGA_G18Unpacker()
    {
+      for(int i = 0; i < G18_MAX_THREADS; i++)
+         delete Workers[i];
       delete[] FrameAI;
+      delete[] FreqsA;
+      delete[] FreqsI;
+      delete[] SummFreqsA;
+      delete[] SummFreqsI;
+      delete[] StampsA;
+      delete[] StampsI;
       delete Compressor;
    }
    //---------------------------------------------------------------------------
-} FGA_G18UnpackerInstance;
-//------------------------------------------------------------------------------
-unsigned short FGA_G18Unpacker::FreqsA[FGA_G18Unpacker::ContextsNumberA+1][FGA_G18Unpacker::CharsNumberA];
-unsigned short FGA_G18Unpacker::FreqsI[FGA_G18Unpacker::ContextsNumberI+1][FGA_G18Unpacker::CharsNumberI];
-unsigned FGA_G18Unpacker::SummFreqsA[FGA_G18Unpacker::ContextsNumberA+1];
-unsigned FGA_G18Unpacker::SummFreqsI[FGA_G18Unpacker::ContextsNumberI+1];
+};
 //------------------------------------------------------------------------------
 unsigned FGA_G18Unpacker::ProcessFile(char* InFileName, char* OutFileName)
 {
@@ -258,55 +461,11 @@ unsigned FGA_G18Unpacker::ProcessFile(char* InFileName, char* OutFileName)
     return OutStream.Size;
 }
 //------------------------------------------------------------------------------
-bool FGA_G18Unpacker::ProcessMemory(unsigned char** pOutData, unsigned* pOutLen, unsigned char* InData, unsigned InLen)
+bool FGA_G18Unpacker::ReadData(FInStream& InStream, FInStream& InStreamData, G18FramesInfo& Info)
 {
-    FInStream InStream;
-    InStream.attach(InData, InLen);
-   if(InStream.getc() != 0xFF)
-   {
-      printf("Not a G18 format!");
-      return false;
-   }
-   //---------------------------------------------------------------------------
-    lowI = 0, codeI = 0, rangeI = (unsigned)-1;
-    lowA = 0, codeA = 0, rangeA = (unsigned)-1;
-   FreqA = FreqI = NULL;
-    SummFreqA = SummFreqI = NULL;
-
-    // -   
-   cnt_ch1A = 0, cnt_ch0A = 0, cnt_chLA = 0, cnt_chUA = 0;
-   cnt_ch1I = 0, cnt_ch0I = 0;
-
-   //------------------------ Initialize models --------------------------------
-   {
-        memset(FreqsA, 0, sizeof(FreqsA));
-      for(unsigned k = 0; k < ContextsNumberA; k++)
-      {
-            FreqsA[k][ESC_A] = 1;
-           SummFreqsA[k] = 1;
-      }
-        memset(FreqsI, 0, sizeof(FreqsI));
-      for(unsigned k = 0; k < ContextsNumberI; k++)
-      {
-            FreqsI[k][ESC_I] = 1;
-           SummFreqsI[k] = 1;
-      }
-   }
-   //------------------------ InitializeModels 0 -------------------------------
-   {
-      for(unsigned i = 0; i < CharsNumberA; i++)
-            FreqsA[ContextsNumberA][i] = 1;
-      
-        for(unsigned i = 0; i < CharsNumberI; i++)
-            FreqsI[ContextsNumberI][i] = 1;
-
-        SummFreqsA[ContextsNumberA] = CharsNumberA;
-        SummFreqsI[ContextsNumberI] = CharsNumberI;
-   }
    //---------------------------------------------------------------------------
    // -  Data
    //---------------------------------------------------------------------------
-    FInStream InStreamData;
    unsigned InDataLen = InStream.getint(InStream.Pos + 1)+9;
    if(!Compressor->Initialize())
    {
@@ -317,95 +476,116 @@ bool FGA_G18Unpacker::ProcessMemory(unsigned char** pOutData, unsigned* pOutLen,
    InStreamData.AllocatedBytes = InStreamData.Size;
    InStream.Pos += InDataLen;
 
-   unsigned FramesNumber = InStreamData._getshort();
-   unsigned X1           = InStreamData._getshort();
-   unsigned Y1           = InStreamData._getshort();
-   unsigned BWidth       = InStreamData._getshort();
-   unsigned BHeight      = InStreamData._getshort();
-   unsigned Width        = InStreamData._getshort();
-   unsigned Height       = InStreamData._getshort();
-   unsigned InfoLen      = InStreamData._getint(), InfoPos = InStreamData.Pos;
-   unsigned G15FileSize  = InStreamData._getint();
-   unsigned Directions   = InStreamData._getc();
+   Info.FramesNumber = InStreamData._getshort();
+   Info.X1           = InStreamData._getshort();
+   Info.Y1           = InStreamData._getshort();
+   Info.BWidth       = InStreamData._getshort();
+   Info.BHeight      = InStreamData._getshort();
+   Info.Width        = InStreamData._getshort();
+   Info.Height       = InStreamData._getshort();
+   unsigned InfoLen  = InStreamData._getint(), InfoPos = InStreamData.Pos;
+   Info.G15FileSize  = InStreamData._getint();
+   Info.Directions   = InStreamData._getc();
    InStreamData.Pos = InfoPos + InfoLen;
    unsigned ColorsNumber = InStreamData._getc()+1;
 
-   static unsigned char palRGB[1024];
-    InStreamData.getblock(palRGB, ColorsNumber*4);
+    InStreamData.getblock(Info.palRGB, ColorsNumber*4);
 
-   FInStream InStreamFramesInfos, InStreamSquares;
-   InStreamFramesInfos.attach(InStreamData.Data + InStreamData.Pos, FramesNumber*2);
-   InStreamSquares.attach(InStreamData.Data + InStreamData.Pos + FramesNumber*2,
-                          InStreamData.Size - InStreamData.Pos - FramesNumber*2);
-
-   FOutStream OutStream, OutStreamSquares;
-   OutStream.reload(G15FileSize);
-
-   // -   GU15   
-   unsigned ToSqrLen = sizeof(DWORD) + //    Magic
-                       sizeof(DWORD) + //    FileSize
-                         sizeof(WORD)  +    // FramesNumber
-                          sizeof(DWORD) +    // InfoLen
-                       sizeof(BYTE)  + // Info: Directions
-                       sizeof(WORD)  + //    Width
-                       sizeof(WORD)  + //    Height
-                      (sizeof(WORD)  + // SquaresNumber
-                         sizeof(WORD)  + // Reserved
-                         sizeof(DWORD))* // Offset
-                       FramesNumber;
+   Info.FramesInfos = InStreamData.Data + InStreamData.Pos;
+   Info.Squares     = InStreamData.Data + InStreamData.Pos + Info.FramesNumber*2;
+   Info.SquaresLen  = InStreamData.Size - InStreamData.Pos - Info.FramesNumber*2;
+   return true;
+}
+//------------------------------------------------------------------------------
+// - pixels and the upper bound of GU15 squares size of the frames range
+//------------------------------------------------------------------------------
+unsigned FGA_G18Unpacker::GetSquaresPixels(const G18FramesInfo& Info, unsigned SquaresPos,
+                                           unsigned FirstFrame, unsigned FramesNumber, unsigned* pOutLen)
+{
+   unsigned Pixels = 0, OutLen = 0;
+   const unsigned short* FramesInfos = (const unsigned short*)Info.FramesInfos;
+   const unsigned* Squares = (const unsigned*)(Info.Squares + SquaresPos);
+   for(unsigned f = FirstFrame; f < FirstFrame + FramesNumber; f++)
+   {
+      unsigned SquaresNumber = FramesInfos[f];
+      for(unsigned s = 0; s < SquaresNumber; s++, Squares++)
+      {
+         unsigned r = 1<<(Squares[0]>>28);
+         Pixels += r*r;
+         OutLen += 8 + r*r*2;
+      }
+   }
+   if(pOutLen) *pOutLen = OutLen;
+   return Pixels;
+}
+//------------------------------------------------------------------------------
+// - Decodes block of frames to GU15 squares. With OutI and OutA given encodes
+//   the block from Symbols instead (A, Idx per pixel). When decoding, Symbols
+//   receive the decoded pixels, if not NULL
+//------------------------------------------------------------------------------
+bool FGA_G18Unpacker::CodeBlock(const G18FramesInfo& Info, G18Block& Block, unsigned char* Symbols,
+                                FOutStream* OutI, FOutStream* OutA)
+{
+   bool isEncode = (OutI != NULL);
+   FInStream InStreamFramesInfos, InStreamSquares, InStreamI, InStreamA;
+   InStreamFramesInfos.attach(Info.FramesInfos + Block.FirstFrame*2, Block.FramesNumber*2);
+   InStreamSquares.attach(Info.Squares + Block.SquaresPos, Info.SquaresLen - Block.SquaresPos);
 
-   OutStreamSquares.attach(OutStream.Data + ToSqrLen, G15FileSize - ToSqrLen);
+   FOutStream OutStreamSquares;
+   if(!isEncode)
+      OutStreamSquares.attach(Block.Out, Block.OutLen);
 
-   OutStream._putint('51UG');
-   OutStream._putint(G15FileSize);
-   OutStream._putshort(FramesNumber);
-   OutStream._putshort(BWidth);
-   OutStream._putshort(BHeight);
-   OutStream._putint(1);          // - InfoLen
-   OutStream._putc(Directions);   // - Info
+   //------------------------ Initialize models --------------------------------
+   ResetModels();
+    lowI = 0, codeI = 0, rangeI = (unsigned)-1;
+    lowA = 0, codeA = 0, rangeA = (unsigned)-1;
+   FreqA = FreqI = NULL;
+    SummFreqA = SummFreqI = NULL;
 
-   FInStream InStreamI, InStreamA;
-   unsigned OutLenI = InStream._getint();
-   unsigned InLenI = InStream._getint();
-   InStreamI.attach(InStream.Data + InStream.Pos, InLenI);
-   InStream.Pos += InLenI;
-   unsigned OutLenA = InStream._getint();
-   unsigned InLenA = InStream._getint();
-   InStreamA.attach(InStream.Data + InStream.Pos, InLenA);
-   InStream.Pos += InLenA;
+    // -   
+   cnt_ch1A = 0, cnt_ch0A = 0, cnt_chLA = 0, cnt_chUA = 0;
+   cnt_ch1I = 0, cnt_ch0I = 0;
 
+   if(!isEncode)
+   {
+      InStreamI.attach(Block.InI, Block.InLenI);
+      InStreamA.attach(Block.InA, Block.InLenA);
+      for(int i = 0; i < 4; i++)
+         codeA = (codeA<<8) | InStreamA._getc();
+      for(int i = 0; i < 4; i++)
+         codeI = (codeI<<8) | InStreamI._getc();
+   }
    //---------------------------------------------------------------------------
-   for(int i = 0; i < 4; i++)
-      codeA = (codeA<<8) | InStreamA._getc();
-   for(int i = 0; i < 4; i++)
-      codeI = (codeI<<8) | InStreamI._getc();
-   //---------------------------------------------------------------------------
-    int _width = ((Width+1)+15)&~15;
-    int _height = ((Height+1)+15)&~15;
+    int _width = ((Info.Width+1)+15)&~15;
+    int _height = ((Info.Height+1)+15)&~15;
    Realloc(_width*_height*2*2);
    //---------------------------------------------------------------------------
-    for(unsigned f = 0; f < FramesNumber; f++)
+   const unsigned char* palRGB = Info.palRGB;
+   unsigned Pixels = 0;
+    for(unsigned f = 0; f < Block.FramesNumber; f++)
    {
       unsigned SquaresNumber = InStreamFramesInfos._getshort();
-
-      OutStream._putint(SquaresNumber);
-      OutStream._putint(OutStreamSquares.Pos);
+      if(!isEncode)
+         Block.FrameOffsets[f] = OutStreamSquares.Pos;
 
       for(unsigned s = 0; s < SquaresNumber; s++)
       {
          unsigned RCXY = InStreamSquares._getint();
-         OutStreamSquares._putint(RCXY);
-         OutStreamSquares._putint(0);
+         if(!isEncode)
+         {
+            OutStreamSquares._putint(RCXY);
+            OutStreamSquares._putint(0);
+         }
 
          unsigned r = 1<<(RCXY>>28);
-         unsigned x = ((RCXY>>12)&0xFFF) - X1;
-         unsigned y = (RCXY&0xFFF) - Y1;
+         unsigned x = ((RCXY>>12)&0xFFF) - Info.X1;
+         unsigned y = (RCXY&0xFFF) - Info.Y1;
 
          int offset = ((y+1)*_width + (x+1))<<2;
             unsigned short* pRleCnt = NULL;
          for(unsigned j = 0; j < r; j++, offset -= ((r-_width)<<2))
          {
-            for(unsigned i = 0; i < r; i++, offset += 4)
+            for(unsigned i = 0; i < r; i++, offset += 4, Pixels++)
             {
                unsigned Idx = 0, A = 0;
                     union {
@@ -415,6 +595,21 @@ bool FGA_G18Unpacker::ProcessMemory(unsigned char** pOutData, unsigned* pOutLen,
                     F = FrameAI + offset - 2;
                     // A1I1A0I0
                     SetContextA(F[0], F[2], F[-2], F[2-(_width<<2)]);
+               if(isEncode)
+               {
+                  A = Symbols[0];
+                  Idx = Symbols[1];
+                  Symbols += 2;
+                  EncodeSymbolA(A, OutA);
+                  if(A)
+                  {
+                     SetContextI(F[1], F[3]);
+                     EncodeSymbolI(Idx, OutI);
+                  }
+                        pF[0] = (pF[0]>>16)|(Idx<<24)|(A<<16);
+                  continue;
+               }
+
                DecodeSymbolA(A, &InStreamA);
 
                if(A)
@@ -422,6 +617,12 @@ bool FGA_G18Unpacker::ProcessMemory(unsigned char** pOutData, unsigned* pOutLen,
                   SetContextI(F[1], F[3]);
                   DecodeSymbolI(Idx, &InStreamI);
                }
+               if(Symbols)
+               {
+                  Symbols[0] = A;
+                  Symbols[1] = Idx;
+                  Symbols += 2;
+               }
 
                     pF[0] = (pF[0]>>16)|(Idx<<24)|(A<<16);
 
@@ -449,7 +650,252 @@ bool FGA_G18Unpacker::ProcessMemory(unsigned char** pOutData, unsigned* pOutLen,
          }
       }
    }
-    OutStream.Size = (unsigned)((OutStreamSquares.Data + OutStreamSquares.Pos) - OutStream.Data);
+   Block.PixelsNumber = Pixels;
+   if(isEncode)
+   {
+      FlushEncoder(lowA, OutA);
+      FlushEncoder(lowI, OutI);
+   }
+   else
+      Block.OutSize = OutStreamSquares.Pos;
+   return true;
+}
+//------------------------------------------------------------------------------
+void FGA_G18Unpacker::DecodeBlocks(G18Job& Job)
+{
+   for(;;)
+   {
+      unsigned b = (unsigned)InterlockedIncrement(Job.NextBlock) - 1;
+      if(b >= Job.BlocksNumber) break;
+      G18Block& Block = Job.Blocks[b];
+      try
+      {
+         Block.isOK = CodeBlock(*Job.Info, Block, NULL, NULL, NULL);
+      }
+      catch(...)
+      {
+         Block.isOK = false;
+      }
+   }
+}
+//------------------------------------------------------------------------------
+DWORD WINAPI FGA_G18Unpacker::ThreadProc(void* pParam)
+{
+   G18Job* Job = (G18Job*)pParam;
+   Job->Unpacker->DecodeBlocks(*Job);
+   return 0;
+}
+//------------------------------------------------------------------------------
+bool FGA_G18Unpacker::ProcessMemory(unsigned char** pOutData, unsigned* pOutLen, unsigned char* InData,
+                                    unsigned InLen, int ThreadsNumber)
+{
+    FInStream InStream;
+    InStream.attach(InData, InLen);
+   unsigned Magic = InStream.getc();
+   if(Magic != G18_MAGIC && Magic != G18_BLOCKED_MAGIC)
+   {
+      printf("Not a G18 format!");
+      return false;
+   }
+   //---------------------------------------------------------------------------
+    FInStream InStreamData;
+   G18FramesInfo Info;
+   ReadData(InStream, InStreamData, Info);
+
+   FOutStream OutStream;
+   OutStream.reload(Info.G15FileSize);
+
+   // -   GU15   
+   unsigned ToSqrLen = sizeof(DWORD) + //    Magic
+                       sizeof(DWORD) + //    FileSize
+                         sizeof(WORD)  +    // FramesNumber
+                          sizeof(DWORD) +    // InfoLen
+                       sizeof(BYTE)  + // Info: Directions
+                       sizeof(WORD)  + //    Width
+                       sizeof(WORD)  + //    Height
+                      (sizeof(WORD)  + // SquaresNumber
+                         sizeof(WORD)  + // Reserved
+                         sizeof(DWORD))* // Offset
+                       Info.FramesNumber;
+
+   OutStream._putint('51UG');
+   OutStream._putint(Info.G15FileSize);
+   OutStream._putshort(Info.FramesNumber);
+   OutStream._putshort(Info.BWidth);
+   OutStream._putshort(Info.BHeight);
+   OutStream._putint(1);          // - InfoLen
+   OutStream._putc(Info.Directions);   // - Info
+
+   //---------------------------------------------------------------------------
+   // - split the streams to blocks, single block for the plain G18
+   //---------------------------------------------------------------------------
+   unsigned BlocksNumber = 1;
+   G18BlockHeader* Headers = NULL;
+   if(Magic == G18_BLOCKED_MAGIC)
+   {
+      // - block count and headers are bounded by the data left
+      if(InStream.Pos + sizeof(unsigned) <= InLen)
+         BlocksNumber = InStream._getint();
+      else
+         BlocksNumber = 0;
+      if(BlocksNumber == 0 || BlocksNumber > (Info.FramesNumber ? Info.FramesNumber : 1) ||
+         BlocksNumber > (InLen - InStream.Pos)/sizeof(G18BlockHeader))
+      {
+         printf("G18 blocks are corrupt!");
+         return false;
+      }
+      Headers = (G18BlockHeader*)(InStream.Data + InStream.Pos);
+      InStream.Pos += BlocksNumber*sizeof(G18BlockHeader);
+   }
+   G18Block* Blocks = new G18Block[BlocksNumber];
+   unsigned* FrameOffsets = new unsigned[Info.FramesNumber + 1];
+   unsigned FirstFrame = 0, SquaresPos = 0;
+   for(unsigned b = 0; b < BlocksNumber; b++)
+   {
+      G18Block& Block = Blocks[b];
+      memset(&Block, 0, sizeof(Block));
+      Block.FirstFrame = FirstFrame;
+      Block.SquaresPos = SquaresPos;
+      Block.FrameOffsets = FrameOffsets + FirstFrame;
+      // - stream lengths are checked before they move the position
+      bool isCorrupt = false;
+      if(Headers)
+      {
+         Block.FramesNumber = Headers[b].FramesNumber;
+         Block.InLenI = Headers[b].InLenI;
+         Block.InLenA = Headers[b].InLenA;
+         isCorrupt = Block.InLenI > InLen - InStream.Pos ||
+                     Block.InLenA > InLen - InStream.Pos - Block.InLenI;
+         if(!isCorrupt)
+         {
+            Block.InI = InStream.Data + InStream.Pos;
+            Block.InA = Block.InI + Block.InLenI;
+            InStream.Pos += Block.InLenI + Block.InLenA;
+         }
+      }
+      else
+      {
+         Block.FramesNumber = Info.FramesNumber;
+         isCorrupt = InStream.Pos + 2*sizeof(unsigned) > InLen;
+         if(!isCorrupt)
+         {
+            unsigned OutLenI = InStream._getint();
+            Block.InLenI = InStream._getint();
+            isCorrupt = InLen - InStream.Pos < 2*sizeof(unsigned) ||
+                        Block.InLenI > InLen - InStream.Pos - 2*sizeof(unsigned);
+         }
+         if(!isCorrupt)
+         {
+            Block.InI = InStream.Data + InStream.Pos;
+            InStream.Pos += Block.InLenI;
+            unsigned OutLenA = InStream._getint();
+            Block.InLenA = InStream._getint();
+            isCorrupt = Block.InLenA > InLen - InStream.Pos;
+         }
+         if(!isCorrupt)
+         {
+            Block.InA = InStream.Data + InStream.Pos;
+            InStream.Pos += Block.InLenA;
+         }
+      }
+      if(isCorrupt || Block.FramesNumber > Info.FramesNumber - FirstFrame)
+      {
+         delete[] Blocks;
+         delete[] FrameOffsets;
+         printf("G18 blocks are corrupt!");
+         return false;
+      }
+      const unsigned short* FramesInfos = (const unsigned short*)Info.FramesInfos;
+      for(unsigned f = FirstFrame; f < FirstFrame + Block.FramesNumber; f++)
+         SquaresPos += FramesInfos[f]*4;
+      FirstFrame += Block.FramesNumber;
+   }
+
+   //---------------------------------------------------------------------------
+   bool isOK = true;
+   unsigned SquaresSize = 0;
+   if(BlocksNumber == 1)
+   {
+      // - decode right into the output
+      Blocks[0].Out = OutStream.Data + ToSqrLen;
+      Blocks[0].OutLen = Info.G15FileSize - ToSqrLen;
+      isOK = CodeBlock(Info, Blocks[0], NULL, NULL, NULL);
+      SquaresSize = Blocks[0].OutSize;
+   }
+   else
+   {
+      // - every block goes to own buffer, sized by its squares
+      for(unsigned b = 0; b < BlocksNumber; b++)
+      {
+         G18Block& Block = Blocks[b];
+         GetSquaresPixels(Info, Block.SquaresPos, Block.FirstFrame, Block.FramesNumber, &Block.OutLen);
+         Block.Out = new unsigned char[Block.OutLen + 16];
+      }
+
+      int Threads = ThreadsNumber;
+      if(Threads > G18_MAX_THREADS) Threads = G18_MAX_THREADS;
+      if(Threads > (int)BlocksNumber) Threads = BlocksNumber;
+      if(Threads < 1) Threads = 1;
+
+      volatile LONG NextBlock = 0;
+      G18Job Jobs[G18_MAX_THREADS];
+      HANDLE hThreads[G18_MAX_THREADS];
+      int ThreadsStarted = 0;
+      for(int t = 0; t < Threads; t++)
+      {
+         Jobs[t].Info = &Info;
+         Jobs[t].Blocks = Blocks;
+         Jobs[t].BlocksNumber = BlocksNumber;
+         Jobs[t].NextBlock = &NextBlock;
+         Jobs[t].Unpacker = this;
+         if(t == 0) continue;
+         if(!Workers[t]) Workers[t] = new FGA_G18Unpacker;
+         Jobs[t].Unpacker = Workers[t];
+         HANDLE hThread = CreateThread(NULL, 0, ThreadProc, &Jobs[t], 0, NULL);
+         if(hThread) hThreads[ThreadsStarted++] = hThread;
+      }
+      DecodeBlocks(Jobs[0]);
+      if(ThreadsStarted > 0)
+      {
+         WaitForMultipleObjects(ThreadsStarted, hThreads, TRUE, INFINITE);
+         for(int t = 0; t < ThreadsStarted; t++)
+            CloseHandle(hThreads[t]);
+      }
+
+      // - gather the blocks
+      unsigned Base = 0;
+      for(unsigned b = 0; b < BlocksNumber; b++)
+      {
+         G18Block& Block = Blocks[b];
+         if(!Block.isOK || ToSqrLen + Base + Block.OutSize > OutStream.AllocatedBytes)
+            isOK = false;
+         if(isOK)
+         {
+            memcpy(OutStream.Data + ToSqrLen + Base, Block.Out, Block.OutSize);
+            for(unsigned f = 0; f < Block.FramesNumber; f++)
+               Block.FrameOffsets[f] += Base;
+            Base += Block.OutSize;
+         }
+         delete[] Block.Out;
+      }
+      SquaresSize = Base;
+   }
+   delete[] Blocks;
+   if(!isOK)
+   {
+      delete[] FrameOffsets;
+      return false;
+   }
+
+   const unsigned short* FramesInfos = (const unsigned short*)Info.FramesInfos;
+    for(unsigned f = 0; f < Info.FramesNumber; f++)
+   {
+      OutStream._putint(FramesInfos[f]);
+      OutStream._putint(FrameOffsets[f]);
+   }
+   delete[] FrameOffsets;
+
+    OutStream.Size = ToSqrLen + SquaresSize;
 
     *pOutData = OutStream.Data;
     *pOutLen = OutStream.Size;
@@ -458,3 +904,123 @@ bool FGA_G18Unpacker::ProcessMemory(unsigned char** pOutData, unsigned* pOutLen,
    return true;
 }
 //------------------------------------------------------------------------------
+bool FGA_G18Unpacker::MakeBlocked(unsigned char** pOutData, unsigned* pOutLen, unsigned char* InData,
+                                  unsigned InLen, unsigned FramesPerBlock)
+{
+    FInStream InStream;
+    InStream.attach(InData, InLen);
+   if(InStream.getc() != G18_MAGIC || FramesPerBlock == 0)
+   {
+      printf("Not a G18 format!");
+      return false;
+   }
+   unsigned DataPos = InStream.Pos;
+    FInStream InStreamData;
+   G18FramesInfo Info;
+   ReadData(InStream, InStreamData, Info);
+   unsigned DataLen = InStream.Pos - DataPos;
+
+   //---------------------------------------------------------------------------
+   // - decode the single stream, keeping the pixels
+   //---------------------------------------------------------------------------
+   G18Block Block;
+   memset(&Block, 0, sizeof(Block));
+   Block.FramesNumber = Info.FramesNumber;
+   unsigned OutLenI = InStream._getint();
+   Block.InLenI = InStream._getint();
+   Block.InI = InStream.Data + InStream.Pos;
+   InStream.Pos += Block.InLenI;
+   unsigned OutLenA = InStream._getint();
+   Block.InLenA = InStream._getint();
+   Block.InA = InStream.Data + InStream.Pos;
+   InStream.Pos += Block.InLenA;
+
+   unsigned Pixels = GetSquaresPixels(Info, 0, 0, Info.FramesNumber, &Block.OutLen);
+   unsigned char* Symbols = new unsigned char[Pixels*2 + 2];
+   Block.Out = new unsigned char[Block.OutLen + 16];
+   Block.FrameOffsets = new unsigned[Info.FramesNumber + 1];
+   bool isOK = CodeBlock(Info, Block, Symbols, NULL, NULL);
+   delete[] Block.Out;
+   delete[] Block.FrameOffsets;
+   if(!isOK)
+   {
+      delete[] Symbols;
+      return false;
+   }
+
+   //---------------------------------------------------------------------------
+   // - encode the blocks with the fresh models
+   //---------------------------------------------------------------------------
+   unsigned BlocksNumber = (Info.FramesNumber + FramesPerBlock - 1)/FramesPerBlock;
+   if(BlocksNumber == 0) BlocksNumber = 1;
+   G18BlockHeader* Headers = new G18BlockHeader[BlocksNumber];
+   FOutStream* OutI = new FOutStream[BlocksNumber];
+   FOutStream* OutA = new FOutStream[BlocksNumber];
+   unsigned char* BlockSymbols = Symbols;
+   unsigned SquaresPos = 0;
+   const unsigned short* FramesInfos = (const unsigned short*)Info.FramesInfos;
+   for(unsigned b = 0; b < BlocksNumber; b++)
+   {
+      memset(&Block, 0, sizeof(Block));
+      Block.FirstFrame = b*FramesPerBlock;
+      Block.FramesNumber = Info.FramesNumber - Block.FirstFrame;
+      if(Block.FramesNumber > FramesPerBlock) Block.FramesNumber = FramesPerBlock;
+      Block.SquaresPos = SquaresPos;
+
+      OutI[b].reload(4096);
+      OutA[b].reload(4096);
+      CodeBlock(Info, Block, BlockSymbols, &OutI[b], &OutA[b]);
+      BlockSymbols += Block.PixelsNumber*2;
+
+      Headers[b].FramesNumber = Block.FramesNumber;
+      Headers[b].InLenI = OutI[b].Size;
+      Headers[b].InLenA = OutA[b].Size;
+      for(unsigned f = Block.FirstFrame; f < Block.FirstFrame + Block.FramesNumber; f++)
+         SquaresPos += FramesInfos[f]*4;
+   }
+   delete[] Symbols;
+
+   FOutStream OutStream;
+   OutStream.reload(InLen);
+   OutStream.putc(G18_BLOCKED_MAGIC);
+   OutStream.putblock(InData + DataPos, DataLen);
+   OutStream.putint(BlocksNumber);
+   OutStream.putblock((unsigned char*)Headers, BlocksNumber*sizeof(G18BlockHeader));
+   for(unsigned b = 0; b < BlocksNumber; b++)
+   {
+      OutStream.putblock(OutI[b].Data, OutI[b].Size);
+      OutStream.putblock(OutA[b].Data, OutA[b].Size);
+   }
+   delete[] Headers;
+   delete[] OutI;
+   delete[] OutA;
+
+    *pOutData = OutStream.Data;
+    *pOutLen = OutStream.Size;
+    OutStream.drop();
+   return true;
+}
+//------------------------------------------------------------------------------
+FGA_G18Unpacker* G18CreateUnpacker(void)
+{
+   return new FGA_G18Unpacker;
+}
+//------------------------------------------------------------------------------
+void G18DestroyUnpacker(FGA_G18Unpacker* Unpacker)
+{
+   delete Unpacker;
+}
+//------------------------------------------------------------------------------
+bool G18UnpackMemory(FGA_G18Unpacker* Unpacker, unsigned char** pOutData, unsigned* pOutLen,
+                     unsigned char* InData, unsigned InLen, int ThreadsNumber)
+{
+   return Unpacker->ProcessMemory(pOutData, pOutLen, InData, InLen, ThreadsNumber);
+}
+//------------------------------------------------------------------------------
+bool G18MakeBlocked(unsigned char** pOutData, unsigned* pOutLen,
+                    unsigned char* InData, unsigned InLen, unsigned FramesPerBlock)
+{
+   FGA_G18Unpacker Unpacker;
+   return Unpacker.MakeBlocked(pOutData, pOutLen, InData, InLen, FramesPerBlock);
+}
+//------------------------------------------------------------------------------
@@ -0,0 +1,33 @@
+//---------------------------------------------------------------------------
+#ifndef FG18G15H
+#define FG18G15H
+
+//------------------------------------------------------------------------------
+// G18 -> GU15 realtime unpacker
+//------------------------------------------------------------------------------
+enum {
+   G18_MAGIC          = 0xFF,   // - frames are coded as a single stream
+   G18_BLOCKED_MAGIC  = 0xFE,   // - blocks of frames are coded independently
+   G18_MAX_THREADS    = 16
+};
+
+class FGA_G18Unpacker;
+
+//------------------------------------------------------------------------------
+// - Unpacker keeps the adaptive models and the frame context, so it is not shared
+//   between the threads. Blocked packages are decoded on up to ThreadsNumber
+//   threads, each with its own models. Output is allocated with new[]
+//------------------------------------------------------------------------------
+FGA_G18Unpacker* G18CreateUnpacker(void);
+void G18DestroyUnpacker(FGA_G18Unpacker* Unpacker);
+bool G18UnpackMemory(FGA_G18Unpacker* Unpacker, unsigned char** pOutData, unsigned* pOutLen,
+                     unsigned char* InData, unsigned InLen, int ThreadsNumber = 1);
+
+//------------------------------------------------------------------------------
+// - Recodes G18 package into the blocked variant: every FramesPerBlock frames
+//   start with the fresh models and the clean frame context
+//------------------------------------------------------------------------------
+bool G18MakeBlocked(unsigned char** pOutData, unsigned* pOutLen,
+                    unsigned char* InData, unsigned InLen, unsigned FramesPerBlock = 32);
+
+#endif
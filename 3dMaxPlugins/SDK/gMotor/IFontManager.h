@@ -26,6 +26,8 @@ public:
     virtual int        CreateUniformFont   ( const char* texName, int charW, int charH )                            = 0;
     //  returns width of the string for a given font
     virtual int        GetStringWidth      ( int fontID, const char* str, int spacing = 1 )                        = 0;
+    //  returns width of the unicode string, missing glyphs are rendered on demand
+    virtual int        GetStringWidth      ( int fontID, const wchar_t* str, int spacing = 1 )                     = 0;
     //  returns width of the given character in the font
     virtual int        GetCharWidth        ( int fontID, BYTE ch ) = 0;
     //  returns height of the given character in the font
@@ -34,6 +36,8 @@ public:
     //  draws a string of the given font (drawing is actually batched)
     virtual bool    DrawString             ( int fontID, const char* str, const Vector3D& pos, DWORD color = 0xFFFFFFFF, int spacing = 1 ) = 0;
     virtual bool    DrawStringW            ( int fontID, const char* str, const Vector3D& pos, DWORD color = 0xFFFFFFFF, int spacing = 1 ) = 0;
+    //  draws unicode string, missing glyphs are rendered on demand
+    virtual bool    DrawString             ( int fontID, const wchar_t* str, const Vector3D& pos, DWORD color = 0xFFFFFFFF, int spacing = 1 ) = 0;
     //  draws single character by its code
     virtual bool    DrawChar               ( int fontID, const Vector3D& pos, BYTE ch, DWORD color = 0xFFFFFFFF )    = 0;
     //  draws single character by its texture coordinates
@@ -42,7 +46,8 @@ public:
     virtual bool    DrawChar               ( int fontID, const Vector3D& pos, const Rct& uv, 
                                                 float w, float h, DWORD color = 0xFFFFFFFF ) = 0;
 
-    //  flushes font batch, if fontID == -1, all fonts' batches are flushed 
+    //  flushes the frame text batch. Text of all the fonts is batched together,
+    //  so the whole batch is flushed for any fontID
     virtual void    FlushText              ( int fontID = -1 )                                                        = 0;
 
 }; // IFontManager
@@ -7,6 +7,16 @@
 #ifndef __IIMPOSTORCACHE_H__ 
 #define __IIMPOSTORCACHE_H__ 
 
+/*****************************************************************************/
+/*  Struct: ImpostorBakeItem
+/*  Desc:   Model and animation to be baked into the impostor atlas
+/*****************************************************************************/
+struct ImpostorBakeItem
+{
+    DWORD           m_ModelID;
+    DWORD           m_AnimID;       //  0xFFFFFFFF for the static model
+}; // struct ImpostorBakeItem
+
 /*****************************************************************************/
 /*  Class:  IImpostorCache
 /*  Desc:   Interface for the impostor cache
@@ -27,9 +37,22 @@ public:
     //  renders debug info
     virtual void    DrawDebugInfo   ( int dbgSurf = -1 ) = 0;
     virtual void    DumpSurfaces    () = 0;
+
+    //  renders all quantized views and animation frames of the items into the atlas 
+    //  pages, which are saved next to the index file as DXT5 textures. 
+    //  Returns number of baked impostors
+    virtual int     BakeAtlas       ( const char* fname, const ImpostorBakeItem* items, int nItems ) = 0;
+    //  loads prebaked atlas, impostors found there are not rendered at runtime
+    virtual bool    LoadAtlas       ( const char* fname ) = 0;
     
 }; // class IImpostorCache
 
 extern IImpostorCache* IImpCache;
 
+//  path of the atlas the cache loads on init, <home>\Impostors\impostors.ima
+void    GetImpostorAtlasPath    ( char* path );
+//  bakes the default atlas from the models in the directory tree: every model 
+//  is baked static and with each animation found in its directory. Returns number of impostors
+int     BakeImpostorAtlas       ( const char* root );
+
 #endif // __IIMPOSTORCACHE_H__ 
\ No newline at end of file
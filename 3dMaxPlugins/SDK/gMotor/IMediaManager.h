@@ -81,6 +81,8 @@ public:
 	virtual void			ReloadModel			(DWORD idModel) = 0;
     virtual SNode*          GetModelRoot        ( DWORD modelID ) = 0;
     virtual const char*     GetModelFileName    ( DWORD modelID ) = 0;
+    //  returns handle of the loaded model, which root is the given node, c_BadID if none
+    virtual DWORD           GetNodeModelID      ( DWORD nodeID ) = 0;
 	virtual void			GetModelBounds		(DWORD idModel, std::vector<AABoundBox> &Bounds, std::vector<Matrix4D> &Transforms) = 0;
 
     //  returns handle to the child node of the given model
@@ -181,6 +183,13 @@ public:
     virtual bool            Intersects          ( float mX, float mY, DWORD modelID, const Matrix4D& tm, float& dist ) = 0;
     //to use in debug
     virtual const char*     GetModelOfNodeName  ( DWORD NodeID ) = 0;
+
+    //  crowd rendering: between BeginModelBatch and EndModelBatch DrawModel only queues 
+    //  model instances, EndModelBatch submits them grouped by model with one flush per group.
+    //  Texture factor, color/shader constants and z states current at DrawModel are kept
+    //  per instance, clip planes and state blocks must not change inside of the batch
+    virtual void            BeginModelBatch     () = 0;
+    virtual void            EndModelBatch       () = 0;
 }; // class IMediaManager
 
 //  use this 
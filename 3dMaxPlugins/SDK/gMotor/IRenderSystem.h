@@ -477,6 +477,8 @@ public:
     virtual void                SetAlphaRef         ( BYTE alphaRef          ) = 0;
     virtual void                SetZEnable          ( bool bEnable = true ) = 0;
     virtual void                SetZWriteEnable     ( bool bEnable = true ) = 0;
+    virtual bool                GetZEnable          () const = 0;
+    virtual bool                GetZWriteEnable     () const = 0;
     virtual void                SetDitherEnable     ( bool bEnable = true ) = 0;
     virtual void                SetTexFilterEnable  ( bool bEnable = true ) = 0;
     virtual void                SetWireframe        ( bool bEnable = true ) = 0;
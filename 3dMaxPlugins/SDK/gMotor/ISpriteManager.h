@@ -29,6 +29,18 @@ enum SpriteStatistics
     ssFrameInstMemory    = 3        //    memory occupied by frame instances
 }; // enum SpriteStatistics
 
+/*****************************************************************/
+/*  Struct:  SpriteDrawItem
+/*  Desc:    Single sprite of the batched submission
+/*****************************************************************/
+struct SpriteDrawItem
+{
+    int                 m_GPID;             //  package ID
+    int                 m_SprID;            //  frame index
+    DWORD               m_Color;            //  national color
+    Matrix4D            m_TM;               //  screen or world space transform
+}; // struct SpriteDrawItem
+
 /*****************************************************************/
 /*  Class:    ISpriteManager
 /*  Desc:    Sprite manager abstract interface
@@ -49,6 +61,9 @@ public:
     virtual bool    DrawWSprite ( int gpID, int sprID, const Vector3D& pos, BaseMesh& geom, DWORD color = 0 ) = 0;
     virtual bool    DrawWChunk  ( int gpID, int sprID, int chunkID, const Vector3D& pos, 
                                         BaseMesh& geom, int cPoly, int nPoly, int cVert, int nVert, DWORD color = 0 ) = 0;
+    //  draws array of sprites, screen space ones or world space when bWorld.
+    //  Runs of the same frame are resolved once. Returns number of sprites drawn
+    virtual int     DrawSprites ( const SpriteDrawItem* pItems, int nItems, bool bWorld = false ) = 0;
 
     //  storage manipulation
     virtual int     GetPackageID     ( const char* gpName ) = 0;
@@ -89,6 +104,9 @@ public:
     virtual DWORD    GetPackageMagic  ( int gpID ) = 0;
     
     virtual void     Precache         ( int gpID ) = 0;
+    //  converts package into block-compressed texture pages for the national color,
+    //  saved next to the package and picked up at LOD 0. Logs decode time, texture memory and PSNR
+    virtual bool     TranscodePackage ( int gpID, DWORD color = 0 ) = 0;
     virtual bool     GetBoundFrame    ( int gpID, int sprID, Rct& frame, DWORD color = 0 ) = 0;
     virtual bool     GetAABB          ( int gpID, int sprID, AABoundBox& aabb, DWORD color = 0 ) = 0;
     virtual void     Purge            () = 0;
@@ -101,6 +119,17 @@ public:
     virtual bool     GetQuadRect      ( int gpID, int sprID, int quadID, Rct& rct ) = 0;
     virtual void     SetManagedCache  ( bool bManaged ) = 0;
 
+    //  warm start: frames cached in the previous session are laid out again before 
+    //  they are requested. OnFrame runs the layout steps, loading screens may run 
+    //  them with the larger budget
+    virtual bool     SaveWarmStart    ( const char* fname ) = 0;
+    virtual bool     LoadWarmStart    ( const char* fname ) = 0;
+    virtual bool     WarmStartStep    ( float budgetMs ) = 0;
+    //  restarts the time to stable frame measurement, terrain calls it when the map extents are set
+    virtual void     ResetStableFrame () = 0;
+    //  seconds to the first frame run without the new frame layout, -1 until then
+    virtual float    GetTimeToStableFrame() const = 0;
+
 }; // ISpriteManager
 
 extern DIALOGS_API ISpriteManager* ISM;
@@ -24,7 +24,13 @@ public:
     virtual bool                CreateTexture   ( int texID, const Rct& mapExt )        { return false; }
     virtual bool                UseTextureCache () const { return false; }
     virtual bool                CreateGeomery   ( const Rct& mapExt, int lod )          { return false; }
+    //  true when CreateGeomery may be called from the terrain bake threads. 
+    //  It then must not use the render system, only ITerra->AllocateGeometry and height queries
+    virtual bool                CanBakeAsync    () const { return false; }
     virtual bool                GetAABB         ( const Rct& mapExt, AABoundBox& aabb ) { return false; }
+    //  updates vertices of the quad mesh lying in the dirty area after heightmap edit.
+    //  Returning false makes the quad geometry to be rebuilt from scratch
+    virtual bool                PatchGeometry   ( BaseMesh& mesh, const Rct& mapExt, int lod, const Rct& dirty ) { return false; }
     virtual void                SetHeight       ( float x, float y, float h ) {}
     virtual Vector3D            GetNormal       ( float x, float y ) = 0;
     virtual Vector3D            GetAvgNormal    ( float x, float y, float radius ) = 0;
@@ -90,6 +96,10 @@ public:
                                               Vector3D& pt )            = 0;
     virtual bool        Pick                ( int mX, int mY, 
                                               Vector3D& pt )            = 0;
+
+    //  the engine has no map loader, the host calls it after loading the map and 
+    //  setting the extents. Loads the trees database stored next to the map file
+    virtual void        LoadMapData         ( const char* mapFile )      = 0;
     
 }; // class ITerrain
 
@@ -30,4 +30,8 @@ public:
 }; // class IWaterscape
 
 extern IWaterscape*     IWater;
+
+//  logs water rendering CPU time and geometry counts with the flat quads scan
+//  and with the quad tree, from the current camera
+bool BenchmarkWater( int nFrames = 64 );
 #endif // __IWATER_H__
\ No newline at end of file
@@ -0,0 +1,185 @@
+/*****************************************************************************/
+/*    File:    kBakeQueue.hpp
+/*    Desc:    Pool of worker threads serving the fixed set of bake requests
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __KBAKEQUEUE_HPP__
+#define __KBAKEQUEUE_HPP__
+
+#include <vector>
+
+/*****************************************************************************/
+/*  Class:  BakeQueue
+/*  Desc:   Render thread allocates requests, fills and submits them, then
+/*          picks up the finished ones and recycles them. Workers take pending
+/*          requests in the order given by SelectPending and build them in Bake
+/*****************************************************************************/
+template <class TRequest, int NRequests, int NThreads>
+class BakeQueue
+{
+public:
+    BakeQueue()
+    {
+        m_NThreads  = 0;
+        m_bQuit     = false;
+        InitializeCriticalSection( &m_Lock );
+        m_hWork     = CreateEvent( NULL, TRUE, FALSE, NULL );
+        for (int i = NRequests - 1; i >= 0; i--) m_Free.push_back( &m_Requests[i] );
+    }
+
+    virtual ~BakeQueue()
+    {
+        //  workers are not waited for during static destruction
+        m_bQuit = true;
+        SetEvent( m_hWork );
+    }
+
+    void StartThreads( int nThreads )
+    {
+        StopThreads();
+        clamp( nThreads, 0, NThreads );
+        m_bQuit = false;
+        for (int i = 0; i < nThreads; i++)
+        {
+            m_Worker[i].m_pQueue = this;
+            m_Worker[i].m_Index  = i;
+            m_hThread[i] = CreateThread( NULL, 0, ThreadProc, &m_Worker[i], 0, NULL );
+            SetThreadPriority( m_hThread[i], THREAD_PRIORITY_BELOW_NORMAL );
+        }
+        m_NThreads = nThreads;
+    }
+
+    //  waits for the bakes in progress, pending and finished requests are dropped
+    void StopThreads()
+    {
+        if (m_NThreads > 0)
+        {
+            m_bQuit = true;
+            SetEvent( m_hWork );
+            WaitForMultipleObjects( m_NThreads, m_hThread, TRUE, INFINITE );
+            for (int i = 0; i < m_NThreads; i++) CloseHandle( m_hThread[i] );
+            m_NThreads = 0;
+        }
+        ResetEvent( m_hWork );
+        for (int i = 0; i < m_Pending.size(); i++) m_Free.push_back( m_Pending[i] );
+        for (int i = 0; i < m_Done.size(); i++) m_Free.push_back( m_Done[i] );
+        m_Pending.clear();
+        m_Done.clear();
+    }
+
+    bool IsRunning() const { return m_NThreads > 0; }
+    int  GetNThreads() const { return m_NThreads; }
+
+    //  NULL when all requests are in use
+    TRequest* Allocate()
+    {
+        TRequest* pReq = NULL;
+        EnterCriticalSection( &m_Lock );
+        if (m_Free.size() > 0)
+        {
+            pReq = m_Free.back();
+            m_Free.pop_back();
+        }
+        LeaveCriticalSection( &m_Lock );
+        return pReq;
+    }
+
+    void Submit( TRequest* pReq )
+    {
+        EnterCriticalSection( &m_Lock );
+        m_Pending.push_back( pReq );
+        SetEvent( m_hWork );
+        LeaveCriticalSection( &m_Lock );
+    }
+
+    //  moves requests not yet taken by the workers to the list, they have to be recycled
+    void CancelPending( std::vector<TRequest*>& reqs )
+    {
+        EnterCriticalSection( &m_Lock );
+        reqs.insert( reqs.end(), m_Pending.begin(), m_Pending.end() );
+        m_Pending.clear();
+        ResetEvent( m_hWork );
+        LeaveCriticalSection( &m_Lock );
+    }
+
+    TRequest* PopDone()
+    {
+        TRequest* pReq = NULL;
+        EnterCriticalSection( &m_Lock );
+        if (m_Done.size() > 0)
+        {
+            pReq = m_Done.front();
+            m_Done.erase( m_Done.begin() );
+        }
+        LeaveCriticalSection( &m_Lock );
+        return pReq;
+    }
+
+    void Recycle( TRequest* pReq )
+    {
+        EnterCriticalSection( &m_Lock );
+        m_Free.push_back( pReq );
+        LeaveCriticalSection( &m_Lock );
+    }
+
+protected:
+    //  builds the request on the worker thread
+    virtual void Bake( TRequest* pReq, int worker ) = 0;
+    //  index of the pending request to be taken next, called under the lock
+    virtual int SelectPending( const std::vector<TRequest*>& pending ) const { return 0; }
+
+private:
+    struct Worker
+    {
+        BakeQueue*  m_pQueue;
+        int         m_Index;
+    }; // struct Worker
+
+    static DWORD WINAPI ThreadProc( void* pParam )
+    {
+        Worker* pWorker = (Worker*)pParam;
+        pWorker->m_pQueue->Work( pWorker->m_Index );
+        return 0;
+    }
+
+    void Work( int worker )
+    {
+        for (;;)
+        {
+            WaitForSingleObject( m_hWork, INFINITE );
+            if (m_bQuit) break;
+
+            EnterCriticalSection( &m_Lock );
+            if (m_Pending.size() == 0)
+            {
+                ResetEvent( m_hWork );
+                LeaveCriticalSection( &m_Lock );
+                continue;
+            }
+            int idx = SelectPending( m_Pending );
+            TRequest* pReq = m_Pending[idx];
+            m_Pending.erase( m_Pending.begin() + idx );
+            LeaveCriticalSection( &m_Lock );
+
+            Bake( pReq, worker );
+
+            EnterCriticalSection( &m_Lock );
+            m_Done.push_back( pReq );
+            LeaveCriticalSection( &m_Lock );
+        }
+    }
+
+    TRequest                    m_Requests[NRequests];
+    std::vector<TRequest*>      m_Free;
+    std::vector<TRequest*>      m_Pending;
+    std::vector<TRequest*>      m_Done;
+
+    CRITICAL_SECTION            m_Lock;
+    HANDLE                      m_hWork;        //  manual-reset, signaled while there are pending requests
+    HANDLE                      m_hThread[NThreads];
+    Worker                      m_Worker[NThreads];
+    int                         m_NThreads;
+    volatile bool               m_bQuit;
+}; // class BakeQueue
+
+#endif // __KBAKEQUEUE_HPP__
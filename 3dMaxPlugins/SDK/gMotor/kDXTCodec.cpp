@@ -0,0 +1,313 @@
+/*****************************************************************************/
+/*    File:    kDXTCodec.cpp
+/*    Desc:    CPU block compression to/from DXT1 (BC1) and DXT5 (BC3)
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#include "stdafx.h"
+#include "kDXTCodec.h"
+#include <math.h>
+
+const double c_DXTMaxPSNR = 99.0;
+
+/*****************************************************************************/
+/*    Helpers
+/*****************************************************************************/
+inline WORD PackRGB565( int r, int g, int b )
+{
+    return  WORD( (((r*31 + 127)/255) << 11) |
+                  (((g*63 + 127)/255) << 5 ) |
+                   ((b*31 + 127)/255) );
+} // PackRGB565
+
+inline void UnpackRGB565( WORD c, int& r, int& g, int& b )
+{
+    r = (c >> 11) & 0x1F;
+    g = (c >> 5 ) & 0x3F;
+    b =  c        & 0x1F;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+} // UnpackRGB565
+
+inline DWORD MakeARGB( int a, int r, int g, int b )
+{
+    return (DWORD( a ) << 24) | (DWORD( r ) << 16) | (DWORD( g ) << 8) | DWORD( b );
+} // MakeARGB
+
+//  4-entry color palette of the block. In the 3-color mode the last entry is transparent black
+static void GetColorPalette( WORD c0, WORD c1, bool bForce4, DWORD* pal )
+{
+    int r0, g0, b0, r1, g1, b1;
+    UnpackRGB565( c0, r0, g0, b0 );
+    UnpackRGB565( c1, r1, g1, b1 );
+    pal[0] = MakeARGB( 0xFF, r0, g0, b0 );
+    pal[1] = MakeARGB( 0xFF, r1, g1, b1 );
+    if (c0 > c1 || bForce4)
+    {
+        pal[2] = MakeARGB( 0xFF, (2*r0 + r1)/3, (2*g0 + g1)/3, (2*b0 + b1)/3 );
+        pal[3] = MakeARGB( 0xFF, (r0 + 2*r1)/3, (g0 + 2*g1)/3, (b0 + 2*b1)/3 );
+    }
+    else
+    {
+        pal[2] = MakeARGB( 0xFF, (r0 + r1)/2, (g0 + g1)/2, (b0 + b1)/2 );
+        pal[3] = 0;
+    }
+} // GetColorPalette
+
+static void GetAlphaPalette( int a0, int a1, int* pal )
+{
+    pal[0] = a0;
+    pal[1] = a1;
+    if (a0 > a1)
+    {
+        for (int i = 2; i < 8; i++) pal[i] = ((8 - i)*a0 + (i - 1)*a1)/7;
+    }
+    else
+    {
+        for (int i = 2; i < 6; i++) pal[i] = ((6 - i)*a0 + (i - 1)*a1)/5;
+        pal[6] = 0;
+        pal[7] = 255;
+    }
+} // GetAlphaPalette
+
+inline int ColorDist2( DWORD c0, DWORD c1 )
+{
+    int dr = int( (c0 >> 16) & 0xFF ) - int( (c1 >> 16) & 0xFF );
+    int dg = int( (c0 >> 8 ) & 0xFF ) - int( (c1 >> 8 ) & 0xFF );
+    int db = int(  c0        & 0xFF ) - int(  c1        & 0xFF );
+    return dr*dr + dg*dg + db*db;
+} // ColorDist2
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    EncodeColorBlock
+/*    Desc:    Range fit of the color endpoints: bounding box of the block colors,
+/*             inset by 1/16 of its extent, is used as the color line. Only
+/*             pixels with alpha above alphaRef define the box
+/*---------------------------------------------------------------------------*/
+static void EncodeColorBlock( const DWORD* pix, BYTE* pBlock, bool b3Color, int alphaRef )
+{
+    int minR = 255, minG = 255, minB = 255;
+    int maxR = 0,   maxG = 0,   maxB = 0;
+    int nUsed = 0;
+    for (int k = 0; k < 2 && nUsed == 0; k++)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            if (k == 0 && int( pix[i] >> 24 ) < alphaRef) continue;
+            int r = (pix[i] >> 16) & 0xFF;
+            int g = (pix[i] >> 8 ) & 0xFF;
+            int b =  pix[i]        & 0xFF;
+            minR = tmin( minR, r ); maxR = tmax( maxR, r );
+            minG = tmin( minG, g ); maxG = tmax( maxG, g );
+            minB = tmin( minB, b ); maxB = tmax( maxB, b );
+            nUsed++;
+        }
+    }
+
+    int insR = (maxR - minR) >> 4;
+    int insG = (maxG - minG) >> 4;
+    int insB = (maxB - minB) >> 4;
+    WORD c0 = PackRGB565( maxR - insR, maxG - insG, maxB - insB );
+    WORD c1 = PackRGB565( minR + insR, minG + insG, minB + insB );
+
+    //  endpoints order selects the block mode: c0 > c1 is 4-color, c0 <= c1 is 3-color
+    if ((b3Color && c0 > c1) || (!b3Color && c0 < c1))
+    {
+        WORD c = c0; c0 = c1; c1 = c;
+    }
+
+    DWORD pal[4];
+    GetColorPalette( c0, c1, false, pal );
+    int nPal = b3Color ? 3 : 4;
+
+    DWORD idx = 0;
+    if (c0 != c1 || b3Color)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            if (b3Color && int( pix[i] >> 24 ) < 128)
+            {
+                best = 3;
+            }
+            else
+            {
+                int bestDist = ColorDist2( pix[i], pal[0] );
+                for (int j = 1; j < nPal; j++)
+                {
+                    int dist = ColorDist2( pix[i], pal[j] );
+                    if (dist < bestDist) { bestDist = dist; best = j; }
+                }
+            }
+            idx |= DWORD( best ) << (i*2);
+        }
+    }
+
+    *((WORD*)(pBlock + 0))  = c0;
+    *((WORD*)(pBlock + 2))  = c1;
+    *((DWORD*)(pBlock + 4)) = idx;
+} // EncodeColorBlock
+
+static void EncodeAlphaBlock( const DWORD* pix, BYTE* pBlock )
+{
+    int minA = 255, maxA = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int a = pix[i] >> 24;
+        minA = tmin( minA, a );
+        maxA = tmax( maxA, a );
+    }
+
+    int pal[8];
+    GetAlphaPalette( maxA, minA, pal );
+
+    DWORD idx[2] = { 0, 0 };
+    if (maxA != minA)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int a = pix[i] >> 24;
+            int best = 0, bestDist = 256;
+            for (int j = 0; j < 8; j++)
+            {
+                int dist = abs( a - pal[j] );
+                if (dist < bestDist) { bestDist = dist; best = j; }
+            }
+            idx[i >> 3] |= DWORD( best ) << ((i & 7)*3);
+        }
+    }
+
+    pBlock[0] = maxA;
+    pBlock[1] = minA;
+    //  two groups of 8 3-bit indices, 24 bits each
+    pBlock[2] = BYTE(  idx[0]        & 0xFF );
+    pBlock[3] = BYTE( (idx[0] >> 8 ) & 0xFF );
+    pBlock[4] = BYTE( (idx[0] >> 16) & 0xFF );
+    pBlock[5] = BYTE(  idx[1]        & 0xFF );
+    pBlock[6] = BYTE( (idx[1] >> 8 ) & 0xFF );
+    pBlock[7] = BYTE( (idx[1] >> 16) & 0xFF );
+} // EncodeAlphaBlock
+
+inline void GatherBlock( const DWORD* pPix, int pitch, DWORD* pix )
+{
+    for (int y = 0; y < 4; y++)
+    {
+        const DWORD* pRow = pPix + y*pitch;
+        pix[y*4 + 0] = pRow[0];
+        pix[y*4 + 1] = pRow[1];
+        pix[y*4 + 2] = pRow[2];
+        pix[y*4 + 3] = pRow[3];
+    }
+} // GatherBlock
+
+/*****************************************************************************/
+/*    Block encoding/decoding
+/*****************************************************************************/
+void DXTEncodeBlockDXT1( const DWORD* pPix, int pitch, BYTE* pBlock )
+{
+    DWORD pix[16];
+    GatherBlock( pPix, pitch, pix );
+    bool b3Color = false;
+    for (int i = 0; i < 16; i++) if ((pix[i] >> 24) < 128) { b3Color = true; break; }
+    EncodeColorBlock( pix, pBlock, b3Color, 128 );
+} // DXTEncodeBlockDXT1
+
+void DXTEncodeBlockDXT5( const DWORD* pPix, int pitch, BYTE* pBlock )
+{
+    DWORD pix[16];
+    GatherBlock( pPix, pitch, pix );
+    EncodeAlphaBlock( pix, pBlock );
+    //  color of the fully transparent pixels does not matter
+    EncodeColorBlock( pix, pBlock + 8, false, 1 );
+} // DXTEncodeBlockDXT5
+
+void DXTDecodeBlockDXT1( const BYTE* pBlock, DWORD* pPix, int pitch )
+{
+    DWORD pal[4];
+    WORD  c0  = *((const WORD*)(pBlock + 0));
+    WORD  c1  = *((const WORD*)(pBlock + 2));
+    DWORD idx = *((const DWORD*)(pBlock + 4));
+    GetColorPalette( c0, c1, false, pal );
+    for (int i = 0; i < 16; i++)
+    {
+        pPix[(i >> 2)*pitch + (i & 3)] = pal[(idx >> (i*2)) & 3];
+    }
+} // DXTDecodeBlockDXT1
+
+void DXTDecodeBlockDXT5( const BYTE* pBlock, DWORD* pPix, int pitch )
+{
+    int   apal[8];
+    DWORD cpal[4];
+    GetAlphaPalette( pBlock[0], pBlock[1], apal );
+    DWORD aidx[2];
+    aidx[0] = DWORD( pBlock[2] ) | (DWORD( pBlock[3] ) << 8) | (DWORD( pBlock[4] ) << 16);
+    aidx[1] = DWORD( pBlock[5] ) | (DWORD( pBlock[6] ) << 8) | (DWORD( pBlock[7] ) << 16);
+
+    WORD  c0  = *((const WORD*)(pBlock + 8));
+    WORD  c1  = *((const WORD*)(pBlock + 10));
+    DWORD idx = *((const DWORD*)(pBlock + 12));
+    GetColorPalette( c0, c1, true, cpal );
+    for (int i = 0; i < 16; i++)
+    {
+        DWORD a = apal[(aidx[i >> 3] >> ((i & 7)*3)) & 7];
+        pPix[(i >> 2)*pitch + (i & 3)] = (cpal[(idx >> (i*2)) & 3] & 0x00FFFFFF) | (a << 24);
+    }
+} // DXTDecodeBlockDXT5
+
+/*****************************************************************************/
+/*    Image encoding/decoding
+/*****************************************************************************/
+int DXTGetImageSize( int w, int h, bool bDXT5 )
+{
+    return (w/c_DXTBlockSide)*(h/c_DXTBlockSide)*(bDXT5 ? c_DXT5BlockBytes : c_DXT1BlockBytes);
+} // DXTGetImageSize
+
+void DXTEncodeImage( const DWORD* pPix, int w, int h, BYTE* pBlocks, bool bDXT5 )
+{
+    assert( (w & 3) == 0 && (h & 3) == 0 );
+    int blockBytes = bDXT5 ? c_DXT5BlockBytes : c_DXT1BlockBytes;
+    for (int y = 0; y < h; y += c_DXTBlockSide)
+    {
+        for (int x = 0; x < w; x += c_DXTBlockSide)
+        {
+            const DWORD* pSrc = pPix + y*w + x;
+            if (bDXT5) DXTEncodeBlockDXT5( pSrc, w, pBlocks );
+                else   DXTEncodeBlockDXT1( pSrc, w, pBlocks );
+            pBlocks += blockBytes;
+        }
+    }
+} // DXTEncodeImage
+
+void DXTDecodeImage( const BYTE* pBlocks, int w, int h, DWORD* pPix, bool bDXT5 )
+{
+    assert( (w & 3) == 0 && (h & 3) == 0 );
+    int blockBytes = bDXT5 ? c_DXT5BlockBytes : c_DXT1BlockBytes;
+    for (int y = 0; y < h; y += c_DXTBlockSide)
+    {
+        for (int x = 0; x < w; x += c_DXTBlockSide)
+        {
+            DWORD* pDst = pPix + y*w + x;
+            if (bDXT5) DXTDecodeBlockDXT5( pBlocks, pDst, w );
+                else   DXTDecodeBlockDXT1( pBlocks, pDst, w );
+            pBlocks += blockBytes;
+        }
+    }
+} // DXTDecodeImage
+
+double DXTCalcPSNR( const DWORD* pSrc, const DWORD* pDst, int nPix )
+{
+    double err = 0.0;
+    int    nSamples = 0;
+    for (int i = 0; i < nPix; i++)
+    {
+        DWORD s = pSrc[i];
+        DWORD d = pDst[i];
+        if ((s >> 24) == 0 && (d >> 24) == 0) continue;
+        int da = int( s >> 24 ) - int( d >> 24 );
+        err += da*da + ColorDist2( s, d );
+        nSamples += 4;
+    }
+    if (nSamples == 0 || err == 0.0) return c_DXTMaxPSNR;
+    double mse = err/double( nSamples );
+    return tmin( c_DXTMaxPSNR, 10.0*log10( 255.0*255.0/mse ) );
+} // DXTCalcPSNR
@@ -0,0 +1,30 @@
+/*****************************************************************************/
+/*    File:    kDXTCodec.h
+/*    Desc:    CPU block compression to/from DXT1 (BC1) and DXT5 (BC3)
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __KDXTCODEC_H__
+#define __KDXTCODEC_H__
+
+const int c_DXTBlockSide        = 4;
+const int c_DXT1BlockBytes      = 8;
+const int c_DXT5BlockBytes      = 16;
+
+//  pixels are ARGB8888, pitch is given in pixels.
+//  DXT1 blocks with any pixel of alpha < 128 are encoded in the 3-color mode,
+//  where such pixels become transparent black
+void    DXTEncodeBlockDXT1      ( const DWORD* pPix, int pitch, BYTE* pBlock );
+void    DXTEncodeBlockDXT5      ( const DWORD* pPix, int pitch, BYTE* pBlock );
+void    DXTDecodeBlockDXT1      ( const BYTE* pBlock, DWORD* pPix, int pitch );
+void    DXTDecodeBlockDXT5      ( const BYTE* pBlock, DWORD* pPix, int pitch );
+
+//  image sides must be multiples of 4. Blocks go in rows, without padding
+int     DXTGetImageSize         ( int w, int h, bool bDXT5 );
+void    DXTEncodeImage          ( const DWORD* pPix, int w, int h, BYTE* pBlocks, bool bDXT5 );
+void    DXTDecodeImage          ( const BYTE* pBlocks, int w, int h, DWORD* pPix, bool bDXT5 );
+
+//  peak signal-to-noise ratio of the decoded image against the source, in dB.
+//  Pixels which are fully transparent in both images are not counted
+double  DXTCalcPSNR             ( const DWORD* pSrc, const DWORD* pDst, int nPix );
+
+#endif // __KDXTCODEC_H__
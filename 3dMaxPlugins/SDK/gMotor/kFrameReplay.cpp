@@ -0,0 +1,646 @@
+/*****************************************************************************/
+/*    File:    kFrameReplay.cpp
+/*    Desc:    Recording of the per-frame engine calls and their deterministic
+/*             replay for benchmarking the engine hot paths
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#include "stdafx.h"
+#include "ICamera.h"
+#include "sgNodePool.h"
+#include "sgNode.h"
+#include "IMediaManager.h"
+#include "IResourceManager.h"
+#include "IEffectManager.h"
+#include "IShadowManager.h"
+#include "ITerrain.h"
+#include "kDirIterator.h"
+#include "kFilePath.h"
+#include "mRandom.h"
+#include "rsRenderSystemNull.h"
+#include "kFrameReplay.h"
+#include <algorithm>
+
+#ifdef _DEBUG
+#include <crtdbg.h>
+#endif // _DEBUG
+
+/*****************************************************************************/
+/*    FrameTrace implementation
+/*****************************************************************************/
+void FrameTrace::Clear()
+{
+    m_Cmd.clear();
+    m_Names.clear();
+    m_NameReg.clear();
+    m_NFrames = 0;
+} // FrameTrace::Clear
+
+int FrameTrace::GetNameID( const char* name )
+{
+    if (!name) name = "";
+    std::map<std::string, int>::iterator it = m_NameReg.find( name );
+    if (it != m_NameReg.end()) return it->second;
+    int id = m_Names.size();
+    m_Names.push_back( name );
+    m_NameReg[name] = id;
+    return id;
+} // FrameTrace::GetNameID
+
+const char* FrameTrace::GetName( int id ) const
+{
+    if (id < 0 || id >= m_Names.size()) return "";
+    return m_Names[id].c_str();
+} // FrameTrace::GetName
+
+void FrameTrace::AddFrame( float dt )
+{
+    ReplayCmd cmd;
+    cmd.m_Type      = rcFrame;
+    cmd.m_NameID    = -1;
+    cmd.m_Param     = m_NFrames;
+    cmd.m_Color     = 0;
+    cmd.m_Value     = dt;
+    cmd.m_TM        = Matrix4D::identity;
+    m_Cmd.push_back( cmd );
+    m_NFrames++;
+} // FrameTrace::AddFrame
+
+void FrameTrace::AddCmd( DWORD type, const char* name, int param, DWORD color, const Matrix4D& tm )
+{
+    ReplayCmd cmd;
+    cmd.m_Type      = type;
+    cmd.m_NameID    = name ? GetNameID( name ) : -1;
+    cmd.m_Param     = param;
+    cmd.m_Color     = color;
+    cmd.m_Value     = 0.0f;
+    cmd.m_TM        = tm;
+    m_Cmd.push_back( cmd );
+} // FrameTrace::AddCmd
+
+bool FrameTrace::Save( const char* fname ) const
+{
+    FOutStream os( fname );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write frame trace <%s>", fname );
+        return false;
+    }
+    FrameTraceHeader hdr;
+    hdr.m_Magic     = c_FrameTraceMagic;
+    hdr.m_Version   = c_FrameTraceVersion;
+    hdr.m_NFrames   = m_NFrames;
+    hdr.m_NCmd      = m_Cmd.size();
+    hdr.m_NNames    = m_Names.size();
+    os.Write( &hdr, sizeof( hdr ) );
+    for (int i = 0; i < m_Names.size(); i++)
+    {
+        os.Write( m_Names[i].c_str(), m_Names[i].size() + 1 );
+    }
+    if (m_Cmd.size() > 0) os.Write( &m_Cmd[0], m_Cmd.size()*sizeof( ReplayCmd ) );
+    os.CloseFile();
+    return true;
+} // FrameTrace::Save
+
+bool FrameTrace::Load( const char* fname )
+{
+    Clear();
+    FInStream is( fname );
+    if (is.NoFile()) return false;
+    FrameTraceHeader hdr;
+    if (is.Read( &hdr, sizeof( hdr ) ) != sizeof( hdr ) ||
+        hdr.m_Magic != c_FrameTraceMagic || hdr.m_Version != c_FrameTraceVersion)
+    {
+        Log.Warning( "Invalid frame trace <%s>", fname );
+        return false;
+    }
+    //  every name takes at least its terminator
+    if (hdr.m_NNames > DWORD( is.GetFileSize() - is.GetTotalBytesRead() ))
+    {
+        Log.Warning( "Frame trace <%s> is truncated", fname );
+        return false;
+    }
+    for (int i = 0; i < hdr.m_NNames; i++)
+    {
+        std::string name;
+        char ch = 0;
+        while (is.Read( &ch, 1 ) == 1 && ch != 0) name += ch;
+        GetNameID( name.c_str() );
+    }
+    //  command count is checked against the file before allocating, so a corrupt header
+    //  can not request an arbitrary amount of memory
+    DWORD nRemaining = DWORD( is.GetFileSize() - is.GetTotalBytesRead() );
+    if (hdr.m_NCmd > nRemaining/sizeof( ReplayCmd ))
+    {
+        Log.Warning( "Frame trace <%s> is truncated", fname );
+        Clear();
+        return false;
+    }
+    m_Cmd.resize( hdr.m_NCmd );
+    int nBytes = hdr.m_NCmd*sizeof( ReplayCmd );
+    if (nBytes > 0 && is.Read( &m_Cmd[0], nBytes ) != nBytes)
+    {
+        Log.Warning( "Frame trace <%s> is truncated", fname );
+        Clear();
+        return false;
+    }
+    m_NFrames = hdr.m_NFrames;
+    return true;
+} // FrameTrace::Load
+
+/*****************************************************************************/
+/*    FrameRecorder implementation
+/*****************************************************************************/
+bool                FrameRecorder::s_bActive = false;
+static FrameTrace   s_RecTrace;
+static std::string  s_RecFileName;
+static DWORD        s_RecFrame = 0xFFFFFFFF;
+static Timer        s_RecTimer;
+
+void FrameRecorder::Start( const char* fname )
+{
+    s_RecTrace.Clear();
+    s_RecFileName   = fname;
+    s_RecFrame      = 0xFFFFFFFF;
+    s_RecTimer.start();
+    s_bActive       = true;
+    Log.Info( "Started frame recording to <%s>", fname );
+} // FrameRecorder::Start
+
+void FrameRecorder::Stop()
+{
+    if (!s_bActive) return;
+    s_bActive = false;
+    s_RecTrace.Save( s_RecFileName.c_str() );
+    Log.Info( "Recorded %d frames (%d commands) to <%s>",
+                s_RecTrace.GetNFrames(), s_RecTrace.GetNCmd(), s_RecFileName.c_str() );
+    s_RecTrace.Clear();
+} // FrameRecorder::Stop
+
+void FrameRecorder::CheckFrame()
+{
+    DWORD curFrame = IRS ? IRS->GetCurFrame() : 0;
+    if (curFrame == s_RecFrame) return;
+    s_RecFrame = curFrame;
+    float dt = s_RecTrace.GetNFrames() == 0 ? 0.0f : float( s_RecTimer.seconds() );
+    s_RecTimer.start();
+    s_RecTrace.AddFrame( dt );
+
+    ICamera* pCam = GetCamera();
+    if (pCam)
+    {
+        s_RecTrace.AddCmd( rcViewTM, NULL, 0, 0, pCam->GetViewTM() );
+        s_RecTrace.AddCmd( rcProjTM, NULL, 0, 0, pCam->GetProjTM() );
+    }
+} // FrameRecorder::CheckFrame
+
+void FrameRecorder::RecordSprite( bool bWorld, int gpID, int sprID, const Matrix4D& tm, DWORD color )
+{
+    CheckFrame();
+    s_RecTrace.AddCmd( bWorld ? rcDrawWSprite : rcDrawSprite, ISM->GetPackageName( gpID ), sprID, color, tm );
+} // FrameRecorder::RecordSprite
+
+void FrameRecorder::RecordEffect( DWORD effID, const Matrix4D& tm )
+{
+    //  effect is referenced by its node, trace keeps the file of the model it is the root of
+    DWORD mdlID = IMM->GetNodeModelID( effID );
+    if (mdlID == c_BadID) return;
+    CheckFrame();
+    s_RecTrace.AddCmd( rcInstanceEffect, IMM->GetModelFileName( mdlID ), 0, 0, tm );
+} // FrameRecorder::RecordEffect
+
+void FrameRecorder::RecordCaster( DWORD modelID, const Matrix4D& tm )
+{
+    CheckFrame();
+    s_RecTrace.AddCmd( rcAddCaster, IMM->GetModelFileName( modelID ), 0, 0, tm );
+} // FrameRecorder::RecordCaster
+
+/*****************************************************************************/
+/*    Replay
+/*****************************************************************************/
+const char* GetReplayPhaseName( ReplayPhase phase )
+{
+    switch (phase)
+    {
+    case rpCamera:  return "camera";
+    case rpSprites: return "sprites";
+    case rpEffects: return "effects";
+    case rpShadows: return "shadows";
+    case rpTerrain: return "terrain";
+    case rpFrame:   return "frame";
+    }
+    return "unknown";
+} // GetReplayPhaseName
+
+#ifdef _DEBUG
+static volatile LONG s_NReplayAllocs = 0;
+static int __cdecl ReplayAllocHook( int allocType, void* pData, size_t size, int blockType,
+                                    long requestNumber, const unsigned char* fileName, int lineNumber )
+{
+    if (allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC) InterlockedIncrement( &s_NReplayAllocs );
+    return TRUE;
+} // ReplayAllocHook
+#endif // _DEBUG
+
+static void CalcPhaseStats( std::vector<float>& times, ReplayPhaseStats& stats )
+{
+    memset( &stats, 0, sizeof( stats ) );
+    int nT = times.size();
+    if (nT == 0) return;
+    std::sort( times.begin(), times.end() );
+    for (int i = 0; i < nT; i++) stats.m_Total += times[i];
+    stats.m_Mean = stats.m_Total/float( nT );
+    stats.m_P50  = times[tmin( nT - 1, nT*50/100 )];
+    stats.m_P90  = times[tmin( nT - 1, nT*90/100 )];
+    stats.m_P99  = times[tmin( nT - 1, nT*99/100 )];
+    stats.m_Max  = times[nT - 1];
+} // CalcPhaseStats
+
+//  replays single frame, returns number of the processed commands
+static int ReplayFrame( const FrameTrace& trace, int cmdIdx, const std::vector<int>& nameToRes,
+                        float phaseTime[rpLAST], ReplayReport* pReport )
+{
+    Timer timer;
+    int nCmd = trace.GetNCmd();
+    float dt = trace.GetCmd( cmdIdx ).m_Value;
+    int firstCmd = cmdIdx;
+    cmdIdx++;
+    for (int i = 0; i < rpLAST; i++) phaseTime[i] = 0.0f;
+
+    IRS->StartFrame();
+    while (cmdIdx < nCmd && trace.GetCmd( cmdIdx ).m_Type != rcFrame)
+    {
+        const ReplayCmd& cmd = trace.GetCmd( cmdIdx++ );
+        int resID = (cmd.m_NameID >= 0) ? nameToRes[cmd.m_NameID] : -1;
+        ReplayPhase phase = rpCamera;
+        timer.start();
+        switch (cmd.m_Type)
+        {
+        case rcViewTM:
+            if (GetCamera()) GetCamera()->SetViewTM( cmd.m_TM ); else IRS->SetViewTM( cmd.m_TM );
+            break;
+        case rcProjTM:
+            if (GetCamera()) GetCamera()->SetProjTM( cmd.m_TM ); else IRS->SetProjTM( cmd.m_TM );
+            break;
+        case rcDrawSprite:
+            phase = rpSprites;
+            ISM->DrawSprite( resID, cmd.m_Param, cmd.m_TM, cmd.m_Color );
+            break;
+        case rcDrawWSprite:
+            phase = rpSprites;
+            ISM->DrawWSprite( resID, cmd.m_Param, cmd.m_TM, cmd.m_Color );
+            break;
+        case rcInstanceEffect:
+        {
+            phase = rpEffects;
+            Matrix4D tm( cmd.m_TM );
+            DWORD hInst = (resID >= 0) ? IEffMgr->InstanceEffect( resID, tm ) : 0xFFFFFFFF;
+            if (pReport)
+            {
+                if (hInst != 0xFFFFFFFF) pReport->m_NEffects++; else pReport->m_NEffectsFailed++;
+            }
+            break;
+        }
+        case rcAddCaster:
+            phase = rpShadows;
+            if (resID >= 0) IShadowMgr->AddCaster( resID, cmd.m_TM );
+            break;
+        }
+        phaseTime[phase] += float( timer.seconds() );
+    }
+
+    //  per-frame work of the subsystems, in the order the game runs it
+    timer.start();
+    if (GetCamera()) GetCamera()->Render();
+    phaseTime[rpCamera] += float( timer.seconds() );
+
+    timer.start();
+    if (ITerra) ITerra->Render();
+    phaseTime[rpTerrain] += float( timer.seconds() );
+
+    timer.start();
+    IEffMgr->Evaluate( dt );
+    IEffMgr->PreRender();
+    IEffMgr->Render();
+    IEffMgr->PostRender();
+    phaseTime[rpEffects] += float( timer.seconds() );
+
+    timer.start();
+    IShadowMgr->Render();
+    phaseTime[rpShadows] += float( timer.seconds() );
+
+    timer.start();
+    ISM->OnFrame();
+    phaseTime[rpSprites] += float( timer.seconds() );
+
+    IRS->EndFrame();
+    return cmdIdx - firstCmd;
+} // ReplayFrame
+
+bool ReplayFrameTrace( const char* fname, ReplayReport& report, int nWarmupFrames )
+{
+    memset( &report, 0, sizeof( report ) );
+    FrameTrace trace;
+    if (!trace.Load( fname )) return false;
+    if (trace.GetNCmd() == 0 || trace.GetCmd( 0 ).m_Type != rcFrame)
+    {
+        Log.Warning( "Frame trace <%s> is empty", fname );
+        return false;
+    }
+
+    //  resolve trace names to the resource ids of this session
+    int nNames = 0;
+    for (int i = 0; i < trace.GetNCmd(); i++) nNames = tmax( nNames, trace.GetCmd( i ).m_NameID + 1 );
+    std::vector<int> nameToRes( nNames, -1 );
+    for (int i = 0; i < trace.GetNCmd(); i++)
+    {
+        const ReplayCmd& cmd = trace.GetCmd( i );
+        if (cmd.m_NameID < 0 || nameToRes[cmd.m_NameID] != -1) continue;
+        const char* name = trace.GetName( cmd.m_NameID );
+        if (cmd.m_Type == rcDrawSprite || cmd.m_Type == rcDrawWSprite)
+        {
+            nameToRes[cmd.m_NameID] = ISM->GetPackageID( name );
+        }
+        else if (cmd.m_Type == rcInstanceEffect)
+        {
+            //  effects are instanced by the node id of the model root
+            SNode* pRoot = IMM->GetModelRoot( IMM->GetModelID( name ) );
+            nameToRes[cmd.m_NameID] = pRoot ? pRoot->GetID() : -1;
+        }
+        else
+        {
+            nameToRes[cmd.m_NameID] = IMM->GetModelID( name );
+        }
+    }
+
+    //  the trace is looped while warming up, so caches are in the steady state
+    rndInit( 0 );
+    float phaseTime[rpLAST];
+    int cmdIdx = 0;
+    for (int i = 0; i < nWarmupFrames; i++)
+    {
+        cmdIdx += ReplayFrame( trace, cmdIdx, nameToRes, phaseTime, NULL );
+        if (cmdIdx >= trace.GetNCmd()) cmdIdx = 0;
+    }
+    IEffMgr->Reset();
+
+#ifdef _DEBUG
+    _CRT_ALLOC_HOOK pPrevHook = _CrtSetAllocHook( ReplayAllocHook );
+    report.m_bAllocsValid = true;
+#endif // _DEBUG
+
+    std::vector<float> times[rpLAST];
+    int nAllocsTotal = 0;
+    Timer frameTimer;
+    cmdIdx = 0;
+    rndInit( 0 );
+    while (cmdIdx < trace.GetNCmd())
+    {
+#ifdef _DEBUG
+        s_NReplayAllocs = 0;
+#endif // _DEBUG
+        frameTimer.start();
+        cmdIdx += ReplayFrame( trace, cmdIdx, nameToRes, phaseTime, &report );
+        phaseTime[rpFrame] = float( frameTimer.seconds() );
+        for (int i = 0; i < rpLAST; i++) times[i].push_back( phaseTime[i]*1000.0f );
+#ifdef _DEBUG
+        nAllocsTotal += s_NReplayAllocs;
+        report.m_MaxAllocs = tmax( report.m_MaxAllocs, int( s_NReplayAllocs ) );
+#endif // _DEBUG
+        report.m_NFrames++;
+    }
+
+#ifdef _DEBUG
+    _CrtSetAllocHook( pPrevHook );
+#endif // _DEBUG
+
+    IEffMgr->Reset();
+
+    for (int i = 0; i < rpLAST; i++) CalcPhaseStats( times[i], report.m_Phase[i] );
+    if (report.m_NFrames > 0) report.m_AllocsPerFrame = float( nAllocsTotal )/float( report.m_NFrames );
+    return true;
+} // ReplayFrameTrace
+
+int RunReplayBenchmark( const char* traceDir, const char* csvName )
+{
+    FILE* fp = csvName ? fopen( csvName, "wt" ) : NULL;
+    if (fp) fprintf( fp, "trace,phase,frames,total_ms,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,allocs_per_frame,max_allocs\n" );
+
+    //  replay measures the engine side, so the device is replaced for its duration
+    bool bInstalled = !IsNullRenderSystemInstalled();
+    if (bInstalled) InstallNullRenderSystem();
+
+    int nTraces = 0;
+    DirTreeIterator it( traceDir );
+    it.AddFilter( c_FrameTraceExt );
+    while (it)
+    {
+        const char* fname = it.GetFullFilePath();
+        ReplayReport rep;
+        if (ReplayFrameTrace( fname, rep ))
+        {
+            Log.Info( "Replay <%s>: %d frames, %.1f allocs/frame (max %d)%s",
+                        fname, rep.m_NFrames, rep.m_AllocsPerFrame, rep.m_MaxAllocs,
+                        rep.m_bAllocsValid ? "" : ", allocations are not counted in this build" );
+            for (int i = 0; i < rpLAST; i++)
+            {
+                const ReplayPhaseStats& ps = rep.m_Phase[i];
+                const char* phName = GetReplayPhaseName( (ReplayPhase)i );
+                Log.Info( "    %-8s mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f ms",
+                            phName, ps.m_Mean, ps.m_P50, ps.m_P90, ps.m_P99, ps.m_Max );
+                if (fp) fprintf( fp, "%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%d\n",
+                                    fname, phName, rep.m_NFrames, ps.m_Total, ps.m_Mean,
+                                    ps.m_P50, ps.m_P90, ps.m_P99, ps.m_Max,
+                                    rep.m_AllocsPerFrame, rep.m_MaxAllocs );
+            }
+            nTraces++;
+        }
+        ++it;
+    }
+    if (fp) fclose( fp );
+    if (bInstalled) RestoreRenderSystem();
+    return nTraces;
+} // RunReplayBenchmark
+
+bool CheckEffectReplay( const char* effName )
+{
+    SNode* pRoot = IMM->GetModelRoot( IMM->GetModelID( effName ) );
+    if (!pRoot)
+    {
+        Log.Warning( "Effect replay check: could not load <%s>", effName );
+        return false;
+    }
+
+    char fname[_MAX_PATH];
+    sprintf( fname, "%s\\Cache", IRM->GetHomeDirectory() );
+    _mkdir( fname );
+    sprintf( fname, "%s\\Cache\\effect_check.%s", IRM->GetHomeDirectory(), c_FrameTraceExt );
+
+    Matrix4D tm = Matrix4D::identity;
+    FrameRecorder::Start( fname );
+    IEffMgr->InstanceEffect( pRoot->GetID(), tm );
+    FrameRecorder::Stop();
+    IEffMgr->Reset();
+
+    ReplayReport rep;
+    bool bOK = ReplayFrameTrace( fname, rep, 0 ) && rep.m_NEffects == 1 && rep.m_NEffectsFailed == 0;
+    DeleteFile( fname );
+    if (!bOK)
+    {
+        Log.Error( "Effect replay check: <%s> recorded, replay created %d instances, %d failed",
+                    effName, rep.m_NEffects, rep.m_NEffectsFailed );
+    }
+    assert( bOK );
+    return bOK;
+} // CheckEffectReplay
+
+/*****************************************************************************/
+/*    Canonical traces
+/*****************************************************************************/
+const int   c_TraceNFrames          = 600;
+const float c_TraceFrameStep        = 1.0f/30.0f;
+const int   c_BattleNUnits          = 2000;
+const int   c_CityNBuildings        = 3000;
+const float c_TraceMapSide          = 8192.0f;
+
+static Matrix4D TraceViewTM( float x, float y, float height )
+{
+    Matrix4D tm = Matrix4D::identity;
+    //  top-down isometric-like camera, looking along -z
+    tm.e30 = -x;
+    tm.e31 = -y;
+    tm.e32 = height;
+    return tm;
+} // TraceViewTM
+
+static Matrix4D TraceProjTM( float viewW )
+{
+    Matrix4D tm = Matrix4D::identity;
+    tm.e00 = 2.0f/viewW;
+    tm.e11 = 2.0f/(viewW*0.75f);
+    tm.e22 = 1.0f/10000.0f;
+    return tm;
+} // TraceProjTM
+
+static Matrix4D TraceObjTM( float x, float y, float z )
+{
+    Matrix4D tm = Matrix4D::identity;
+    tm.e30 = x;
+    tm.e31 = y;
+    tm.e32 = z;
+    return tm;
+} // TraceObjTM
+
+static void AddTraceCamera( FrameTrace& trace, float x, float y, float viewW )
+{
+    trace.AddCmd( rcViewTM, NULL, 0, 0, TraceViewTM( x, y, viewW ) );
+    trace.AddCmd( rcProjTM, NULL, 0, 0, TraceProjTM( viewW ) );
+} // AddTraceCamera
+
+//  units walk around and fight, explosions are spawned, every unit casts shadow
+static void MakeBattleTrace( FrameTrace& trace, const char* gpName, const char* effName, const char* casterName )
+{
+    rndInit( 1 );
+    std::vector<Vector3D> pos( c_BattleNUnits );
+    std::vector<Vector3D> vel( c_BattleNUnits );
+    for (int i = 0; i < c_BattleNUnits; i++)
+    {
+        pos[i] = Vector3D( rndValuef( 0.0f, 2048.0f ), rndValuef( 0.0f, 2048.0f ), 0.0f );
+        vel[i] = Vector3D( rndValuef( -2.0f, 2.0f ), rndValuef( -2.0f, 2.0f ), 0.0f );
+    }
+    for (int f = 0; f < c_TraceNFrames; f++)
+    {
+        trace.AddFrame( c_TraceFrameStep );
+        AddTraceCamera( trace, 1024.0f, 1024.0f, 2048.0f );
+        for (int i = 0; i < c_BattleNUnits; i++)
+        {
+            pos[i] += vel[i];
+            int sprID = (f/4 + i)%16 + (i%8)*16;
+            DWORD color = 0xFF000000 | ((i%7) << 21);
+            trace.AddCmd( rcDrawWSprite, gpName, sprID, color, TraceObjTM( pos[i].x, pos[i].y, pos[i].z ) );
+            trace.AddCmd( rcAddCaster, casterName, 0, 0, TraceObjTM( pos[i].x, pos[i].y, pos[i].z ) );
+        }
+        for (int i = 0; i < 8; i++)
+        {
+            trace.AddCmd( rcInstanceEffect, effName, 0, 0,
+                            TraceObjTM( rndValuef( 0.0f, 2048.0f ), rndValuef( 0.0f, 2048.0f ), 0.0f ) );
+        }
+    }
+} // MakeBattleTrace
+
+//  static city is scrolled across the whole map
+static void MakeCityScrollTrace( FrameTrace& trace, const char* gpName, const char* casterName )
+{
+    rndInit( 2 );
+    std::vector<Vector3D> pos( c_CityNBuildings );
+    for (int i = 0; i < c_CityNBuildings; i++)
+    {
+        pos[i] = Vector3D( rndValuef( 0.0f, c_TraceMapSide ), rndValuef( 0.0f, c_TraceMapSide ), 0.0f );
+    }
+    const float viewW = 1600.0f;
+    for (int f = 0; f < c_TraceNFrames; f++)
+    {
+        trace.AddFrame( c_TraceFrameStep );
+        float camX = viewW*0.5f + (c_TraceMapSide - viewW)*float( f )/float( c_TraceNFrames );
+        float camY = c_TraceMapSide*0.5f;
+        AddTraceCamera( trace, camX, camY, viewW );
+        for (int i = 0; i < c_CityNBuildings; i++)
+        {
+            //  game culls by the view before submitting, so does the trace
+            if (fabs( pos[i].x - camX ) > viewW || fabs( pos[i].y - camY ) > viewW) continue;
+            trace.AddCmd( rcDrawWSprite, gpName, i%64, 0xFF808080, TraceObjTM( pos[i].x, pos[i].y, 0.0f ) );
+            trace.AddCmd( rcAddCaster, casterName, 0, 0, TraceObjTM( pos[i].x, pos[i].y, 0.0f ) );
+        }
+    }
+} // MakeCityScrollTrace
+
+//  camera pulls back from the close-up to the whole map, visible set grows
+static void MakeZoomOutTrace( FrameTrace& trace, const char* gpName, const char* effName )
+{
+    rndInit( 3 );
+    const int nObj = c_BattleNUnits*2;
+    std::vector<Vector3D> pos( nObj );
+    for (int i = 0; i < nObj; i++)
+    {
+        pos[i] = Vector3D( rndValuef( 0.0f, c_TraceMapSide ), rndValuef( 0.0f, c_TraceMapSide ), 0.0f );
+    }
+    const float c = c_TraceMapSide*0.5f;
+    for (int f = 0; f < c_TraceNFrames; f++)
+    {
+        trace.AddFrame( c_TraceFrameStep );
+        float viewW = 512.0f + (c_TraceMapSide - 512.0f)*float( f )/float( c_TraceNFrames - 1 );
+        AddTraceCamera( trace, c, c, viewW );
+        for (int i = 0; i < nObj; i++)
+        {
+            if (fabs( pos[i].x - c ) > viewW*0.5f || fabs( pos[i].y - c ) > viewW*0.5f) continue;
+            trace.AddCmd( rcDrawWSprite, gpName, i%128, 0xFFFFFFFF, TraceObjTM( pos[i].x, pos[i].y, 0.0f ) );
+        }
+        if (f%10 == 0)
+        {
+            trace.AddCmd( rcInstanceEffect, effName, 0, 0, TraceObjTM( c, c, 0.0f ) );
+        }
+    }
+} // MakeZoomOutTrace
+
+int MakeCanonicalTraces( const char* traceDir, const char* gpName, const char* effName, const char* casterName )
+{
+    _mkdir( traceDir );
+    char fname[_MAX_PATH];
+    int nTraces = 0;
+    FrameTrace trace;
+
+    MakeBattleTrace( trace, gpName, effName, casterName );
+    sprintf( fname, "%s\\battle.%s", traceDir, c_FrameTraceExt );
+    if (trace.Save( fname )) nTraces++;
+
+    trace.Clear();
+    MakeCityScrollTrace( trace, gpName, casterName );
+    sprintf( fname, "%s\\city_scroll.%s", traceDir, c_FrameTraceExt );
+    if (trace.Save( fname )) nTraces++;
+
+    trace.Clear();
+    MakeZoomOutTrace( trace, gpName, effName );
+    sprintf( fname, "%s\\zoom_out.%s", traceDir, c_FrameTraceExt );
+    if (trace.Save( fname )) nTraces++;
+
+    return nTraces;
+} // MakeCanonicalTraces
@@ -0,0 +1,169 @@
+/*****************************************************************************/
+/*    File:    kFrameReplay.h
+/*    Desc:    Recording of the per-frame engine calls and their deterministic
+/*             replay for benchmarking the engine hot paths
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __KFRAMEREPLAY_H__
+#define __KFRAMEREPLAY_H__
+
+#include <map>
+#include "kTimer.h"
+
+const DWORD c_FrameTraceMagic   = 'LPRF';
+const DWORD c_FrameTraceVersion = 1;
+const char  c_FrameTraceExt[]   = "frp";
+
+/*****************************************************************************/
+/*    Enum:    ReplayCmdType
+/*****************************************************************************/
+enum ReplayCmdType
+{
+    rcUnknown           = 0,
+    rcFrame             = 1,    //  frame start, m_Value is frame time step
+    rcViewTM            = 2,    //  camera view transform
+    rcProjTM            = 3,    //  camera projection transform
+    rcDrawSprite        = 4,    //  ISM->DrawSprite,  m_NameID is package name
+    rcDrawWSprite       = 5,    //  ISM->DrawWSprite, m_NameID is package name
+    rcInstanceEffect    = 6,    //  IEffMgr->InstanceEffect, m_NameID is file name of the model, which root is the effect
+    rcAddCaster         = 7     //  IShadowMgr->AddCaster, m_NameID is model file name
+}; // enum ReplayCmdType
+
+/*****************************************************************************/
+/*    Struct:  ReplayCmd
+/*    Desc:    Single recorded engine call. Resources are referenced by the
+/*             index in the trace name table, so traces do not depend on the
+/*             order resources were loaded in the recording session.
+/*****************************************************************************/
+struct ReplayCmd
+{
+    DWORD           m_Type;         //  ReplayCmdType
+    int             m_NameID;       //  index in the trace name table
+    int             m_Param;        //  sprite frame index
+    DWORD           m_Color;        //  sprite color
+    float           m_Value;        //  frame time step
+    Matrix4D        m_TM;           //  sprite/effect/caster/camera transform
+}; // struct ReplayCmd
+
+/*****************************************************************************/
+/*    Struct:  FrameTraceHeader
+/*****************************************************************************/
+struct FrameTraceHeader
+{
+    DWORD           m_Magic;        //  c_FrameTraceMagic
+    DWORD           m_Version;      //  c_FrameTraceVersion
+    DWORD           m_NFrames;      //  number of recorded frames
+    DWORD           m_NCmd;         //  number of commands, including frame markers
+    DWORD           m_NNames;       //  number of zero-terminated names following the header
+}; // struct FrameTraceHeader
+
+/*****************************************************************************/
+/*    Class:   FrameTrace
+/*    Desc:    In-memory sequence of the recorded commands
+/*****************************************************************************/
+class FrameTrace
+{
+public:
+    void                        Clear           ();
+    int                         GetNameID       ( const char* name );
+    const char*                 GetName         ( int id ) const;
+    void                        AddFrame        ( float dt );
+    void                        AddCmd          ( DWORD type, const char* name, int param, DWORD color, const Matrix4D& tm );
+
+    bool                        Save            ( const char* fname ) const;
+    bool                        Load            ( const char* fname );
+
+    int                         GetNFrames      () const { return m_NFrames; }
+    int                         GetNCmd         () const { return m_Cmd.size(); }
+    const ReplayCmd&            GetCmd          ( int idx ) const { return m_Cmd[idx]; }
+
+                                FrameTrace      () : m_NFrames( 0 ) {}
+
+private:
+    std::vector<ReplayCmd>      m_Cmd;
+    std::vector<std::string>    m_Names;
+    std::map<std::string, int>  m_NameReg;
+    int                         m_NFrames;
+}; // class FrameTrace
+
+/*****************************************************************************/
+/*    Class:   FrameRecorder
+/*    Desc:    Captures engine calls while recording is active. Hooks in the
+/*             subsystems test s_bActive only, so recording costs nothing
+/*             when it is off. Frame boundaries are detected by the render
+/*             system frame counter, camera is sampled on each new frame.
+/*****************************************************************************/
+class FrameRecorder
+{
+public:
+    static bool                 s_bActive;
+
+    static void                 Start           ( const char* fname );
+    static void                 Stop            ();
+
+    static void                 RecordSprite    ( bool bWorld, int gpID, int sprID, const Matrix4D& tm, DWORD color );
+    static void                 RecordEffect    ( DWORD effID, const Matrix4D& tm );
+    static void                 RecordCaster    ( DWORD modelID, const Matrix4D& tm );
+
+private:
+    static void                 CheckFrame      ();
+}; // class FrameRecorder
+
+/*****************************************************************************/
+/*    Enum:    ReplayPhase
+/*    Desc:    Subsystems timed separately during replay
+/*****************************************************************************/
+enum ReplayPhase
+{
+    rpCamera            = 0,
+    rpSprites           = 1,
+    rpEffects           = 2,
+    rpShadows           = 3,
+    rpTerrain           = 4,
+    rpFrame             = 5,    //  whole frame
+    rpLAST              = 6
+}; // enum ReplayPhase
+
+/*****************************************************************************/
+/*    Struct:  ReplayPhaseStats
+/*****************************************************************************/
+struct ReplayPhaseStats
+{
+    float           m_Total;        //  milliseconds
+    float           m_Mean;
+    float           m_P50;
+    float           m_P90;
+    float           m_P99;
+    float           m_Max;
+}; // struct ReplayPhaseStats
+
+/*****************************************************************************/
+/*    Struct:  ReplayReport
+/*****************************************************************************/
+struct ReplayReport
+{
+    int                 m_NFrames;
+    ReplayPhaseStats    m_Phase[rpLAST];
+    float               m_AllocsPerFrame;   //  mean number of heap allocations per frame
+    int                 m_MaxAllocs;        //  max number of heap allocations in a frame
+    bool                m_bAllocsValid;     //  allocations are counted in debug CRT builds only
+    int                 m_NEffects;         //  effect instances created
+    int                 m_NEffectsFailed;   //  effect commands, which did not create an instance
+}; // struct ReplayReport
+
+const char* GetReplayPhaseName( ReplayPhase phase );
+
+//  replays trace against the current engine subsystems. When the null render system
+//  is installed (Benchmarks node, NullRenderSystem switch), the device does not take
+//  part in the measurements
+bool    ReplayFrameTrace        ( const char* fname, ReplayReport& report, int nWarmupFrames = 8 );
+//  replays all traces in the directory on the null render system, logs the reports and writes them to csv
+int     RunReplayBenchmark      ( const char* traceDir, const char* csvName = NULL );
+//  records instancing of the effect model, replays the trace and checks the
+//  effect instance is created again
+bool    CheckEffectReplay       ( const char* effName );
+//  writes deterministic synthetic traces: battle, city scroll and zoom-out
+int     MakeCanonicalTraces     ( const char* traceDir, const char* gpName,
+                                    const char* effName, const char* casterName );
+
+#endif // __KFRAMEREPLAY_H__
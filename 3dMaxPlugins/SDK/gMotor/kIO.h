@@ -47,12 +47,11 @@ public:
     _inl            operator bool() const;
 
     virtual int GetTotalSize() = 0;
+    _inl int        GetTotalBytesRead() const;
 
 
 protected:
 
-    _inl int        GetTotalBytesRead() const;
-
     virtual bool    IsEndOfStream()    const                    = 0;
     virtual DWORD    OnRead( void* buf, DWORD nBytes )        = 0;
     virtual void    OnSkip( DWORD nBytes ){}
@@ -16,41 +16,85 @@ struct QuadPos
     float x, y;
 }; // struct QuadPos
 
+/*---------------------------------------------------------------*
+/*  Func:    QuadMortonKey
+/*    Desc:    Z-order key of the quad position. Aligned quads with
+/*          lower keys lie closer to the surface origin
+/*---------------------------------------------------------------*/
+inline DWORD QuadMortonKey( WORD x, WORD y )
+{
+    DWORD kx = x, ky = y;
+    kx = (kx | (kx << 8)) & 0x00FF00FF;
+    kx = (kx | (kx << 4)) & 0x0F0F0F0F;
+    kx = (kx | (kx << 2)) & 0x33333333;
+    kx = (kx | (kx << 1)) & 0x55555555;
+    ky = (ky | (ky << 8)) & 0x00FF00FF;
+    ky = (ky | (ky << 4)) & 0x0F0F0F0F;
+    ky = (ky | (ky << 2)) & 0x33333333;
+    ky = (ky | (ky << 1)) & 0x55555555;
+    return kx | (ky << 1);
+} // QuadMortonKey
+
 /*****************************************************************************/
 /*    Struct:    QuadLayoutLevel
-/*    Desc:    Helper structure for packing sprite chunks on the texture surface
+/*    Desc:    Free quads of the single side on the texture surface,
+/*          positions are packed as (x << 16) | y
 /*****************************************************************************/
 struct QuadLayoutLevel
 {
-    QuadPos        quad[3];
-    WORD        numQuads;
+    std::vector<DWORD>      quad;
 };  // struct QuadLayoutLevel
 
 /****************************************************************************/
-/*  Class:  QuadLayout                                        
-/*  Desc:    Describes layout of sprite chunks on the texture surface
+/*  Class:  QuadLayout
+/*  Desc:    Describes layout of sprite chunks on the texture surface.
+/*          Buddy allocator: quad is split into four on allocation and
+/*          merged back when all four parts are free
 /****************************************************************************/
 class QuadLayout
 {
     QuadLayoutLevel            m_Level[c_MaxQuadLevels + 1];
-    int                        m_CurLevel;
     int                        m_MaxLevel;
     int                        m_NFreePixels;
     int                        m_MaxPixels;
 
+    inline int  FindLowest      ( int level ) const;
+    inline void SplitQuad       ( int level, int idx, int sidePow, WORD& allocx, WORD& allocy );
+
 public:
-                QuadLayout        () : m_MaxLevel( c_MaxQuadLevels ) {}
+                QuadLayout        () : m_MaxLevel( c_MaxQuadLevels ), m_NFreePixels( 0 ), m_MaxPixels( 0 ) {}
     inline bool    AllocChunk        ( int sidePow, WORD& allocx, WORD& allocy );
+    inline bool    AllocLowestChunk  ( int sidePow, WORD& allocx, WORD& allocy, DWORD maxKey );
+    inline void    FreeChunk         ( int sidePow, WORD x, WORD y );
     int            NumFreePixels    () const { return m_NFreePixels; }
-    
+    int            GetMaxPixels     () const { return m_MaxPixels; }
+    inline int     GetLargestFreePow() const;
+    inline int     GetNFreeQuads    () const;
+
+    //  part of the surface which is allocated
+    float GetOccupancy() const
+    {
+        if (m_MaxPixels == 0) return 0.0f;
+        return 1.0f - float( m_NFreePixels )/float( m_MaxPixels );
+    }
+
+    //  part of the free space which is not in the largest free quad
+    float GetFragmentation() const
+    {
+        int maxPow = GetLargestFreePow();
+        if (maxPow < 0) return 0.0f;
+        int maxFree = int( c_PowSidesWORD[maxPow] )*int( c_PowSidesWORD[maxPow] );
+        return 1.0f - float( maxFree )/float( m_NFreePixels );
+    }
+
     void Init( int texSide )
     {
-        m_NFreePixels = texSide * texSide;
+        m_MaxPixels = texSide * texSide;
         m_MaxLevel = 0;
-        while (texSide > 1) 
+        while (texSide > 1)
         {
             texSide >>= 1;
-            m_MaxLevel++;                
+            m_MaxLevel++;
         }
         Free();
     }
@@ -58,77 +102,157 @@ public:
     void Free()
     {
         //  make all quads "free"
-        memset( &m_Level, 0, sizeof( m_Level ) );
-        m_CurLevel = m_MaxLevel;
-        m_Level[m_MaxLevel].numQuads = 1;
+        for (int i = 0; i <= c_MaxQuadLevels; i++) m_Level[i].quad.clear();
+        m_Level[m_MaxLevel].quad.push_back( 0 );
         m_NFreePixels = m_MaxPixels;
     }
 }; //  class QuadLayout
 
 /*****************************************************************
-/*  QuadLayout implementation                                 
+/*  QuadLayout implementation
 /*****************************************************************/
+inline int QuadLayout::FindLowest( int level ) const
+{
+    const std::vector<DWORD>& quad = m_Level[level].quad;
+    int     nQuads  = quad.size();
+    int     best    = -1;
+    DWORD   bestKey = 0xFFFFFFFF;
+    for (int i = 0; i < nQuads; i++)
+    {
+        DWORD key = QuadMortonKey( WORD( quad[i] >> 16 ), WORD( quad[i] & 0xFFFF ) );
+        if (key < bestKey) { bestKey = key; best = i; }
+    }
+    return best;
+} // QuadLayout::FindLowest
+
+inline int QuadLayout::GetLargestFreePow() const
+{
+    for (int i = m_MaxLevel; i >= 0; i--)
+    {
+        if (m_Level[i].quad.size() > 0) return i;
+    }
+    return -1;
+} // QuadLayout::GetLargestFreePow
+
+inline int QuadLayout::GetNFreeQuads() const
+{
+    int nQuads = 0;
+    for (int i = 0; i <= m_MaxLevel; i++) nQuads += m_Level[i].quad.size();
+    return nQuads;
+} // QuadLayout::GetNFreeQuads
+
+/*---------------------------------------------------------------*
+/*  Func:    QuadLayout::SplitQuad
+/*    Desc:    Takes free quad from the level and splits it down to
+/*          the chunk side, lower quad part is kept for the chunk
+/*---------------------------------------------------------------*/
+inline void QuadLayout::SplitQuad( int level, int idx, int sidePow, WORD& allocx, WORD& allocy )
+{
+    std::vector<DWORD>& quad = m_Level[level].quad;
+    WORD x = WORD( quad[idx] >> 16 );
+    WORD y = WORD( quad[idx] & 0xFFFF );
+    quad[idx] = quad.back();
+    quad.pop_back();
+
+    for (int i = level - 1; i >= sidePow; i--)
+    {
+        WORD side = c_PowSidesWORD[i];
+        std::vector<DWORD>& part = m_Level[i].quad;
+        part.push_back( (DWORD( x + side ) << 16) | DWORD( y ) );
+        part.push_back( (DWORD( x ) << 16) | DWORD( y + side ) );
+        part.push_back( (DWORD( x + side ) << 16) | DWORD( y + side ) );
+    }
+
+    allocx = x;
+    allocy = y;
+    m_NFreePixels -= (int)c_PowSidesWORD[sidePow] * (int)c_PowSidesWORD[sidePow];
+} // QuadLayout::SplitQuad
 
 /*---------------------------------------------------------------*
 /*  Func:    QuadLayout::AllocChunk
-/*    Desc:    Finds the place on the surface for the given chunk
+/*    Desc:    Finds the place on the surface for the given chunk,
+/*          smallest fitting free quad is used
 /*---------------------------------------------------------------*/
 inline bool QuadLayout::AllocChunk( int sidePow, WORD& allocx, WORD& allocy )
 {
-    if (sidePow > m_CurLevel) return false;
+    if (sidePow > m_MaxLevel) return false;
+    assert( sidePow >= 0 );
+
+    for (int i = sidePow; i <= m_MaxLevel; i++)
+    {
+        if (m_Level[i].quad.size() == 0) continue;
+        SplitQuad( i, FindLowest( i ), sidePow, allocx, allocy );
+        return true;
+    }
+    return false;
+} // QuadLayout::AllocChunk
+
+/*---------------------------------------------------------------*
+/*  Func:    QuadLayout::AllocLowestChunk
+/*    Desc:    Allocates chunk at the lowest free position, if its
+/*          Morton key is below maxKey. Used to compact the surface
+/*---------------------------------------------------------------*/
+inline bool QuadLayout::AllocLowestChunk( int sidePow, WORD& allocx, WORD& allocy, DWORD maxKey )
+{
+    if (sidePow > m_MaxLevel) return false;
+    int     bestLevel   = -1;
+    int     bestIdx     = -1;
+    DWORD   bestKey     = maxKey;
+    for (int i = sidePow; i <= m_MaxLevel; i++)
+    {
+        int idx = FindLowest( i );
+        if (idx < 0) continue;
+        DWORD q = m_Level[i].quad[idx];
+        DWORD key = QuadMortonKey( WORD( q >> 16 ), WORD( q & 0xFFFF ) );
+        if (key < bestKey) { bestKey = key; bestLevel = i; bestIdx = idx; }
+    }
+    if (bestLevel < 0) return false;
+    SplitQuad( bestLevel, bestIdx, sidePow, allocx, allocy );
+    return true;
+} // QuadLayout::AllocLowestChunk
 
-    assert( sidePow <= m_MaxLevel && sidePow > 0 ); 
+/*---------------------------------------------------------------*
+/*  Func:    QuadLayout::FreeChunk
+/*    Desc:    Returns chunk to the free quads, merging it with
+/*          the free buddies into the parent quads
+/*---------------------------------------------------------------*/
+inline void QuadLayout::FreeChunk( int sidePow, WORD x, WORD y )
+{
+    assert( sidePow >= 0 && sidePow <= m_MaxLevel );
+    m_NFreePixels += (int)c_PowSidesWORD[sidePow] * (int)c_PowSidesWORD[sidePow];
 
-    QuadLayoutLevel* curLevel = &m_Level[sidePow];
-    //  no free place - split parent greater free chunks
-    if (m_Level[sidePow].numQuads == 0) 
+    int level = sidePow;
+    while (level < m_MaxLevel)
     {
-        WORD idx = sidePow;
-        while (m_Level[idx].numQuads == 0) 
+        WORD    side    = c_PowSidesWORD[level];
+        WORD    px      = x & ~WORD( side*2 - 1 );
+        WORD    py      = y & ~WORD( side*2 - 1 );
+        std::vector<DWORD>& quad = m_Level[level].quad;
+        int     nQuads  = quad.size();
+        int     buddy[3];
+        int     nBuddies = 0;
+        for (int i = 0; i < nQuads && nBuddies < 3; i++)
         {
-            idx++;
-            if (idx >= c_MaxQuadLevels) return false;
+            WORD qx = WORD( quad[i] >> 16 );
+            WORD qy = WORD( quad[i] & 0xFFFF );
+            if ((qx & ~WORD( side*2 - 1 )) == px && (qy & ~WORD( side*2 - 1 )) == py)
+            {
+                buddy[nBuddies++] = i;
+            }
         }
+        if (nBuddies < 3) break;
 
-        //  free last chunk
-        QuadLayoutLevel* parentLevel = &m_Level[idx];
-        parentLevel->numQuads--;
-        WORD x = parentLevel->quad[parentLevel->numQuads].x;
-        WORD y = parentLevel->quad[parentLevel->numQuads].y;
-        //  now do descending splitting of the last free chunk on levels
-        for (int i = idx - 1; i >= sidePow; i--)
+        //  all the buddies are free - merge them into the parent quad
+        for (int i = 2; i >= 0; i--)
         {
-            curLevel = &m_Level[i];
-            curLevel->numQuads = 3;
-
-            curLevel->quad[0].x = x;
-            curLevel->quad[1].x = x;
-            x += c_PowSidesWORD[i];
-
-            curLevel->quad[2].x = x;
-
-            curLevel->quad[0].y = y;
-            curLevel->quad[2].y = y;
-            y += c_PowSidesWORD[i];
-
-            curLevel->quad[1].y = y;
+            quad[buddy[i]] = quad.back();
+            quad.pop_back();
         }
-
-        //  now do allocate forth chunk
-        allocx = x; 
-        allocy = y;
+        x = px;
+        y = py;
+        level++;
     }
-    else
-        //  there IS free chunk on the level - so allocate it
-    {
-        curLevel->numQuads--;
-        allocx = curLevel->quad[curLevel->numQuads].x; 
-        allocy = curLevel->quad[curLevel->numQuads].y;
-    }
-
-    m_NFreePixels -= (int)c_PowSidesWORD[sidePow] * (int)c_PowSidesWORD[sidePow];
-    return true;
-} // QuadLayout::AllocChunk
-
+    m_Level[level].quad.push_back( (DWORD( x ) << 16) | DWORD( y ) );
+} // QuadLayout::FreeChunk
 
-#endif // __KQUADLAYOUT_H__
\ No newline at end of file
+#endif // __KQUADLAYOUT_H__
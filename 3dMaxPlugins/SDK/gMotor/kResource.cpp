@@ -6,6 +6,7 @@
 #include "stdafx.h"
 #include "kHash.hpp"
 #include "kResource.h"
+#include "kTimer.h"
 
 #ifndef _INLINES
 #include "kResource.inl"
@@ -17,3 +18,103 @@ void BaseResource::Dump()
 {
 }
 
+
+/*****************************************************************************/
+/*    Class:    TraceResource
+/*    Desc:    Resource stub, used to replay recorded access traces
+/*****************************************************************************/
+class TraceResource : public BaseResource
+{
+    int                 m_NBytes;
+public:
+                        TraceResource( int nBytes ) : m_NBytes( nBytes ) {}
+    virtual int         GetDismissableSizeBytes() const { return m_NBytes; }
+    virtual int         GetHeaderSizeBytes() const { return 0; }
+    virtual bool        InitPrefix() { return true; }
+    virtual void        Dismiss() { dismissed = true; }
+    virtual bool        Restore() { dismissed = false; return true; }
+}; // class TraceResource
+
+struct TraceKey
+{
+    int                 m_ID;
+    unsigned int        hash() const { return m_ID; }
+    bool                operator ==( const TraceKey& key ) const { return m_ID == key.m_ID; }
+}; // struct TraceKey
+
+void ReplayResourceTrace( const ResourceTrace& trace, int memoryBudget )
+{
+    int nAcc = trace.size();
+    if (nAcc == 0) return;
+
+    DWORD oldFactor = BaseResource::curCacheFactor;
+    DynamicResMgr<TraceResource, TraceKey>* pMgr = new DynamicResMgr<TraceResource, TraceKey>();
+    pMgr->SetMemoryBudget( memoryBudget );
+
+    //  trace resource IDs are mapped to the replay manager IDs
+    std::vector<int> resMap;
+    int nRes = 0;
+    for (int i = 0; i < nAcc; i++)
+    {
+        const ResourceAccess& acc = trace[i];
+        if (acc.m_ResID >= (int)resMap.size()) resMap.resize( acc.m_ResID + 1, -1 );
+        if (resMap[acc.m_ResID] == -1)
+        {
+            TraceKey key;
+            key.m_ID = acc.m_ResID;
+            resMap[acc.m_ResID] = pMgr->InsertResource( new TraceResource( acc.m_NBytes ), key );
+            nRes++;
+        }
+    }
+
+    Timer timer;
+    timer.start();
+    for (int i = 0; i < nAcc; i++)
+    {
+        const ResourceAccess& acc = trace[i];
+        BaseResource::curCacheFactor = acc.m_Factor;
+        pMgr->GetResource( resMap[acc.m_ResID] );
+    }
+    double replayTime = timer.seconds();
+
+    Log.Info( "Resource trace replay: %d accesses, %d resources, budget %d bytes. "
+              "Hits: %d, misses: %d, evictions: %d, time: %.2fms", 
+              nAcc, nRes, memoryBudget,
+              pMgr->GetNHits(), pMgr->GetNMisses(), pMgr->GetNEvictions(), replayTime*1000.0 );
+    delete pMgr;
+    BaseResource::curCacheFactor = oldFactor;
+} // ReplayResourceTrace
+
+bool SaveResourceTrace( const ResourceTrace& trace, const char* fname )
+{
+    FOutStream os( fname );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write resource trace <%s>", fname );
+        return false;
+    }
+    DWORD nAcc = trace.size();
+    os.Write( &c_ResourceTraceMagic, sizeof( DWORD ) );
+    os.Write( &nAcc, sizeof( DWORD ) );
+    if (nAcc > 0) os.Write( &trace[0], nAcc*sizeof( ResourceAccess ) );
+    os.CloseFile();
+    return true;
+} // SaveResourceTrace
+
+bool LoadResourceTrace( ResourceTrace& trace, const char* fname )
+{
+    trace.clear();
+    FInStream is( fname );
+    if (is.NoFile()) return false;
+    DWORD magic = 0, nAcc = 0;
+    if (is.Read( &magic, sizeof( DWORD ) ) != sizeof( DWORD ) || magic != c_ResourceTraceMagic ||
+        is.Read( &nAcc, sizeof( DWORD ) ) != sizeof( DWORD ) || 
+        nAcc > DWORD( is.GetFileSize() - is.GetTotalBytesRead() )/sizeof( ResourceAccess ))
+    {
+        Log.Warning( "Invalid resource trace <%s>", fname );
+        return false;
+    }
+    trace.resize( nAcc );
+    if (nAcc > 0) is.Read( &trace[0], nAcc*sizeof( ResourceAccess ) );
+    return true;
+} // LoadResourceTrace
@@ -14,6 +14,7 @@
 /*    Class:    BaseResource
 /*    Desc:    Basic resource type
 /*****************************************************************************/
+class ResidencyList;
 class BaseResource
 {
 protected:
@@ -21,9 +22,16 @@ protected:
     bool                locked;
     DWORD                usedFactor;
     DWORD                tag;
+
+private:
+    BaseResource*       lruPrev;        //  neighbours in the residency list
+    BaseResource*       lruNext;
+    ResidencyList*      lruOwner;       //  residency list the resource is in, if any
+    int                 lruBytes;       //  size accounted in the residency list
     
 public:    
-                        BaseResource() : dismissed( true ), usedFactor( curCacheFactor ) 
+                        BaseResource() : dismissed( true ), usedFactor( curCacheFactor ),
+                                         lruPrev( NULL ), lruNext( NULL ), lruOwner( NULL ), lruBytes( 0 )
                         {
                             static int s_Tag    = 0;
                             tag                    = s_Tag++;
@@ -52,8 +60,54 @@ public:
 
     static DWORD        curCacheFactor;
 
+    friend class        ResidencyList;
 }; // class BaseResource
 
+/*****************************************************************************/
+/*    Class:    ResidencyList
+/*    Desc:    Intrusive doubly-linked list of the restored resources, ordered
+/*              from the least to the most recently used
+/*****************************************************************************/
+class ResidencyList
+{
+    BaseResource*       head;
+    BaseResource*       tail;
+    int                 nBytes;
+
+public:
+                        ResidencyList() : head( NULL ), tail( NULL ), nBytes( 0 ) {}
+
+    _inl void           PushBack    ( BaseResource* pRes );
+    _inl void           Remove      ( BaseResource* pRes );
+    _inl bool           Contains    ( const BaseResource* pRes ) const;
+    _inl static void    Unlink      ( BaseResource* pRes );
+
+    BaseResource*       Front       () const { return head; }
+    bool                IsEmpty     () const { return head == NULL; }
+    int                 GetNBytes   () const { return nBytes; }
+}; // class ResidencyList
+
+/*****************************************************************************/
+/*    Struct:    ResourceAccess
+/*    Desc:    Single record of the resource access trace
+/*****************************************************************************/
+struct ResourceAccess
+{
+    int                 m_ResID;        //  resource ID in the manager
+    int                 m_NBytes;       //  resource dismissable size
+    DWORD               m_Factor;       //  cache factor (frame stamp) at the access
+}; // struct ResourceAccess
+
+typedef std::vector<ResourceAccess> ResourceTrace;
+
+const DWORD c_ResourceTraceMagic = 'RTCR';
+
+//  replays recorded access trace against the resource manager with given budget,
+//  logs hit/miss/eviction numbers and timing
+void ReplayResourceTrace( const ResourceTrace& trace, int memoryBudget );
+bool SaveResourceTrace  ( const ResourceTrace& trace, const char* fname );
+bool LoadResourceTrace  ( ResourceTrace& trace, const char* fname );
+
 /*****************************************************************************/
 /*    Class:    BaseResourceMgr
 /*    Desc:    Basic resource manager
@@ -95,7 +149,16 @@ private:
 
 /*****************************************************************************/
 /*    Class:    DynamicResMgr 
+/*    Desc:    Keeps restored resources within the memory budget. Eviction 
+/*              policy is segmented LRU: restored resource gets into the 
+/*              probation list and is promoted to the protected one, when it is
+/*              hit again at a later frame. Victims are taken from the probation
+/*              list first, so one-time bursts of resources (e.g. after camera 
+/*              jump) do not wash out the working set.
 /*****************************************************************************/
+const int c_ResLowWaterDiv      = 8;    //  eviction frees budget/c_ResLowWaterDiv extra bytes
+const int c_ResProtectedPart    = 4;    //  protected list takes at most (c_ResProtectedPart - 1)/c_ResProtectedPart of the budget
+
 template <class TRes, class TKey, 
             int        tableSize    = c_DefTableSize, 
             int        minPoolSize = c_DefMinPoolSize>
@@ -104,8 +167,17 @@ class DynamicResMgr
     PointerHash<TRes,TKey, tableSize, minPoolSize>        hash;
     int                                                    memoryBudget;
     int                                                    nUsedBytes;
+
+    ResidencyList                                       probation;
+    ResidencyList                                       protect;
+
+    int                                                 nHits;
+    int                                                 nMisses;
+    int                                                 nEvictions;
+    ResourceTrace*                                      pTrace;
+
 public:
-    DynamicResMgr() {}
+    DynamicResMgr() : memoryBudget( 0 ), nUsedBytes( 0 ), pTrace( NULL ) { ResetStats(); }
     ~DynamicResMgr()
     {
         for (int i = 0; i < hash.numElem(); i++)
@@ -130,16 +202,55 @@ public:
     TRes* GetResource( int resID )
     {
         TRes* res = hash.elem( resID );
+        DWORD lastFactor = res->GetFactor();
         res->Hit( BaseResource::curCacheFactor );
+        if (pTrace)
+        {
+            ResourceAccess acc;
+            acc.m_ResID  = resID;
+            acc.m_NBytes = res->GetDismissableSizeBytes();
+            acc.m_Factor = BaseResource::curCacheFactor;
+            pTrace->push_back( acc );
+        }
+
         if (res->IsDismissed())
         //  rise up uninitialized or previously dismissed resource
         {
-            while (!FitsInMemoryBudget( res->GetDismissableSizeBytes() ))
+            nMisses++;
+            if (!FitsInMemoryBudget( res->GetDismissableSizeBytes() ))
             {
-                DismissLRU();
+                DismissToLowWater( res->GetDismissableSizeBytes() );
             }
             res->Restore();
             nUsedBytes += res->GetDismissableSizeBytes();
+            ResidencyList::Unlink( res );
+            probation.PushBack( res );
+        }
+        else
+        {
+            nHits++;
+            if (protect.Contains( res ))
+            {
+                protect.Remove( res );
+                protect.PushBack( res );
+            }
+            else if (lastFactor != BaseResource::curCacheFactor)
+            {
+                //  second hit at the later frame, promote
+                ResidencyList::Unlink( res );
+                protect.PushBack( res );
+                int maxProtected = memoryBudget - memoryBudget/c_ResProtectedPart;
+                while (protect.GetNBytes() > maxProtected && protect.Front() != res)
+                {
+                    BaseResource* pDemoted = protect.Front();
+                    protect.Remove( pDemoted );
+                    probation.PushBack( pDemoted );
+                }
+            }
+            else if (!probation.Contains( res ))
+            {
+                probation.PushBack( res );
+            }
         }
         return res;
     }
@@ -155,24 +266,39 @@ public:
         nUsedBytes        = 0;
     }
 
-    void DismissLRU()
+    //  dismisses least recently used resources, until there is space for nBytes
+    //  plus the low-water reserve, so the next misses do not evict again
+    void DismissToLowWater( int nBytes )
     {
-        int nRes = hash.numElem();
-        DWORD minfactor = BaseResource::curCacheFactor;
-        TRes* candidate = hash.elem( 0 );
-        for (int i = 0; i < nRes; i++)
+        int lowWater = memoryBudget - memoryBudget/c_ResLowWaterDiv;
+        while (nUsedBytes + nBytes >= lowWater)
         {
-            TRes* res = hash.elem( i );
-            if (!res->IsDismissed() && res->GetFactor() < minfactor)
-            {
-                minfactor = res->GetFactor();
-                candidate = res;
-            }
+            if (!DismissLRU()) break;
         }
-        assert( candidate );
+    }
+
+    bool DismissLRU()
+    {
+        ResidencyList& victims = probation.IsEmpty() ? protect : probation;
+        TRes* candidate = static_cast<TRes*>( victims.Front() );
+        if (!candidate) return false;
+        victims.Remove( candidate );
+        //  resource could be dismissed by its owner
+        if (candidate->IsDismissed()) return true;
         candidate->Dismiss();
         nUsedBytes -= candidate->GetDismissableSizeBytes();
+        nEvictions++;
+        return true;
     }
+
+    //  starts/stops recording of the accesses for ReplayResourceTrace
+    void SetTrace( ResourceTrace* trace ) { pTrace = trace; }
+
+    void ResetStats() { nHits = 0; nMisses = 0; nEvictions = 0; }
+    int  GetNHits       () const { return nHits;        }
+    int  GetNMisses     () const { return nMisses;      }
+    int  GetNEvictions  () const { return nEvictions;   }
+    int  GetNUsedBytes  () const { return nUsedBytes;   }
     
 }; // class DynamicResMgr
 
@@ -47,3 +47,39 @@ _inl DWORD BaseResource::GetFactor() const
 { 
 	return usedFactor;				
 }
+
+/*****************************************************************************/
+/*	ResidencyList implementation
+/*****************************************************************************/
+_inl void ResidencyList::PushBack( BaseResource* pRes )
+{
+	assert( pRes->lruOwner == NULL );
+	pRes->lruOwner	= this;
+	pRes->lruPrev	= tail;
+	pRes->lruNext	= NULL;
+	pRes->lruBytes	= pRes->GetDismissableSizeBytes();
+	if (tail) tail->lruNext = pRes; else head = pRes;
+	tail = pRes;
+	nBytes += pRes->lruBytes;
+}
+
+_inl void ResidencyList::Remove( BaseResource* pRes )
+{
+	assert( pRes->lruOwner == this );
+	if (pRes->lruPrev) pRes->lruPrev->lruNext = pRes->lruNext; else head = pRes->lruNext;
+	if (pRes->lruNext) pRes->lruNext->lruPrev = pRes->lruPrev; else tail = pRes->lruPrev;
+	pRes->lruPrev	= NULL;
+	pRes->lruNext	= NULL;
+	pRes->lruOwner	= NULL;
+	nBytes -= pRes->lruBytes;
+}
+
+_inl bool ResidencyList::Contains( const BaseResource* pRes ) const
+{
+	return pRes->lruOwner == this;
+}
+
+_inl void ResidencyList::Unlink( BaseResource* pRes )
+{
+	if (pRes->lruOwner) pRes->lruOwner->Remove( pRes );
+} // ResidencyList::Unlink
@@ -0,0 +1,176 @@
+/*****************************************************************************/
+/*    File:    kXMLCache.cpp
+/*    Desc:    Cache of the compiled (binary) xml files
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#include "stdafx.h"
+#include "direct.h"
+#include "kXMLParser.h"
+#include "kDirIterator.h"
+#include "IResourceManager.h"
+#include "kXMLCache.h"
+
+static int s_XMLCacheHits   = 0;
+static int s_XMLCacheMisses = 0;
+
+static DWORD HashXMLData( const BYTE* pData, int size )
+{
+    //  FNV-1a
+    DWORD h = 2166136261;
+    for (int i = 0; i < size; i++)
+    {
+        h ^= pData[i];
+        h *= 16777619;
+    }
+    return h;
+} // HashXMLData
+
+static DWORD HashXMLPath( const char* path )
+{
+    DWORD h = 2166136261;
+    for (const char* pCh = path; *pCh; pCh++)
+    {
+        char c = (*pCh == '/') ? '\\' : tolower( *pCh );
+        h ^= (BYTE)c;
+        h *= 16777619;
+    }
+    return h;
+} // HashXMLPath
+
+static void GetXMLCachePath( DWORD pathHash, char* cachePath )
+{
+    sprintf( cachePath, "%s\\%s\\%08X.xmc", IRM->GetHomeDirectory(), c_XMLCacheDir, pathHash );
+} // GetXMLCachePath
+
+//  opens the cache file and reads its header, 
+//  false when it is missing or was compiled from another source
+static bool OpenXMLCache( FInStream& is, const char* cachePath, const XMLCacheHeader& key, XMLCacheHeader& hdr )
+{
+    if (!is.OpenFile( cachePath )) return false;
+    if (is.Read( &hdr, sizeof( hdr ) ) != sizeof( hdr )) return false;
+    return (hdr.m_Magic     == key.m_Magic      &&
+            hdr.m_Version   == key.m_Version    &&
+            hdr.m_PathHash  == key.m_PathHash   &&
+            hdr.m_SrcSize   == key.m_SrcSize);
+} // OpenXMLCache
+
+static bool ReadXMLCache( InStream& is, XMLNode& root )
+{
+    if (root.Unserialize( is )) return true;
+    root.Clear();
+    return false;
+} // ReadXMLCache
+
+static void WriteXMLCache( const char* cachePath, const XMLCacheHeader& key, const XMLNode& root )
+{
+    char path[_MAX_PATH];
+    sprintf( path, "%s\\Cache", IRM->GetHomeDirectory() );
+    _mkdir( path );
+    sprintf( path, "%s\\%s", IRM->GetHomeDirectory(), c_XMLCacheDir );
+    _mkdir( path );
+    FOutStream os( cachePath );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write xml cache file <%s>", cachePath );
+        return;
+    }
+    os.Write( &key, sizeof( key ) );
+    root.Serialize( os );
+    os.CloseFile();
+} // WriteXMLCache
+
+bool LoadXMLCached( const char* fname, XMLNode& root )
+{
+    if (!fname) return false;
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesEx( fname, GetFileExInfoStandard, &attr )) return false;
+
+    XMLCacheHeader key;
+    key.m_Magic     = c_XMLCacheMagic;
+    key.m_Version   = c_XMLCacheVersion;
+    key.m_PathHash  = HashXMLPath( fname );
+    key.m_SrcSize   = attr.nFileSizeLow;
+    key.m_SrcTime   = attr.ftLastWriteTime;
+    key.m_SrcHash   = 0;
+
+    //  same size and write time: source is not read at all
+    char cachePath[_MAX_PATH];
+    GetXMLCachePath( key.m_PathHash, cachePath );
+    FInStream cs;
+    XMLCacheHeader hdr;
+    bool bCached = OpenXMLCache( cs, cachePath, key, hdr );
+    if (bCached && CompareFileTime( &hdr.m_SrcTime, &key.m_SrcTime ) == 0)
+    {
+        if (ReadXMLCache( cs, root ))
+        {
+            s_XMLCacheHits++;
+            return true;
+        }
+        bCached = false;
+    }
+
+    FInStream is( fname );
+    if (is.NoFile()) return false;
+    int   size = is.GetFileSize();
+    char* pBuf = new char[size + 1];
+    pBuf[size] = 0;
+    if (is.Read( pBuf, size ) != (DWORD)size)
+    {
+        delete []pBuf;
+        return false;
+    }
+    is.Close();
+    key.m_SrcSize   = size;
+    key.m_SrcHash   = HashXMLData( (const BYTE*)pBuf, size );
+
+    //  only write time differs, contents are compared by the hash
+    if (bCached && hdr.m_SrcSize == key.m_SrcSize && hdr.m_SrcHash == key.m_SrcHash && ReadXMLCache( cs, root ))
+    {
+        delete []pBuf;
+        cs.Close();
+        //  restamp, so the next load does not hash the source again
+        WriteXMLCache( cachePath, key, root );
+        s_XMLCacheHits++;
+        return true;
+    }
+    cs.Close();
+
+    s_XMLCacheMisses++;
+    XMLTreeParser parser( &root );
+    bool bRes = parser.ParseBuffer( pBuf );
+    delete []pBuf;
+    if (bRes) WriteXMLCache( cachePath, key, root );
+    return bRes;
+} // LoadXMLCached
+
+int PrewarmXMLCache( const char* root, const char* ext )
+{
+    int nHits   = s_XMLCacheHits;
+    int nMisses = s_XMLCacheMisses;
+    int nFiles  = 0;
+    DirTreeIterator it( root );
+    it.AddFilter( ext );
+    while (it)
+    {
+        XMLNode node;
+        if (LoadXMLCached( it.GetFullFilePath(), node )) nFiles++;
+        ++it;
+    }
+    nHits   = s_XMLCacheHits   - nHits;
+    nMisses = s_XMLCacheMisses - nMisses;
+    Log.Info( "XML cache prewarm in <%s>: %d files, %d up to date, %d compiled", 
+                root, nFiles, nHits, nMisses );
+    return nMisses;
+} // PrewarmXMLCache
+
+void GetXMLCacheStats( int& nHits, int& nMisses )
+{
+    nHits   = s_XMLCacheHits;
+    nMisses = s_XMLCacheMisses;
+} // GetXMLCacheStats
+
+void ResetXMLCacheStats()
+{
+    s_XMLCacheHits   = 0;
+    s_XMLCacheMisses = 0;
+} // ResetXMLCacheStats
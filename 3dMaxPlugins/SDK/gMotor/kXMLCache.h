@@ -0,0 +1,42 @@
+/*****************************************************************************/
+/*    File:    kXMLCache.h
+/*    Desc:    Cache of the compiled (binary) xml files
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __KXMLCACHE_H__
+#define __KXMLCACHE_H__
+
+class XMLNode;
+
+const DWORD c_XMLCacheMagic     = 'XMLC';
+const DWORD c_XMLCacheVersion   = 2;
+const char  c_XMLCacheDir[]     = "Cache\\xml";   //  relative to the home directory
+
+/*****************************************************************************/
+/*    Struct:  XMLCacheHeader
+/*    Desc:    Header of the compiled xml file. Compiled file holds the binary
+/*             image of the XMLNode tree, it is valid while source file 
+/*             path, size and write time are the same. When only the write 
+/*             time differs, the contents hash decides, so touched files 
+/*             are not parsed again.
+/*****************************************************************************/
+struct XMLCacheHeader
+{
+    DWORD           m_Magic;        //  c_XMLCacheMagic
+    DWORD           m_Version;      //  c_XMLCacheVersion
+    DWORD           m_PathHash;     //  hash of the source file path
+    DWORD           m_SrcSize;      //  size of the source file
+    FILETIME        m_SrcTime;      //  last write time of the source file
+    DWORD           m_SrcHash;      //  hash of the source file contents
+}; // struct XMLCacheHeader
+
+//  loads xml tree from the compiled cache, if the cached copy is up to date,
+//  otherwise parses the source file and refreshes the cache
+bool    LoadXMLCached       ( const char* fname, XMLNode& root );
+//  compiles all files with given extension in the directory tree
+int     PrewarmXMLCache     ( const char* root, const char* ext = "xml" );
+//  number of loads served from the cache and number of parsed sources
+void    GetXMLCacheStats    ( int& nHits, int& nMisses );
+void    ResetXMLCacheStats  ();
+
+#endif // __KXMLCACHE_H__
@@ -2559,17 +2559,19 @@ const char*    _getcurpos()
 
 END_NAMESPACE(xmlParser)
 
-bool XMLParser::ParseBuffer( char* buffer )
+bool XMLParser::ParseBufferLegacy( char* buffer )
 {
     assert( buffer );
     Init();
     
+    ClearStringPool();
     m_Buffer            = buffer;
     m_BufPtr            = buffer;
     xmlParser::pParser    = this;
     xmlParser::yyparse();
+    ClearStringPool();
     return true;
-} // XMLParser::ParseBuffer
+} // XMLParser::ParseBufferLegacy
 
 
 
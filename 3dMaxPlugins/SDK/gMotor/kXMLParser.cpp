@@ -5,6 +5,9 @@
 /*****************************************************************************/
 #include "stdafx.h"
 #include "kXMLParser.h"
+#include "kPoolAllocator.h"
+#include "kDirIterator.h"
+#include "kTimer.h"
 
 /*****************************************************************************/
 /*    XMLParser implementation
@@ -30,15 +33,208 @@ bool XMLParser::ParseFile( const char* fName )
     fclose( fp );
     buf[fileSize] = 0;
     
-    ClearStringPool();
-
-    ParseBuffer( buf );
+    bool bRes = ParseBuffer( buf );
     
-    ClearStringPool();
     delete []buf;
-    return true;
+    return bRes;
 } // XMLParser::ParseFile
 
+int XMLParser::GetLineAt( const char* pos ) const
+{
+    //  line is counted only when it is needed, i.e. on errors
+    int line = 1;
+    for (const char* pCh = m_Buffer; pCh && pCh < pos && *pCh; pCh++)
+    {
+        if (*pCh == '\n') line++;
+    }
+    return line;
+} // XMLParser::GetLineAt
+
+bool XMLParser::ParseError( const char* msg, const char* pos )
+{
+    m_pErrToken = NULL;
+    Error( (char*)msg, GetLineAt( pos ) );
+    return false;
+} // XMLParser::ParseError
+
+static inline bool IsXMLSpace( char c )
+{
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+static inline bool IsXMLNameChar( char c )
+{
+    return (c != 0 && !IsXMLSpace( c ) && c != '<' && c != '>' && c != '/' && c != '=');
+}
+
+static inline char* SkipXMLSpace( char* pCh )
+{
+    while (IsXMLSpace( *pCh )) pCh++;
+    return pCh;
+}
+
+//  returns pointer to the first symbol of the pattern in the buffer, or NULL
+static char* FindXMLToken( char* pCh, const char* pattern )
+{
+    char first = pattern[0];
+    int  len   = strlen( pattern );
+    while (*pCh)
+    {
+        if (*pCh == first && !strncmp( pCh, pattern, len )) return pCh;
+        pCh++;
+    }
+    return NULL;
+} // FindXMLToken
+
+//  reads tag name, writes terminating zero over the first symbol after it, 
+//  returns that symbol
+static char TerminateXMLName( char*& pCh )
+{
+    while (IsXMLNameChar( *pCh )) pCh++;
+    char term = *pCh;
+    *pCh = 0;
+    return term;
+} // TerminateXMLName
+
+bool XMLParser::ParseBuffer( char* buffer )
+{
+    assert( buffer );
+    Init();
+    m_Buffer = buffer;
+    m_BufPtr = buffer;
+
+    char* pCh = buffer;
+    while (*pCh)
+    {
+        if (*pCh != '<')
+        {
+            //  text value, trimmed from both sides
+            char* pText = SkipXMLSpace( pCh );
+            char* pEnd  = pText;
+            while (*pEnd && *pEnd != '<') pEnd++;
+            char* pNext = pEnd;
+            while (pEnd > pText && IsXMLSpace( pEnd[-1] )) pEnd--;
+            if (pEnd > pText)
+            {
+                char term = *pEnd;
+                *pEnd = 0;
+                OnValue( pText );
+                *pEnd = term;
+            }
+            pCh = pNext;
+            continue;
+        }
+
+        if (pCh[1] == '?')
+        {
+            char* pEnd = FindXMLToken( pCh + 2, "?>" );
+            if (!pEnd) return ParseError( "Unterminated processing instruction", pCh );
+            pCh = pEnd + 2;
+        }
+        else if (!strncmp( pCh, "<!--", 4 ))
+        {
+            char* pEnd = FindXMLToken( pCh + 4, "-->" );
+            if (!pEnd) return ParseError( "Unterminated comment", pCh );
+            pCh = pEnd + 3;
+        }
+        else if (!strncmp( pCh, "<![CDATA[", 9 ))
+        {
+            char* pText = pCh + 9;
+            char* pEnd  = FindXMLToken( pText, "]]>" );
+            if (!pEnd) return ParseError( "Unterminated CDATA section", pCh );
+            *pEnd = 0;
+            OnValue( pText );
+            *pEnd = ']';
+            pCh = pEnd + 3;
+        }
+        else if (pCh[1] == '!')
+        {
+            char* pEnd = strchr( pCh, '>' );
+            if (!pEnd) return ParseError( "Unterminated declaration", pCh );
+            pCh = pEnd + 1;
+        }
+        else if (pCh[1] == '/')
+        {
+            char* pTag = SkipXMLSpace( pCh + 2 );
+            pCh = pTag;
+            char term = TerminateXMLName( pCh );
+            if (!*pTag) return ParseError( "Closing tag name expected", pTag );
+            if (term != '>')
+            {
+                if (term != 0) pCh = SkipXMLSpace( pCh + 1 );
+                if (*pCh != '>') return ParseError( "'>' expected after closing tag name", pCh );
+            }
+            OnClose( pTag );
+            pCh++;
+        }
+        else
+        {
+            char* pTag = pCh + 1;
+            pCh = pTag;
+            char term = TerminateXMLName( pCh );
+            if (!*pTag) return ParseError( "Tag name expected", pTag );
+            OnOpen( pTag );
+
+            //  attributes
+            if (IsXMLSpace( term ))
+            {
+                pCh  = SkipXMLSpace( pCh + 1 );
+                term = *pCh;
+            }
+            while (term != 0 && term != '>' && term != '/')
+            {
+                char* pName = pCh;
+                char  nameTerm = TerminateXMLName( pCh );
+                if (!*pName) return ParseError( "Attribute name expected", pName );
+                if (nameTerm != '=')
+                {
+                    if (nameTerm != 0) pCh = SkipXMLSpace( pCh + 1 );
+                    if (*pCh != '=') return ParseError( "'=' expected after attribute name", pCh );
+                }
+                pCh = SkipXMLSpace( pCh + 1 );
+                if (*pCh == '"' || *pCh == '\'')
+                {
+                    char* pEnd = strchr( pCh + 1, *pCh );
+                    if (!pEnd) return ParseError( "Unterminated attribute value", pCh );
+                    *pEnd = 0;
+                    OnAttribute( pName, pCh + 1 );
+                    pCh = SkipXMLSpace( pEnd + 1 );
+                }
+                else
+                {
+                    char* pValue = pCh;
+                    while (*pCh && !IsXMLSpace( *pCh ) && *pCh != '>' && 
+                            !(pCh[0] == '/' && pCh[1] == '>')) pCh++;
+                    char valTerm = *pCh;
+                    *pCh = 0;
+                    OnAttribute( pName, pValue );
+                    *pCh = valTerm;
+                    pCh = SkipXMLSpace( pCh );
+                }
+                term = *pCh;
+            }
+
+            //  here pCh points to the zero written over term, or to term itself
+            if (term == '/')
+            {
+                if (pCh[1] != '>') return ParseError( "'>' expected after '/'", pCh );
+                OnClose( pTag );
+                pCh += 2;
+            }
+            else if (term == '>')
+            {
+                pCh++;
+            }
+            else 
+            {
+                return ParseError( "Unterminated tag", pTag );
+            }
+        }
+    }
+    m_BufPtr = pCh;
+    return true;
+} // XMLParser::ParseBuffer
+
 const char* XMLParser::GetCurLocation() const
 {
     static const int c_MaxLocationStr = 256;
@@ -101,6 +297,47 @@ void XMLParser::OnAttribute( const char* name, const char* value )
 int        XMLNode::s_Indent            = 0;
 bool    XMLNode::s_bCaseIndependent = true;
 
+//  nodes are carved from big pages, freed nodes are kept in the free list.
+//  XML trees may be built and freed from any thread, so the pool is locked.
+//  The lock is never deleted: nodes of static trees are freed at the exit too
+struct XMLNodePool
+{
+    PoolAllocator<65536>    m_Pages;
+    void*                   m_pFree;
+    CRITICAL_SECTION        m_Lock;
+
+    XMLNodePool() : m_pFree( NULL ) { InitializeCriticalSection( &m_Lock ); }
+}; // struct XMLNodePool
+
+static XMLNodePool& GetXMLNodePool()
+{
+    static XMLNodePool s_NodePool;
+    return s_NodePool;
+}
+//  creates the pool before any threads are started
+static XMLNodePool& s_XMLNodePool = GetXMLNodePool();
+
+void* XMLNode::operator new( size_t size )
+{
+    assert( size == sizeof( XMLNode ) );
+    XMLNodePool& pool = GetXMLNodePool();
+    EnterCriticalSection( &pool.m_Lock );
+    void* pNode = pool.m_pFree;
+    if (pNode) pool.m_pFree = *((void**)pNode); else pNode = pool.m_Pages.Allocate( size );
+    LeaveCriticalSection( &pool.m_Lock );
+    return pNode;
+} // XMLNode::operator new
+
+void XMLNode::operator delete( void* pNode )
+{
+    if (!pNode) return;
+    XMLNodePool& pool = GetXMLNodePool();
+    EnterCriticalSection( &pool.m_Lock );
+    *((void**)pNode) = pool.m_pFree;
+    pool.m_pFree = pNode;
+    LeaveCriticalSection( &pool.m_Lock );
+} // XMLNode::operator delete
+
 XMLNode::XMLNode( InStream& is )
 {
     m_pChild        = NULL;    
@@ -129,6 +366,11 @@ XMLNode::XMLNode( char* buf )
 }
 
 XMLNode::~XMLNode()
+{
+    Clear();
+} // XMLNode::~XMLNode
+
+void XMLNode::Clear()
 {
     while (m_pChild)
     {
@@ -136,7 +378,84 @@ XMLNode::~XMLNode()
         delete m_pChild;
         m_pChild = pChild;
     }
-} // XMLNode::~XMLNode
+    while (m_pAttr)
+    {
+        XMLNode* pAttr = m_pAttr->NextSibling(); 
+        delete m_pAttr;
+        m_pAttr = pAttr;
+    }
+    m_Tag   = "";
+    m_Value = "";
+} // XMLNode::Clear
+
+static void WriteXMLString( OutStream& os, const std::string& str )
+{
+    DWORD len = str.size();
+    os.Write( &len, sizeof( len ) );
+    if (len) os.Write( str.c_str(), len );
+} // WriteXMLString
+
+static bool ReadXMLString( InStream& is, std::string& str )
+{
+    DWORD len = 0;
+    if (is.Read( &len, sizeof( len ) ) != sizeof( len )) return false;
+    //  length comes from the file, corrupt one must not request arbitrary memory
+    if (len > DWORD( is.GetTotalSize() - is.GetTotalBytesRead() )) return false;
+    str.resize( len );
+    if (len == 0) return true;
+    return (is.Read( &str[0], len ) == len);
+} // ReadXMLString
+
+void XMLNode::Serialize( OutStream& os ) const
+{
+    WriteXMLString( os, m_Tag );
+    WriteXMLString( os, m_Value );
+
+    DWORD nAttr = GetNAttr();
+    os.Write( &nAttr, sizeof( nAttr ) );
+    for (const XMLNode* pAttr = m_pAttr; pAttr; pAttr = pAttr->m_pNext)
+    {
+        WriteXMLString( os, pAttr->m_Tag );
+        WriteXMLString( os, pAttr->m_Value );
+    }
+
+    DWORD nChildren = GetNChildren();
+    os.Write( &nChildren, sizeof( nChildren ) );
+    for (const XMLNode* pChild = m_pChild; pChild; pChild = pChild->m_pNext)
+    {
+        pChild->Serialize( os );
+    }
+} // XMLNode::Serialize
+
+bool XMLNode::Unserialize( InStream& is )
+{
+    if (!ReadXMLString( is, m_Tag ) || !ReadXMLString( is, m_Value )) return false;
+
+    DWORD nAttr = 0;
+    if (is.Read( &nAttr, sizeof( nAttr ) ) != sizeof( nAttr )) return false;
+    XMLNode* pLast = NULL;
+    for (DWORD i = 0; i < nAttr; i++)
+    {
+        XMLNode* pAttr = new XMLNode();
+        pAttr->m_pParent = this;
+        if (pLast) pLast->m_pNext = pAttr; else m_pAttr = pAttr;
+        pLast = pAttr;
+        if (!ReadXMLString( is, pAttr->m_Tag ) || !ReadXMLString( is, pAttr->m_Value )) return false;
+    }
+
+    DWORD nChildren = 0;
+    if (is.Read( &nChildren, sizeof( nChildren ) ) != sizeof( nChildren )) return false;
+    pLast = NULL;
+    for (DWORD i = 0; i < nChildren; i++)
+    {
+        XMLNode* pChild = new XMLNode();
+        pChild->m_pParent = this;
+        if (pLast) pLast->m_pNext = pChild; else m_pChild = pChild;
+        pLast = pChild;
+        if (!pChild->Unserialize( is )) return false;
+    }
+    return true;
+} // XMLNode::Unserialize
 
 bool XMLNode::Read( InStream& is )
 {
@@ -305,28 +624,38 @@ void XMLTreeParser::OnOpen( const char* tag )
     XMLNode* pNode = NULL;
     if (m_NodeStack.size() > 0)
     {
-        XMLNode* pTop = m_NodeStack.top();
-        pNode =  pTop->AddChild( tag );
+        //  append to the tail of the parent children list directly
+        XMLNode* pTop   = m_NodeStack.back();
+        XMLNode*& pLast = m_LastChild.back();
+        pNode = new XMLNode();
+        pNode->m_pParent = pTop;
+        pNode->SetTag( tag );
+        if (pLast) pLast->m_pNext = pNode; else pTop->AddChild( pNode );
+        pLast = pNode;
     }
     else
     {
         m_pRoot->SetTag( tag );
         pNode = m_pRoot;
     }
-    m_NodeStack.push( pNode );
-    m_pCurNode = pNode;
+    m_NodeStack.push_back( pNode );
+    m_LastChild.push_back( NULL );
+    m_pCurNode  = pNode;
+    m_pLastAttr = NULL;
 } // XMLTreeParser::OnOpen
 
 void XMLTreeParser::OnClose( const char* tag )
 {
     if (!m_pCurNode || !m_pCurNode->HasTag( tag ))
     {
-        Log.Warning( "Unexpected closing tag </%s> in .xml root node %s", m_pRoot->GetTag() );
+        Log.Warning( "Unexpected closing tag </%s> in .xml root node %s", tag, m_pRoot->GetTag() );
         return;
     }
+    m_pLastAttr = NULL;
     if (m_NodeStack.size() == 0) { m_pCurNode = NULL; return; }
-    m_NodeStack.pop();
-    m_pCurNode = (m_NodeStack.size() > 0) ? m_NodeStack.top() : NULL;
+    m_NodeStack.pop_back();
+    m_LastChild.pop_back();
+    m_pCurNode = (m_NodeStack.size() > 0) ? m_NodeStack.back() : NULL;
 } // XMLTreeParser::OnClose
 
 void XMLTreeParser::OnValue( const char* value )
@@ -338,10 +667,178 @@ void XMLTreeParser::OnValue( const char* value )
 void XMLTreeParser::OnAttribute( const char* name, 
                                 const char* value )
 {
-    if (m_pCurNode) m_pCurNode->AddAttr( name, value );
-    else Log.Error( "Unexpected attribute %s in .xml root node %s", name, m_pRoot->GetTag() );
+    if (!m_pCurNode)
+    {
+        Log.Error( "Unexpected attribute %s in .xml root node %s", name, m_pRoot->GetTag() );
+        return;
+    }
+    if (!m_pLastAttr)
+    {
+        m_pLastAttr = m_pCurNode->AddAttr( name, value );
+        return;
+    }
+    XMLNode* pAttr = new XMLNode();
+    pAttr->SetTag( name );
+    pAttr->m_Value   = value;
+    pAttr->m_pParent = m_pCurNode;
+    m_pLastAttr->m_pNext = pAttr;
+    m_pLastAttr = pAttr;
 } // XMLTreeParser::OnAttribute
 
+/*****************************************************************************/
+/*    Parser benchmark
+/*****************************************************************************/
+//  compares tags, values, attributes and children of the trees, 
+//  reports the first difference, path is the tag path of the nodes
+static bool CompareXMLTrees( const XMLNode* pA, const XMLNode* pB, const char* fileName, std::string& path )
+{
+    int pathLen = path.size();
+    path += "/";
+    path += pA->GetTag();
+    bool bEqual = false;
+    if (strcmp( pA->GetTag(), pB->GetTag() ))
+    {
+        Log.Error( "XML parser mismatch in <%s> at %s: tag <%s> vs <%s>", 
+                    fileName, path.c_str(), pA->GetTag(), pB->GetTag() );
+    }
+    else if (strcmp( pA->GetValue(), pB->GetValue() ))
+    {
+        Log.Error( "XML parser mismatch in <%s> at %s: value <%s> vs <%s>", 
+                    fileName, path.c_str(), pA->GetValue(), pB->GetValue() );
+    }
+    else
+    {
+        bEqual = true;
+        const XMLNode* pAttrA = pA->FirstAttr();
+        const XMLNode* pAttrB = pB->FirstAttr();
+        while (bEqual && (pAttrA || pAttrB))
+        {
+            if (!pAttrA || !pAttrB || strcmp( pAttrA->GetTag(), pAttrB->GetTag() ) || 
+                strcmp( pAttrA->GetValue(), pAttrB->GetValue() ))
+            {
+                Log.Error( "XML parser mismatch in <%s> at %s: attribute %s=<%s> vs %s=<%s>", fileName, path.c_str(),
+                            pAttrA ? pAttrA->GetTag() : "(none)", pAttrA ? pAttrA->GetValue() : "",
+                            pAttrB ? pAttrB->GetTag() : "(none)", pAttrB ? pAttrB->GetValue() : "" );
+                bEqual = false;
+                break;
+            }
+            pAttrA = pAttrA->NextSibling();
+            pAttrB = pAttrB->NextSibling();
+        }
+
+        const XMLNode* pChildA = pA->FirstChild();
+        const XMLNode* pChildB = pB->FirstChild();
+        while (bEqual && (pChildA || pChildB))
+        {
+            if (!pChildA || !pChildB)
+            {
+                Log.Error( "XML parser mismatch in <%s> at %s: child <%s> vs <%s>", fileName, path.c_str(),
+                            pChildA ? pChildA->GetTag() : "(none)", pChildB ? pChildB->GetTag() : "(none)" );
+                bEqual = false;
+                break;
+            }
+            bEqual = CompareXMLTrees( pChildA, pChildB, fileName, path );
+            pChildA = pChildA->NextSibling();
+            pChildB = pChildB->NextSibling();
+        }
+    }
+    path.resize( pathLen );
+    return bEqual;
+} // CompareXMLTrees
+
+void BenchmarkXMLParser( const char* root )
+{
+    std::vector<std::string> names;
+    std::vector<char*> files;
+    std::vector<int>   sizes;
+    DirTreeIterator it( root );
+    it.AddFilter( "xml" );
+    while (it)
+    {
+        FILE* fp = fopen( it.GetFullFilePath(), "rb" );
+        if (fp)
+        {
+            fseek( fp, 0, SEEK_END );
+            int size = ftell( fp ); 
+            fseek( fp, 0, SEEK_SET );
+            char* buf = new char[size + 1];
+            fread( buf, size, 1, fp );
+            fclose( fp );
+            buf[size] = 0;
+            files.push_back( buf );
+            sizes.push_back( size );
+            names.push_back( it.GetFullFilePath() );
+        }
+        ++it;
+    }
+
+    int nFiles = files.size();
+    int nBytes = 0;
+    for (int i = 0; i < nFiles; i++) nBytes += sizes[i];
+
+    //  the in-place parser replaced the legacy one for every consumer, 
+    //  so both must build the same trees on the whole corpus
+    int nMismatches = 0;
+    for (int i = 0; i < nFiles; i++)
+    {
+        char* pLegacyBuf  = new char[sizes[i] + 1];
+        char* pInPlaceBuf = new char[sizes[i] + 1];
+        memcpy( pLegacyBuf,  files[i], sizes[i] + 1 );
+        memcpy( pInPlaceBuf, files[i], sizes[i] + 1 );
+        XMLNode legacyRoot, inPlaceRoot;
+        XMLTreeParser legacyParser( &legacyRoot );
+        XMLTreeParser inPlaceParser( &inPlaceRoot );
+        bool bLegacyRes  = legacyParser.ParseBufferLegacy( pLegacyBuf );
+        bool bInPlaceRes = inPlaceParser.ParseBuffer( pInPlaceBuf );
+        std::string path;
+        if (bLegacyRes != bInPlaceRes)
+        {
+            Log.Error( "XML parser mismatch in <%s>: legacy parser %s, in-place parser %s", names[i].c_str(),
+                        bLegacyRes ? "succeeded" : "failed", bInPlaceRes ? "succeeded" : "failed" );
+            nMismatches++;
+        }
+        else if (!CompareXMLTrees( &legacyRoot, &inPlaceRoot, names[i].c_str(), path )) 
+        {
+            nMismatches++;
+        }
+        delete []pLegacyBuf;
+        delete []pInPlaceBuf;
+    }
+    if (nMismatches > 0)
+    {
+        Log.Error( "XML parser check FAILED: %d of %d files parse differently with the in-place parser", 
+                    nMismatches, nFiles );
+        assert( false );
+    }
+    else
+    {
+        Log.Info( "XML parser check: %d files, trees are identical", nFiles );
+    }
+
+    //  both parsers get a fresh copy, since the in-place parser modifies the buffer
+    char* pCopy = NULL;
+    double legacyTime = 0.0, inPlaceTime = 0.0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        Timer timer;
+        timer.start();
+        for (int i = 0; i < nFiles; i++)
+        {
+            pCopy = new char[sizes[i] + 1];
+            memcpy( pCopy, files[i], sizes[i] + 1 );
+            XMLNode node;
+            XMLTreeParser parser( &node );
+            if (pass == 0) parser.ParseBufferLegacy( pCopy ); else parser.ParseBuffer( pCopy );
+            delete []pCopy;
+        }
+        if (pass == 0) legacyTime = timer.seconds(); else inPlaceTime = timer.seconds();
+    }
+
+    for (int i = 0; i < nFiles; i++) delete []files[i];
+    Log.Info( "XML parser benchmark: %d files, %d bytes. Legacy: %.2fms, in-place: %.2fms", 
+                nFiles, nBytes, legacyTime*1000.0, inPlaceTime*1000.0 );
+} // BenchmarkXMLParser
+
 /*****************************************************************************/
 /*    String pooling
 /*****************************************************************************/
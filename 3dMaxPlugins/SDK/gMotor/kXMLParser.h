@@ -22,7 +22,11 @@ public:
 
 
     bool            ParseFile        ( const char* fName            );
+    //  parses buffer in place: strings passed to the callbacks point into 
+    //  the buffer and are valid only until the callback returns
     bool            ParseBuffer        ( char* buffer                );
+    //  old grammar-driven parser, copies every token into the string pool
+    bool            ParseBufferLegacy( char* buffer                );
     int                yyInput            ( char* buf, int max_size    );
     void            Error            ( char* msg, int curLine    );
     
@@ -41,6 +45,9 @@ protected:
     bool            m_bInited;
 
 private:
+    int             GetLineAt        ( const char* pos ) const;
+    bool            ParseError       ( const char* msg, const char* pos );
+
     char*            m_Buffer;
     char*            m_BufPtr;
     char*            m_pErrToken;
@@ -65,7 +72,13 @@ class XMLNode
     static int                s_Indent;            //  indentation counter when writing 
     static bool                s_bCaseIndependent; //  whether tags are case independent
 
+    friend class XMLTreeParser;
+
 public:
+    //  nodes are allocated from the shared node pool
+    static void*            operator new    ( size_t size );
+    static void             operator delete ( void* pNode );
+
                             XMLNode            ();
                             XMLNode            ( InStream& is );
                             XMLNode            ( char* buf );
@@ -130,6 +143,11 @@ public:
 
     bool                    Read            ( InStream& is );
     void                    Write            ( OutStream& os );
+    //  compact binary form of the subtree, used by the compiled xml cache
+    void                    Serialize       ( OutStream& os ) const;
+    bool                    Unserialize     ( InStream& is );
+    //  removes children, attributes, tag and value
+    void                    Clear           ();
     void                    WriteAttr        ( OutStream& os );
     operator                bool            (){ return false; }
 
@@ -170,10 +188,12 @@ class XMLTreeParser : public XMLParser
 {
     XMLNode*                m_pRoot;
     XMLNode*                m_pCurNode;
-    std::stack<XMLNode*>    m_NodeStack;
+    XMLNode*                m_pLastAttr;        //  tail of the current node attribute list
+    std::vector<XMLNode*>   m_NodeStack;
+    std::vector<XMLNode*>   m_LastChild;        //  tails of the children lists, parallel to m_NodeStack
 
 public:
-                    XMLTreeParser    ( XMLNode* pRoot ) { m_pRoot = pRoot; m_pCurNode = pRoot; }
+                    XMLTreeParser    ( XMLNode* pRoot ) { m_pRoot = pRoot; m_pCurNode = pRoot; m_pLastAttr = NULL; }
     virtual void    OnOpen            ( const char* tag );
     virtual void    OnClose            ( const char* tag );
     virtual void    OnValue            ( const char* value );
@@ -181,6 +201,9 @@ public:
 
 }; // class XMLTreeParser 
 
+//  parses all .xml files in the directory tree with both parsers and logs timings
+void        BenchmarkXMLParser( const char* root );
+
 const char* GetPooledString( DWORD id );
 DWORD       CreatePooledString( const char* pStr, int len );
 void        ClearStringPool();
@@ -0,0 +1,1192 @@
+/*****************************************************************************/
+/*    File:    rsRenderSystemNull.cpp
+/*    Desc:    Headless render system implementation
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#include "stdafx.h"
+#include "rsVertex.h"
+#include "kColorValue.h"
+#include "rsRenderSystemNull.h"
+
+/*****************************************************************************/
+/*    NullRenderSystem implementation
+/*****************************************************************************/
+NullRenderSystem::NullRenderSystem( bool bSoftware )
+{
+    m_bSoftware         = bSoftware;
+    m_NRasterThreads    = 4;
+    m_hWnd              = NULL;
+    m_CurFrame          = 0;
+    m_ViewTM            = Matrix4D::identity;
+    m_ProjTM            = Matrix4D::identity;
+    m_WorldTM           = Matrix4D::identity;
+    m_WVPTM             = Matrix4D::identity;
+    for (int i = 0; i < c_MaxTextureStages; i++)
+    {
+        m_TextureTM[i]       = Matrix4D::identity;
+        m_BumpTM[i]          = Matrix3D::identity;
+        m_CurTexture[i]      = -1;
+        m_TextureOverride[i] = -1;
+    }
+    m_ViewPort          = Rct( 0.0f, 0.0f, m_ScreenProp.m_Width, m_ScreenProp.m_Height );
+    m_ZNear             = 0.0f;
+    m_ZFar              = 1.0f;
+
+    m_CurVB             = -1;
+    m_CurVType          = -1;
+    m_CurIB             = -1;
+    m_CurShader         = -1;
+    m_CurFont           = -1;
+    m_QuadIB            = -1;
+    m_CurStateBlock     = 0;
+    m_NStateBlocks      = 0;
+
+    m_TFactor           = 0;
+    m_ColorConst        = 0;
+    m_AlphaRef          = 0;
+    m_bZEnable          = true;
+    m_bZWrite           = true;
+    m_bBump             = false;
+    m_ShadersQuality    = 0;
+    m_ShaderConst[0]    = m_ShaderConst[1] = m_ShaderConst[2] = m_ShaderConst[3] = 0.0f;
+    m_FogDensity        = 0.0f;
+    m_bTimeOverride     = false;
+    m_TimeOverride      = 0.0f;
+
+    m_NTasks            = 0;
+    m_bSorted           = false;
+
+    m_NPoolThreads      = 0;
+    m_PoolSize          = 0;
+    m_bStopRaster       = false;
+} // NullRenderSystem::NullRenderSystem
+
+NullRenderSystem::~NullRenderSystem()
+{
+    ShutDown();
+} // NullRenderSystem::~NullRenderSystem
+
+void NullRenderSystem::Init( HINSTANCE hInst, HWND hWnd )
+{
+    m_hWnd = hWnd;
+    if (m_VertexTypes.size() == 0)
+    {
+        for (int i = 0; i < (int)vfLAST; i++)
+        {
+            RegisterVType( CreateVertexDeclaration( (VertexFormat)i ) );
+        }
+    }
+    if (m_VBuffers.size() == 0)
+    {
+        CreateIB( "SharedDynamic",  c_NullDynIBufferBytes,      isWORD, true    );
+        CreateIB( "SharedStatic",   c_NullStaticIBufferBytes,   isWORD, false   );
+        CreateIB( "Quads",          c_NullQuadIBufferBytes,     isWORD, false   );
+        CreateVB( "SharedDynamic",  c_NullDynVBufferBytes,      -1,     true    );
+        CreateVB( "SharedStatic",   c_NullStaticVBufferBytes,   -1,     false   );
+        FillQuadIndexBuffer();
+    }
+    SetScreenProp( m_ScreenProp );
+    ResetStats();
+    Log.Info( "Null render system initialized (%s).", m_bSoftware ? "software rasterizer" : "no rasterizer" );
+} // NullRenderSystem::Init
+
+void NullRenderSystem::ShutDown()
+{
+    StopRasterThreads();
+    m_VBuffers.clear();
+    m_IBuffers.clear();
+    m_Textures.clear();
+    m_Shaders.clear();
+    m_Fonts.clear();
+    m_RTStack.clear();
+    m_Tris.clear();
+    m_NTasks = 0;
+    m_QuadIB = -1;
+} // NullRenderSystem::ShutDown
+
+void NullRenderSystem::ResetStats()
+{
+    m_FrameStats.Reset();
+    m_TotalStats.Reset();
+} // NullRenderSystem::ResetStats
+
+void NullRenderSystem::SetNRasterThreads( int nThreads )
+{
+    clamp( nThreads, 1, c_NullMaxRasterThreads );
+    if (nThreads == m_NRasterThreads) return;
+    StopRasterThreads();
+    m_NRasterThreads = nThreads;
+} // NullRenderSystem::SetNRasterThreads
+
+bool NullRenderSystem::SetScreenProp( const ScreenProp& prop )
+{
+    m_ScreenProp = prop;
+    m_ViewPort   = Rct( 0.0f, 0.0f, prop.m_Width, prop.m_Height );
+    if (m_bSoftware)
+    {
+        int nPix = prop.m_Width*prop.m_Height;
+        m_ColorBuf.resize( nPix );
+        m_DepthBuf.resize( nPix );
+    }
+    return true;
+} // NullRenderSystem::SetScreenProp
+
+void NullRenderSystem::GetDisplayMode( int idx, int& width, int& height )
+{
+    width  = m_ScreenProp.m_Width;
+    height = m_ScreenProp.m_Height;
+} // NullRenderSystem::GetDisplayMode
+
+void NullRenderSystem::GetClientSize( int& width, int& height )
+{
+    width  = m_ScreenProp.m_Width;
+    height = m_ScreenProp.m_Height;
+} // NullRenderSystem::GetClientSize
+
+bool NullRenderSystem::GetDeviceDisplayMode( int *pWidth, int *pHeight, int *pBpp, int *pRefreshRate )
+{
+    if (pWidth)         *pWidth         = m_ScreenProp.m_Width;
+    if (pHeight)        *pHeight        = m_ScreenProp.m_Height;
+    if (pBpp)           *pBpp           = 32;
+    if (pRefreshRate)   *pRefreshRate   = m_ScreenProp.m_RefreshRate;
+    return true;
+} // NullRenderSystem::GetDeviceDisplayMode
+
+bool NullRenderSystem::TimeOverrideIsEnabled( float *pSecTime )
+{
+    if (m_bTimeOverride && pSecTime) *pSecTime = m_TimeOverride;
+    return m_bTimeOverride;
+} // NullRenderSystem::TimeOverrideIsEnabled
+
+void NullRenderSystem::ClearDevice( DWORD color, bool bColor, bool bDepth, bool bStencil )
+{
+    if (!m_bSoftware || m_ColorBuf.size() == 0) return;
+    //  triangles binned before the clear must land in the framebuffer first
+    RasterizeFrame();
+    if (bColor) std::fill( m_ColorBuf.begin(), m_ColorBuf.end(), color );
+    if (bDepth) std::fill( m_DepthBuf.begin(), m_DepthBuf.end(), 1.0f );
+} // NullRenderSystem::ClearDevice
+
+bool NullRenderSystem::StartFrame()
+{
+    m_FrameStats.Reset();
+    m_Tris.clear();
+    return true;
+} // NullRenderSystem::StartFrame
+
+void NullRenderSystem::EndFrame()
+{
+    Flush();
+    if (m_bSoftware) RasterizeFrame();
+
+    m_TotalStats.m_NDrawCalls       += m_FrameStats.m_NDrawCalls;
+    m_TotalStats.m_NPrimitives      += m_FrameStats.m_NPrimitives;
+    m_TotalStats.m_NShaderChanges   += m_FrameStats.m_NShaderChanges;
+    m_TotalStats.m_NTextureChanges  += m_FrameStats.m_NTextureChanges;
+    m_TotalStats.m_NBufferChanges   += m_FrameStats.m_NBufferChanges;
+    m_TotalStats.m_NStateChanges    += m_FrameStats.m_NStateChanges;
+    m_TotalStats.m_NLocks           += m_FrameStats.m_NLocks;
+    m_TotalStats.m_NLockedBytes     += m_FrameStats.m_NLockedBytes;
+    m_TotalStats.m_NTasks           += m_FrameStats.m_NTasks;
+    m_TotalStats.m_NRasterTris      += m_FrameStats.m_NRasterTris;
+    m_CurFrame++;
+} // NullRenderSystem::EndFrame
+
+void NullRenderSystem::Dump( const char* fname )
+{
+    const NullRenderStats& s = m_FrameStats;
+    Log.Info( "Null render system, frame %d: %d draws, %d primitives, %d tasks, %d locks (%d bytes)",
+                m_CurFrame, s.m_NDrawCalls, s.m_NPrimitives, s.m_NTasks, s.m_NLocks, s.m_NLockedBytes );
+    Log.Info( "    changes: %d shader, %d texture, %d buffer, %d state; %d rasterized triangles",
+                s.m_NShaderChanges, s.m_NTextureChanges, s.m_NBufferChanges, s.m_NStateChanges, s.m_NRasterTris );
+} // NullRenderSystem::Dump
+
+//  transforms
+void NullRenderSystem::UpdateWVP()
+{
+    Matrix4D wv;
+    wv.mul( m_WorldTM, m_ViewTM );
+    m_WVPTM.mul( wv, m_ProjTM );
+} // NullRenderSystem::UpdateWVP
+
+void NullRenderSystem::SetViewTM( const Matrix4D& vmatr )
+{
+    m_ViewTM = vmatr;
+    UpdateWVP();
+    CountStateChange();
+} // NullRenderSystem::SetViewTM
+
+void NullRenderSystem::SetProjTM( const Matrix4D& pmatr )
+{
+    m_ProjTM = pmatr;
+    UpdateWVP();
+    CountStateChange();
+} // NullRenderSystem::SetProjTM
+
+void NullRenderSystem::SetWorldTM( const Matrix4D& wmatr )
+{
+    m_WorldTM = wmatr;
+    UpdateWVP();
+    CountStateChange();
+} // NullRenderSystem::SetWorldTM
+
+void NullRenderSystem::SetWorldViewProjTM( const Matrix4D& wmatr )
+{
+    m_WVPTM = wmatr;
+    CountStateChange();
+} // NullRenderSystem::SetWorldViewProjTM
+
+void NullRenderSystem::ResetWorldTM()
+{
+    SetWorldTM( Matrix4D::identity );
+} // NullRenderSystem::ResetWorldTM
+
+void NullRenderSystem::SetTextureTM( const Matrix4D& tmatr, int stage )
+{
+    m_TextureTM[stage] = tmatr;
+    CountStateChange();
+} // NullRenderSystem::SetTextureTM
+
+void NullRenderSystem::SetBumpTM( const Matrix3D& bmatr, int stage )
+{
+    m_BumpTM[stage] = bmatr;
+    CountStateChange();
+} // NullRenderSystem::SetBumpTM
+
+void NullRenderSystem::SetViewPort( const Rct& vp, float zn, float zf, bool bClip )
+{
+    m_ViewPort  = vp;
+    m_ZNear     = zn;
+    m_ZFar      = zf;
+    CountStateChange();
+} // NullRenderSystem::SetViewPort
+
+bool NullRenderSystem::PushRenderTarget( int texID, int dsID )
+{
+    m_RTStack.push_back( texID );
+    CountStateChange();
+    return true;
+} // NullRenderSystem::PushRenderTarget
+
+bool NullRenderSystem::PopRenderTarget()
+{
+    if (m_RTStack.size() == 0) return false;
+    m_RTStack.pop_back();
+    CountStateChange();
+    return true;
+} // NullRenderSystem::PopRenderTarget
+
+//  render states, filtered the same way as in Direct3D backend
+void NullRenderSystem::SetTextureFactor( DWORD tfactor )
+{
+    if (m_TFactor == tfactor) return;
+    m_TFactor = tfactor;
+    CountStateChange();
+} // NullRenderSystem::SetTextureFactor
+
+void NullRenderSystem::SetAlphaRef( BYTE alphaRef )
+{
+    if (m_AlphaRef == alphaRef) return;
+    m_AlphaRef = alphaRef;
+    CountStateChange();
+} // NullRenderSystem::SetAlphaRef
+
+void NullRenderSystem::SetZEnable( bool bEnable )
+{
+    m_bZEnable = bEnable;
+    CountStateChange();
+} // NullRenderSystem::SetZEnable
+
+void NullRenderSystem::SetZWriteEnable( bool bEnable )
+{
+    m_bZWrite = bEnable;
+    CountStateChange();
+} // NullRenderSystem::SetZWriteEnable
+
+bool NullRenderSystem::ApplyStateBlock( DWORD id )
+{
+    if (id == m_CurStateBlock) return true;
+    m_CurStateBlock = id;
+    CountStateChange();
+    return true;
+} // NullRenderSystem::ApplyStateBlock
+
+//  buffers
+void NullRenderSystem::CountLock( int nBytes )
+{
+    m_FrameStats.m_NLocks++;
+    m_FrameStats.m_NLockedBytes += nBytes;
+} // NullRenderSystem::CountLock
+
+int NullRenderSystem::FindBuffer( const std::vector<NullBuffer>& bufs, const char* name ) const
+{
+    for (int i = 0; i < bufs.size(); i++)
+    {
+        if (!stricmp( name, bufs[i].m_Name.c_str() )) return i;
+    }
+    return -1;
+} // NullRenderSystem::FindBuffer
+
+BYTE* NullRenderSystem::LockBuffer( NullBuffer& buf, int first, int num, DWORD& stamp, bool bDiscard )
+{
+    if (num == 0 || first + num > buf.GetNElem()) return NULL;
+    if (bDiscard)
+    {
+        buf.m_FirstValidStamp = buf.m_CurStamp;
+        buf.m_NFilled = 0;
+    }
+    stamp = buf.m_CurStamp++;
+    buf.m_NFilled = tmax( buf.m_NFilled, first + num );
+    CountLock( num*buf.m_Stride );
+    return &buf.m_Data[first*buf.m_Stride];
+} // NullRenderSystem::LockBuffer
+
+BYTE* NullRenderSystem::LockAppendBuffer( std::vector<NullBuffer>& bufs, int id, int num, int& offset, DWORD& stamp )
+{
+    if (id < 0 || id >= bufs.size()) return NULL;
+    NullBuffer& buf = bufs[id];
+    int nElem = buf.GetNElem();
+    if (num == 0 || num > nElem) return NULL;
+    bool bDiscard = false;
+    if (buf.m_NFilled + num > nElem)
+    {
+        //  same as in Direct3D backend: pending tasks reference the old contents
+        Flush();
+        bDiscard = true;
+    }
+    offset = bDiscard ? 0 : buf.m_NFilled;
+    return LockBuffer( buf, offset, num, stamp, bDiscard );
+} // NullRenderSystem::LockAppendBuffer
+
+int NullRenderSystem::RegisterVType( const VertexDeclaration& vdecl )
+{
+    for (int i = 0; i < m_VertexTypes.size(); i++)
+    {
+        if (m_VertexTypes[i] == vdecl) return i;
+    }
+    m_VertexTypes.push_back( vdecl );
+    m_VertexTypes.back().m_TypeID = m_VertexTypes.size() - 1;
+    return m_VertexTypes.size() - 1;
+} // NullRenderSystem::RegisterVType
+
+BYTE* NullRenderSystem::LockVB( int vbID, int firstV, int numV, DWORD& stamp )
+{
+    if (vbID < 0 || vbID >= m_VBuffers.size()) return NULL;
+    return LockBuffer( m_VBuffers[vbID], firstV, numV, stamp, false );
+} // NullRenderSystem::LockVB
+
+BYTE* NullRenderSystem::LockAppendVB( int vbID, int size, int& offset, DWORD& stamp )
+{
+    return LockAppendBuffer( m_VBuffers, vbID, size, offset, stamp );
+} // NullRenderSystem::LockAppendVB
+
+bool NullRenderSystem::IsVBStampValid( int vbID, DWORD stamp )
+{
+    if (vbID < 0 || vbID >= m_VBuffers.size()) return true;
+    return stamp >= m_VBuffers[vbID].m_FirstValidStamp;
+} // NullRenderSystem::IsVBStampValid
+
+int NullRenderSystem::GetVBufferID( const char* vbName )
+{
+    return FindBuffer( m_VBuffers, vbName );
+} // NullRenderSystem::GetVBufferID
+
+bool NullRenderSystem::DiscardVB( int vbID )
+{
+    if (vbID < 0 || vbID >= m_VBuffers.size()) return false;
+    if (m_VBuffers[vbID].m_bDynamic) m_VBuffers[vbID].Purge();
+    return true;
+} // NullRenderSystem::DiscardVB
+
+int NullRenderSystem::CreateVB( const char* name, int size, int vType, bool bDynamic )
+{
+    int vbID = GetVBufferID( name );
+    if (vbID != -1) return vbID;
+    for (int i = 0; i < m_VBuffers.size(); i++)
+    {
+        NullBuffer& vb = m_VBuffers[i];
+        if (vb.m_bFree && vb.m_VType == vType && vb.m_bDynamic == bDynamic && vb.m_Data.size() >= size)
+        {
+            vb.m_bFree = false;
+            return i;
+        }
+    }
+
+    NullBuffer vb;
+    vb.m_Name               = name;
+    vb.m_VType              = vType;
+    vb.m_Stride             = (vType >= 0 && vType < m_VertexTypes.size()) ? m_VertexTypes[vType].m_VertexSize : 1;
+    vb.m_NFilled            = 0;
+    vb.m_CurStamp           = c_NullStampBase;
+    vb.m_FirstValidStamp    = c_NullStampBase;
+    vb.m_bDynamic           = bDynamic;
+    vb.m_bFree              = false;
+    m_VBuffers.push_back( vb );
+    m_VBuffers.back().m_Data.resize( size );
+    return m_VBuffers.size() - 1;
+} // NullRenderSystem::CreateVB
+
+bool NullRenderSystem::DeleteVB( int vbID )
+{
+    if (vbID < 0 || vbID >= m_VBuffers.size()) return false;
+    m_VBuffers[vbID].m_bFree = true;
+    return true;
+} // NullRenderSystem::DeleteVB
+
+bool NullRenderSystem::SetVB( int vbID, int vType, int stream, int frequency )
+{
+    if (vbID < 0 || vbID >= m_VBuffers.size()) return false;
+    NullBuffer& vb = m_VBuffers[vbID];
+    if (vType < 0) vType = vb.m_VType;
+    if (vType < 0 || vType >= m_VertexTypes.size()) return false;
+    int vSize = m_VertexTypes[vType].m_VertexSize;
+    if (vSize == 0) return false;
+    if (vb.m_Stride != vSize)
+    {
+        //  keep append position on the vertex boundary, as Direct3D backend does
+        int nBytes = vb.m_Stride*vb.m_NFilled;
+        vb.m_NFilled = (nBytes + vSize - 1)/vSize;
+        vb.m_Stride  = vSize;
+    }
+    vb.m_VType = vType;
+    if (vbID != m_CurVB || vType != m_CurVType) m_FrameStats.m_NBufferChanges++;
+    m_CurVB    = vbID;
+    m_CurVType = vType;
+    return true;
+} // NullRenderSystem::SetVB
+
+BYTE* NullRenderSystem::LockIB( int ibID, int firstIdx, int numIdx, DWORD& stamp )
+{
+    if (ibID < 0 || ibID >= m_IBuffers.size()) return NULL;
+    return LockBuffer( m_IBuffers[ibID], firstIdx, numIdx, stamp, false );
+} // NullRenderSystem::LockIB
+
+BYTE* NullRenderSystem::LockAppendIB( int ibID, int size, int& offset, DWORD& stamp )
+{
+    return LockAppendBuffer( m_IBuffers, ibID, size, offset, stamp );
+} // NullRenderSystem::LockAppendIB
+
+bool NullRenderSystem::IsIBStampValid( int ibID, DWORD stamp )
+{
+    if (ibID < 0 || ibID >= m_IBuffers.size()) return true;
+    return stamp >= m_IBuffers[ibID].m_FirstValidStamp;
+} // NullRenderSystem::IsIBStampValid
+
+int NullRenderSystem::GetIBufferID( const char* ibName )
+{
+    return FindBuffer( m_IBuffers, ibName );
+} // NullRenderSystem::GetIBufferID
+
+bool NullRenderSystem::DiscardIB( int ibID )
+{
+    if (ibID < 0 || ibID >= m_IBuffers.size()) return false;
+    if (m_IBuffers[ibID].m_bDynamic) m_IBuffers[ibID].Purge();
+    return true;
+} // NullRenderSystem::DiscardIB
+
+int NullRenderSystem::CreateIB( const char* name, int size, IndexSize idxSize, bool bDynamic )
+{
+    int ibID = GetIBufferID( name );
+    if (ibID != -1) return ibID;
+    NullBuffer ib;
+    ib.m_Name               = name;
+    ib.m_VType              = -1;
+    ib.m_Stride             = (idxSize == isDWORD) ? 4 : 2;
+    ib.m_NFilled            = 0;
+    ib.m_CurStamp           = c_NullStampBase;
+    ib.m_FirstValidStamp    = c_NullStampBase;
+    ib.m_bDynamic           = bDynamic;
+    ib.m_bFree              = false;
+    m_IBuffers.push_back( ib );
+    m_IBuffers.back().m_Data.resize( size );
+    return m_IBuffers.size() - 1;
+} // NullRenderSystem::CreateIB
+
+bool NullRenderSystem::DeleteIB( int ibID )
+{
+    return false;
+} // NullRenderSystem::DeleteIB
+
+bool NullRenderSystem::SetIB( int ibID )
+{
+    if (ibID < 0 || ibID >= m_IBuffers.size()) return false;
+    if (ibID != m_CurIB) m_FrameStats.m_NBufferChanges++;
+    m_CurIB = ibID;
+    return true;
+} // NullRenderSystem::SetIB
+
+void NullRenderSystem::FillQuadIndexBuffer()
+{
+    m_QuadIB = GetIBufferID( "Quads" );
+    if (m_QuadIB == -1) return;
+    NullBuffer& ib = m_IBuffers[m_QuadIB];
+    int nQuads = ib.GetNElem()/6;
+    WORD* pIdx = (WORD*)&ib.m_Data[0];
+    for (int i = 0; i < nQuads; i++)
+    {
+        int cV = i*4;
+        pIdx[i*6 + 0] = cV + 0;
+        pIdx[i*6 + 1] = cV + 1;
+        pIdx[i*6 + 2] = cV + 2;
+        pIdx[i*6 + 3] = cV + 2;
+        pIdx[i*6 + 4] = cV + 1;
+        pIdx[i*6 + 5] = cV + 3;
+    }
+    ib.m_NFilled = nQuads*6;
+} // NullRenderSystem::FillQuadIndexBuffer
+
+void NullRenderSystem::PurgeStaticBuffers()
+{
+    for (int i = 0; i < m_VBuffers.size(); i++)
+    {
+        if (!m_VBuffers[i].m_bDynamic) m_VBuffers[i].Purge();
+    }
+    for (int i = 0; i < m_IBuffers.size(); i++)
+    {
+        if (!m_IBuffers[i].m_bDynamic && i != m_QuadIB) m_IBuffers[i].Purge();
+    }
+} // NullRenderSystem::PurgeStaticBuffers
+
+//  textures
+int NullRenderSystem::GetTextureID( const char* texName )
+{
+    if (!texName || texName[0] == 0) return -1;
+    for (int i = 0; i < m_Textures.size(); i++)
+    {
+        if (!stricmp( texName, m_Textures[i].m_Name.c_str() )) return i;
+    }
+    //  there are no files to load, so every requested texture is a placeholder
+    return CreateTexture( texName, 256, 256, cfARGB8888, 1 );
+} // NullRenderSystem::GetTextureID
+
+int NullRenderSystem::CreateTexture( const char* texName, int width, int height, ColorFormat clrFormat,
+                                        int nMips, TextureMemoryPool memPool, bool bRenderTarget,
+                                        DepthStencilFormat dsFormat, bool bDynamic )
+{
+    NullTexture tex;
+    tex.m_Name      = texName ? texName : "";
+    tex.m_Width     = width;
+    tex.m_Height    = height;
+    tex.m_NMips     = tmax( nMips, 1 );
+    tex.m_Format    = clrFormat;
+    tex.m_Pool      = memPool;
+    tex.m_bRT       = bRenderTarget;
+    m_Textures.push_back( tex );
+    return m_Textures.size() - 1;
+} // NullRenderSystem::CreateTexture
+
+int NullRenderSystem::CreateNormalMap( int texID, float amplitude )
+{
+    if (texID < 0 || texID >= m_Textures.size()) return -1;
+    const NullTexture& tex = m_Textures[texID];
+    char name[_MAX_PATH];
+    sprintf( name, "%s_nm", tex.m_Name.c_str() );
+    return CreateTexture( name, tex.m_Width, tex.m_Height, cfARGB8888, 1 );
+} // NullRenderSystem::CreateNormalMap
+
+bool NullRenderSystem::DeleteTexture( int texID )
+{
+    if (texID < 0 || texID >= m_Textures.size()) return false;
+    std::vector<BYTE> empty;
+    m_Textures[texID].m_Bits.swap( empty );
+    return true;
+} // NullRenderSystem::DeleteTexture
+
+BYTE* NullRenderSystem::LockTexBits( int texID, int& pitch, int level )
+{
+    if (texID < 0 || texID >= m_Textures.size()) return NULL;
+    NullTexture& tex = m_Textures[texID];
+    int bpp = tmax( ColorValue::GetBytesPerPixel( tex.m_Format ), 1 );
+    int w = tmax( tex.m_Width >> level, 1 );
+    int h = tmax( tex.m_Height >> level, 1 );
+    pitch = w*bpp;
+    //  all levels share the storage of the top one
+    if (tex.m_Bits.size() == 0) tex.m_Bits.resize( tex.m_Width*tex.m_Height*bpp );
+    CountLock( pitch*h );
+    return &tex.m_Bits[0];
+} // NullRenderSystem::LockTexBits
+
+BYTE* NullRenderSystem::LockTexBits( int texID, const Rct& rect, int& pitch, int level )
+{
+    BYTE* pBits = LockTexBits( texID, pitch, level );
+    if (!pBits) return NULL;
+    int bpp = tmax( ColorValue::GetBytesPerPixel( m_Textures[texID].m_Format ), 1 );
+    return pBits + int( rect.y )*pitch + int( rect.x )*bpp;
+} // NullRenderSystem::LockTexBits
+
+void NullRenderSystem::SetTexture( int texID, int stage, bool bCache )
+{
+    if (m_CurTexture[stage] == texID) return;
+    m_CurTexture[stage] = texID;
+    m_FrameStats.m_NTextureChanges++;
+} // NullRenderSystem::SetTexture
+
+const char* NullRenderSystem::GetTexturePath( int texID ) const
+{
+    if (texID < 0 || texID >= m_Textures.size()) return "";
+    return m_Textures[texID].m_Name.c_str();
+} // NullRenderSystem::GetTexturePath
+
+const char* NullRenderSystem::GetTextureName( int texID )
+{
+    return GetTexturePath( texID );
+} // NullRenderSystem::GetTextureName
+
+ColorFormat NullRenderSystem::GetTextureFormat( int texID )
+{
+    if (texID < 0 || texID >= m_Textures.size()) return cfUnknown;
+    return m_Textures[texID].m_Format;
+} // NullRenderSystem::GetTextureFormat
+
+int NullRenderSystem::GetTextureSize( int texID ) const
+{
+    if (texID < 0 || texID >= m_Textures.size()) return 0;
+    const NullTexture& tex = m_Textures[texID];
+    return ColorValue::GetBitmapSize( tex.m_Format, tex.m_Width*tex.m_Height );
+} // NullRenderSystem::GetTextureSize
+
+TextureMemoryPool NullRenderSystem::GetTexturePool( int texID ) const
+{
+    if (texID < 0 || texID >= m_Textures.size()) return tmpUnknown;
+    return m_Textures[texID].m_Pool;
+} // NullRenderSystem::GetTexturePool
+
+int NullRenderSystem::GetTextureWidth( int texID ) const
+{
+    if (texID < 0 || texID >= m_Textures.size()) return 0;
+    return m_Textures[texID].m_Width;
+} // NullRenderSystem::GetTextureWidth
+
+int NullRenderSystem::GetTextureHeight( int texID ) const
+{
+    if (texID < 0 || texID >= m_Textures.size()) return 0;
+    return m_Textures[texID].m_Height;
+} // NullRenderSystem::GetTextureHeight
+
+int NullRenderSystem::GetTextureNMips( int texID ) const
+{
+    if (texID < 0 || texID >= m_Textures.size()) return 0;
+    return m_Textures[texID].m_NMips;
+} // NullRenderSystem::GetTextureNMips
+
+int NullRenderSystem::GetTexMemorySize() const
+{
+    int nBytes = 0;
+    for (int i = 0; i < m_Textures.size(); i++) nBytes += GetTextureSize( i );
+    return nBytes;
+} // NullRenderSystem::GetTexMemorySize
+
+//  shaders
+int NullRenderSystem::GetShaderID( const char* shaderName )
+{
+    if (!shaderName) return -1;
+    for (int i = 0; i < m_Shaders.size(); i++)
+    {
+        if (!stricmp( shaderName, m_Shaders[i].c_str() )) return i;
+    }
+    m_Shaders.push_back( shaderName );
+    return m_Shaders.size() - 1;
+} // NullRenderSystem::GetShaderID
+
+const char* NullRenderSystem::GetShaderName( int shID ) const
+{
+    if (shID < 0 || shID >= m_Shaders.size()) return "";
+    return m_Shaders[shID].c_str();
+} // NullRenderSystem::GetShaderName
+
+void NullRenderSystem::SetShader( int shaderID, int passID )
+{
+    if (m_CurShader == shaderID) return;
+    m_CurShader = shaderID;
+    m_FrameStats.m_NShaderChanges++;
+} // NullRenderSystem::SetShader
+
+//  fonts: fixed metrics, nothing is drawn
+const int c_NullFontCharW = 8;
+const int c_NullFontCharH = 16;
+
+int NullRenderSystem::GetFontID( const char* name )
+{
+    for (int i = 0; i < m_Fonts.size(); i++)
+    {
+        if (!stricmp( name, m_Fonts[i].c_str() )) return i;
+    }
+    return -1;
+} // NullRenderSystem::GetFontID
+
+int NullRenderSystem::CreateFont( const char* name, int height, DWORD charset, bool bBold, bool bItalic )
+{
+    int fontID = GetFontID( name );
+    if (fontID != -1) return fontID;
+    m_Fonts.push_back( name );
+    return m_Fonts.size() - 1;
+} // NullRenderSystem::CreateFont
+
+int NullRenderSystem::CreateFont( const char* texName, int charW, int charH )
+{
+    return CreateFont( texName, charH );
+} // NullRenderSystem::CreateFont
+
+int NullRenderSystem::GetStringWidth( int fontID, const char* str, int spacing )
+{
+    if (!str) return 0;
+    return strlen( str )*(c_NullFontCharW + spacing);
+} // NullRenderSystem::GetStringWidth
+
+int NullRenderSystem::GetCharWidth( int fontID, BYTE ch )
+{
+    return c_NullFontCharW;
+} // NullRenderSystem::GetCharWidth
+
+int NullRenderSystem::GetCharHeight( int fontID, BYTE ch )
+{
+    return c_NullFontCharH;
+} // NullRenderSystem::GetCharHeight
+
+bool NullRenderSystem::DrawString( const char* str, const Vector3D& pos, DWORD color, int spacing )
+{
+    return true;
+} // NullRenderSystem::DrawString
+
+bool NullRenderSystem::DrawString3D( const char* str, const Vector3D& pos, DWORD color, int spacing )
+{
+    return true;
+} // NullRenderSystem::DrawString3D
+
+//  tasks
+RenderTask& NullRenderSystem::AddTask()
+{
+    if (m_NTasks == c_NullMaxRenderTasks) Flush();
+    RenderTask& task = m_Tasks[m_NTasks];
+    task = RenderTask();
+    m_NTasks++;
+    task.m_TFactor = m_TFactor;
+    m_bSorted = false;
+    return task;
+} // NullRenderSystem::AddTask
+
+static int CmpNullTasks( const void* a, const void* b )
+{
+    const RenderTask& ta = **((const RenderTask**)a);
+    const RenderTask& tb = **((const RenderTask**)b);
+    if (ta.m_ShaderID != tb.m_ShaderID) return ta.m_ShaderID - tb.m_ShaderID;
+    return ta.m_TexID[0] - tb.m_TexID[0];
+} // CmpNullTasks
+
+void NullRenderSystem::SortTasks()
+{
+    if (m_bSorted) return;
+    m_SortedTasks.resize( m_NTasks );
+    for (int i = 0; i < m_NTasks; i++) m_SortedTasks[i] = &m_Tasks[i];
+    if (m_NTasks > 1) qsort( &m_SortedTasks[0], m_NTasks, sizeof( RenderTask* ), CmpNullTasks );
+    m_bSorted = true;
+} // NullRenderSystem::SortTasks
+
+void NullRenderSystem::Flush()
+{
+    SortTasks();
+    int nT = m_SortedTasks.size();
+    for (int i = 0; i < nT; i++)
+    {
+        const RenderTask& rt = *m_SortedTasks[i];
+        const RenderTask& pt = (i == 0) ? RenderTask::c_Invalid : *m_SortedTasks[i - 1];
+
+        if (rt.m_ShaderID != pt.m_ShaderID) SetShader( rt.m_ShaderID, rt.m_Pass );
+        if (rt.m_bHasTM) SetWorldTM( rt.m_TM );
+        if (rt.m_VBufID != pt.m_VBufID || rt.m_VType != pt.m_VType) SetVB( rt.m_VBufID, rt.m_VType );
+        if (rt.m_IBufID != pt.m_IBufID) SetIB( rt.m_IBufID );
+        for (int j = 0; j < c_MaxTextureStages; j++)
+        {
+            if (rt.m_TexID[j] >= 0) SetTexture( rt.m_TexID[j], j );
+        }
+        SetTextureFactor( rt.m_TFactor );
+        Draw( rt.m_FirstVert, rt.m_NVert, rt.m_FirstIdx, rt.m_NIdx, rt.m_PriType );
+    }
+    m_FrameStats.m_NTasks += nT;
+    m_SortedTasks.clear();
+    m_NTasks  = 0;
+    m_bSorted = false;
+} // NullRenderSystem::Flush
+
+void NullRenderSystem::Draw( int firstVert, int nVert, int firstIdx, int nIdx, PrimitiveType priType )
+{
+    if (nVert == 0) return;
+    int numPri = 0;
+    if (nIdx == 0)
+    {
+        numPri = GetNumPrimitives( priType, nVert );
+        if (priType == ptQuadList)
+        {
+            numPri = nVert/2;
+            SetIB( m_QuadIB );
+        }
+    }
+    else
+    {
+        numPri = GetNumPrimitives( priType, nIdx );
+    }
+    for (int i = 0; i < c_MaxTextureStages; i++)
+    {
+        if (m_TextureOverride[i] > 0) SetTexture( m_TextureOverride[i], i );
+    }
+    m_FrameStats.m_NDrawCalls++;
+    m_FrameStats.m_NPrimitives += numPri;
+    INC_COUNTER( NullDrawCalls, 1 );
+
+    if (m_bSoftware) BinTriangles( firstVert, nVert, firstIdx, nIdx, priType );
+} // NullRenderSystem::Draw
+
+/*****************************************************************************/
+/*    Software rasterizer
+/*****************************************************************************/
+bool NullRenderSystem::TransformVertex( const BYTE* pV, const VertexDeclaration& vd, RasterVertex& rv ) const
+{
+    rv.color = 0xFFFFFFFF;
+    bool bHasPos = false;
+    for (int i = 0; i < vd.m_NElements; i++)
+    {
+        const VertElement& el = vd.m_Element[i];
+        const float* pF = (const float*)(pV + el.m_Offset);
+        if (el.m_Usage == vcPositionRHW)
+        {
+            rv.x = pF[0];
+            rv.y = pF[1];
+            rv.z = pF[2];
+            bHasPos = true;
+        }
+        else if (el.m_Usage == vcPosition)
+        {
+            Vector4D p;
+            p.mul( Vector4D( pF[0], pF[1], pF[2], 1.0f ), m_WVPTM );
+            //  triangles crossing the near plane are dropped, not clipped
+            if (p.w <= c_SpaceEpsilon) return false;
+            float rw = 1.0f/p.w;
+            rv.x = m_ViewPort.x + (p.x*rw + 1.0f)*0.5f*m_ViewPort.w;
+            rv.y = m_ViewPort.y + (1.0f - p.y*rw)*0.5f*m_ViewPort.h;
+            rv.z = m_ZNear + p.z*rw*(m_ZFar - m_ZNear);
+            bHasPos = true;
+        }
+        else if (el.m_Usage == vcDiffuse)
+        {
+            rv.color = *((const DWORD*)(pV + el.m_Offset));
+        }
+    }
+    return bHasPos;
+} // NullRenderSystem::TransformVertex
+
+void NullRenderSystem::BinTriangles( int firstVert, int nVert, int firstIdx, int nIdx, PrimitiveType priType )
+{
+    if (priType != ptTriangleList && priType != ptTriangleStrip &&
+        priType != ptTriangleFan  && priType != ptQuadList) return;
+    if (m_CurVB < 0 || m_CurVType < 0) return;
+    const NullBuffer& vb = m_VBuffers[m_CurVB];
+    const VertexDeclaration& vd = m_VertexTypes[m_CurVType];
+    int stride = vd.m_VertexSize;
+    int nVBVert = vb.m_Data.size()/stride;
+
+    const BYTE* pIdx = NULL;
+    int idxStride = 2;
+    int nInd = nVert;
+    if (nIdx > 0 || priType == ptQuadList)
+    {
+        if (m_CurIB < 0) return;
+        const NullBuffer& ib = m_IBuffers[m_CurIB];
+        if (nIdx == 0)
+        {
+            firstIdx = 0;
+            nIdx = nVert/4*6;
+        }
+        if (priType == ptQuadList) priType = ptTriangleList;
+        if ((firstIdx + nIdx)*ib.m_Stride > ib.m_Data.size()) return;
+        pIdx = &ib.m_Data[firstIdx*ib.m_Stride];
+        idxStride = ib.m_Stride;
+        nInd = nIdx;
+    }
+
+    int nTri = (priType == ptTriangleList) ? nInd/3 : nInd - 2;
+    for (int i = 0; i < nTri; i++)
+    {
+        int c[3];
+        if (priType == ptTriangleList)      { c[0] = i*3; c[1] = i*3 + 1; c[2] = i*3 + 2; }
+        else if (priType == ptTriangleStrip){ c[0] = i; c[1] = i + 1; c[2] = i + 2; }
+        else                                { c[0] = 0; c[1] = i + 1; c[2] = i + 2; }
+
+        RasterTri tri;
+        bool bValid = true;
+        for (int j = 0; j < 3 && bValid; j++)
+        {
+            int vIdx = c[j];
+            if (pIdx) vIdx = (idxStride == 2) ? ((const WORD*)pIdx)[c[j]] : ((const DWORD*)pIdx)[c[j]];
+            vIdx += firstVert;
+            bValid = (vIdx < nVBVert) && TransformVertex( &vb.m_Data[vIdx*stride], vd, tri.v[j] );
+        }
+        if (!bValid) continue;
+        tri.minY = tmin( tri.v[0].y, tri.v[1].y, tri.v[2].y );
+        tri.maxY = tmax( tri.v[0].y, tri.v[1].y, tri.v[2].y );
+        tri.bZTest  = m_bZEnable;
+        tri.bZWrite = m_bZWrite;
+        m_Tris.push_back( tri );
+    }
+} // NullRenderSystem::BinTriangles
+
+DWORD WINAPI NullRenderSystem::RasterThreadProc( void* pParam )
+{
+    RasterBand* pBand = (RasterBand*)pParam;
+    NullRenderSystem* pRS = pBand->m_pRS;
+    for (;;)
+    {
+        WaitForSingleObject( pBand->m_hStart, INFINITE );
+        if (pRS->m_bStopRaster) break;
+        pRS->RasterizeBand( pBand->m_Top, pBand->m_Bottom );
+        SetEvent( pBand->m_hDone );
+    }
+    return 0;
+} // NullRenderSystem::RasterThreadProc
+
+void NullRenderSystem::StartRasterThreads()
+{
+    StopRasterThreads();
+    m_bStopRaster = false;
+    //  the calling thread rasterizes the first band itself
+    for (int i = 0; i < m_NRasterThreads - 1; i++)
+    {
+        RasterBand& band = m_RasterBand[i];
+        band.m_pRS      = this;
+        band.m_Top      = 0;
+        band.m_Bottom   = 0;
+        band.m_hStart   = CreateEvent( NULL, FALSE, FALSE, NULL );
+        band.m_hDone    = CreateEvent( NULL, FALSE, FALSE, NULL );
+        HANDLE hThread  = NULL;
+        if (band.m_hStart && band.m_hDone)
+        {
+            hThread = CreateThread( NULL, 0, RasterThreadProc, &band, 0, NULL );
+        }
+        if (!hThread)
+        {
+            if (band.m_hStart) CloseHandle( band.m_hStart );
+            if (band.m_hDone) CloseHandle( band.m_hDone );
+            Log.Warning( "Null render system: could not start raster thread %d", i + 1 );
+            break;
+        }
+        m_hRasterThread[m_NPoolThreads++] = hThread;
+    }
+    m_PoolSize = m_NRasterThreads;
+} // NullRenderSystem::StartRasterThreads
+
+void NullRenderSystem::StopRasterThreads()
+{
+    if (m_NPoolThreads > 0)
+    {
+        m_bStopRaster = true;
+        for (int i = 0; i < m_NPoolThreads; i++) SetEvent( m_RasterBand[i].m_hStart );
+        WaitForMultipleObjects( m_NPoolThreads, m_hRasterThread, TRUE, INFINITE );
+        for (int i = 0; i < m_NPoolThreads; i++)
+        {
+            CloseHandle( m_hRasterThread[i] );
+            CloseHandle( m_RasterBand[i].m_hStart );
+            CloseHandle( m_RasterBand[i].m_hDone );
+        }
+    }
+    m_NPoolThreads  = 0;
+    m_PoolSize      = 0;
+    m_bStopRaster   = false;
+} // NullRenderSystem::StopRasterThreads
+
+void NullRenderSystem::RasterizeFrame()
+{
+    int h = m_ScreenProp.m_Height;
+    if (m_Tris.size() == 0 || m_ColorBuf.size() == 0 || h <= 0) return;
+
+    if (m_PoolSize != m_NRasterThreads) StartRasterThreads();
+    int nBands = tmin( m_NPoolThreads + 1, h );
+    int bandH = (h + nBands - 1)/nBands;
+    //  bands do not overlap, so threads write to disjoint framebuffer rows
+    HANDLE done[c_NullMaxRasterThreads];
+    for (int i = 1; i < nBands; i++)
+    {
+        RasterBand& band = m_RasterBand[i - 1];
+        band.m_Top      = i*bandH;
+        band.m_Bottom   = tmin( (i + 1)*bandH, h );
+        done[i - 1]     = band.m_hDone;
+        SetEvent( band.m_hStart );
+    }
+    RasterizeBand( 0, tmin( bandH, h ) );
+    if (nBands > 1) WaitForMultipleObjects( nBands - 1, done, TRUE, INFINITE );
+    m_FrameStats.m_NRasterTris += m_Tris.size();
+    m_Tris.clear();
+} // NullRenderSystem::RasterizeFrame
+
+void NullRenderSystem::RasterizeBand( int top, int bottom )
+{
+    int scrW = m_ScreenProp.m_Width;
+    DWORD* pColor = &m_ColorBuf[0];
+    float* pDepth = &m_DepthBuf[0];
+    int nTri = m_Tris.size();
+    for (int t = 0; t < nTri; t++)
+    {
+        const RasterTri& tri = m_Tris[t];
+        if (tri.maxY < top || tri.minY >= bottom) continue;
+        const RasterVertex& a = tri.v[0];
+        const RasterVertex& b = tri.v[1];
+        const RasterVertex& c = tri.v[2];
+
+        float area = (b.x - a.x)*(c.y - a.y) - (b.y - a.y)*(c.x - a.x);
+        if (fabs( area ) < c_SpaceEpsilon) continue;
+        float rArea = 1.0f/area;
+
+        int x0 = tmax( 0,       int( floorf( tmin( a.x, b.x, c.x ) ) ) );
+        int x1 = tmin( scrW - 1, int( ceilf( tmax( a.x, b.x, c.x ) ) ) );
+        int y0 = tmax( top,     int( floorf( tri.minY ) ) );
+        int y1 = tmin( bottom - 1, int( ceilf( tri.maxY ) ) );
+
+        for (int y = y0; y <= y1; y++)
+        {
+            float py = float( y ) + 0.5f;
+            for (int x = x0; x <= x1; x++)
+            {
+                float px = float( x ) + 0.5f;
+                float w0 = ((b.x - px)*(c.y - py) - (b.y - py)*(c.x - px))*rArea;
+                float w1 = ((c.x - px)*(a.y - py) - (c.y - py)*(a.x - px))*rArea;
+                float w2 = 1.0f - w0 - w1;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) continue;
+
+                int pix = y*scrW + x;
+                float z = a.z*w0 + b.z*w1 + c.z*w2;
+                if (tri.bZTest && z > pDepth[pix]) continue;
+                if (tri.bZWrite) pDepth[pix] = z;
+
+                DWORD clr = 0;
+                for (int s = 0; s < 32; s += 8)
+                {
+                    float ch = float( (a.color >> s)&0xFF )*w0 +
+                               float( (b.color >> s)&0xFF )*w1 +
+                               float( (c.color >> s)&0xFF )*w2;
+                    clr |= (DWORD( ch + 0.5f )&0xFF) << s;
+                }
+                pColor[pix] = clr;
+            }
+        }
+    }
+} // NullRenderSystem::RasterizeBand
+
+void NullRenderSystem::ScreenShotBMP( const char *pBMPFileName )
+{
+    int w = m_ScreenProp.m_Width;
+    int h = m_ScreenProp.m_Height;
+    if (m_ColorBuf.size() != w*h) return;
+
+    BITMAPFILEHEADER fh;
+    BITMAPINFOHEADER ih;
+    memset( &fh, 0, sizeof( fh ) );
+    memset( &ih, 0, sizeof( ih ) );
+    fh.bfType       = 'MB';
+    fh.bfOffBits    = sizeof( fh ) + sizeof( ih );
+    fh.bfSize       = fh.bfOffBits + w*h*4;
+    ih.biSize       = sizeof( ih );
+    ih.biWidth      = w;
+    ih.biHeight     = h;
+    ih.biPlanes     = 1;
+    ih.biBitCount   = 32;
+    ih.biCompression= BI_RGB;
+
+    FOutStream os( pBMPFileName );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write screenshot <%s>", pBMPFileName );
+        return;
+    }
+    os.Write( &fh, sizeof( fh ) );
+    os.Write( &ih, sizeof( ih ) );
+    //  bitmap rows go bottom-up
+    for (int y = h - 1; y >= 0; y--) os.Write( &m_ColorBuf[y*w], w*4 );
+    os.CloseFile();
+} // NullRenderSystem::ScreenShotBMP
+
+int NullRenderSystem::CompareWithBMP( const char* fname, int tolerance )
+{
+    int w = m_ScreenProp.m_Width;
+    int h = m_ScreenProp.m_Height;
+    if (m_ColorBuf.size() != w*h) return -1;
+
+    FInStream is( fname );
+    if (is.NoFile()) return -1;
+    BITMAPFILEHEADER fh;
+    BITMAPINFOHEADER ih;
+    if (is.Read( &fh, sizeof( fh ) ) != sizeof( fh ) ||
+        is.Read( &ih, sizeof( ih ) ) != sizeof( ih )) return -1;
+    if (fh.bfType != 'MB' || ih.biWidth != w || ih.biHeight != h || ih.biBitCount != 32) return -1;
+
+    std::vector<DWORD> row( w );
+    int nDiff = 0;
+    for (int y = h - 1; y >= 0; y--)
+    {
+        if (is.Read( &row[0], w*4 ) != w*4) return -1;
+        const DWORD* pCur = &m_ColorBuf[y*w];
+        for (int x = 0; x < w; x++)
+        {
+            //  alpha is not compared, it depends on the blending setup only
+            for (int s = 0; s < 24; s += 8)
+            {
+                int d = int( (pCur[x] >> s)&0xFF ) - int( (row[x] >> s)&0xFF );
+                if (abs( d ) > tolerance) { nDiff++; break; }
+            }
+        }
+    }
+    return nDiff;
+} // NullRenderSystem::CompareWithBMP
+
+static NullRenderSystem*    s_pNullRS       = NULL;
+static IRenderSystem*       s_pReplacedRS   = NULL;
+
+//  drops everything appended to the buffers of the render system being switched in,
+//  offsets cached while the other render system was current point to stale data there
+static void PurgeAllBuffers( IRenderSystem* pRS )
+{
+    pRS->PurgeStaticBuffers();
+    for (int i = 0; pRS->DiscardVB( i ); i++);
+    for (int i = 0; pRS->DiscardIB( i ); i++);
+} // PurgeAllBuffers
+
+NullRenderSystem* GetNullRenderSystem( bool bSoftware )
+{
+    if (!s_pNullRS)
+    {
+        s_pNullRS = new NullRenderSystem( bSoftware );
+        s_pNullRS->Init( GetModuleHandle( NULL ) );
+    }
+    return s_pNullRS;
+} // GetNullRenderSystem
+
+NullRenderSystem* InstallNullRenderSystem( bool bSoftware )
+{
+    NullRenderSystem* pNullRS = GetNullRenderSystem( bSoftware );
+    pNullRS->SetSoftware( bSoftware );
+    pNullRS->SetScreenProp( pNullRS->GetScreenProp() );
+    if (IRS != pNullRS)
+    {
+        s_pReplacedRS = IRS;
+        PurgeAllBuffers( pNullRS );
+        IRS = pNullRS;
+        Log.Info( "Null render system installed." );
+    }
+    pNullRS->ResetStats();
+    return pNullRS;
+} // InstallNullRenderSystem
+
+void RestoreRenderSystem()
+{
+    if (!IsNullRenderSystemInstalled() || !s_pReplacedRS) return;
+    const NullRenderStats& st = s_pNullRS->GetTotalStats();
+    Log.Info( "Null render system: %d draw calls, %d primitives, %d shader, %d texture, %d buffer, %d state changes, %d locks (%d bytes).",
+        st.m_NDrawCalls, st.m_NPrimitives, st.m_NShaderChanges, st.m_NTextureChanges,
+        st.m_NBufferChanges, st.m_NStateChanges, st.m_NLocks, st.m_NLockedBytes );
+    PurgeAllBuffers( s_pReplacedRS );
+    IRS = s_pReplacedRS;
+    s_pReplacedRS = NULL;
+    Log.Info( "Device render system restored." );
+} // RestoreRenderSystem
+
+bool IsNullRenderSystemInstalled()
+{
+    return s_pNullRS && IRS == s_pNullRS;
+} // IsNullRenderSystemInstalled
@@ -0,0 +1,445 @@
+/*****************************************************************************/
+/*    File:    rsRenderSystemNull.h
+/*    Desc:    Headless render system: counts the submitted work instead of
+/*             talking to the device, optionally rasterizes it in software
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __RSRENDERSYSTEMNULL_H__
+#define __RSRENDERSYSTEMNULL_H__
+
+#include "IRenderSystem.h"
+
+//  shared buffers mirror the ones Direct3D backend creates at device init
+const int c_NullDynVBufferBytes     = 65535 * 64;
+const int c_NullStaticVBufferBytes  = 1024*1024*16;
+const int c_NullDynIBufferBytes     = 65535 * 8;
+const int c_NullStaticIBufferBytes  = 1024*1024*8;
+const int c_NullQuadIBufferBytes    = 65535 * 8;
+const int c_NullMaxRenderTasks      = 16384;
+const int c_NullMaxRasterThreads    = 16;
+
+/*****************************************************************************/
+/*    Struct:  NullRenderStats
+/*    Desc:    Per-frame counters of the work, which would go to the device
+/*****************************************************************************/
+struct NullRenderStats
+{
+    int             m_NDrawCalls;       //  number of Draw calls
+    int             m_NPrimitives;      //  number of submitted primitives
+    int             m_NShaderChanges;   //  number of actual shader switches
+    int             m_NTextureChanges;  //  number of actual texture switches
+    int             m_NBufferChanges;   //  number of actual vertex/index buffer switches
+    int             m_NStateChanges;    //  number of actual render state changes
+    int             m_NLocks;           //  number of buffer/texture locks
+    int             m_NLockedBytes;     //  number of bytes exposed through locks
+    int             m_NTasks;           //  number of flushed render tasks
+    int             m_NRasterTris;      //  number of rasterized triangles (software mode)
+
+    NullRenderStats() { Reset(); }
+    void Reset() { memset( this, 0, sizeof( *this ) ); }
+}; // struct NullRenderStats
+
+/*****************************************************************************/
+/*    Class:   NullRenderSystem
+/*    Desc:    IRenderSystem implementation without device. Buffers and
+/*             textures are plain system memory, all state setters are
+/*             filtered the same way the Direct3D backend does and counted.
+/*             In software mode geometry is transformed and binned during the
+/*             frame, and rasterized with untextured Gouraud shading into
+/*             the 32-bit framebuffer at EndFrame, in horizontal bands on
+/*             several threads.
+/*****************************************************************************/
+class NullRenderSystem : public IRenderSystem
+{
+public:
+                                NullRenderSystem    ( bool bSoftware = false );
+    virtual                     ~NullRenderSystem   ();
+
+    //  null backend specific
+    const NullRenderStats&      GetFrameStats       () const { return m_FrameStats; }
+    const NullRenderStats&      GetTotalStats       () const { return m_TotalStats; }
+    void                        ResetStats          ();
+    void                        SetSoftware         ( bool bSoftware ) { m_bSoftware = bSoftware; }
+    bool                        IsSoftware          () const { return m_bSoftware; }
+    void                        SetNRasterThreads   ( int nThreads );
+    const DWORD*                GetFrameBuffer      () const { return m_ColorBuf.size() ? &m_ColorBuf[0] : NULL; }
+    //  returns number of pixels, which differ from golden image by more than tolerance, -1 on failure
+    int                         CompareWithBMP      ( const char* fname, int tolerance = 0 );
+
+    //  general
+    virtual void                Init                ( HINSTANCE hInst, HWND hWnd = NULL );
+    virtual void                ShutDown            ();
+    virtual bool                SetScreenProp       ( const ScreenProp& prop );
+    virtual ScreenProp          GetScreenProp       () { return m_ScreenProp; }
+    virtual int                 GetNDisplayModes    () { return 1; }
+    virtual void                GetDisplayMode      ( int idx, int& width, int& height );
+    virtual void                GetClientSize       ( int& width, int& height );
+    virtual void                ClearDevice         ( DWORD color = 0, bool bColor = true, bool bDepth = false, bool bStencil = false );
+    virtual DWORD               GetCurFrame         () const { return m_CurFrame; }
+    virtual void                AddClient           ( IDeviceClient* iNotify ) {}
+    virtual float               GetFPS              () const { return 0.0f; }
+    virtual void                EnablePostEffects   ( bool Enable, float AutoBrightDegree, float AutoBrightSpeed, float, float MotionBlurAlpha ) {}
+    virtual void                PreparePosteffects  () {}
+    virtual void                RenderPosteffects   () {}
+
+    //  transforms
+    virtual void                SetViewTM           ( const Matrix4D& vmatr );
+    virtual void                SetProjTM           ( const Matrix4D& pmatr );
+    virtual void                SetWorldTM          ( const Matrix4D& wmatr );
+    virtual void                SetWorldViewProjTM  ( const Matrix4D& wmatr );
+    virtual void                ResetWorldTM        ();
+    virtual void                SetTextureTM        ( const Matrix4D& tmatr, int stage = 0 );
+    virtual void                SetBumpTM           ( const Matrix3D& bmatr, int stage = 0 );
+    virtual const Matrix4D&     GetViewTM           () const { return m_ViewTM; }
+    virtual const Matrix4D&     GetProjTM           () const { return m_ProjTM; }
+    virtual const Matrix4D&     GetWorldTM          () const { return m_WorldTM; }
+    virtual const Matrix4D&     GetWorldViewProjTM  () const { return m_WVPTM; }
+    virtual const Matrix4D&     GetTextureTM        ( int stage = 0 ) const { return m_TextureTM[stage]; }
+    virtual const Matrix3D&     GetBumpTM           ( int stage = 0 ) const { return m_BumpTM[stage]; }
+
+    //  cursor
+    virtual bool                SetCursor           ( int texID, const Rct& rctOnTex, int hotspotX = 0, int hotspotY = 0 ) { return true; }
+    virtual bool                UpdateCursor        ( int x, int y, bool drawNow = false ) { return true; }
+    virtual void                ShowCursor          ( bool bShow = true ) {}
+
+    //  vertex buffers
+    virtual int                 RegisterVType       ( const VertexDeclaration& vdecl );
+    virtual BYTE*               LockVB              ( int vbID, int firstV, int numV, DWORD& stamp );
+    virtual BYTE*               LockAppendVB        ( int vbID, int size, int& offset, DWORD& stamp );
+    virtual void                UnlockVB            ( int vbID ) {}
+    virtual bool                IsVBStampValid      ( int vbID, DWORD stamp );
+    virtual int                 GetVBufferID        ( const char* vbName );
+    virtual bool                DiscardVB           ( int vbID );
+    virtual int                 CreateVB            ( const char* name, int size, int vType, bool bDynamic = false );
+    virtual bool                DeleteVB            ( int vbID );
+    virtual bool                SetVB               ( int vbID, int vType = -1, int stream = 0, int frequency = 1 );
+
+    //  index buffers
+    virtual BYTE*               LockIB              ( int ibID, int firstIdx, int numIdx, DWORD& stamp );
+    virtual BYTE*               LockAppendIB        ( int ibID, int size, int& offset, DWORD& stamp );
+    virtual bool                IsIBStampValid      ( int ibID, DWORD stamp );
+    virtual void                UnlockIB            ( int ibID ) {}
+    virtual int                 GetIBufferID        ( const char* ibName );
+    virtual bool                DiscardIB           ( int ibID );
+    virtual int                 CreateIB            ( const char* name, int size, IndexSize idxSize, bool bDynamic = false );
+    virtual bool                DeleteIB            ( int ibID );
+    virtual bool                SetIB               ( int ibID );
+
+    //  drawing
+    virtual bool                StartFrame          ();
+    virtual void                EndFrame            ();
+    virtual void                Draw                ( int firstVert, int nVert, int firstIdx, int nIdx,
+                                                        PrimitiveType priType = ptTriangleList );
+
+    //  textures
+    virtual bool                ReloadTextures      () { return true; }
+    virtual void                SetTextureOverride  ( int TextureID, int Stage ) { m_TextureOverride[Stage] = TextureID; }
+    virtual int                 GetTextureOverride  ( int Stage ) { return m_TextureOverride[Stage]; }
+    virtual void                SetTransparentTexOverride( int Stage ) {}
+    virtual void                SetTexture          ( int texID, int stage = 0, bool bCache = false );
+    virtual int                 GetTexture          ( int stage = 0 ) { return m_CurTexture[stage]; }
+    virtual const char*         GetTexturePath      ( int texID ) const;
+    virtual int                 GetShader           () { return m_CurShader; }
+    virtual bool                SaveTexture         ( int texID, const char* fname ) { return false; }
+    virtual void                CopyTexture         ( int destID, int srcID, const Rct* rct = NULL, int nRect = 1 ) {}
+    virtual void                CreateMipLevels     ( int texID ) {}
+    virtual int                 GetTextureID        ( const char* texName );
+    virtual bool                CopyRenderTarget    ( int RenderTargetID, int SysMemTexID ) { return true; }
+    virtual void                RegCallbackOnGetTextureID( OnGetTextureID *Fn ) {}
+    virtual void                RegCallbackOnLoadTexture( OnLoadTexture *Fn ) {}
+    virtual int                 CreateTexture       ( const char* texName,
+                                                        int width, int height,
+                                                        ColorFormat clrFormat,
+                                                        int nMips = 0,
+                                                        TextureMemoryPool memPool = tmpManaged,
+                                                        bool bRenderTarget = false,
+                                                        DepthStencilFormat dsFormat = dsfNone,
+                                                        bool bDynamic = false );
+    virtual int                 CreateNormalMap     ( int texID, float amplitude = 10.0f );
+    virtual bool                DeleteTexture       ( int texID );
+    virtual BYTE*               LockTexBits         ( int texID, int& pitch, int level = 0 );
+    virtual BYTE*               LockTexBits         ( int texID, const Rct& rect, int& pitch, int level = 0 );
+    virtual void                UnlockTexBits       ( int texID, int level = 0 ) {}
+    virtual const char*         GetTextureName      ( int texID );
+    virtual ColorFormat         GetTextureFormat    ( int texID );
+    virtual int                 GetNTextures        () const { return m_Textures.size(); }
+    virtual int                 GetTextureSize      ( int texID ) const;
+    virtual TextureMemoryPool   GetTexturePool      ( int texID ) const;
+    virtual int                 GetTextureWidth     ( int texID ) const;
+    virtual int                 GetTextureHeight    ( int texID ) const;
+    virtual int                 GetTextureNMips     ( int texID ) const;
+    virtual int                 GetTexMemorySize    () const;
+
+    //  shaders
+    virtual int                 GetShaderID         ( const char* shaderName );
+    virtual IShader*            GetShader           ( int shID ) const { return NULL; }
+    virtual const char*         GetShaderName       ( int shID ) const;
+    virtual bool                SetShaderTech       ( int shID, int techID ) { return true; }
+    virtual int                 GetNShaderVars      ( int shID ) const { return 0; }
+    virtual int                 GetNShaderPasses    ( int shID ) const { return 1; }
+    virtual int                 GetShaderVarID      ( int shID, const char* constantName ) { return -1; }
+    virtual bool                SetShaderVar        ( int shID, int cID, bool val ) { return true; }
+    virtual bool                SetShaderVar        ( int shID, int cID, float val ) { return true; }
+    virtual bool                SetShaderVar        ( int shID, int cID, int val ) { return true; }
+    virtual bool                SetShaderVar        ( int shID, int cID, const Matrix4D& val ) { return true; }
+    virtual bool                SetShaderVar        ( int shID, int cID, const Vector4D& val ) { return true; }
+    virtual bool                SetShaderVar        ( int shID, int cID, const Vector4D* val, int count ) { return true; }
+    virtual bool                SetShaderVar        ( int shID, int cID, const Vector3D& val ) { return true; }
+    virtual bool                ReloadShaders       () { return true; }
+    virtual void                SetShader           ( int shaderID, int passID = 0 );
+    virtual void                SetShaderAutoVars   () {}
+    virtual bool                IsShaderValid       ( int shID, int techID = 0 ) { return shID >= 0 && shID < m_Shaders.size(); }
+    virtual void                SetShadersQuality   ( int Level ) { m_ShadersQuality = Level; }
+    virtual int                 GetShadersQuality   () { return m_ShadersQuality; }
+    virtual void                SetBumpEnable       ( bool State ) { m_bBump = State; }
+    virtual bool                GetBumpEnable       () { return m_bBump; }
+    virtual void                SetShaderConst      ( int ConstIndex, float Value ) { m_ShaderConst[ConstIndex&3] = Value; }
+    virtual float               GetShaderConst      ( int ConstIndex ) { return m_ShaderConst[ConstIndex&3]; }
+
+    virtual bool                SetClipPlane        ( DWORD idx, const Plane& plane ) { return true; }
+    virtual bool                PushRenderTarget    ( int texID, int dsID = -1 );
+    virtual bool                PopRenderTarget     ();
+    virtual void                SetViewPort         ( const Rct& vp, float zn = 0.0f, float zf = 1.0f, bool bClip = true );
+    virtual Rct                 GetViewPort         () const { return m_ViewPort; }
+
+    //  direct render states changing
+    virtual void                SetTextureFactor    ( DWORD tfactor );
+    virtual DWORD               GetTextureFactor    () const { return m_TFactor; }
+    virtual void                SetAlphaRef         ( BYTE alphaRef );
+    virtual void                SetZEnable          ( bool bEnable = true );
+    virtual void                SetZWriteEnable     ( bool bEnable = true );
+    virtual bool                GetZEnable          () const { return m_bZEnable; }
+    virtual bool                GetZWriteEnable     () const { return m_bZWrite; }
+    virtual void                SetDitherEnable     ( bool bEnable = true ) {}
+    virtual void                SetTexFilterEnable  ( bool bEnable = true ) {}
+    virtual void                SetWireframe        ( bool bEnable = true ) {}
+    virtual void                SetColorConst       ( DWORD Color ) { m_ColorConst = Color; }
+    virtual DWORD               GetColorConst       () { return m_ColorConst; }
+
+    virtual void                Dump                ( const char* fname = 0 );
+    virtual bool                ApplyStateBlock     ( DWORD id );
+    virtual bool                DeleteStateBlock    ( DWORD id ) { return true; }
+    virtual void                SetRSBlock          ( RenderStateBlock* pBlock ) { CountStateChange(); }
+    virtual void                SetTSBlock          ( TextureStateBlock* pBlock, int stage ) { CountStateChange(); }
+    virtual DWORD               CreateStateBlock    ( StateBlock* pBlock ) { return ++m_NStateBlocks; }
+
+    //  lighting
+    virtual void                SetDirLight         ( DirectionalLight* pLight, int& index ) {}
+    virtual void                SetPointLight       ( PointLight* pLight, int& index ) {}
+    virtual void                SetSpotLight        ( SpotLight* pLight, int& index ) {}
+    virtual void                SetFog              ( DWORD FogColor, float FogStart, float FogEnd, float FogDensity, int FogMode ) {}
+    virtual void                ApplyFogStateBlock  () {}
+    virtual void                DisableLights       () {}
+    virtual void                SetMaterial         ( DWORD ambient, DWORD diffuse, DWORD specular, DWORD emissive, float power ) {}
+    virtual float               GetFogDensity       () const { return m_FogDensity; }
+    virtual void                SetFogDensity       ( float fog ) { m_FogDensity = fog; }
+
+    //  font
+    virtual int                 GetFontID           ( const char* name );
+    virtual void                DestroyFont         ( int fontID ) {}
+    virtual int                 CreateFont          ( const char* name, int height, DWORD charset = DEFAULT_CHARSET, bool bBold = false, bool bItalic = false );
+    virtual int                 CreateFont          ( const char* texName, int charW, int charH );
+    virtual int                 GetStringWidth      ( int fontID, const char* str, int spacing = 1 );
+    virtual int                 GetCharWidth        ( int fontID, BYTE ch );
+    virtual int                 GetCharHeight       ( int fontID, BYTE ch );
+    virtual void                SetCurrentFont      ( int fontID ) { m_CurFont = fontID; }
+    virtual bool                DrawString          ( const char* str, const Vector3D& pos, DWORD color = 0xFFFFFFFF, int spacing = 1 );
+    virtual bool                DrawString3D        ( const char* str, const Vector3D& pos, DWORD color = 0xFFFFFFFF, int spacing = 1 );
+    virtual bool                DrawChar            ( const Vector3D& pos, BYTE ch, DWORD color = 0xFFFFFFFF ) { return true; }
+    virtual bool                DrawChar            ( const Vector3D& pos, const Rct& uv, DWORD color = 0xFFFFFFFF ) { return true; }
+    virtual bool                DrawChar            ( const Vector3D& pos, const Rct& uv, float w, float h, DWORD color = 0xFFFFFFFF ) { return true; }
+    virtual void                FlushText           () {}
+
+    //  primitives
+    virtual void                DrawLine            ( float x1, float y1, float x2, float y2, float z, DWORD color1, DWORD color2 ) {}
+    virtual void                DrawLine            ( const Vector3D& a, const Vector3D& b, DWORD color1, DWORD color2 ) {}
+    virtual void                DrawRect            ( const Rct& rct, const Rct& uv, float z, DWORD ca, DWORD cb, DWORD cc, DWORD cd ) {}
+    virtual void                DrawPoly            ( float ax, float ay, float bx, float by, float cx, float cy,
+                                                        float au, float av, float bu, float bv, float cu, float cv ) {}
+    virtual void                DrawPoly            ( const Vector3D& a, const Vector3D& b, const Vector3D& c, DWORD acol, DWORD bcol, DWORD ccol,
+                                                        float au, float av, float bu, float bv, float cu, float cv ) {}
+    virtual void                FlushPrim           ( bool bShaded = true ) {}
+    virtual void                PurgeStaticBuffers  ();
+    virtual RenderTask&         AddTask             ();
+    virtual void                Flush               ();
+
+    virtual void                ScreenShotBMP       ( const char *pBMPFileName );
+    virtual void                ScreenShotJPG       ( const char *pJPGFileName ) { ScreenShotBMP( pJPGFileName ); }
+
+    virtual void                TimeOverrideEnable  ( const float secNewTime ) { m_bTimeOverride = true; m_TimeOverride = secNewTime; }
+    virtual void                TimeOverrideDisable () { m_bTimeOverride = false; }
+    virtual bool                TimeOverrideIsEnabled( float *pSecTime = NULL );
+
+    virtual void                AntialiasingEnable  () {}
+    virtual void                AntialiasingDisable () {}
+    virtual bool                AntialiasingIsEnabled() { return false; }
+
+    virtual void                TrueColorEnable     () {}
+    virtual void                TrueColorDisable    () {}
+    virtual bool                TrueColorIsEnabled  () { return true; }
+
+    virtual bool                GetDeviceDisplayMode( int *pWidth, int *pHeight, int *pBpp, int *pRefreshRate );
+
+    virtual void                RefreshRateOverrideEnable   ( const int Hz ) {}
+    virtual void                RefreshRateOverrideDisable  () {}
+    virtual bool                RefreshRateOverrideIsEnabled( int *pHz = NULL ) { return false; }
+    virtual HWND                GetHWND             () { return m_hWnd; }
+
+    virtual void                AddScreenResolution ( const int XRes, const int YRes, const int RR ) {}
+
+protected:
+    //  system memory stand-in for the hardware vertex/index buffer
+    struct NullBuffer
+    {
+        std::string         m_Name;
+        std::vector<BYTE>   m_Data;
+        int                 m_VType;        //  vertex type for the vertex buffers
+        int                 m_Stride;       //  vertex size or index size, in bytes
+        int                 m_NFilled;      //  number of appended elements
+        DWORD               m_CurStamp;
+        DWORD               m_FirstValidStamp;
+        bool                m_bDynamic;
+        bool                m_bFree;
+
+        int                 GetNElem() const { return m_Stride ? m_Data.size()/m_Stride : 0; }
+        void                Purge() { m_FirstValidStamp = ++m_CurStamp; m_NFilled = 0; }
+    }; // struct NullBuffer
+
+    struct NullTexture
+    {
+        std::string         m_Name;
+        int                 m_Width;
+        int                 m_Height;
+        int                 m_NMips;
+        ColorFormat         m_Format;
+        TextureMemoryPool   m_Pool;
+        bool                m_bRT;
+        std::vector<BYTE>   m_Bits;         //  allocated on the first lock
+    }; // struct NullTexture
+
+    //  screen space vertex of the binned triangle
+    struct RasterVertex
+    {
+        float               x, y, z;
+        DWORD               color;
+    }; // struct RasterVertex
+
+    struct RasterTri
+    {
+        RasterVertex        v[3];
+        float               minY, maxY;
+        bool                bZTest;
+        bool                bZWrite;
+    }; // struct RasterTri
+
+    //  band of the framebuffer rows, owned by one of the pooled raster threads
+    struct RasterBand
+    {
+        NullRenderSystem*   m_pRS;
+        int                 m_Top;
+        int                 m_Bottom;
+        HANDLE              m_hStart;       //  signaled when the band is ready to be rasterized
+        HANDLE              m_hDone;        //  signaled by the thread when the band is rasterized
+    }; // struct RasterBand
+
+    void                    CountStateChange    () { m_FrameStats.m_NStateChanges++; }
+    void                    CountLock           ( int nBytes );
+    BYTE*                   LockBuffer          ( NullBuffer& buf, int first, int num, DWORD& stamp, bool bDiscard );
+    BYTE*                   LockAppendBuffer    ( std::vector<NullBuffer>& bufs, int id, int num, int& offset, DWORD& stamp );
+    int                     FindBuffer          ( const std::vector<NullBuffer>& bufs, const char* name ) const;
+    void                    UpdateWVP           ();
+    void                    SortTasks           ();
+    void                    FillQuadIndexBuffer ();
+
+    void                    BinTriangles        ( int firstVert, int nVert, int firstIdx, int nIdx, PrimitiveType priType );
+    bool                    TransformVertex     ( const BYTE* pV, const VertexDeclaration& vd, RasterVertex& rv ) const;
+    void                    RasterizeFrame      ();
+    void                    RasterizeBand       ( int top, int bottom );
+    void                    StartRasterThreads  ();
+    void                    StopRasterThreads   ();
+    static DWORD WINAPI     RasterThreadProc    ( void* pParam );
+
+    bool                    m_bSoftware;
+    int                     m_NRasterThreads;
+    HWND                    m_hWnd;
+    ScreenProp              m_ScreenProp;
+    DWORD                   m_CurFrame;
+    NullRenderStats         m_FrameStats;
+    NullRenderStats         m_TotalStats;
+
+    Matrix4D                m_ViewTM;
+    Matrix4D                m_ProjTM;
+    Matrix4D                m_WorldTM;
+    Matrix4D                m_WVPTM;
+    Matrix4D                m_TextureTM[c_MaxTextureStages];
+    Matrix3D                m_BumpTM[c_MaxTextureStages];
+    Rct                     m_ViewPort;
+    float                   m_ZNear;
+    float                   m_ZFar;
+
+    std::vector<VertexDeclaration>  m_VertexTypes;
+    std::vector<NullBuffer>         m_VBuffers;
+    std::vector<NullBuffer>         m_IBuffers;
+    std::vector<NullTexture>        m_Textures;
+    std::vector<std::string>        m_Shaders;
+    std::vector<std::string>        m_Fonts;
+    std::vector<int>                m_RTStack;
+
+    int                     m_CurVB;
+    int                     m_CurVType;
+    int                     m_CurIB;
+    int                     m_CurShader;
+    int                     m_CurTexture[c_MaxTextureStages];
+    int                     m_TextureOverride[c_MaxTextureStages];
+    int                     m_CurFont;
+    int                     m_QuadIB;
+    DWORD                   m_CurStateBlock;
+    DWORD                   m_NStateBlocks;
+
+    DWORD                   m_TFactor;
+    DWORD                   m_ColorConst;
+    BYTE                    m_AlphaRef;
+    bool                    m_bZEnable;
+    bool                    m_bZWrite;
+    bool                    m_bBump;
+    int                     m_ShadersQuality;
+    float                   m_ShaderConst[4];
+    float                   m_FogDensity;
+    bool                    m_bTimeOverride;
+    float                   m_TimeOverride;
+
+    RenderTask              m_Tasks[c_NullMaxRenderTasks];
+    std::vector<RenderTask*> m_SortedTasks;
+    int                     m_NTasks;
+    bool                    m_bSorted;
+
+    //  software rasterizer state
+    std::vector<RasterTri>  m_Tris;
+    std::vector<DWORD>      m_ColorBuf;
+    std::vector<float>      m_DepthBuf;
+
+    //  raster threads live until the thread count changes or shutdown
+    HANDLE                  m_hRasterThread[c_NullMaxRasterThreads];
+    RasterBand              m_RasterBand[c_NullMaxRasterThreads];
+    int                     m_NPoolThreads;     //  number of running raster threads
+    int                     m_PoolSize;         //  m_NRasterThreads the pool was started for, 0 if none
+    volatile bool           m_bStopRaster;
+}; // class NullRenderSystem
+
+//  null render system buffer stamps have the high bit set, so that the device render system
+//  rejects the stamps cached against the null one and vice versa
+const DWORD c_NullStampBase = 0x80000001;
+
+//  creates (once) the headless render system, bSoftware applies to the creation only
+NullRenderSystem*   GetNullRenderSystem     ( bool bSoftware = false );
+//  makes the headless render system current in IRS, remembers the render system it replaces.
+//  Both swaps purge the buffers of the render system switched in. Buffer, texture and shader IDs
+//  are indices into the tables of the render system that was current when they were looked up
+//  or created, so IDs cached while the null render system is installed must be looked up again
+//  after RestoreRenderSystem (and the other way round).
+NullRenderSystem*   InstallNullRenderSystem ( bool bSoftware = false );
+//  makes the render system, which was replaced by InstallNullRenderSystem, current again
+void                RestoreRenderSystem     ();
+bool                IsNullRenderSystemInstalled();
+
+#endif // __RSRENDERSYSTEMNULL_H__
@@ -0,0 +1,363 @@
+/*****************************************************************************/
+/*    File:    sgBenchmarks.cpp
+/*    Desc:    Scene node running the engine benchmarks from the editor
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#include "stdafx.h"
+#include "sg.h"
+#include "IMediaManager.h"
+#include "IResourceManager.h"
+#include "vModelInstance.h"
+#include "sgModelBake.h"
+#include "kXMLCache.h"
+#include "kResource.h"
+#include "mRandom.h"
+#include "kFrameReplay.h"
+#include "vTerrainRenderer.h"
+#include "vTreesRenderer.h"
+#include "vShadowManager.h"
+#include "sgSpriteManager.h"
+#include "sgG18.h"
+#include "vFontManager.h"
+#include "IWater.h"
+#include "rsVertex.h"
+#include "vBillboardBatch.h"
+#include "IImpostorCache.h"
+#include "rsRenderSystemNull.h"
+#include "sgBenchmarks.h"
+
+IMPLEMENT_CLASS( Benchmarks );
+
+/*****************************************************************************/
+/*    Benchmarks implementation
+/*****************************************************************************/
+Benchmarks::Benchmarks()
+{
+    SetName( "Benchmarks" );
+    m_ResourceBudget = 16*1024*1024;
+    m_PackageColor   = 0;
+    m_bSoftwareRS    = false;
+}
+
+Benchmarks::~Benchmarks()
+{
+    if (IsRecordingResources()) g_SpriteManager.SetResourceTrace( NULL );
+}
+
+void Benchmarks::RunModelBatch()
+{
+    DWORD mdlID = IMM->GetModelID( m_ModelName.c_str() );
+    if (mdlID == 0xFFFFFFFF)
+    {
+        Log.Warning( "Model batch benchmark: could not load model <%s>", m_ModelName.c_str() );
+        return;
+    }
+    DWORD animID = m_AnimName.empty() ? 0xFFFFFFFF : IMM->GetModelID( m_AnimName.c_str() );
+    BenchmarkModelBatch( mdlID, animID );
+} // Benchmarks::RunModelBatch
+
+void Benchmarks::RunXMLParser()
+{
+    BenchmarkXMLParser( m_XMLRoot.empty() ? IRM->GetHomeDirectory() : m_XMLRoot.c_str() );
+} // Benchmarks::RunXMLParser
+
+void Benchmarks::GetTraceDir( char* dir ) const
+{
+    if (m_TraceDir.empty()) sprintf( dir, "%s\\Traces", IRM->GetHomeDirectory() );
+    else strcpy( dir, m_TraceDir.c_str() );
+} // Benchmarks::GetTraceDir
+
+void Benchmarks::MakeTraces()
+{
+    char dir[_MAX_PATH];
+    GetTraceDir( dir );
+    int nTraces = MakeCanonicalTraces( dir, m_PackageName.c_str(), m_EffectName.c_str(), m_ModelName.c_str() );
+    Log.Info( "Written %d frame traces to <%s>", nTraces, dir );
+} // Benchmarks::MakeTraces
+
+void Benchmarks::RunReplay()
+{
+    char dir[_MAX_PATH];
+    char csv[_MAX_PATH];
+    GetTraceDir( dir );
+    sprintf( csv, "%s\\replay.csv", dir );
+    if (RunReplayBenchmark( dir, csv ) > 0) return;
+    //  no recorded sessions yet, fall back to the canonical synthetic ones
+    Log.Info( "No frame traces in <%s>, writing the canonical ones", dir );
+    if (MakeCanonicalTraces( dir, m_PackageName.c_str(), m_EffectName.c_str(), m_ModelName.c_str() ) > 0)
+    {
+        RunReplayBenchmark( dir, csv );
+    }
+} // Benchmarks::RunReplay
+
+bool Benchmarks::IsRecording() const
+{
+    return FrameRecorder::s_bActive;
+} // Benchmarks::IsRecording
+
+void Benchmarks::SetRecording( bool bRecord )
+{
+    if (!bRecord)
+    {
+        FrameRecorder::Stop();
+        return;
+    }
+    if (FrameRecorder::s_bActive) return;
+    char dir[_MAX_PATH];
+    char fname[_MAX_PATH];
+    GetTraceDir( dir );
+    _mkdir( dir );
+    sprintf( fname, "%s\\session_%u.%s", dir, GetTickCount(), c_FrameTraceExt );
+    FrameRecorder::Start( fname );
+} // Benchmarks::SetRecording
+
+void Benchmarks::CheckEffect()
+{
+    CheckEffectReplay( m_EffectName.c_str() );
+} // Benchmarks::CheckEffect
+
+void Benchmarks::RunTreesDB()
+{
+    BenchmarkTreesDB( 100000 );
+    BenchmarkTreesDB( 1000000 );
+} // Benchmarks::RunTreesDB
+
+void Benchmarks::BakeTreesDB()
+{
+    BakeMapTreesDB( m_MapFile.c_str() );
+} // Benchmarks::BakeTreesDB
+
+void Benchmarks::LoadMapData()
+{
+    ITerra->LoadMapData( m_MapFile.c_str() );
+} // Benchmarks::LoadMapData
+
+void Benchmarks::RunShadowCasters()
+{
+    DWORD mdlID = IMM->GetModelID( m_ModelName.c_str() );
+    if (mdlID == 0xFFFFFFFF)
+    {
+        Log.Warning( "Shadow casters benchmark: could not load model <%s>", m_ModelName.c_str() );
+        return;
+    }
+    BenchmarkShadowCasters( mdlID );
+} // Benchmarks::RunShadowCasters
+
+void Benchmarks::RunG18Decode()
+{
+    BenchmarkG18Decode( m_G18File.c_str() );
+} // Benchmarks::RunG18Decode
+
+void Benchmarks::RunTextLabels()
+{
+    int fontID = m_FontName.empty() ? 0 : IWM->GetFontID( m_FontName.c_str() );
+    BenchmarkTextLabels( fontID );
+} // Benchmarks::RunTextLabels
+
+void Benchmarks::RunSprites()
+{
+    BenchmarkSprites( ISM->GetPackageID( m_PackageName.c_str() ) );
+} // Benchmarks::RunSprites
+
+void Benchmarks::TranscodeSprites()
+{
+    int gpID = ISM->GetPackageID( m_PackageName.c_str() );
+    if (gpID < 0 || !ISM->TranscodePackage( gpID, m_PackageColor ))
+    {
+        Log.Warning( "Sprite transcode: could not transcode package <%s>", m_PackageName.c_str() );
+    }
+} // Benchmarks::TranscodeSprites
+
+void Benchmarks::RunWater()
+{
+    BenchmarkWater();
+} // Benchmarks::RunWater
+
+void Benchmarks::RunBillboards()
+{
+    BenchmarkBillboards();
+} // Benchmarks::RunBillboards
+
+void Benchmarks::BakeModels()
+{
+    ::BakeModels( m_ModelRoot.empty() ? IRM->GetHomeDirectory() : m_ModelRoot.c_str() );
+} // Benchmarks::BakeModels
+
+void Benchmarks::BakeImpostors()
+{
+    BakeImpostorAtlas( m_ModelRoot.empty() ? IRM->GetHomeDirectory() : m_ModelRoot.c_str() );
+} // Benchmarks::BakeImpostors
+
+void Benchmarks::PrewarmXMLCache()
+{
+    ::PrewarmXMLCache( m_XMLRoot.empty() ? IRM->GetHomeDirectory() : m_XMLRoot.c_str() );
+} // Benchmarks::PrewarmXMLCache
+
+void Benchmarks::ResetXMLCache()
+{
+    ResetXMLCacheStats();
+} // Benchmarks::ResetXMLCache
+
+int Benchmarks::GetXMLCacheHits() const
+{
+    int nHits, nMisses;
+    GetXMLCacheStats( nHits, nMisses );
+    return nHits;
+} // Benchmarks::GetXMLCacheHits
+
+int Benchmarks::GetXMLCacheMisses() const
+{
+    int nHits, nMisses;
+    GetXMLCacheStats( nHits, nMisses );
+    return nMisses;
+} // Benchmarks::GetXMLCacheMisses
+
+void Benchmarks::GetResourceTracePath( char* fname ) const
+{
+    char dir[_MAX_PATH];
+    GetTraceDir( dir );
+    sprintf( fname, "%s\\sprites.rtr", dir );
+} // Benchmarks::GetResourceTracePath
+
+bool Benchmarks::IsRecordingResources() const
+{
+    return g_SpriteManager.GetResourceTrace() == &m_ResTrace;
+} // Benchmarks::IsRecordingResources
+
+void Benchmarks::SetRecordingResources( bool bRecord )
+{
+    if (bRecord == IsRecordingResources()) return;
+    if (bRecord)
+    {
+        m_ResTrace.clear();
+        g_SpriteManager.SetResourceTrace( &m_ResTrace );
+        return;
+    }
+    g_SpriteManager.SetResourceTrace( NULL );
+    char dir[_MAX_PATH];
+    char fname[_MAX_PATH];
+    GetTraceDir( dir );
+    _mkdir( dir );
+    GetResourceTracePath( fname );
+    if (SaveResourceTrace( m_ResTrace, fname ))
+    {
+        Log.Info( "Recorded %d sprite cache accesses to <%s>", m_ResTrace.size(), fname );
+    }
+    m_ResTrace.clear();
+} // Benchmarks::SetRecordingResources
+
+void Benchmarks::RunResourceReplay()
+{
+    //  sprite cache accesses recorded in a real session are replayed, 
+    //  when there are none, the synthetic pattern is used instead
+    char fname[_MAX_PATH];
+    GetResourceTracePath( fname );
+    ResourceTrace trace;
+    if (LoadResourceTrace( trace, fname ) && trace.size() > 0)
+    {
+        Log.Info( "Replaying recorded resource trace <%s>", fname );
+        ReplayResourceTrace( trace, m_ResourceBudget );
+        return;
+    }
+    Log.Info( "No recorded resource trace <%s>, replaying the synthetic one", fname );
+
+    //  sprite-like pattern: every frame the view touches a window of resources, 
+    //  which scrolls slowly and jumps to the random place of the map from time to time
+    const int c_NResources  = 8192;
+    const int c_ViewSize    = 512;
+    const int c_NFrames     = 512;
+    const int c_JumpFrames  = 64;
+
+    std::vector<int> sizes( c_NResources );
+    for (int i = 0; i < c_NResources; i++) sizes[i] = rndValue( 4096, 65536 );
+
+    trace.reserve( c_NFrames*c_ViewSize );
+    int viewPos = 0;
+    for (int f = 0; f < c_NFrames; f++)
+    {
+        if (f%c_JumpFrames == 0) viewPos = rndValue( 0, c_NResources - c_ViewSize );
+        viewPos += rndValue( 0, 8 );
+        clamp( viewPos, 0, c_NResources - c_ViewSize );
+        for (int i = 0; i < c_ViewSize; i++)
+        {
+            ResourceAccess acc;
+            acc.m_ResID  = viewPos + i;
+            acc.m_NBytes = sizes[acc.m_ResID];
+            acc.m_Factor = f + 1;
+            trace.push_back( acc );
+        }
+    }
+    ReplayResourceTrace( trace, m_ResourceBudget );
+} // Benchmarks::RunResourceReplay
+
+bool Benchmarks::IsNullRS() const
+{
+    return IsNullRenderSystemInstalled();
+} // Benchmarks::IsNullRS
+
+void Benchmarks::SetNullRS( bool bNull )
+{
+    //  benchmarks started while the null render system is installed 
+    //  measure the engine side only, the device does not take part
+    if (bNull) InstallNullRenderSystem( m_bSoftwareRS );
+    else RestoreRenderSystem();
+} // Benchmarks::SetNullRS
+
+bool Benchmarks::IsSpriteDefrag() const
+{
+    return SpriteManager::s_bDefragment;
+} // Benchmarks::IsSpriteDefrag
+
+void Benchmarks::SetSpriteDefrag( bool bDefrag )
+{
+    //  the shadow surfaces are created by SpriteManager::Init only
+    SpriteManager::s_bDefragment = bDefrag;
+    if (!bDefrag && g_SpriteManager.IsDefragmenting())
+    {
+        Log.Warning( "SpriteDefragment takes effect after the sprite manager is initialized again" );
+    }
+} // Benchmarks::SetSpriteDefrag
+
+void Benchmarks::Expose( PropertyMap& pm )
+{
+    pm.start<Parent>( "Benchmarks", this );
+    pm.f( "Model",          m_ModelName, "#model" );
+    pm.f( "Animation",      m_AnimName,  "#model" );
+    pm.f( "ModelRoot",      m_ModelRoot );
+    pm.f( "XMLRoot",        m_XMLRoot );
+    pm.f( "MapFile",        m_MapFile, "file" );
+    pm.f( "TraceDir",       m_TraceDir );
+    pm.f( "Package",        m_PackageName );
+    pm.f( "PackageColor",   m_PackageColor, "color" );
+    pm.f( "Effect",         m_EffectName, "#model" );
+    pm.f( "G18File",        m_G18File, "file" );
+    pm.f( "Font",           m_FontName );
+    pm.f( "ResourceBudget", m_ResourceBudget );
+    pm.f( "SoftwareRaster", m_bSoftwareRS );
+    pm.p( "NullRenderSystem", &Benchmarks::IsNullRS, &Benchmarks::SetNullRS );
+    pm.p( "SpriteDefragment", &Benchmarks::IsSpriteDefrag, &Benchmarks::SetSpriteDefrag );
+    pm.m( "ModelBatch",     &Benchmarks::RunModelBatch  );
+    pm.m( "XMLParser",      &Benchmarks::RunXMLParser   );
+    pm.m( "MakeTraces",     &Benchmarks::MakeTraces     );
+    pm.m( "Replay",         &Benchmarks::RunReplay      );
+    pm.p( "Record",         &Benchmarks::IsRecording, &Benchmarks::SetRecording );
+    pm.m( "CheckEffect",    &Benchmarks::CheckEffect    );
+    pm.m( "TreesDB",        &Benchmarks::RunTreesDB     );
+    pm.m( "BakeTreesDB",    &Benchmarks::BakeTreesDB    );
+    pm.m( "LoadMapData",    &Benchmarks::LoadMapData    );
+    pm.m( "ShadowCasters",  &Benchmarks::RunShadowCasters );
+    pm.m( "G18Decode",      &Benchmarks::RunG18Decode   );
+    pm.m( "TextLabels",     &Benchmarks::RunTextLabels  );
+    pm.m( "Sprites",        &Benchmarks::RunSprites     );
+    pm.m( "TranscodeSprites",&Benchmarks::TranscodeSprites );
+    pm.m( "Water",          &Benchmarks::RunWater       );
+    pm.m( "Billboards",     &Benchmarks::RunBillboards  );
+    pm.m( "BakeModels",     &Benchmarks::BakeModels     );
+    pm.m( "BakeImpostors",  &Benchmarks::BakeImpostors  );
+    pm.m( "PrewarmXMLCache",&Benchmarks::PrewarmXMLCache );
+    pm.m( "ResetXMLCache",  &Benchmarks::ResetXMLCache  );
+    pm.p( "XMLCacheHits",   &Benchmarks::GetXMLCacheHits    );
+    pm.p( "XMLCacheMisses", &Benchmarks::GetXMLCacheMisses  );
+    pm.m( "ResourceReplay", &Benchmarks::RunResourceReplay );
+    pm.p( "RecordResources",&Benchmarks::IsRecordingResources, &Benchmarks::SetRecordingResources );
+} // Benchmarks::Expose
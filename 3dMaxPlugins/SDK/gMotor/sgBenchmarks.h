@@ -0,0 +1,76 @@
+/*****************************************************************************/
+/*    File:    sgBenchmarks.h
+/*    Desc:    Scene node running the engine benchmarks from the editor
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __SGBENCHMARKS_H__
+#define __SGBENCHMARKS_H__
+
+/*****************************************************************************/
+/*    Class:    Benchmarks
+/*    Desc:    Debug panel, each method runs one benchmark or asset tool over
+/*             the assets named in the fields and writes the results to the log
+/*****************************************************************************/
+class Benchmarks : public SNode
+{
+public:
+                            Benchmarks      ();
+    virtual                 ~Benchmarks     ();
+    virtual void            Expose          ( PropertyMap& pm );
+
+    void                    RunModelBatch   ();
+    void                    RunXMLParser    ();
+    void                    MakeTraces      ();
+    void                    RunReplay       ();
+    bool                    IsRecording     () const;
+    void                    SetRecording    ( bool bRecord );
+    void                    CheckEffect     ();
+    void                    RunTreesDB      ();
+    void                    BakeTreesDB     ();
+    void                    LoadMapData     ();
+    void                    RunShadowCasters();
+    void                    RunG18Decode    ();
+    void                    RunTextLabels   ();
+    void                    RunSprites      ();
+    void                    TranscodeSprites();
+    void                    RunWater        ();
+    void                    RunBillboards   ();
+    void                    BakeModels      ();
+    void                    BakeImpostors   ();
+    void                    PrewarmXMLCache ();
+    void                    ResetXMLCache   ();
+    int                     GetXMLCacheHits () const;
+    int                     GetXMLCacheMisses() const;
+    void                    RunResourceReplay();
+    bool                    IsRecordingResources() const;
+    void                    SetRecordingResources( bool bRecord );
+    bool                    IsNullRS        () const;
+    void                    SetNullRS       ( bool bNull );
+    bool                    IsSpriteDefrag  () const;
+    void                    SetSpriteDefrag ( bool bDefrag );
+
+    DECLARE_SCLASS(Benchmarks,SNode,BNCH);
+
+protected:
+    std::string             m_ModelName;    //  model instanced by the model and shadow benchmarks
+    std::string             m_AnimName;     //  animation played on it, may be empty
+    std::string             m_ModelRoot;    //  models to bake and to build impostors of, home directory when empty
+    std::string             m_XMLRoot;      //  directory with the xml files, home directory when empty
+    std::string             m_MapFile;      //  map the trees database is baked for and loaded with
+    std::string             m_TraceDir;     //  frame traces, <home>\Traces when empty
+    std::string             m_PackageName;  //  sprite package, also drawn by the sprite benchmark
+    DWORD                   m_PackageColor; //  national color the package is transcoded for
+    std::string             m_EffectName;   //  effect model
+    std::string             m_G18File;      //  .g18 package decoded by the G18 benchmark
+    std::string             m_FontName;     //  font of the text labels, first font when empty
+    int                     m_ResourceBudget;   //  bytes, budget of the resource manager replay
+    bool                    m_bSoftwareRS;  //  null render system rasterizes the frames in software
+
+private:
+    void                    GetTraceDir     ( char* dir ) const;
+    void                    GetResourceTracePath( char* fname ) const;
+
+    ResourceTrace           m_ResTrace;     //  sprite cache accesses being recorded
+}; // class Benchmarks
+
+#endif // __SGBENCHMARKS_H__
@@ -16,11 +16,13 @@
 
 #include "kFilePath.h"
 #include "kColorTraits.h"
+#include "kXMLCache.h"
 
 #include "ITerrain.h"
 
 #include "IResourceManager.h"
 #include "IShadowManager.h"
+#include "kFrameReplay.h"
 
 #ifndef _INLINES
 #include "sgEffect.inl"
@@ -1857,6 +1859,8 @@ void PModelRendererWithStop::Unserialize ( InStream& is  )
 /*****************************************************************************/
 /*    PBillboardRenderer implemetation
 /*****************************************************************************/
+bool PBillboardRenderer::s_bBatched = true;
+
 PBillboardRenderer::PBillboardRenderer()
 {
     m_Alignment = baCamera;
@@ -1994,6 +1998,25 @@ bool PBillboardRenderer::FillGeometry( PEmitterInstance* pEmitter )
     }
 
     float s = pEmitter->m_pEmitter->IsWorldSpace() ? pEmitter->m_WorldTM.getV0().norm() : 1.0f;    
+    if (s_bBatched && !IsHeadMoveDir())
+    {
+        //  basis is the same for all particles, quads are expanded at once when rendering
+        BillboardBasis basis;
+        basis.m_Right   = Vector3D( alignTM.e00, alignTM.e01, alignTM.e02 );
+        basis.m_Up      = Vector3D( alignTM.e10, alignTM.e11, alignTM.e12 );
+        basis.m_Origin  = alignTM.getTranslation();
+        basis.m_RefX    = m_RefPoint.x + 0.5f;
+        basis.m_RefY    = m_RefPoint.y + 0.5f;
+        m_Queue.BeginRun( basis );
+        for (; p; p = p->m_pNext)
+        {
+            if (p->GetFlag( pfDead ) || p->GetFlag( pfJustBorn )) continue;
+            m_Queue.Add( p->m_Position, p->m_Size.x*s, p->m_Size.y*s, p->m_Roll, 
+                            _modalp(p->m_Color,pEmitter->m_Alpha), p->m_UV, p->m_UV2 );
+        }
+        return true;
+    }
+
     while (p)
     {
         if (m_RenderBin.getNVert() + 4 >= c_ParticleRenderBinSize) 
@@ -2018,9 +2041,15 @@ bool PBillboardRenderer::FillGeometry( PEmitterInstance* pEmitter )
     return true; 
 } // PBillboardRenderer::FillGeometry
 
+void PBillboardRenderer::DrawBatch()
+{
+    if (m_RenderBin.getNVert() > 0) DrawPrimBM( m_RenderBin );
+    if (m_Queue.GetNQuads() > 0) m_Queue.Draw();
+} // PBillboardRenderer::DrawBatch
+
 void PBillboardRenderer::RenderGeometry( PEmitterInstance* pEmitter ) 
 {
-    if (m_RenderBin.getNVert() == 0) return;
+    if (m_RenderBin.getNVert() == 0 && m_Queue.GetNQuads() == 0) return;
     ICamera* pCam = GetCamera();
     if (!pCam) return;
 
@@ -2064,7 +2093,7 @@ void PBillboardRenderer::RenderGeometry( PEmitterInstance* pEmitter )
         pCam->Render();    
 
         IRS->SetShaderAutoVars();
-        DrawPrimBM( m_RenderBin );
+        DrawBatch();
 
         pCam->ShiftZ( shiftZ );
         pCam->Render();    
@@ -2072,10 +2101,11 @@ void PBillboardRenderer::RenderGeometry( PEmitterInstance* pEmitter )
     else
     {
         IRS->SetShaderAutoVars();
-        DrawPrimBM( m_RenderBin );
+        DrawBatch();
     }
     m_RenderBin.setNVert( 0 );
     m_RenderBin.setNPri( 0 );
+    m_Queue.Clear();
 } // PBillboardRenderer::RenderGeometry
 
 void PBillboardRenderer::Expose( PropertyMap& pm )
@@ -2098,6 +2128,81 @@ void PBillboardRenderer::Unserialize( InStream& is )
     is >> Enum2Byte( m_Alignment ) >> m_RefPoint;
 }
 
+/*---------------------------------------------------------------*/
+/*  Func:    BenchmarkBillboards
+/*    Desc:    Times expansion and drawing of nQuads billboards per
+/*          frame: quad by quad into the render bin, copied into the
+/*          shared dynamic buffer, and from the streams right into
+/*          the ring buffer. Draws with the current render state
+/*---------------------------------------------------------------*/
+bool BenchmarkBillboards( int nQuads, int nFrames )
+{
+    if (nQuads <= 0 || nFrames <= 0) return false;
+
+    BaseMesh bin;
+    bin.create( c_ParticleRenderBinSize, 0, vfVertex2t );
+    bin.setIsQuadList( true );
+
+    BillboardBasis basis;
+    basis.m_Right   = Vector3D::oX;
+    basis.m_Up      = Vector3D::oY;
+    basis.m_Origin  = Vector3D::null;
+    basis.m_RefX    = 0.5f;
+    basis.m_RefY    = 0.5f;
+
+    Matrix4D alignTM = Matrix4D::identity;
+    Rct uv( 0.0f, 0.0f, 1.0f, 1.0f );
+
+    std::vector<Vector3D> pos( nQuads );
+    for (int i = 0; i < nQuads; i++)
+    {
+        pos[i] = Vector3D( float( (i*37)%1024 ), float( (i*53)%768 ), float( i%64 ) );
+    }
+
+    BillboardQueue queue;
+    g_BillboardRing.ResetStats();
+    Timer timer;
+    double tSingle = 0.0, tBatched = 0.0;
+    for (int f = 0; f < nFrames; f++)
+    {
+        timer.start();
+        for (int i = 0; i < nQuads; i++)
+        {
+            if (bin.getNVert() + 4 >= c_ParticleRenderBinSize)
+            {
+                DrawPrimBM( bin );
+                bin.setNVert( 0 );
+                bin.setNPri( 0 );
+            }
+            AddQuad<Vertex2t>( bin, pos[i], 16.0f, 16.0f, 0.5f, 0.5f, float( i%7 )*0.1f, 
+                                0xFFFFFFFF, uv, uv, alignTM );
+        }
+        if (bin.getNVert() > 0) DrawPrimBM( bin );
+        bin.setNVert( 0 );
+        bin.setNPri( 0 );
+        tSingle += timer.seconds();
+
+        timer.start();
+        queue.BeginRun( basis );
+        for (int i = 0; i < nQuads; i++)
+        {
+            queue.Add( pos[i], 16.0f, 16.0f, float( i%7 )*0.1f, 0xFFFFFFFF, uv, uv );
+        }
+        queue.Draw();
+        tBatched += timer.seconds();
+    }
+
+    double total = double( nQuads )*double( nFrames );
+    Log.Info( "Billboard benchmark: %d quads, %d frames", nQuads, nFrames );
+    Log.Info( "  single, render bin:     %.1f quads/ms, %.2fms per frame", 
+                tSingle > 0.0 ? total/(tSingle*1000.0) : 0.0, tSingle*1000.0/double( nFrames ) );
+    Log.Info( "  batched, ring buffer:   %.1f quads/ms, %.2fms per frame", 
+                tBatched > 0.0 ? total/(tBatched*1000.0) : 0.0, tBatched*1000.0/double( nFrames ) );
+    Log.Info( "  ring expansion only:    %.1f quads/ms, %d wraps", 
+                g_BillboardRing.GetQuadsPerMs(), g_BillboardRing.GetNWraps() );
+    return true;
+} // BenchmarkBillboards
+
 /*****************************************************************************/
 /*    PConeRenderer implemetation
 /*****************************************************************************/
@@ -4638,6 +4743,7 @@ void PEffectManager::Pause( bool bPause )
 
 DWORD PEffectManager::InstanceEffect( DWORD effID )
 {
+    if (FrameRecorder::s_bActive) FrameRecorder::RecordEffect( effID, Matrix4D::identity );
     PEmitter* pEff = dynamic_cast<PEmitter*>(NodePool::GetNode( effID ));
     if (!pEff || !pEff->IsA<PEmitter>()) return 0xFFFFFFFF;
     DWORD res = SpawnEmitter( pEff );
@@ -4646,6 +4752,7 @@ DWORD PEffectManager::InstanceEffect( DWORD effID )
 
 DWORD PEffectManager::InstanceEffect( DWORD effID,Matrix4D& TM )
 {
+    if (FrameRecorder::s_bActive) FrameRecorder::RecordEffect( effID, TM );
     PEmitter* pEff = dynamic_cast<PEmitter*>(NodePool::GetNode( effID ));
     if (!pEff || !pEff->IsA<PEmitter>()) return 0xFFFFFFFF;
     DWORD res = SpawnEmitter( pEff,-1,-1,false,0xFFFFFFFF,&TM );
@@ -5527,9 +5634,8 @@ int PEffectManager::GetEffectSetID( const char* fileName )
 {
     int id = m_EffectSet.size();
     if (!fileName) return - 1;
-    FInStream is( fileName );
-    if (is.NoFile()) return -1;
-    XMLNode root( is );
+    XMLNode root;
+    if (!LoadXMLCached( fileName, root )) return -1;
     int nEff = root.GetNChildren();
     XMLNode* pChild = root.FirstChild();
     EffectSet effSet;
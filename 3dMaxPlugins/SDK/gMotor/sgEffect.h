@@ -8,6 +8,7 @@
 #include "IEffectManager.h"
 #include "kHash.hpp"
 #include "kContext.h"
+#include "vBillboardBatch.h"
 
 /*****************************************************************************/
 /*    Enum:    EffectBlendMode
@@ -1248,6 +1249,9 @@ class PBillboardRenderer : public PRenderer
 {
     BillboardAlignment      m_Alignment;
     Vector3D                m_RefPoint;
+    BillboardQueue          m_Queue;        //  quads of the batched path, drawn through the ring buffer
+
+    void                    DrawBatch            ();
 
 public:
                             PBillboardRenderer   ();
@@ -1258,6 +1262,8 @@ public:
     virtual bool            FillGeometry         ( PEmitterInstance* pEmitter );
     virtual void            RenderGeometry       ( PEmitterInstance* pEmitter );
 
+    static bool             s_bBatched;     //  expand quads from the streams instead of AddQuad
+
     DECLARE_SCLASS(PBillboardRenderer,PRenderer,2BRE);
 }; // class PBillboardRenderer
 
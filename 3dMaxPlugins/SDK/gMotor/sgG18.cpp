@@ -9,6 +9,8 @@
 #include "kResource.h"
 #include "sgSpriteManager.h"
 #include "sgG18.h"
+#include "kTimer.h"
+#include "FG18G15.h"
 
 
 /*****************************************************************************/
@@ -29,7 +31,77 @@ const char*    G18Creator::Description() const
     return "G18 Sprite Loader";
 } // G18Creator::Description
 
+/*****************************************************************************/
+/*    G18 decoding benchmark
+/*****************************************************************************/
+bool BenchmarkG18Decode( const char* fileName, int maxThreads, int framesPerBlock )
+{
+    FInStream is( fileName );
+    if (is.NoFile()) 
+    {
+        Log.Warning( "G18 benchmark: could not open <%s>", fileName );
+        return false;
+    }
+    std::vector<BYTE> g18( is.GetFileSize() );
+    if (g18.size() == 0 || is.Read( &g18[0], g18.size() ) != g18.size()) return false;
+    is.Close();
+
+    if (maxThreads <= 0)
+    {
+        SYSTEM_INFO sysInfo;
+        GetSystemInfo( &sysInfo );
+        maxThreads = sysInfo.dwNumberOfProcessors;
+    }
+    if (maxThreads > G18_MAX_THREADS) maxThreads = G18_MAX_THREADS;
+
+    FGA_G18Unpacker* pUnpacker = G18CreateUnpacker();
+    BYTE*   pRef    = NULL;
+    unsigned refLen = 0;
+    Timer   timer;
+    timer.start();
+    bool bOK = G18UnpackMemory( pUnpacker, &pRef, &refLen, &g18[0], g18.size(), 1 );
+    double refTime = timer.seconds();
+    if (!bOK)
+    {
+        Log.Warning( "G18 benchmark: <%s> is not a valid G18 file", fileName );
+        G18DestroyUnpacker( pUnpacker );
+        return false;
+    }
+    Log.Info( "G18 benchmark <%s>: %dK packed, %dK unpacked", fileName, g18.size()/1024, refLen/1024 );
+    Log.Info( "  single stream: %.2fms, %.2fMB/s", refTime*1000.0, double( refLen )/(refTime*1024.0*1024.0) );
 
+    BYTE*   pBlocked    = NULL;
+    unsigned blockedLen = 0;
+    if (!G18MakeBlocked( &pBlocked, &blockedLen, &g18[0], g18.size(), framesPerBlock ))
+    {
+        delete []pRef;
+        G18DestroyUnpacker( pUnpacker );
+        return false;
+    }
+    Log.Info( "  blocked by %d frames: %dK packed (%+.1f%%)", framesPerBlock, blockedLen/1024, 
+                100.0*(double( blockedLen ) - double( g18.size() ))/double( g18.size() ) );
 
+    for (int nThreads = 1; nThreads <= maxThreads; nThreads++)
+    {
+        BYTE*   pOut    = NULL;
+        unsigned outLen = 0;
+        timer.start();
+        bOK = G18UnpackMemory( pUnpacker, &pOut, &outLen, pBlocked, blockedLen, nThreads );
+        double t = timer.seconds();
+        if (!bOK || outLen != refLen || memcmp( pOut, pRef, refLen ) != 0)
+        {
+            Log.Error( "G18 benchmark: blocked unpacking on %d threads does not match the single stream", nThreads );
+            delete []pOut;
+            bOK = false;
+            break;
+        }
+        Log.Info( "  %d thread(s): %.2fms, %.2fMB/s, x%.2f", nThreads, t*1000.0, 
+                    double( outLen )/(t*1024.0*1024.0), refTime/t );
+        delete []pOut;
+    }
 
-    
+    delete []pBlocked;
+    delete []pRef;
+    G18DestroyUnpacker( pUnpacker );
+    return bOK;
+} // BenchmarkG18Decode
@@ -24,4 +24,12 @@ public:
 
 
 
+/*****************************************************************************/
+/*    Func:    BenchmarkG18Decode
+/*    Desc:    Unpacks .G18 file to GU15 single-threaded, recodes it into the
+/*             blocked variant and unpacks it on 1..maxThreads threads, 
+/*             logging the throughput. maxThreads == 0 means number of cores
+/*****************************************************************************/
+bool BenchmarkG18Decode( const char* fileName, int maxThreads = 0, int framesPerBlock = 32 );
+
 #endif // __SGG18_H__
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include "kResource.h"
 #include "sgSpriteManager.h"
 #include "sgGQuad.h"
+#include "sgSpriteTexCache.h"
+#include "kTimer.h"
 
 #ifndef _INLINES
 #include "sgGQuad.inl"
@@ -17,6 +19,35 @@
 /*****************************************************************************/
 /*    QuadSpritePackage implementation
 /*****************************************************************************/
+QuadSpritePackage::QuadSpritePackage()
+{
+}
+
+QuadSpritePackage::~QuadSpritePackage()
+{
+    for (int i = 0; i < m_TexCache.size(); i++) delete m_TexCache[i];
+}
+
+FrameInstance* QuadSpritePackage::CreateFrameInstance( int frameID, DWORD color, int lod, int nChunks )
+{
+    int nExtra = nChunks * (sizeof( FrameChunk ) + sizeof( FrameVert )*4);
+
+    //  allocate frame instance from the pool
+    FrameInstance* pInst = g_SpriteManager.AllocFrameInstance( nExtra );
+    if (!pInst) return NULL;
+    pInst->SetNChunks   ( nChunks, (void*)(pInst + 1) );
+    pInst->SetSeqID     ( m_ID       ); 
+    pInst->SetFrameID   ( frameID    );
+    pInst->SetColor     ( color      );
+    pInst->SetLOD       ( lod        );
+    pInst->SetWidth     ( GetFrameWidth ( frameID ) );
+    pInst->SetHeight    ( GetFrameHeight( frameID ) );
+    DWORD instID = g_SpriteManager.AddFrameInstance( pInst );
+    pInst->SetID        ( instID     );
+    pInst->Drop();
+    return pInst;
+} // QuadSpritePackage::CreateFrameInstance
+
 FrameInstance* QuadSpritePackage::PrecacheFrame( int sprID, DWORD color, int lod ) 
 { 
     //  create and init frame instance
@@ -25,6 +56,13 @@ FrameInstance* QuadSpritePackage::PrecacheFrame( int sprID, DWORD color, int lod
     if (sprID < 0 || sprID >= m_NFrames) return NULL;
     _chdir( IRM->GetHomeDirectory() );
 
+    //  transcoded pages need neither unpacking nor surface allocation
+    if (lod == 0)
+    {
+        SpriteTexCache* pCache = GetTexCache( color );
+        if (pCache) return PrecacheTexCacheFrame( pCache, sprID, color );
+    }
+
     //  extract pointer to the packed segment data for this frame
     DWORD nFrames, dataSize, firstInSeg, segIdx;
     DWORD frameOffset[c_MaxFramesInPackedSegment];
@@ -44,22 +82,8 @@ FrameInstance* QuadSpritePackage::PrecacheFrame( int sprID, DWORD color, int lod
         FrameInstance* cInst = g_SpriteManager.FindFrameInstance( m_ID, curFrame, color, lod );
         if (!cInst)
         {
-            int nChunks    = GetFrameNSquares( curFrame );
-            int nExtra    = nChunks * (sizeof( FrameChunk ) + sizeof( FrameVert )*4);
-
-            //  allocate frame instance from the pool
-            cInst = g_SpriteManager.AllocFrameInstance( nExtra );
-            if (!cInst) return false;
-            cInst->SetNChunks   ( nChunks, (void*)(cInst + 1) );
-            cInst->SetSeqID     ( m_ID       ); 
-            cInst->SetFrameID   ( curFrame   );
-            cInst->SetColor     ( color      );
-            cInst->SetLOD       ( lod        );
-            cInst->SetWidth     ( GetFrameWidth ( curFrame ) );
-            cInst->SetHeight    ( GetFrameHeight( curFrame ) );
-            DWORD sprID = g_SpriteManager.AddFrameInstance( cInst );
-            cInst->SetID        ( sprID      );
-            cInst->Drop();
+            cInst = CreateFrameInstance( curFrame, color, lod, GetFrameNSquares( curFrame ) );
+            if (!cInst) return NULL;
         }
 
         if (!cInst->IsCached()) 
@@ -85,10 +109,12 @@ FrameInstance* QuadSpritePackage::PrecacheFrame( int sprID, DWORD color, int lod
 
                 //  allocate chunk on the surface    
                 WORD ax, ay;
-                surfID = g_SpriteManager.AllocateQuad( sidePow, ax, ay, cInst, surfID );
+                surfID = g_SpriteManager.AllocateQuad( sidePow, ax, ay, cInst, surfID, i );
                 if (surfID == -1)
                 {
                     Log.Error( "Could not cache frame from sprite package: %s", GetName() );
+                    cInst->Unlock();
+                    g_SpriteManager.ReleaseFrameInstance( cInst, i );
                     return NULL;
                 }
 
@@ -169,6 +195,7 @@ FrameInstance* QuadSpritePackage::PrecacheFrame( int sprID, DWORD color, int lod
             cInst->Unlock();
 
             cInst->SetSegIdx( segIdx    );
+            cInst->SetUseStamp( g_SpriteManager.GetFrameStamp() );
             cInst->SetBounds( minX, minY, maxX - minX, maxY - minY );
             cInst->SetZBounds( 0.0f, 0.0f );
         }
@@ -177,6 +204,138 @@ FrameInstance* QuadSpritePackage::PrecacheFrame( int sprID, DWORD color, int lod
     return pInst; 
 } // QuadSpritePackage::PrecacheFrame
 
+/*---------------------------------------------------------------------------*/
+/*    Func:    QuadSpritePackage::GetTexCache
+/*    Desc:    Returns transcoded pages for the color, loading them on the 
+/*             first request. Missing or stale caches are remembered as well,
+/*             so the file is looked up once per color
+/*---------------------------------------------------------------------------*/
+SpriteTexCache* QuadSpritePackage::GetTexCache( DWORD color )
+{
+    if (!SpriteTexCache::s_bEnabled) return NULL;
+    for (int i = 0; i < m_TexCache.size(); i++)
+    {
+        SpriteTexCache* pCache = m_TexCache[i];
+        if (pCache->GetColor() != color) continue;
+        return pCache->IsValid() ? pCache : NULL;
+    }
+
+    SpriteTexCache* pCache = new SpriteTexCache();
+    m_TexCache.push_back( pCache );
+    char fname[_MAX_PATH];
+    SpriteTexCache::GetFileName( GetPath(), color, fname );
+    Timer timer;
+    timer.start();
+    if (!pCache->Load( fname, this, color )) return NULL;
+    Log.Info( "Sprite texture cache <%s>: %d pages, %dK, loaded in %.2fms", 
+                fname, pCache->GetNPages(), pCache->GetTextureBytes()/1024, timer.seconds()*1000.0 );
+    return pCache;
+} // QuadSpritePackage::GetTexCache
+
+FrameInstance* QuadSpritePackage::PrecacheTexCacheFrame( SpriteTexCache* pCache, int sprID, DWORD color )
+{
+    const SpriteTexFrame& frame = pCache->GetFrame( sprID );
+    FrameInstance* pInst = g_SpriteManager.FindFrameInstance( m_ID, sprID, color, 0 );
+    if (!pInst) pInst = CreateFrameInstance( sprID, color, 0, frame.m_NChunks );
+    if (!pInst) return NULL;
+    if (pInst->IsCached()) return pInst;
+
+    FrameVert* v = (FrameVert*)((BYTE*)(pInst + 1) + pInst->m_NChunks*sizeof(FrameChunk));
+    float texel = 1.0f/float( pCache->GetPageSide() );
+    int minX =  INT_MAX;
+    int minY =  INT_MAX;
+    int maxX = -INT_MAX;
+    int maxY = -INT_MAX;
+
+    int nChunks = pInst->GetNChunks();
+    for (int i = 0; i < nChunks; i++)
+    {
+        const SpriteTexChunk& tc = pCache->GetChunk( frame.m_FirstChunk + i );
+        FrameChunk& chunk = pInst->m_Chunk[i];
+        int texID = pCache->GetPageTexID( tc.m_Page );
+        if (texID == -1) return NULL;
+
+        int     x   = tc.m_X;
+        int     y   = tc.m_Y;
+        int     s   = tc.m_Side;
+        float   u0  = float( tc.m_U     )*texel;
+        float   v0  = float( tc.m_V     )*texel;
+        float   u1  = float( tc.m_U + s )*texel;
+        float   v1  = float( tc.m_V + s )*texel;
+
+        v[0].x = x;     v[0].y = y;     v[0].z = 0.0f; v[0].u = u0; v[0].v = v0; v[0].color = 0xFF808080;
+        v[1].x = x + s; v[1].y = y;     v[1].z = 0.0f; v[1].u = u1; v[1].v = v0; v[1].color = 0xFF808080;
+        v[2].x = x;     v[2].y = y + s; v[2].z = 0.0f; v[2].u = u0; v[2].v = v1; v[2].color = 0xFF808080;
+        v[3].x = x + s; v[3].y = y + s; v[3].z = 0.0f; v[3].u = u1; v[3].v = v1; v[3].color = 0xFF808080;
+
+        minX = tmin( minX, x );
+        minY = tmin( minY, y );
+        maxX = tmax( maxX, x + s );
+        maxY = tmax( maxY, y + s );
+
+        //  pages are not sprite manager surfaces, chunks reference the texture directly
+        chunk.m_NVert        = 4;
+        chunk.m_NTri         = 2;
+        chunk.m_Vert         = v;
+        chunk.m_Idx          = NULL;
+        chunk.m_SurfaceID    = texID;
+        chunk.m_TextureID    = texID;
+        v += 4;
+    }
+
+    pInst->SetSegIdx( frame.m_SegIdx );
+    pInst->SetBounds( minX, minY, maxX - minX, maxY - minY );
+    pInst->SetZBounds( 0.0f, 0.0f );
+    INC_COUNTER( SpriteTexCacheFrames, 1 );
+    return pInst;
+} // QuadSpritePackage::PrecacheTexCacheFrame
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    QuadSpritePackage::Transcode
+/*    Desc:    Builds texture pages of the package for the color, saves them 
+/*             next to the package and reports the decode time, texture 
+/*             memory and image quality against the 4444 texels
+/*---------------------------------------------------------------------------*/
+bool QuadSpritePackage::Transcode( DWORD color )
+{
+    _chdir( IRM->GetHomeDirectory() );
+    SpriteTexCache* pCache = NULL;
+    for (int i = 0; i < m_TexCache.size(); i++)
+    {
+        if (m_TexCache[i]->GetColor() == color) pCache = m_TexCache[i];
+    }
+    if (!pCache)
+    {
+        pCache = new SpriteTexCache();
+        m_TexCache.push_back( pCache );
+    }
+
+    SpriteTexReport rep;
+    if (!pCache->Build( this, color, &rep )) return false;
+    char fname[_MAX_PATH];
+    SpriteTexCache::GetFileName( GetPath(), color, fname );
+    if (!pCache->Save( fname )) return false;
+
+    //  time the load path the runtime takes on the next session
+    SpriteTexCache loaded;
+    Timer timer;
+    timer.start();
+    bool bLoaded = loaded.Load( fname, this, color );
+    double loadMs = timer.seconds()*1000.0;
+    if (!bLoaded) return false;
+
+    Log.Info( "Transcoded <%s>, color %08X: %d frames, %d chunks, %d pages (%d DXT5)",
+                GetName(), color, rep.m_NFrames, rep.m_NChunks, rep.m_NPages, rep.m_NDXT5Pages );
+    Log.Info( "  decode: %.2fms (%.3fms per frame), layout and compression: %.2fms", 
+                rep.m_DecodeMs, rep.m_DecodeMs/float( tmax( rep.m_NFrames, 1 ) ), rep.m_EncodeMs );
+    Log.Info( "  cache load: %.2fms (%.1fx faster than decode)", 
+                loadMs, loadMs > 0.0 ? rep.m_DecodeMs/loadMs : 0.0 );
+    Log.Info( "  texture memory: %dK as 4444, %dK as DXT pages",
+                rep.m_Bytes4444/1024, rep.m_BytesDXT/1024 );
+    Log.Info( "  PSNR: %.2fdB mean, %.2fdB min", rep.m_MeanPSNR, rep.m_MinPSNR );
+    return true;
+} // QuadSpritePackage::Transcode
+
 DWORD QuadSpritePackage::GetAlpha( FrameInstance* frameInst, int ptX, int ptY, bool bPrecise )
 {
     float fX = ptX;
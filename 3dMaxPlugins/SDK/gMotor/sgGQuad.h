@@ -38,19 +38,33 @@ private:
     BYTE            data[8]; //  dummy data. Don't touch it with dirty hands
 }; // class FrameChunkHeader
 
+class SpriteTexCache;
 /*****************************************************************************/
 /*    Class:    QuadSpritePackage
+/*    Desc:    LOD 0 frames are taken from the transcoded texture pages
+/*             (SpriteTexCache) when the package has them for the color
 /*****************************************************************************/
 class QuadSpritePackage : public SpritePackage
 {
 public:
+                                QuadSpritePackage();
+    virtual                     ~QuadSpritePackage();
+
     virtual FrameInstance*      PrecacheFrame    ( int sprID, DWORD color = 0, int lod = 0 );
     virtual const BYTE*         GetSegmentData   ( DWORD sprID, DWORD& dataSize, DWORD& segIdx, 
                                                     DWORD& firstInSeg, DWORD& nFrames, 
                                                     DWORD* frameOffset, DWORD color = 0 ){ return NULL; }
     virtual DWORD               GetAlpha         ( FrameInstance* frameInst, int ptX, int ptY, bool bPrecise = false );
+    virtual bool                Transcode        ( DWORD color );
+
+protected:
+    FrameInstance*              CreateFrameInstance ( int frameID, DWORD color, int lod, int nChunks );
+    SpriteTexCache*             GetTexCache         ( DWORD color );
+    FrameInstance*              PrecacheTexCacheFrame( SpriteTexCache* pCache, int sprID, DWORD color );
 
-}; // class GU2DPackage
+private:
+    std::vector<SpriteTexCache*>    m_TexCache;     //  per national color, including the failed loads
+}; // class QuadSpritePackage
 
 
 
@@ -32,10 +32,34 @@ void Geometry::Serialize( OutStream& os ) const
     os << m_Mesh;
 } // Geometry::Serialize
 
+//  same as operator >>( InStream&, BaseMesh& ), but mesh data goes to the node block
+static void UnserializeMeshInBlock( InStream& is, BaseMesh& bm )
+{
+    int             nV, nI, nPri;
+    BYTE            flags;
+    VertexFormat    vf;
+    PrimitiveType   pt;
+
+    is >> nV >> nI >> nPri >> flags;
+    is.Read( &vf, sizeof( vf ) );
+    is.Read( &pt, sizeof( pt ) );
+
+    BYTE* pData = SNode::AllocInBlock( Primitive::getBlockSize( nV + 2, nI, vf ), 32 );
+    if (pData) bm.createInBlock( nV + 2, nI, vf, pt, pData );
+    else bm.create( nV + 2, nI, vf, pt );
+    if (nV > 0) is.Read( bm.getVertexData(), nV * Vertex::GetStride( vf ) );
+    if (nI > 0) is.Read( bm.getIndices(), nI * 2 );
+
+    bm.setNVert     ( nV    );
+    bm.setNInd      ( nI    );
+    bm.setNPri      ( nPri  );
+    bm.SetFlagsByte ( flags );
+} // UnserializeMeshInBlock
+
 void Geometry::Unserialize( InStream& is ) 
 {
     Parent::Unserialize( is );
-    is >> m_Mesh;
+    if (SNode::HasBlock()) UnserializeMeshInBlock( is, m_Mesh ); else is >> m_Mesh;
     m_AABB = m_Mesh.GetAABB();
 } // Geometry::Serialize
 
@@ -78,8 +102,9 @@ void Geometry::PostRender()
     }
 } // Geometry::PostRender
 
-int Geometry::s_VBuffer = -1;
-int Geometry::s_IBuffer = -1;
+int  Geometry::s_VBuffer     = -1;
+int  Geometry::s_IBuffer     = -1;
+bool Geometry::s_bDeferFlush = false;
 
 void Geometry::Render()
 {
@@ -133,7 +158,7 @@ void Geometry::Render()
     rt.m_bHasTM         = true; 
     rt.m_TM             = TransformNode::TMStackTop();     
     
-    IRS->Flush();
+    if (!s_bDeferFlush) IRS->Flush();
     PostRender();
 } // Geometry::Render
 
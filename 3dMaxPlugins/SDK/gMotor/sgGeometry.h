@@ -31,6 +31,7 @@ class Geometry : public SNode, public IGeometry
 
     static int          s_VBuffer;
     static int          s_IBuffer;
+    static bool         s_bDeferFlush;  //  when set, render tasks are left queued for the batch
 
 protected:
     BaseMesh            m_Mesh;                //  mesh data
@@ -99,6 +100,9 @@ public:
 
     void                PostRender      ();
 
+    static void         SetDeferFlush   ( bool bDefer ) { s_bDeferFlush = bDefer; }
+    static bool         IsDeferFlush    () { return s_bDeferFlush; }
+
     DECLARE_SCLASS(Geometry,SNode,GEOM);
 }; // class Geometry 
 
@@ -13,6 +13,7 @@
 #include "sgGeometry.h"
 #include "kFilePath.h"
 #include "vSkin.h"
+#include "sgModelBake.h"
 
 IMPLEMENT_CLASS(Model);
 
@@ -38,20 +39,24 @@ bool Model::Reload()
 {
     int resID = IRM->FindResource( m_FileName.c_str() );
     if (resID == -1) return false;
-    InStream& is = IRM->LockResource( m_FileName.c_str() );
-
     FilePath path( IRM->GetPath( resID ) );
     _chdir( path.GetDrive() );
     _chdir( path.GetDir() );
 
-    SNode* pModel = SNode::UnserializeSubtree( is );            
-    is.Close();
+    SNode* pModel = LoadBakedModel( IRM->GetFullPath( resID ) );
+    bool bBaked = (pModel != NULL);
+    if (!bBaked)
+    {
+        InStream& is = IRM->LockResource( m_FileName.c_str() );
+        pModel = SNode::UnserializeSubtree( is );            
+        is.Close();
+    }
     _chdir( IRM->GetHomeDirectory() );
 
     if (!pModel) return c_BadID;
 
     PrefetchTextures( pModel, path );
-    pModel = CompileModel( (SNode*)pModel, path.GetFullPath() );
+    if (!bBaked) pModel = CompileModel( (SNode*)pModel, path.GetFullPath() );
 
     if (pModel->IsA<Model>()) 
     {
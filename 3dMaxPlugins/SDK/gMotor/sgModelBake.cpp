@@ -0,0 +1,226 @@
+/*****************************************************************************/
+/*    File:    sgModelBake.cpp
+/*    Desc:    Baked model file format
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#include "stdafx.h"
+#include "sgNodePool.h"
+#include "sgNode.h"
+#include "sgGeometry.h"
+#include "IMediaManager.h"
+#include "kFilePath.h"
+#include "kDirIterator.h"
+#include "kFileMapping.h"
+#include "sgModelBake.h"
+
+SNode* CompileModel( SNode* pRoot, const char* path );
+
+static bool GetFileStamp( const char* path, DWORD& size, FILETIME& time )
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesEx( path, GetFileExInfoStandard, &attr )) return false;
+    size = attr.nFileSizeLow;
+    time = attr.ftLastWriteTime;
+    return true;
+} // GetFileStamp
+
+static bool IsHeaderValid( const BakedModelHeader& hdr, DWORD fileSize, const char* srcPath )
+{
+    if (fileSize < sizeof( BakedModelHeader )   ||
+        hdr.m_Magic    != c_BakedModelMagic     ||
+        hdr.m_Version  != c_BakedModelVersion   ||
+        hdr.m_FileSize != fileSize              ||
+        hdr.m_NNodes   == 0                     ||
+        hdr.m_NNodes   > fileSize/sizeof( DWORD ) ||
+        hdr.m_TableOffset < sizeof( BakedModelHeader ) ||
+        hdr.m_TableOffset > fileSize - hdr.m_NNodes*sizeof( DWORD ) ||
+        hdr.m_DataOffset < hdr.m_TableOffset + hdr.m_NNodes*sizeof( DWORD ) ||
+        hdr.m_DataOffset > fileSize             ||
+        hdr.m_BlockSize == 0                    ||
+        hdr.m_BlockSize/64 > fileSize)          //  nodes are never that much larger than their records
+    {
+        return false;
+    }
+
+    DWORD    srcSize = 0;
+    FILETIME srcTime;
+    if (!GetFileStamp( srcPath, srcSize, srcTime )) return false;
+    return (srcSize == hdr.m_SrcSize && CompareFileTime( &srcTime, &hdr.m_SrcTime ) == 0);
+} // IsHeaderValid
+
+//  every record (class magic, block size, block) must lie within the data
+static bool AreRecordsValid( const BYTE* pData, const BakedModelHeader& hdr )
+{
+    const DWORD* pOffsets = (const DWORD*)(pData + hdr.m_TableOffset);
+    DWORD dataSize = hdr.m_FileSize - hdr.m_DataOffset;
+    for (DWORD i = 0; i < hdr.m_NNodes; i++)
+    {
+        DWORD offset = pOffsets[i];
+        if (offset > dataSize || dataSize - offset < 2*sizeof( DWORD )) return false;
+        DWORD nBytes = *((const DWORD*)(pData + hdr.m_DataOffset + offset) + 1);
+        if (nBytes > dataSize - offset - 2*sizeof( DWORD )) return false;
+    }
+    return true;
+} // AreRecordsValid
+
+static int AlignBlockPos( int pos, int align )
+{
+    return (pos + align - 1)&~(align - 1);
+} // AlignBlockPos
+
+//  replays allocations of LoadBakedModel: node object, then mesh data of the geometry
+static int CalcBlockSize( const std::vector<SNode*>& nodes )
+{
+    int pos = 0;
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        int objSize = nodes[i]->GetAllocSize();
+        if (objSize == 0) return 0;
+        pos = AlignBlockPos( pos, 8 ) + objSize + c_NodeAllocHeaderSize;
+        const Geometry* pGeom = dynamic_cast<const Geometry*>( nodes[i] );
+        if (pGeom)
+        {
+            const BaseMesh& bm = pGeom->GetMesh();
+            pos = AlignBlockPos( pos, 32 ) + 
+                    Primitive::getBlockSize( bm.getNVert() + 2, bm.getNInd(), bm.getVertexFormat() );
+        }
+    }
+    return pos;
+} // CalcBlockSize
+
+void GetBakedModelPath( const char* srcPath, char* bakedPath )
+{
+    FilePath path( srcPath );
+    path.SetExt( c_BakedModelExt );
+    strcpy( bakedPath, path.GetFullPath() );
+} // GetBakedModelPath
+
+bool IsBakedModelValid( const char* srcPath )
+{
+    char bakedPath[_MAX_PATH];
+    GetBakedModelPath( srcPath, bakedPath );
+    FInStream is( bakedPath );
+    if (is.NoFile()) return false;
+    BakedModelHeader hdr;
+    if (is.Read( &hdr, sizeof( hdr ) ) != sizeof( hdr )) return false;
+    return IsHeaderValid( hdr, is.GetFileSize(), srcPath );
+} // IsBakedModelValid
+
+bool BakeModel( SNode* pModel, const char* srcPath )
+{
+    if (!pModel) return false;
+
+    BakedModelHeader hdr;
+    memset( &hdr, 0, sizeof( hdr ) );
+    if (!GetFileStamp( srcPath, hdr.m_SrcSize, hdr.m_SrcTime )) return false;
+
+    //  first pass gathers record offsets, size of the data and the nodes in record order
+    std::vector<DWORD> offsets;
+    std::vector<SNode*> nodes;
+    CountStream cs;
+    pModel->SerializeSubtree( cs, &offsets, &nodes );
+    if (offsets.size() == 0) return false;
+    hdr.m_BlockSize = CalcBlockSize( nodes );
+    if (hdr.m_BlockSize == 0) return false;
+
+    hdr.m_Magic         = c_BakedModelMagic;
+    hdr.m_Version       = c_BakedModelVersion;
+    hdr.m_NNodes        = offsets.size();
+    hdr.m_TableOffset   = sizeof( BakedModelHeader );
+    hdr.m_DataOffset    = hdr.m_TableOffset + hdr.m_NNodes*sizeof( DWORD );
+    hdr.m_FileSize      = hdr.m_DataOffset + cs.GetNBytes();
+
+    char bakedPath[_MAX_PATH];
+    GetBakedModelPath( srcPath, bakedPath );
+    IRM->CheckFileAccess( bakedPath );
+    FOutStream os( bakedPath );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write baked model <%s>", bakedPath );
+        return false;
+    }
+    os.Write( &hdr, sizeof( hdr ) );
+    os.Write( &offsets[0], hdr.m_NNodes*sizeof( DWORD ) );
+    pModel->SerializeSubtree( os );
+    os.CloseFile();
+    return true;
+} // BakeModel
+
+SNode* LoadBakedModel( const char* srcPath )
+{
+    char bakedPath[_MAX_PATH];
+    GetBakedModelPath( srcPath, bakedPath );
+    if (GetFileAttributes( bakedPath ) == INVALID_FILE_ATTRIBUTES) return NULL;
+
+    FileMapping mapping( bakedPath );
+    BYTE* pData = mapping.GetPointer();
+    if (!pData) return NULL;
+
+    const BakedModelHeader& hdr = *((const BakedModelHeader*)pData);
+    SNode* pRoot = NULL;
+    if (IsHeaderValid( hdr, mapping.GetFileSize(), srcPath ))
+    {
+        if (!AreRecordsValid( pData, hdr ))
+        {
+            Log.Warning( "Baked model <%s> is corrupt", bakedPath );
+            mapping.Close();
+            return NULL;
+        }
+        //  the block lives as long as the model nodes, which are never freed
+        BYTE* pBlock = new BYTE[hdr.m_BlockSize + 32];
+        SNode::BeginBlock( (BYTE*)((UINT_PTR( pBlock ) + 31)&~31), hdr.m_BlockSize );
+        pRoot = SNode::UnserializeSubtree( pData + hdr.m_DataOffset,
+                                           (const DWORD*)(pData + hdr.m_TableOffset),
+                                           hdr.m_NNodes );
+        int nMisses = SNode::EndBlock();
+        if (nMisses > 0)
+        {
+            Log.Warning( "Baked model <%s>: %d allocations did not fit into the node block", 
+                            bakedPath, nMisses );
+        }
+    }
+    mapping.Close();
+    return pRoot;
+} // LoadBakedModel
+
+//  loads and compiles the source model, as the model manager does, without touching 
+//  the model which may be already loaded (and modified by CreateShell)
+static SNode* CompileSourceModel( const char* srcPath )
+{
+    FilePath path( srcPath );
+    _chdir( path.GetDrive() );
+    _chdir( path.GetDir() );
+    SNode* pRoot = NULL;
+    FInStream is( srcPath );
+    if (!is.NoFile()) pRoot = SNode::UnserializeSubtree( is );
+    if (pRoot) pRoot = CompileModel( pRoot, srcPath );
+    _chdir( IRM->GetHomeDirectory() );
+    return pRoot;
+} // CompileSourceModel
+
+int BakeModels( const char* root )
+{
+    int nBaked = 0;
+    DirTreeIterator it( root );
+    it.AddFilter( "c2m" );
+    while (it)
+    {
+        const char* srcPath = it.GetFullFilePath();
+        if (!IsBakedModelValid( srcPath ))
+        {
+            SNode* pModel = CompileSourceModel( srcPath );
+            if (BakeModel( pModel, srcPath ))
+            {
+                nBaked++;
+            }
+            else
+            {
+                Log.Warning( "Could not bake model <%s>", srcPath );
+            }
+            if (pModel) NodePool::DestroyNode( pModel );
+        }
+        ++it;
+    }
+    Log.Info( "Baked %d models in <%s>", nBaked, root );
+    return nBaked;
+} // BakeModels
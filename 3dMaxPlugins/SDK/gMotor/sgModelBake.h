@@ -0,0 +1,50 @@
+/*****************************************************************************/
+/*    File:    sgModelBake.h
+/*    Desc:    Baked model file format
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __SGMODELBAKE_H__
+#define __SGMODELBAKE_H__
+
+class SNode;
+
+const DWORD c_BakedModelMagic   = 'BM2C';
+const DWORD c_BakedModelVersion = 2;
+const char  c_BakedModelExt[]   = "c2b";
+
+/*****************************************************************************/
+/*    Struct:  BakedModelHeader
+/*    Desc:    Header of the baked model file. Baked model is a cache of the
+/*             already compiled model subtree in the node serialization format.
+/*             Node references inside are record indices and record positions
+/*             are offsets, so the file is position-independent. Loading reads
+/*             the records from the memory-mapped view and places all node 
+/*             objects and their mesh data into one block of m_BlockSize bytes,
+/*             so the model costs one allocation plus the small members of the
+/*             nodes (names, child lists, animation keys).
+/*****************************************************************************/
+struct BakedModelHeader
+{
+    DWORD           m_Magic;        //  c_BakedModelMagic
+    DWORD           m_Version;      //  c_BakedModelVersion
+    DWORD           m_SrcSize;      //  size of the source .c2m file
+    FILETIME        m_SrcTime;      //  last write time of the source .c2m file
+    DWORD           m_NNodes;       //  number of node records
+    DWORD           m_TableOffset;  //  offset of the record offsets table (DWORD per node)
+    DWORD           m_DataOffset;   //  offset of the first node record
+    DWORD           m_FileSize;     //  total size of the baked file
+    DWORD           m_BlockSize;    //  size of the block for node objects and mesh data
+}; // struct BakedModelHeader
+
+//  path of the baked file, which corresponds to the given source model path
+void    GetBakedModelPath   ( const char* srcPath, char* bakedPath );
+//  true when baked file exists and was baked from the current source file
+bool    IsBakedModelValid   ( const char* srcPath );
+//  writes compiled model next to its source, model nodes must be created with new
+bool    BakeModel           ( SNode* pModel, const char* srcPath );
+//  loads model from the baked file, if it is up to date, otherwise returns NULL
+SNode*  LoadBakedModel      ( const char* srcPath );
+//  bakes all models in the directory tree, every model is compiled anew from its source
+int     BakeModels          ( const char* root );
+
+#endif // __SGMODELBAKE_H__
@@ -22,6 +22,10 @@ SNode::NodeIdMap         SNode::s_NodeIdMap;
 SNode::NodePtrList       SNode::s_NodeList;
 
 bool                     SNode::s_bRenderTMOnly = false;
+BYTE*                    SNode::s_pBlock        = NULL;
+int                      SNode::s_BlockSize     = 0;
+int                      SNode::s_BlockUsed     = 0;
+int                      SNode::s_NBlockMisses  = 0;
 char                     SNode::NameFilter::m_Name[c_MaxNodeNameLen];
 
 bool SNode::SetChild( int idx, IReflected* pChild ) 
@@ -237,13 +241,57 @@ SNode* SNode::UnserializeSubtree( InStream& is )
     }
 }// SNode::UnserializeSubtree
 
-bool SNode::SerializeSubtree( OutStream& os ) const
+//  unserializes subtree from the in-memory image, where node records are laid 
+//  out as in SerializeSubtree, and pOffsets[i] is offset of i-th record from pData 
+SNode* SNode::UnserializeSubtree( BYTE* pData, const DWORD* pOffsets, int nNodes )
+{
+    if (!pData || !pOffsets || nNodes <= 0) return NULL;
+    s_NodeList.clear();
+    try{
+        for (int i = 0; i < nNodes; i++)
+        {
+            BYTE*   pRecord = pData + pOffsets[i];
+            DWORD   magic   = *((DWORD*)pRecord);
+            DWORD   nBytes  = *((DWORD*)pRecord + 1);
+            SNode*  cNode   = (SNode*)ObjectFactory::instance().Create( magic );
+            if (!cNode && i == 0) return NULL;
+            if (!cNode)
+            {
+                //  keep record indices intact, so references to the node just get dropped
+                Log.Warning( "Could not create node of class <%.4s> from the memory image", &magic );
+                s_NodeList.push_back( NULL );
+                continue;
+            }
+            MemInStream is( pRecord + sizeof( DWORD ), nBytes + sizeof( DWORD ) );
+            cNode->Unserialize( is );
+            s_NodeList.push_back( cNode );
+        }
+
+        SNode* root = s_NodeList[0];
+        for (int i = 0; i < s_NodeList.size(); i++)
+        {
+            if (s_NodeList[i]) s_NodeList[i]->PostUnserialize();
+        }
+        s_NodeList.clear();
+        return root;
+    }
+    catch (...)
+    {
+        Log.Error( "Could not unserialize subtree from the memory image" );
+        s_NodeList.clear();
+        return NULL;
+    }
+} // SNode::UnserializeSubtree
+
+bool SNode::SerializeSubtree( OutStream& os, std::vector<DWORD>* pOffsets, std::vector<SNode*>* pNodes ) const
 {
     s_NodeMap.clear();
     s_NodeList.clear();
 
     PreSerialize();
 
+    if (pOffsets) pOffsets->clear();
+    DWORD curOffset = 0;
     int nNodes = s_NodeList.size();
     for (int i = 0; i < nNodes; i++)
     {
@@ -252,7 +300,11 @@ bool SNode::SerializeSubtree( OutStream& os ) const
         pNode->Serialize( cs );
         int nBytes = cs.GetNBytes();
         pNode->Serialize( os, nBytes );
+        //  record is class magic, block size and the block itself
+        if (pOffsets) pOffsets->push_back( curOffset );
+        curOffset += nBytes + 2*sizeof( DWORD );
     }
+    if (pNodes) *pNodes = s_NodeList;
 
     s_NodeMap.clear();
     s_NodeList.clear();
@@ -260,6 +312,75 @@ bool SNode::SerializeSubtree( OutStream& os ) const
     return true;
 } // SNode::Serialize
 
+struct NodeAllocHeader
+{
+    DWORD           m_Size;         //  size of the node object
+    DWORD           m_Tag;          //  c_NodeHeapTag or c_NodeBlockTag
+}; // struct NodeAllocHeader
+
+const DWORD c_NodeHeapTag   = 'NDHP';
+const DWORD c_NodeBlockTag  = 'NDBL';
+
+void* SNode::operator new( size_t size )
+{
+    assert( sizeof( NodeAllocHeader ) == c_NodeAllocHeaderSize );
+    NodeAllocHeader* pHdr = (NodeAllocHeader*)AllocInBlock( size + c_NodeAllocHeaderSize, 8 );
+    if (pHdr) 
+    {
+        pHdr->m_Tag = c_NodeBlockTag;
+    }
+    else
+    {
+        pHdr = (NodeAllocHeader*)::operator new( size + c_NodeAllocHeaderSize );
+        pHdr->m_Tag = c_NodeHeapTag;
+    }
+    pHdr->m_Size = size;
+    return pHdr + 1;
+} // SNode::operator new
+
+void SNode::operator delete( void* p )
+{
+    if (!p) return;
+    NodeAllocHeader* pHdr = (NodeAllocHeader*)p - 1;
+    //  nodes in the block go away with the block
+    if (pHdr->m_Tag == c_NodeHeapTag) ::operator delete( pHdr );
+} // SNode::operator delete
+
+void SNode::BeginBlock( BYTE* pBlock, int size )
+{
+    s_pBlock        = pBlock;
+    s_BlockSize     = size;
+    s_BlockUsed     = 0;
+    s_NBlockMisses  = 0;
+} // SNode::BeginBlock
+
+int SNode::EndBlock()
+{
+    s_pBlock    = NULL;
+    s_BlockSize = 0;
+    return s_NBlockMisses;
+} // SNode::EndBlock
+
+BYTE* SNode::AllocInBlock( int size, int align )
+{
+    if (!s_pBlock) return NULL;
+    int pos = (s_BlockUsed + align - 1)&~(align - 1);
+    if (pos + size > s_BlockSize)
+    {
+        s_NBlockMisses++;
+        return NULL;
+    }
+    s_BlockUsed = pos + size;
+    return s_pBlock + pos;
+} // SNode::AllocInBlock
+
+int SNode::GetAllocSize() const
+{
+    const NodeAllocHeader* pHdr = (const NodeAllocHeader*)dynamic_cast<const void*>( this ) - 1;
+    if (pHdr->m_Tag != c_NodeHeapTag && pHdr->m_Tag != c_NodeBlockTag) return 0;
+    return pHdr->m_Size;
+} // SNode::GetAllocSize
+
 IReflected* SNode::Clone() const
 {
     CountStream cs;
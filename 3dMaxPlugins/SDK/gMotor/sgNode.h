@@ -20,6 +20,7 @@ class XMLNode;
 
 const int    c_MaxNodePathLen = 512;
 const DWORD    c_BadID             = 0xFFFFFFFF;
+const int    c_NodeAllocHeaderSize = 8;    //  size and tag in front of every node object
 
 class SNode;
 /*****************************************************************************/
@@ -61,6 +62,12 @@ protected:
     static NodePtrList          s_NodeList;
     static bool                 s_bRenderTMOnly;
 
+    //  node block, see BeginBlock
+    static BYTE*                s_pBlock;
+    static int                  s_BlockSize;
+    static int                  s_BlockUsed;
+    static int                  s_NBlockMisses;
+
 public:
     //  node flags operations
     enum NodeFlags
@@ -199,8 +206,10 @@ public:
     virtual void                 Unserialize          ( InStream& is    );
 
     void                         Serialize            ( OutStream& os, DWORD nBytes ) const;
-    bool                         SerializeSubtree     ( OutStream& os ) const;
+    bool                         SerializeSubtree     ( OutStream& os, std::vector<DWORD>* pOffsets = NULL,
+                                                        std::vector<SNode*>* pNodes = NULL ) const;
     static SNode*                UnserializeSubtree   ( InStream& is    );
+    static SNode*                UnserializeSubtree   ( BYTE* pData, const DWORD* pOffsets, int nNodes );
 
     void                         AdjustClonedName     ( const char* name );
     void                         FixInputs            ();
@@ -241,6 +250,21 @@ public:
     static bool                  IsRenderTMOnly       () { return s_bRenderTMOnly; }
     static void                  SetRenderTMOnly      ( bool bVal ) { s_bRenderTMOnly = bVal; }   
 
+    //  node objects keep their size in front of them. Between BeginBlock and EndBlock 
+    //  nodes (and the data they place with AllocInBlock) go to the given block, which 
+    //  is how baked model is loaded with one allocation. Nodes in the block are not 
+    //  freed by delete, the block is owned by the caller and must outlive them
+    static void*                 operator new         ( size_t size );
+    static void                  operator delete      ( void* p );
+    static void                  BeginBlock           ( BYTE* pBlock, int size );
+    //  returns number of the allocations which did not fit and went to the heap
+    static int                   EndBlock             ();
+    static bool                  HasBlock             () { return s_pBlock != NULL; }
+    //  returns NULL when there is no block or no room in it
+    static BYTE*                 AllocInBlock         ( int size, int align );
+    //  size of the node object, 0 when node was not created with new
+    int                          GetAllocSize         () const;
+
 private:
     static SNode*                CreateFromXML        ( XMLNode* pRoot );
 }; // class SNode
@@ -77,6 +77,7 @@ LINK_CLASS( FramerateCursor     );
 //  kangaroo stuff
 LINK_CLASS( PhysicsEditor       );
 LINK_CLASS( StatManager         );
+LINK_CLASS( Benchmarks          );
 
 //  manipulators
 LINK_CLASS( TransformTool       );
@@ -23,14 +23,17 @@
 #include "sgGU15.h"
 #include "sgG2D.h"
 #include "sgGP2.h"
+#include "sgSpriteTexCache.h"
 
 #include "kUtilities.h" 
 #include "kStrUtil.h"
 #include "kBmptool.h"
 #include "kFilePath.h"
 #include "IResourceManager.h"
+#include "kFrameReplay.h"
 
 #include <algorithm>
+#include <xmmintrin.h>
 
 
 #ifndef _INLINES
@@ -289,11 +292,15 @@ bool SpriteSurface::Free()
         }
     }
 
-    for (int i = 0; i < nInst; i++) 
+    //  instances release their chunks on the other surfaces as well
+    while (m_pFrameInstance.size() > 0) 
     {
-        m_pFrameInstance[i]->Drop();
+        FrameInstance* pInst = m_pFrameInstance[0];
+        g_SpriteManager.ReleaseFrameInstance( pInst );
+        ReleaseInstance( pInst );
     }
     m_Layout.Free();
+    m_Chunks.clear();
 
     m_DropStamp = ++s_DropStamp;
     m_pFrameInstance.clear();
@@ -303,9 +310,43 @@ bool SpriteSurface::Free()
     return true;
 } // SpriteSurface::Free
 
+void SpriteSurface::ReleaseInstance( FrameInstance* pInst )
+{
+    for (int i = 0; i < m_Chunks.size(); i++)
+    {
+        const SurfaceChunk& chunk = m_Chunks[i];
+        if (chunk.m_pInst != pInst) continue;
+        m_Layout.FreeChunk( chunk.m_SidePow, chunk.m_X, chunk.m_Y );
+        m_Chunks[i] = m_Chunks.back();
+        m_Chunks.pop_back();
+        i--;
+    }
+    for (int i = 0; i < m_pFrameInstance.size(); i++)
+    {
+        if (m_pFrameInstance[i] != pInst) continue;
+        m_pFrameInstance.erase( i );
+        i--;
+    }
+} // SpriteSurface::ReleaseInstance
+
+void SpriteSurface::GetStats( SpriteSurfaceStats& stats ) const
+{
+    int maxPow = m_Layout.GetLargestFreePow();
+    stats.m_Occupancy       = m_Layout.GetOccupancy();
+    stats.m_Fragmentation   = m_Layout.GetFragmentation();
+    stats.m_NFreePixels     = m_Layout.NumFreePixels();
+    stats.m_LargestFreeSide = maxPow >= 0 ? c_PowSidesWORD[maxPow] : 0;
+    stats.m_NFreeQuads      = m_Layout.GetNFreeQuads();
+    stats.m_NChunks         = m_Chunks.size();
+    stats.m_NInstances      = m_pFrameInstance.size();
+} // SpriteSurface::GetStats
+
 /*****************************************************************/
 /*  SpriteManager implementation
 /*****************************************************************/
+//  Init still skips the shadow surfaces when all of the surfaces fit into video memory
+bool SpriteManager::s_bDefragment = true;
+bool SpriteManager::s_bStreamVertices = true;
 SpriteManager::SpriteManager() 
 {
     SetName( "SpriteManager" );
@@ -320,6 +361,9 @@ SpriteManager::SpriteManager()
     m_pSurfaces            = AddChild<Group>( "Surfaces" );
     m_pPackages            = AddChild<Group>( "Packages" );
     m_CurSurface        = 0;
+    m_DefragSurface     = -1;
+    m_bDefragment       = false;
+    m_FrameStamp        = 1;
     ISM                    = this;
     m_NPackages            = 0;
     m_TotalPackageBytes = 0;
@@ -328,11 +372,20 @@ SpriteManager::SpriteManager()
     m_LockSurfID        = -1;
     m_LockRect          = Rct::unit;
     m_CanvasTex         = -1;
+    m_WarmCursor        = 0;
+    m_hWarmThread       = NULL;
+    m_NWarmLaidOut      = 0;
+    m_NFrameMisses      = 0;
+    m_NStableFrames     = 0;
+    m_StartTime         = 0.0f;
+    m_StableTime        = -1.0f;
+    m_pResTrace         = NULL;
 
 } // SpriteManager::SpriteManager
 
 SpriteManager::~SpriteManager()
 {
+    WaitWarmRead();
     for (int i = 0; i < m_NPackages; i++)
     {
         delete m_PackageReg[i].m_pPackage;
@@ -361,6 +414,8 @@ void SpriteManager::Init()
     float surfSz = c_GPTexSide*c_GPTexSide*2 + 1024;
     int nSurf    = tmin( c_MaxSpriteSurfaces, (int)((texMem*m_VMEMQuote)/surfSz) );
     m_Surface.resize( nSurf );
+    m_bDefragment = s_bDefragment && nSurf < c_MaxSpriteSurfaces;
+    if (m_bDefragment) Log.Info( "SpriteManager: %d surfaces, defragmentation enabled", nSurf );
 
     TextureMemoryPool memPool = tmpDefault;
 
@@ -373,6 +428,11 @@ void SpriteManager::Init()
         int texID = IRS->CreateTexture( texName, c_GPTexSide, c_GPTexSide, cfARGB4444, 1, memPool );
         m_Surface[i].SetTextureID( texID );
         assert( texID != -1 );
+        if (m_bDefragment)
+        {
+            sprintf( texName, "SpriteSurfShadow%02d", i );
+            m_Surface[i].m_ShadowTexID = IRS->CreateTexture( texName, c_GPTexSide, c_GPTexSide, cfARGB4444, 1, tmpSystem );
+        }
         Texture* pTexture = m_pSurfaces->AddChild<Texture>( texName );
         pTexture->SetTexID( m_Surface[i].m_TexID );
     }
@@ -396,6 +456,7 @@ void SpriteManager::Init()
 
     IRS->AddClient( this );
     m_bInited = true;
+    m_StartTime = m_Timer.seconds();
 
     static int shSprite2D = IRS->GetShaderID( "hud" );
     m_Prim.create            ( c_MaxVertDrawn, c_MaxIndDrawn, vfVertexTnL, ptTriangleList );
@@ -415,9 +476,11 @@ void SpriteManager::Purge()
     for (int i = 0; i < m_Surface.size(); i++)
     {
         m_Surface[i].m_Layout.Free();
+        m_Surface[i].m_Chunks.clear();
         m_Surface[i].m_pFrameInstance.clear();
         m_Surface[i].m_DropStamp = m_Surface[i].s_DropStamp++;
     }
+    m_DefragSurface = -1;
 
     for (int i = 0; i < m_NPackages; i++)
     {
@@ -429,6 +492,7 @@ void SpriteManager::Purge()
 
     GU2DPackage::CleanCache();
     GP2Package::CleanCache();
+    SpriteTexCache::CleanCache();
 } // SpriteManager::Purge
 
 DWORD SpriteManager::GetPackageMagic( int gpID )
@@ -622,16 +686,545 @@ void SpriteManager::OnFrame()
 {
     Flush();
     GP2Package::OnFrame();
-
+    UpdateStableFrame();
+    if (!IsWarmStartDone()) WarmStartStep( c_SpriteWarmStartFrameBudget );
+    else if (m_hWarmThread) PollWarmRead();
+    Defragment();
+    m_FrameStamp++;
 } // SpriteManager::OnFrame
 
-struct RenderBitCmp
+void SpriteManager::UpdateStableFrame()
+{
+    if (m_StableTime < 0.0f)
+    {
+        m_NStableFrames = (m_NFrameMisses == 0) ? m_NStableFrames + 1 : 0;
+        if (m_NStableFrames == c_SpriteStableFrameRun)
+        {
+            m_StableTime = m_Timer.seconds() - m_StartTime;
+            Log.Info( "Sprite cache is stable after %.2fs, frame %d. Warm start laid out %d frames.",
+                        m_StableTime, m_FrameStamp, m_NWarmLaidOut );
+        }
+    }
+    INC_COUNTER( SpriteFrameMisses, m_NFrameMisses );
+    m_NFrameMisses = 0;
+} // SpriteManager::UpdateStableFrame
+
+void SpriteManager::ResetStableFrame()
+{
+    m_NStableFrames = 0;
+    m_NFrameMisses  = 0;
+    m_NWarmLaidOut  = 0;
+    m_StableTime    = -1.0f;
+    m_StartTime     = m_Timer.seconds();
+} // SpriteManager::ResetStableFrame
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::SaveWarmStart
+/*    Desc:    Writes the frame instances which are cached on the surfaces, 
+/*             with the surface they were placed on
+/*---------------------------------------------------------------------------*/
+bool SpriteManager::SaveWarmStart( const char* fname )
+{
+    std::vector<int>                    pkgIdx( m_NPackages, -1 );
+    std::vector<int>                    pkgIDs;
+    std::vector<SpriteWarmStartFrame>   frames;
+    int nInst = m_FrameReg.numElem();
+    for (int i = 0; i < nInst; i++)
+    {
+        const FrameInstance* pInst = m_FrameReg.elem( i );
+        if (!pInst || !pInst->IsCached() || pInst->GetNChunks() == 0) continue;
+        int gpID = pInst->GetSeqID();
+        if (gpID < 0 || gpID >= m_NPackages) continue;
+        if (pkgIdx[gpID] < 0)
+        {
+            pkgIdx[gpID] = pkgIDs.size();
+            pkgIDs.push_back( gpID );
+        }
+        SpriteWarmStartFrame fr;
+        fr.m_Package    = pkgIdx[gpID];
+        fr.m_SprID      = pInst->GetFrameID();
+        fr.m_Color      = pInst->GetColor();
+        fr.m_LOD        = pInst->GetLOD();
+        fr.m_SurfaceID  = pInst->GetChunk( 0 ).m_SurfaceID;
+        fr.m_Width      = pInst->m_Width;
+        fr.m_Height     = pInst->m_Height;
+        fr.m_Age        = m_FrameStamp - pInst->GetUseStamp();
+        frames.push_back( fr );
+    }
+
+    FOutStream os( fname );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write sprite warm start <%s>", fname );
+        return false;
+    }
+    SpriteWarmStartHeader hdr;
+    hdr.m_Magic     = c_SpriteWarmStartMagic;
+    hdr.m_Version   = c_SpriteWarmStartVersion;
+    hdr.m_TexSide   = c_GPTexSide;
+    hdr.m_NPackages = pkgIDs.size();
+    hdr.m_NFrames   = frames.size();
+    os.Write( &hdr, sizeof( hdr ) );
+    //  packages are stored by name, their IDs differ between the sessions
+    for (int i = 0; i < pkgIDs.size(); i++)
+    {
+        const char* name = m_PackageReg[pkgIDs[i]].m_Name;
+        os.Write( name, strlen( name ) + 1 );
+    }
+    if (frames.size() > 0) os.Write( &frames[0], frames.size()*sizeof( SpriteWarmStartFrame ) );
+    os.CloseFile();
+    return true;
+} // SpriteManager::SaveWarmStart
+
+static bool WarmFrameNewer( const SpriteWarmStartFrame& a, const SpriteWarmStartFrame& b )
+{
+    return a.m_Age < b.m_Age;
+} // WarmFrameNewer
+
+static bool WarmFrameLess( const SpriteWarmStartFrame& a, const SpriteWarmStartFrame& b )
+{
+    if (a.m_SurfaceID != b.m_SurfaceID) return a.m_SurfaceID < b.m_SurfaceID;
+    return int( a.m_Width )*int( a.m_Height ) > int( b.m_Width )*int( b.m_Height );
+} // WarmFrameLess
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::LoadWarmStart
+/*    Desc:    Reads the warm start file, loads the packages and starts reading
+/*             their files ahead. Frames are laid out by WarmStartStep: recently 
+/*             used first, up to c_SpriteWarmStartFill of the surfaces, then 
+/*             grouped by the previous surface, larger first, so that frames 
+/*             drawn together share the surface again
+/*---------------------------------------------------------------------------*/
+bool SpriteManager::LoadWarmStart( const char* fname )
+{
+    Init();
+    WaitWarmRead();
+    m_WarmFrames.clear();
+    m_WarmPaths.clear();
+    m_WarmCursor = 0;
+    ResetStableFrame();
+
+    FInStream is( fname );
+    if (is.NoFile()) return false;
+    //  every package name takes at least one byte
+    DWORD nDataBytes = is.GetFileSize() - sizeof( SpriteWarmStartHeader );
+    SpriteWarmStartHeader hdr;
+    if (is.Read( &hdr, sizeof( hdr ) ) != sizeof( hdr ) || hdr.m_Magic != c_SpriteWarmStartMagic ||
+        hdr.m_Version != c_SpriteWarmStartVersion || hdr.m_TexSide != c_GPTexSide ||
+        hdr.m_NPackages > c_MaxGPSeqs || hdr.m_NFrames > c_SpriteWarmStartMaxFrames ||
+        hdr.m_NPackages + hdr.m_NFrames*sizeof( SpriteWarmStartFrame ) > nDataBytes)
+    {
+        Log.Warning( "Invalid sprite warm start <%s>", fname );
+        return false;
+    }
+
+    std::vector<int> gpIDs;
+    for (int i = 0; i < hdr.m_NPackages; i++)
+    {
+        std::string name;
+        char ch = 0;
+        while (is.Read( &ch, 1 ) == 1 && ch != 0) name += ch;
+        int gpID = name.size() ? GetPackageID( name.c_str() ) : -1;
+        if (gpID >= 0 && !LoadPackage( gpID )) gpID = -1;
+        gpIDs.push_back( gpID );
+        if (gpID < 0) continue;
+
+        const char* path = GetPackagePath( gpID );
+        if (strchr( path, ':' )) m_WarmPaths.push_back( path );
+        else m_WarmPaths.push_back( std::string( IRM->GetHomeDirectory() ) + "\\" + path );
+    }
+
+    std::vector<SpriteWarmStartFrame> frames( hdr.m_NFrames );
+    int nBytes = frames.size()*sizeof( SpriteWarmStartFrame );
+    if (nBytes > 0 && is.Read( &frames[0], nBytes ) != nBytes)
+    {
+        Log.Warning( "Sprite warm start <%s> is truncated", fname );
+        return false;
+    }
+
+    //  most recently used frames fit into the surfaces
+    int j = 0;
+    for (int i = 0; i < frames.size(); i++)
+    {
+        if (frames[i].m_Package >= gpIDs.size() || gpIDs[frames[i].m_Package] < 0) continue;
+        frames[i].m_Package = gpIDs[frames[i].m_Package];
+        frames[j++] = frames[i];
+    }
+    frames.resize( j );
+    std::stable_sort( frames.begin(), frames.end(), WarmFrameNewer );
+    int maxPixels = int( float( m_Surface.size()*c_GPTexSide*c_GPTexSide )*c_SpriteWarmStartFill );
+    int nPixels   = 0;
+    for (int i = 0; i < frames.size(); i++)
+    {
+        nPixels += int( frames[i].m_Width )*int( frames[i].m_Height );
+        if (nPixels > maxPixels) { frames.resize( i ); break; }
+    }
+    std::sort( frames.begin(), frames.end(), WarmFrameLess );
+    m_WarmFrames = frames;
+
+    if (m_WarmPaths.size() > 0)
+    {
+        m_hWarmThread = CreateThread( NULL, 0, WarmReadProc, &m_WarmPaths, 0, NULL );
+    }
+    Log.Info( "Sprite warm start <%s>: %d packages, %d frames", fname, m_WarmPaths.size(), m_WarmFrames.size() );
+    return true;
+} // SpriteManager::LoadWarmStart
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::WarmReadProc
+/*    Desc:    Reads the package files, so that the frame decoding on the main 
+/*             thread does not wait for the disk. Only the system file cache 
+/*             is touched, the package file mappings are not used here
+/*---------------------------------------------------------------------------*/
+DWORD WINAPI SpriteManager::WarmReadProc( LPVOID pParam )
+{
+    const std::vector<std::string>& paths = *((const std::vector<std::string>*)pParam);
+    const int c_ReadBlock = 1024*1024;
+    BYTE* pBuf = new BYTE[c_ReadBlock];
+    for (int i = 0; i < paths.size(); i++)
+    {
+        HANDLE hFile = CreateFile( paths[i].c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, 
+                                    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+        if (hFile == INVALID_HANDLE_VALUE) continue;
+        DWORD nRead = 0;
+        while (ReadFile( hFile, pBuf, c_ReadBlock, &nRead, NULL ) && nRead > 0) {}
+        CloseHandle( hFile );
+    }
+    delete []pBuf;
+    return 0;
+} // SpriteManager::WarmReadProc
+
+void SpriteManager::WaitWarmRead()
+{
+    if (!m_hWarmThread) return;
+    WaitForSingleObject( m_hWarmThread, INFINITE );
+    CloseHandle( m_hWarmThread );
+    m_hWarmThread = NULL;
+} // SpriteManager::WaitWarmRead
+
+//  closes the read-ahead thread handle if the thread has finished, never blocks
+bool SpriteManager::PollWarmRead()
+{
+    if (!m_hWarmThread) return true;
+    if (WaitForSingleObject( m_hWarmThread, 0 ) != WAIT_OBJECT_0) return false;
+    CloseHandle( m_hWarmThread );
+    m_hWarmThread = NULL;
+    return true;
+} // SpriteManager::PollWarmRead
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::WarmStartStep
+/*    Desc:    Lays out warm start frames until the time budget is spent.
+/*             Called each frame and may be called on the loading screens 
+/*             with the larger budget
+/*    Ret:     true when all the frames are laid out
+/*---------------------------------------------------------------------------*/
+bool SpriteManager::WarmStartStep( float budgetMs )
+{
+    if (IsWarmStartDone()) return true;
+    if (!m_bInited) return false;
+    float endTime = m_Timer.seconds() + budgetMs*0.001f;
+    while (m_WarmCursor < m_WarmFrames.size())
+    {
+        const SpriteWarmStartFrame& fr = m_WarmFrames[m_WarmCursor++];
+        SpritePackage* pPackage = GetPackage( fr.m_Package );
+        if (pPackage && fr.m_SprID < pPackage->GetNFrames())
+        {
+            FrameInstance* pInst = FindFrameInstance( fr.m_Package, fr.m_SprID, fr.m_Color, fr.m_LOD );
+            if (!pInst || !pInst->IsCached())
+            {
+                if (pPackage->PrecacheFrame( fr.m_SprID, fr.m_Color, fr.m_LOD )) m_NWarmLaidOut++;
+                pInst = FindFrameInstance( fr.m_Package, fr.m_SprID, fr.m_Color, fr.m_LOD );
+            }
+            //  laid out frames are not the first ones to be evicted before they are drawn
+            if (pInst) pInst->SetUseStamp( m_FrameStamp );
+        }
+        if (m_Timer.seconds() >= endTime) break;
+    }
+    if (IsWarmStartDone())
+    {
+        //  read-ahead may still be running, its handle is closed from OnFrame once it ends
+        PollWarmRead();
+        m_WarmFrames.clear();
+        m_WarmCursor = 0;
+        return true;
+    }
+    return false;
+} // SpriteManager::WarmStartStep
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::ReleaseFrameInstance
+/*    Desc:    Drops frame instance, returning its chunks to the surface layouts.
+/*             nChunks limits the chunks looked at, for the partially cached frame
+/*---------------------------------------------------------------------------*/
+void SpriteManager::TraceFrameAccess( FrameInstance* pInst )
+{
+    SpritePackage* pPackage = GetPackage( pInst->GetSeqID() );
+    if (!pPackage) return;
+    ResourceAccess acc;
+    acc.m_ResID  = m_FrameReg.find( pInst->GetKey() );
+    if (acc.m_ResID == NO_ELEMENT) return;
+    //  surfaces are ARGB4444
+    acc.m_NBytes = pPackage->GetFrameWidth( pInst->GetFrameID() )*pPackage->GetFrameHeight( pInst->GetFrameID() )*2;
+    acc.m_Factor = m_FrameStamp;
+    m_pResTrace->push_back( acc );
+} // SpriteManager::TraceFrameAccess
+
+void SpriteManager::ReleaseFrameInstance( FrameInstance* pInst, int nChunks )
+{
+    if (!pInst) return;
+    if (nChunks < 0) nChunks = pInst->IsCached() ? pInst->GetNChunks() : 0;
+    for (int i = 0; i < nChunks; i++)
+    {
+        const FrameChunk& chunk = pInst->GetChunk( i );
+        int surfID = chunk.m_SurfaceID;
+        if (chunk.m_TextureID != 0xFFFF || surfID >= m_Surface.size()) continue;
+        bool bDone = false;
+        for (int j = 0; j < i && !bDone; j++) 
+        {
+            bDone = (pInst->GetChunk( j ).m_SurfaceID == surfID);
+        }
+        if (!bDone) m_Surface[surfID].ReleaseInstance( pInst );
+    }
+    pInst->Drop();
+} // SpriteManager::ReleaseFrameInstance
+
+int SpriteManager::FindFreeSurface( int sidePow ) const
+{
+    int nSurf = m_Surface.size();
+    for (int i = 1; i < nSurf; i++)
+    {
+        int surfID = (m_CurSurface + i) % nSurf;
+        const SpriteSurface& surf = m_Surface[surfID];
+        if (surf.m_pFrameInstance.full()) continue;
+        if (surf.m_Layout.GetLargestFreePow() >= sidePow) return surfID;
+    }
+    return -1;
+} // SpriteManager::FindFreeSurface
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::EvictFromSurface
+/*    Desc:    Drops frames of the surface, least recently used first, until
+/*             the chunk fits. Frames used at the current frame are kept
+/*---------------------------------------------------------------------------*/
+bool SpriteManager::EvictFromSurface( SpriteSurface* pSurface, int sidePow, WORD& ax, WORD& ay )
+{
+    static std::vector<FrameInstance*> victims;
+    victims.clear();
+    for (int i = 0; i < pSurface->m_Chunks.size(); i++)
+    {
+        FrameInstance* pInst = pSurface->m_Chunks[i].m_pInst;
+        if (!pInst || pInst->IsLocked() || pInst->GetUseStamp() == m_FrameStamp) continue;
+        if (std::find( victims.begin(), victims.end(), pInst ) == victims.end()) victims.push_back( pInst );
+    }
+
+    int nVictims = victims.size();
+    for (int i = 0; i < nVictims; i++)
+    {
+        //  selection by the use stamp, victims are few and usually only some are dropped
+        int oldest = i;
+        for (int j = i + 1; j < nVictims; j++)
+        {
+            if (victims[j]->GetUseStamp() < victims[oldest]->GetUseStamp()) oldest = j;
+        }
+        std::swap( victims[i], victims[oldest] );
+
+        ReleaseFrameInstance( victims[i] );
+        INC_COUNTER( SpriteEvictions, 1 );
+        if (!pSurface->m_pFrameInstance.full() && 
+            pSurface->m_Layout.AllocChunk( sidePow, ax, ay )) return true;
+    }
+    return false;
+} // SpriteManager::EvictFromSurface
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::Defragment
+/*    Desc:    Compacts the most fragmented surface, moving chunks to the lower
+/*             free quads in the surface system memory copy, so the free quads
+/*             merge. Stops after budget texels, continues at the next frame
+/*    Ret:     Number of texels moved
+/*---------------------------------------------------------------------------*/
+int SpriteManager::Defragment( int budget )
+{
+    if (!m_bDefragment || m_Surface.size() == 0) return 0;
+    if (m_DefragSurface < 0)
+    {
+        float maxFrag = c_SpriteDefragThreshold;
+        for (int i = 0; i < m_Surface.size(); i++)
+        {
+            const QuadLayout& layout = m_Surface[i].m_Layout;
+            //  nearly full surfaces have nothing to merge
+            if (layout.NumFreePixels()*8 < layout.GetMaxPixels()) continue;
+            float frag = layout.GetFragmentation();
+            if (frag > maxFrag) { maxFrag = frag; m_DefragSurface = i; }
+        }
+        if (m_DefragSurface < 0) return 0;
+    }
+
+    SpriteSurface& surf = m_Surface[m_DefragSurface];
+    if (surf.m_ShadowTexID < 0) { m_DefragSurface = -1; return 0; }
+
+    int     pitch   = 0;
+    BYTE*   pBits   = NULL;
+    int     nMoved  = 0;
+    Rct     rects[c_MaxSpriteDefragRects];
+    int     nRects  = 0;
+    bool    bDone   = false;
+    while (nMoved < budget && nRects < c_MaxSpriteDefragRects)
+    {
+        //  topmost chunk goes first, it frees the upper quads
+        int     best    = -1;
+        DWORD   bestKey = 0;
+        for (int i = 0; i < surf.m_Chunks.size(); i++)
+        {
+            const SurfaceChunk& chunk = surf.m_Chunks[i];
+            if (!chunk.m_pInst || chunk.m_pInst->IsLocked() || !chunk.m_pInst->IsCached()) continue;
+            DWORD key = QuadMortonKey( chunk.m_X, chunk.m_Y );
+            if (key >= bestKey) { bestKey = key; best = i; }
+        }
+        if (best < 0) { bDone = true; break; }
+
+        SurfaceChunk& chunk = surf.m_Chunks[best];
+        WORD ax, ay;
+        if (!surf.m_Layout.AllocLowestChunk( chunk.m_SidePow, ax, ay, bestKey )) 
+        {
+            //  the topmost chunk has no lower place, try the others
+            bestKey = 0xFFFFFFFF;
+            best = -1;
+            for (int i = 0; i < surf.m_Chunks.size(); i++)
+            {
+                SurfaceChunk& c = surf.m_Chunks[i];
+                if (!c.m_pInst || c.m_pInst->IsLocked() || !c.m_pInst->IsCached()) continue;
+                if (surf.m_Layout.AllocLowestChunk( c.m_SidePow, ax, ay, QuadMortonKey( c.m_X, c.m_Y ) ))
+                {
+                    best = i;
+                    break;
+                }
+            }
+            if (best < 0) { bDone = true; break; }
+        }
+        SurfaceChunk& mv = surf.m_Chunks[best];
+        int side = c_PowSidesWORD[mv.m_SidePow];
+
+        if (!pBits) 
+        {
+            pBits = IRS->LockTexBits( surf.m_ShadowTexID, pitch );
+            if (!pBits) 
+            {
+                surf.m_Layout.FreeChunk( mv.m_SidePow, ax, ay );
+                bDone = true; 
+                break;
+            }
+        }
+        util::MemcpyRect( pBits + ay*pitch + ax*2, pitch, pBits + mv.m_Y*pitch + mv.m_X*2, pitch, side, side*2 );
+
+        //  move the chunk texture coordinates
+        FrameChunk& fc = mv.m_pInst->GetChunk( mv.m_ChunkIdx );
+        float du = float( int( ax ) - int( mv.m_X ) )*c_GPTexel;
+        float dv = float( int( ay ) - int( mv.m_Y ) )*c_GPTexel;
+        for (int i = 0; i < fc.m_NVert; i++)
+        {
+            fc.m_Vert[i].u += du;
+            fc.m_Vert[i].v += dv;
+        }
+
+        surf.m_Layout.FreeChunk( mv.m_SidePow, mv.m_X, mv.m_Y );
+        mv.m_X = ax;
+        mv.m_Y = ay;
+        rects[nRects++] = Rct( ax, ay, side, side );
+        nMoved += side*side;
+    }
+
+    if (pBits)
+    {
+        IRS->UnlockTexBits( surf.m_ShadowTexID );
+        IRS->CopyTexture( surf.m_TexID, surf.m_ShadowTexID, rects, nRects );
+    }
+    INC_COUNTER( SpriteDefragTexels, nMoved );
+    if (bDone || surf.m_Layout.GetFragmentation() < c_SpriteDefragThreshold*0.5f) m_DefragSurface = -1;
+    return nMoved;
+} // SpriteManager::Defragment
+
+void SpriteManager::DumpSurfaceStats() const
+{
+    float occupancy = 0.0f, fragmentation = 0.0f;
+    for (int i = 0; i < m_Surface.size(); i++)
+    {
+        SpriteSurfaceStats st;
+        m_Surface[i].GetStats( st );
+        Log.Info( "SpriteSurf%02d: occupied %.1f%%, fragmented %.1f%%, largest free %d, %d free quads, %d chunks, %d frames",
+                    i, st.m_Occupancy*100.0f, st.m_Fragmentation*100.0f, st.m_LargestFreeSide, 
+                    st.m_NFreeQuads, st.m_NChunks, st.m_NInstances );
+        occupancy       += st.m_Occupancy;
+        fragmentation   += st.m_Fragmentation;
+    }
+    if (m_Surface.size() == 0) return;
+    Log.Info( "Sprite surfaces: %d, mean occupancy %.1f%%, mean fragmentation %.1f%%", m_Surface.size(),
+                occupancy*100.0f/float( m_Surface.size() ), fragmentation*100.0f/float( m_Surface.size() ) );
+} // SpriteManager::DumpSurfaceStats
+
+void SpriteManager::SortRenderBits()
 {
-    bool operator ()( const SpriteRenderBit* l, const SpriteRenderBit* r )
+    int nB = m_RenderBits.size();
+    m_SortKeys.resize( nB );
+    m_SortKeysTmp.resize( nB );
+
+    //  build keys by walking render bits linearly
+    bool bSorted = true;
+    DWORD prevKey = 0;
+    for (int i = 0; i < nB; i++)
+    {
+        const SpriteRenderBit& rb = m_RenderBits[i];
+        DWORD key = ((DWORD( rb.m_TexID + 1 ) & 0xFFFF) << 8) | (DWORD( rb.m_VF ) & 0xFF);
+        m_SortKeys[i].m_Key   = key;
+        m_SortKeys[i].m_Index = i;
+        if (key < prevKey) bSorted = false;
+        prevKey = key;
+    }
+    INC_COUNTER( SpriteRenderBits, nB );
+
+    //  sprites usually come surface by surface, in the same order as at the
+    //  previous frame, so often there is nothing to do
+    if (bSorted) return;
+
+    //  stable LSD radix sort, 8 bits per pass. Stability keeps submission 
+    //  order of the sprites on the same surface.
+    const int c_NPasses = 3;
+    int hist[c_NPasses][256];
+    memset( hist, 0, sizeof( hist ) );
+    for (int i = 0; i < nB; i++)
     {
-        return (*l < *r);
+        DWORD key = m_SortKeys[i].m_Key;
+        hist[0][key & 0xFF]++;
+        hist[1][(key >> 8) & 0xFF]++;
+        hist[2][(key >> 16) & 0xFF]++;
+    }
+
+    SpriteSortKey* pSrc = &m_SortKeys[0];
+    SpriteSortKey* pDst = &m_SortKeysTmp[0];
+    for (int pass = 0; pass < c_NPasses; pass++)
+    {
+        int* h     = hist[pass];
+        int  shift = pass*8;
+        //  all keys have the same digit, pass does not change anything
+        if (h[(pSrc[0].m_Key >> shift) & 0xFF] == nB) continue;
+
+        int sum = 0;
+        for (int j = 0; j < 256; j++)
+        {
+            int cnt = h[j];
+            h[j] = sum;
+            sum += cnt;
+        }
+        for (int i = 0; i < nB; i++)
+        {
+            pDst[h[(pSrc[i].m_Key >> shift) & 0xFF]++] = pSrc[i];
+        }
+        std::swap( pSrc, pDst );
+        INC_COUNTER( SpriteSortPasses, 1 );
     }
-}; // struct RenderBitCmp
+    if (pSrc != &m_SortKeys[0]) memcpy( &m_SortKeys[0], pSrc, nB*sizeof( SpriteSortKey ) );
+} // SpriteManager::SortRenderBits
 
 void SpriteManager::DrawBatches()
 {
@@ -639,8 +1232,8 @@ void SpriteManager::DrawBatches()
 
     for (int cPass = 0; cPass < nPasses; cPass++)
     {
-        int             cSurf   = m_SortedRenderBits[0]->m_TexID;
-        VertexFormat    cVF     = m_SortedRenderBits[0]->m_VF;
+        int             cSurf   = m_RenderBits[m_SortKeys[0].m_Index].m_TexID;
+        VertexFormat    cVF     = m_RenderBits[m_SortKeys[0].m_Index].m_VF;
         VertexTnL*      vTnL    = (VertexTnL*)m_Prim.getVertexData();
         VertexTS*       v2t     = (VertexTS*)m_Prim.getVertexData();
         WORD*           pIdx    = m_Prim.getIndices();
@@ -653,7 +1246,7 @@ void SpriteManager::DrawBatches()
         
         for (int i = 0; i < nB; i++)
         {
-            const SpriteRenderBit& rb = *m_SortedRenderBits[i];
+            const SpriteRenderBit& rb = m_RenderBits[m_SortKeys[i].m_Index];
             for (int j = 0; j < rb.m_NChunks; j++)
             {
                 const FrameChunk& chunk = rb.m_pChunk[j];
@@ -773,8 +1366,8 @@ void SpriteManager::sse_DrawBatches()
 
     //for (int cPass = 0; cPass < nPasses; cPass++)
     //{
-        int             cSurf   = m_SortedRenderBits[0]->m_TexID;
-        VertexFormat    cVF     = m_SortedRenderBits[0]->m_VF;
+        int             cSurf   = m_RenderBits[m_SortKeys[0].m_Index].m_TexID;
+        VertexFormat    cVF     = m_RenderBits[m_SortKeys[0].m_Index].m_VF;
         VertexTnL*      vTnL    = (VertexTnL*)m_Prim.getVertexData();
         VertexTS*       v2t     = (VertexTS*)m_Prim.getVertexData();
         WORD*           pIdx    = m_Prim.getIndices();
@@ -794,11 +1387,7 @@ void SpriteManager::sse_DrawBatches()
 
         for (int i = 0; i < nB; i++)
         {
-            __prefetch64(DWORD(m_SortedRenderBits[i]));            
-        }
-        for (int i = 0; i < nB; i++)
-        {
-            const SpriteRenderBit& rb = *m_SortedRenderBits[i];
+            const SpriteRenderBit& rb = m_RenderBits[m_SortKeys[i].m_Index];
             for (int j = 0; j < rb.m_NChunks; j++)
             {
                 __prefetch64(DWORD(&rb.m_pChunk[j]));
@@ -806,7 +1395,7 @@ void SpriteManager::sse_DrawBatches()
         }
         for (int i = 0; i < nB; i++)
         {
-            const SpriteRenderBit& rb = *m_SortedRenderBits[i];
+            const SpriteRenderBit& rb = m_RenderBits[m_SortKeys[i].m_Index];
             for (int j = 0; j < rb.m_NChunks; j++)
             {
                 const FrameChunk& chunk = rb.m_pChunk[j];
@@ -823,7 +1412,7 @@ void SpriteManager::sse_DrawBatches()
 
         for (int i = 0; i < nB; i++)
         {
-            const SpriteRenderBit& rb = *m_SortedRenderBits[i];
+            const SpriteRenderBit& rb = m_RenderBits[m_SortKeys[i].m_Index];
             for (int j = 0; j < rb.m_NChunks; j++)
             {
                 const FrameChunk& chunk = rb.m_pChunk[j];
@@ -1051,6 +1640,176 @@ void SpriteManager::sse_DrawBatches()
     //}
 } // SpriteManager::sse_DrawBatches
 
+//  transforms chunk vertices and writes them together with the colors and texture
+//  coordinates as 32-byte VertexTS/VertexTnL records: x, y, z, w, diffuse, specular, u, v.
+//  w is masked with rhw[0] and combined with rhw[1]
+static __forceinline void StreamSpriteVerts( const FrameVert* pSrc, int nV, float* pDst, const __m128* tm, 
+                                             const __m128* rhw, __m128 attr, bool bAligned )
+{
+    const __m128 zero = _mm_setzero_ps();
+    for (int i = 0; i < nV; i++, pSrc++, pDst += 8)
+    {
+        __m128 pt = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( pSrc->x ), tm[0] ), 
+                                            _mm_mul_ps( _mm_set1_ps( pSrc->y ), tm[1] ) ),
+                                _mm_add_ps( _mm_mul_ps( _mm_set1_ps( pSrc->z ), tm[2] ), tm[3] ) );
+        pt = _mm_or_ps( _mm_and_ps( pt, rhw[0] ), rhw[1] );
+        __m128 uv = _mm_loadl_pi( zero, (const __m64*)&pSrc->u );
+        __m128 at = _mm_or_ps( attr, _mm_movelh_ps( zero, uv ) );
+        if (bAligned)
+        {
+            _mm_stream_ps( pDst,     pt );
+            _mm_stream_ps( pDst + 4, at );
+        }
+        else
+        {
+            _mm_storeu_ps( pDst,     pt );
+            _mm_storeu_ps( pDst + 4, at );
+        }
+    }
+} // StreamSpriteVerts
+
+struct StreamChunk
+{
+    const SpriteRenderBit*  m_pBit;
+    const FrameChunk*       m_pChunk;
+}; // struct StreamChunk
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::stream_DrawBatches
+/*    Desc:    Draws sorted render bits without the intermediate system memory
+/*             mesh: indices and vertices of the batch are generated right into
+/*             the locked shared dynamic buffers, vertices with the streaming
+/*             stores
+/*---------------------------------------------------------------------------*/
+void SpriteManager::stream_DrawBatches()
+{
+    static int vbID = IRS->GetVBufferID( "SharedDynamic" );
+    static int ibID = IRS->GetIBufferID( "SharedDynamic" );
+    static std::vector<StreamChunk> batch;
+
+    __declspec(align(16)) static const DWORD c_RHWMask [4] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000 };
+    __declspec(align(16)) static const DWORD c_RHWValue[4] = { 0x00000000, 0x00000000, 0x00000000, 0x3F800000 };
+    __declspec(align(16)) static const DWORD c_NoMask  [4] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+    const __m128 pixelBias = _mm_set_ps( 0.0f, 0.0f, -c_HalfPixel, -c_HalfPixel );
+
+    int nPasses = IRS->GetNShaderPasses( m_Shader );
+    int nB      = m_RenderBits.size();
+    int cB      = 0;
+    int cC      = 0;
+    while (cB < nB)
+    {
+        const SpriteRenderBit& first = m_RenderBits[m_SortKeys[cB].m_Index];
+        int             texID   = first.m_TexID;
+        VertexFormat    vf      = first.m_VF;
+
+        //  gather the batch: chunks on the same surface with the same vertex format
+        batch.clear();
+        int nV = 0;
+        int nI = 0;
+        while (cB < nB)
+        {
+            const SpriteRenderBit& rb = m_RenderBits[m_SortKeys[cB].m_Index];
+            if (rb.m_TexID != texID || rb.m_VF != vf) break;
+            if (cC >= rb.m_NChunks)
+            {
+                cC = 0;
+                cB++;
+                continue;
+            }
+            const FrameChunk& chunk = rb.m_pChunk[cC];
+            if (chunk.m_NVert > 0 && chunk.m_NTri > 0)
+            {
+                if (nV > 0 && nV + chunk.m_NVert >= c_MaxVertDrawn) break;
+                StreamChunk sc;
+                sc.m_pBit   = &rb;
+                sc.m_pChunk = &chunk;
+                batch.push_back( sc );
+                nV += chunk.m_NVert;
+                nI += chunk.m_NTri*3;
+            }
+            cC++;
+        }
+        if (nV == 0) continue;
+
+        IRS->SetVB( vbID, (int)vf );
+        IRS->SetIB( ibID );
+
+        //  indices
+        DWORD   stamp       = 0;
+        int     firstIdx    = 0;
+        int     firstVert   = 0;
+        WORD*   pIdx        = (WORD*)IRS->LockAppendIB( ibID, nI, firstIdx, stamp );
+        if (!pIdx) return;
+        int nChunks = batch.size();
+        int cV = 0;
+        for (int i = 0; i < nChunks; i++)
+        {
+            const FrameChunk& chunk = *batch[i].m_pChunk;
+            int nIdx = chunk.m_NTri*3;
+            if (chunk.m_Idx)
+            {
+                for (int k = 0; k < nIdx; k++) pIdx[k] = chunk.m_Idx[k] + cV;
+            }
+            else
+            {
+                pIdx[0] = cV + 0; pIdx[1] = cV + 1; pIdx[2] = cV + 2;
+                pIdx[3] = cV + 2; pIdx[4] = cV + 1; pIdx[5] = cV + 3;
+            }
+            pIdx += nIdx;
+            cV   += chunk.m_NVert;
+        }
+        IRS->UnlockIB( ibID );
+
+        //  vertices
+        BYTE* pVert = IRS->LockAppendVB( vbID, nV, firstVert, stamp );
+        if (!pVert) return;
+        bool    bAligned    = (DWORD( pVert ) & 0xF) == 0;
+        bool    bTnL        = (vf == vfVertexTnL);
+        __m128  rhw[2];
+        rhw[0] = _mm_load_ps( (const float*)(bTnL ? c_RHWMask : c_NoMask) );
+        rhw[1] = bTnL ? _mm_load_ps( (const float*)c_RHWValue ) : _mm_setzero_ps();
+        float*  pDst        = (float*)pVert;
+        const SpriteRenderBit* pBit = NULL;
+        __m128  tm[4];
+        __m128  attr;
+        for (int i = 0; i < nChunks; i++)
+        {
+            const StreamChunk& sc = batch[i];
+            if (sc.m_pBit != pBit)
+            {
+                pBit = sc.m_pBit;
+                const Matrix4D& m = pBit->m_TM;
+                tm[0] = _mm_loadu_ps( &m.e00 );
+                tm[1] = _mm_loadu_ps( &m.e10 );
+                tm[2] = _mm_loadu_ps( &m.e20 );
+                tm[3] = _mm_add_ps( _mm_loadu_ps( &m.e30 ), pixelBias );
+                //  screen space sprites keep the white specular, as with sse_DrawBatches
+                __declspec(align(16)) DWORD clr[4];
+                clr[0] = pBit->m_DiffuseColor;
+                clr[1] = bTnL ? 0x00FFFFFF : (pBit->m_NationalColor & 0x00FFFFFF);
+                clr[2] = 0;
+                clr[3] = 0;
+                attr = _mm_load_ps( (const float*)clr );
+            }
+            int nCV = sc.m_pChunk->m_NVert;
+            StreamSpriteVerts( sc.m_pChunk->m_Vert, nCV, pDst, tm, rhw, attr, bAligned );
+            pDst += nCV*8;
+        }
+        if (bAligned) _mm_sfence();
+        IRS->UnlockVB( vbID );
+
+        IRS->SetTexture( texID, 0, false );
+        IRS->SetTexture( texID, 1, false );
+        for (int i = 0; i < nPasses; i++)
+        {
+            IRS->SetShader( m_Shader, i );
+            IRS->SetShaderAutoVars();
+            IRS->Draw( firstVert, nV, firstIdx, nI, ptTriangleList );
+        }
+        INC_COUNTER( SpriteBatches, 1 );
+    }
+} // SpriteManager::stream_DrawBatches
+
 
 void SpriteManager::Flush( bool bResetWorldTM )
 {
@@ -1065,11 +1824,11 @@ void SpriteManager::Flush( bool bResetWorldTM )
         if (tm.e00 != 1.0f || tm.e11 != 1.0f) IRS->ResetWorldTM();
     }
     //  sort render bits by sprite surface
-    std::sort( m_SortedRenderBits.begin(), m_SortedRenderBits.end(), RenderBitCmp() );
-    /*if (m_bUseSSE) sse_DrawBatches(); else */sse_DrawBatches();
+    SortRenderBits();
+    if (s_bStreamVertices && m_bUseSSE) stream_DrawBatches(); else sse_DrawBatches();
     
     m_RenderBits.clear();
-    m_SortedRenderBits.clear();
+    m_SortKeys.clear();
 } // SpriteManager::Flush
 
 
@@ -1114,36 +1873,49 @@ bool SpriteManager::DrawSprite(    int    gpID, int sprID, const Vector3D& pos,
 /*---------------------------------------------------------------------------*/
 bool SpriteManager::DrawSprite( int gpID, int sprID, const Matrix4D& transf, DWORD color )
 {
+    if (FrameRecorder::s_bActive) FrameRecorder::RecordSprite( false, gpID, sprID, transf, color );
     FrameInstance* frameInst = GetFrameInstance( gpID, sprID, color, m_CurLOD );
     if (frameInst == NULL) 
     {
         return false;
     }
 
-    int    nChunks     = frameInst->GetNChunks(); 
+    AddRenderBits( frameInst, transf, color, vfVertexTnL );
+    return true;
+} // SpriteManager::DrawSprite
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::AddRenderBits
+/*    Desc:    Queues render bits for the frame instance chunks, one per run of
+/*             chunks on the same surface
+/*    Ret:     Index of the first added render bit
+/*---------------------------------------------------------------------------*/
+int SpriteManager::AddRenderBits( FrameInstance* pInst, const Matrix4D& tm, DWORD color, VertexFormat vf )
+{
+    int nChunks  = pInst->GetNChunks(); 
     int curSurf  = -1;
     int cNChunks = 0;
     SpriteRenderBit* rb = NULL;
     
     if (m_RenderBits.size() + nChunks >= c_MaxSpritesDrawn) Flush();
+    int firstBit = m_RenderBits.size();
 
     for (int i = 0; i < nChunks; i++)
     {
-        const FrameChunk& chunk = frameInst->GetChunk( i );
+        const FrameChunk& chunk = pInst->GetChunk( i );
         //  fill in render bit 
         if (chunk.m_SurfaceID != curSurf)
         {
             if (rb) rb->m_NChunks = cNChunks;
             rb = &m_RenderBits.expand();
-            m_SortedRenderBits.push_back( rb );
             rb->m_pChunk        = &chunk;
             rb->m_DiffuseColor  = m_CurDiffuse;
             rb->m_NationalColor = color;
             rb->m_TexID         = chunk.m_TextureID != 0xFFFF ? 
                                                 chunk.m_TextureID : 
                                                 m_Surface[chunk.m_SurfaceID].m_TexID;
-            rb->m_TM            = transf;
-            rb->m_VF            = vfVertexTnL;
+            rb->m_TM            = tm;
+            rb->m_VF            = vf;
 
             curSurf             = chunk.m_SurfaceID;
             cNChunks            = 0;
@@ -1151,8 +1923,65 @@ bool SpriteManager::DrawSprite( int gpID, int sprID, const Matrix4D& transf, DWO
         cNChunks++;
     }
     if (rb) rb->m_NChunks = cNChunks;
-    return true;
-} // SpriteManager::DrawSprite
+    return firstBit;
+} // SpriteManager::AddRenderBits
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::DrawSprites
+/*    Desc:    Batched sprite submission. Frame instance is looked up once per
+/*             run of the same frame, and render bits of the previous sprite are
+/*             copied with the new transform
+/*    Parm:    pItems      - sprites
+/*             nItems      - number of sprites
+/*             bWorld      - world space transforms, screen space otherwise
+/*    Ret:     Number of sprites drawn
+/*---------------------------------------------------------------------------*/
+int SpriteManager::DrawSprites( const SpriteDrawItem* pItems, int nItems, bool bWorld )
+{
+    VertexFormat    vf          = bWorld ? vfVertexTS : vfVertexTnL;
+    FrameInstance*  pInst       = NULL;
+    int             firstBit    = 0;
+    int             nBits       = 0;
+    int             nDrawn      = 0;
+    bool            bRecord     = FrameRecorder::s_bActive;
+
+    for (int i = 0; i < nItems; i++)
+    {
+        const SpriteDrawItem& item = pItems[i];
+        if (bRecord) FrameRecorder::RecordSprite( bWorld, item.m_GPID, item.m_SprID, item.m_TM, item.m_Color );
+
+        //  instance is kept only while the frame repeats: lookup of the other 
+        //  frame can evict it
+        bool bSame = pInst && item.m_GPID == pItems[i - 1].m_GPID && 
+                        item.m_SprID == pItems[i - 1].m_SprID && item.m_Color == pItems[i - 1].m_Color;
+        if (!bSame)
+        {
+            int gpID  = item.m_GPID;
+            int sprID = item.m_SprID;
+            pInst = GetFrameInstance( gpID, sprID, item.m_Color, m_CurLOD );
+            nBits = 0;
+            if (!pInst) continue;
+        }
+
+        if (nBits > 0 && m_RenderBits.size() + nBits < c_MaxSpritesDrawn)
+        {
+            for (int j = 0; j < nBits; j++)
+            {
+                SpriteRenderBit& rb = m_RenderBits.expand();
+                rb      = m_RenderBits[firstBit + j];
+                rb.m_TM = item.m_TM;
+            }
+            firstBit += nBits;
+        }
+        else
+        {
+            firstBit = AddRenderBits( pInst, item.m_TM, item.m_Color, vf );
+            nBits    = m_RenderBits.size() - firstBit;
+        }
+        nDrawn++;
+    }
+    return nDrawn;
+} // SpriteManager::DrawSprites
 
 /*---------------------------------------------------------------------------*/
 /*    Func:    SpriteManager::DrawWSprite
@@ -1163,43 +1992,14 @@ bool SpriteManager::DrawSprite( int gpID, int sprID, const Matrix4D& transf, DWO
 /*---------------------------------------------------------------------------*/
 bool SpriteManager::DrawWSprite( int gpID, int sprID, const Matrix4D& m, DWORD color )
 {
+    if (FrameRecorder::s_bActive) FrameRecorder::RecordSprite( true, gpID, sprID, m, color );
     FrameInstance* frameInst = GetFrameInstance( gpID, sprID, color, m_CurLOD );
     if (frameInst == NULL) 
     {
         return false;
     }
 
-    int    nChunks     = frameInst->GetNChunks(); 
-    int curSurf  = -1;
-    int cNChunks = 0;
-    SpriteRenderBit* rb = NULL;
-
-    if (m_RenderBits.size() + nChunks >= c_MaxSpritesDrawn) Flush();
-
-    for (int i = 0; i < nChunks; i++)
-    {
-        const FrameChunk& chunk = frameInst->GetChunk( i );
-        //  fill in render bit 
-        if (chunk.m_SurfaceID != curSurf)
-        {
-            if (rb) rb->m_NChunks = cNChunks;
-            rb = &m_RenderBits.expand();
-            m_SortedRenderBits.push_back( rb );
-            rb->m_pChunk        = &chunk;
-            rb->m_DiffuseColor  = m_CurDiffuse;
-            rb->m_NationalColor = color;
-            rb->m_TexID         = chunk.m_TextureID != 0xFFFF ? 
-                                                chunk.m_TextureID : 
-                                                m_Surface[chunk.m_SurfaceID].m_TexID;
-            rb->m_TM            = m;
-            rb->m_VF            = vfVertexTS;
-
-            curSurf             = chunk.m_SurfaceID;
-            cNChunks            = 0;
-        }
-        cNChunks++;
-    }
-    if (rb) rb->m_NChunks = cNChunks;
+    AddRenderBits( frameInst, m, color, vfVertexTS );
     return true;
 } // SpriteManager::DrawWSprite
 
@@ -1293,7 +2093,6 @@ bool SpriteManager::DrawWChunk( int gpID, int sprID, int chunkID,
                                        m_Surface[chunk.m_SurfaceID].m_TexID;
     rb->m_TM            = IRS->GetWorldTM();
     rb->m_VF            = vfVertexTS;
-    m_SortedRenderBits.push_back( rb );
     return true;    
 } // SpriteManager::DrawWChunk
 
@@ -1454,6 +2253,29 @@ void SpriteManager::Precache( int gpID )
     pPackage->Precache();
 } // SpriteManager::Precache
 
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteManager::TranscodePackage
+/*    Desc:    Converts package into block-compressed texture pages for the 
+/*             given national color. Cached pages are picked up at LOD 0 
+/*             instead of unpacking the package data
+/*---------------------------------------------------------------------------*/
+bool SpriteManager::TranscodePackage( int gpID, DWORD color )
+{
+    SpritePackage* pPackage = GetPackage( gpID );
+    if (!pPackage) 
+    {
+        LoadPackage( gpID );
+        pPackage = GetPackage( gpID );
+    }  
+    if (!pPackage) return false;
+    if (!pPackage->Transcode( color ))
+    {
+        Log.Warning( "Could not transcode sprite package %s", pPackage->GetName() );
+        return false;
+    }
+    return true;
+} // SpriteManager::TranscodePackage
+
 int SpriteManager::GetFrameHeight( int gpID, int sprID )
 {
     SpritePackage* pPackage = GetPackage( gpID );
@@ -1600,16 +2422,85 @@ BYTE* SpriteManager::LockSurfRect( int surfID, const Rct& rect, int& pitch )
     int texID       = m_Surface[surfID].m_TexID;
     m_LockSurfID    = surfID;
     m_LockRect      = rect;
-    return IRS->LockTexBits( m_CanvasTex, rect, pitch );
+    //  surface shadow keeps the texels for the defragmenter
+    int canvasID    = m_Surface[surfID].m_ShadowTexID;
+    if (canvasID < 0) canvasID = m_CanvasTex;
+    return IRS->LockTexBits( canvasID, rect, pitch );
 } // SpriteManager::LockSurfRect
 
 void SpriteManager::UnlockSurfRect()
 {
     if (m_LockSurfID < 0) return;
     int texID = m_Surface[m_LockSurfID].m_TexID;
-    IRS->UnlockTexBits( m_CanvasTex );
-    IRS->CopyTexture( texID, m_CanvasTex, &m_LockRect );
+    int canvasID = m_Surface[m_LockSurfID].m_ShadowTexID;
+    if (canvasID < 0) canvasID = m_CanvasTex;
+    IRS->UnlockTexBits( canvasID );
+    IRS->CopyTexture( texID, canvasID, &m_LockRect );
     m_LockSurfID = -1;
 } // SpriteManager::UnlockSurfRect
 
 
+/*---------------------------------------------------------------*/
+/*  Func:    BenchmarkSprites
+/*    Desc:    Times submission and drawing of nSprites frames of the
+/*          package per frame: sprite by sprite with the system memory
+/*          mesh, and batched with the vertices streamed into the
+/*          dynamic buffers. Meant for 10K..100K sprites
+/*---------------------------------------------------------------*/
+bool BenchmarkSprites( int gpID, int nSprites, int nFrames )
+{
+    SpriteManager& sm = g_SpriteManager;
+    int nSeqFrames = sm.GetNFrames( gpID );
+    if (nSeqFrames <= 0 || nSeqFrames == 0x7FFFFFFF)
+    {
+        Log.Warning( "Sprite benchmark: invalid package %d", gpID );
+        return false;
+    }
+    if (nSprites <= 0 || nFrames <= 0) return false;
+
+    //  units come in groups showing the same frame
+    std::vector<SpriteDrawItem> items( nSprites );
+    for (int i = 0; i < nSprites; i++)
+    {
+        SpriteDrawItem& item = items[i];
+        item.m_GPID  = gpID;
+        item.m_SprID = (i/16)%nSeqFrames;
+        item.m_Color = 0;
+        item.m_TM.setIdentity();
+        item.m_TM.e30 = float( (i*37)%1024 );
+        item.m_TM.e31 = float( (i*53)%768 );
+        item.m_TM.e32 = 0.5f;
+    }
+
+    bool bStream = SpriteManager::s_bStreamVertices;
+    Timer timer;
+    double tSingle = 0.0, tBatched = 0.0;
+    for (int f = 0; f < nFrames; f++)
+    {
+        SpriteManager::s_bStreamVertices = false;
+        timer.start();
+        for (int i = 0; i < nSprites; i++)
+        {
+            const SpriteDrawItem& item = items[i];
+            sm.DrawSprite( item.m_GPID, item.m_SprID, item.m_TM, item.m_Color );
+        }
+        sm.Flush();
+        tSingle += timer.seconds();
+
+        SpriteManager::s_bStreamVertices = true;
+        timer.start();
+        sm.DrawSprites( &items[0], nSprites );
+        sm.Flush();
+        tBatched += timer.seconds();
+    }
+    SpriteManager::s_bStreamVertices = bStream;
+
+    double scale = 1000.0*1000.0/double( nSprites*nFrames );
+    Log.Info( "Sprite benchmark: %d sprites, %d frames", nSprites, nFrames );
+    Log.Info( "  single, mesh copy:      %.3fms per 1K sprites, %.2fms per frame", 
+                tSingle*scale, tSingle*1000.0/double( nFrames ) );
+    Log.Info( "  batched, streamed:      %.3fms per 1K sprites, %.2fms per frame", 
+                tBatched*scale, tBatched*1000.0/double( nFrames ) );
+    return true;
+} // BenchmarkSprites
+
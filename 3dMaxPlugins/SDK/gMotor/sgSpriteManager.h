@@ -46,6 +46,15 @@ const float     c_GPTexel                       = 1.0f / c_GPTexSide;
 const float     c_HalfGPTexel                   = -c_GPTexel*0.375f;
 const float     c_HalfPixel                     = 0.5f;
 const float     c_PurgeTimeout                  = 30.0f;
+const int       c_SpriteDefragBudget            = 64*64*4;  //  texels moved by the defragmenter per frame
+const float     c_SpriteDefragThreshold         = 0.5f;     //  surface fragmentation to start compaction
+const int       c_MaxSpriteDefragRects          = 64;       //  chunks moved per frame
+const DWORD     c_SpriteWarmStartMagic          = 'TSWS';
+const DWORD     c_SpriteWarmStartVersion        = 1;
+const float     c_SpriteWarmStartFill           = 0.8f;     //  part of the surfaces filled by the warm start
+const float     c_SpriteWarmStartFrameBudget    = 2.0f;     //  ms of the warm start layout per frame
+const int       c_SpriteStableFrameRun          = 30;       //  frames without new layout to call the cache stable
+const int       c_SpriteWarmStartMaxFrames      = 65536;
 
 class Group;
 class SpritePackage;
@@ -188,7 +197,11 @@ public:
     void                    Unlock          () { m_bLocked = false; }
     bool                    IsLocked        () const { return m_bLocked; }
 
-    FrameInstance() : m_PackSegIdx(0xFFFF), m_ID(0xFFFFFFFF), m_bLocked(false){}
+    //  frame stamp of the last request of the instance, used to pick eviction victims
+    void                    SetUseStamp     ( DWORD stamp ) { m_UseStamp = stamp; }
+    DWORD                   GetUseStamp     () const { return m_UseStamp; }
+
+    FrameInstance() : m_PackSegIdx(0xFFFF), m_ID(0xFFFFFFFF), m_bLocked(false), m_UseStamp(0){}
 
 public:
     FrameChunk*                m_Chunk;
@@ -202,6 +215,7 @@ public:
     DWORD                    m_ID;
     WORD                    m_PackSegIdx;
     bool                    m_bLocked;
+    DWORD                   m_UseStamp;
 
     friend class            SpriteManager;
 }; // class FrameInstance
@@ -270,6 +284,8 @@ public:
     bool                        HasColorData        () const { return m_bHasColorData; }
 
     virtual bool                Reload              () { return false; }
+    //  builds and saves the block-compressed texture pages of the package for the color
+    virtual bool                Transcode           ( DWORD color ) { return false; }
 
 protected:
     const BYTE*                 GetPalette          ( int palIdx ) { return GetFileData() + m_PaletteOffset[palIdx];}
@@ -331,9 +347,47 @@ struct SpriteRenderBit
     }
 }; // struct SpriteRenderBit
 
+/*****************************************************************************/
+/*    Struct:  SpriteSortKey
+/*    Desc:    Compact sorting record for the render bit: integer key, made of
+/*              the surface texture and vertex format, and render bit index
+/*****************************************************************************/
+struct SpriteSortKey
+{
+    DWORD               m_Key;              //  (texID + 1) << 8 | vertex format
+    DWORD               m_Index;            //  index in the render bits array
+}; // struct SpriteSortKey
+
 typedef static_array<FrameInstance*, c_MaxFrameInstancesPerSurface>     PFrameInstanceArray;
-typedef static_array<SpriteRenderBit*, c_MaxSpritesDrawn>               PSpriteRenderBitArray;
+typedef static_array<SpriteSortKey, c_MaxSpritesDrawn>                  SpriteSortKeyArray;
 typedef static_array<SpriteRenderBit, c_MaxSpritesDrawn>                SpriteRenderBitArray;
+/*****************************************************************************/
+/*    Struct:  SurfaceChunk
+/*    Desc:    Allocated quad of the sprite surface
+/*****************************************************************************/
+struct SurfaceChunk
+{
+    FrameInstance*      m_pInst;        //  owner, NULL for the quads shared by stamps
+    WORD                m_X;
+    WORD                m_Y;
+    WORD                m_ChunkIdx;     //  chunk index in the owner
+    WORD                m_SidePow;
+}; // struct SurfaceChunk
+
+/*****************************************************************************/
+/*    Struct:  SpriteSurfaceStats
+/*****************************************************************************/
+struct SpriteSurfaceStats
+{
+    float               m_Occupancy;        //  allocated part of the surface
+    float               m_Fragmentation;    //  free space out of the largest free quad
+    int                 m_NFreePixels;
+    int                 m_LargestFreeSide;
+    int                 m_NFreeQuads;
+    int                 m_NChunks;
+    int                 m_NInstances;
+}; // struct SpriteSurfaceStats
+
 /*****************************************************************************/
 /*    Class:    SpriteSurface
 /*    Desc:    Sprite surface layout
@@ -341,15 +395,20 @@ typedef static_array<SpriteRenderBit, c_MaxSpritesDrawn>                SpriteRe
 class SpriteSurface
 {
 public:
-    SpriteSurface    () :    m_TexID(-1), m_DropStamp(0xFFFFFFFF) { m_Layout.Init( c_GPTexSide ); }
+    SpriteSurface    () :    m_TexID(-1), m_ShadowTexID(-1), m_DropStamp(0xFFFFFFFF) { m_Layout.Init( c_GPTexSide ); }
     _inl int                AddFrameInstance( FrameInstance* pInstance );
+    _inl void               AddChunk        ( FrameInstance* pInst, int chunkIdx, int sidePow, WORD x, WORD y );
+    void                    ReleaseInstance ( FrameInstance* pInst );
+    void                    GetStats        ( SpriteSurfaceStats& stats ) const;
     
     bool                    Free            ();
     void                    SetTextureID    ( int id ) { m_TexID = id; }
     int                     m_Index;    //  index in the sprite manager's surface array 
     int                     m_TexID;    //  ID of texture used
+    int                     m_ShadowTexID;  //  system memory copy of the surface, when it may be defragmented
     QuadLayout              m_Layout;
     PFrameInstanceArray     m_pFrameInstance;
+    std::vector<SurfaceChunk>   m_Chunks;
 
     //  used for .gp2 drawing style
     int                     m_PackageID;
@@ -360,6 +419,36 @@ public:
 
 
 const int c_MaxPackageNameLen = 64;
+/*****************************************************************************/
+/*    Struct:  SpriteWarmStartHeader
+/*    Desc:    Header of the warm start file, followed by the package names 
+/*              and the frame records
+/*****************************************************************************/
+struct SpriteWarmStartHeader
+{
+    DWORD               m_Magic;            //  c_SpriteWarmStartMagic
+    DWORD               m_Version;
+    DWORD               m_TexSide;          //  surface side the layout was made for
+    DWORD               m_NPackages;
+    DWORD               m_NFrames;
+}; // struct SpriteWarmStartHeader
+
+/*****************************************************************************/
+/*    Struct:  SpriteWarmStartFrame
+/*    Desc:    Frame instance which was cached when the warm start was saved
+/*****************************************************************************/
+struct SpriteWarmStartFrame
+{
+    WORD                m_Package;          //  index of the package name in the file
+    WORD                m_SprID;
+    DWORD               m_Color;
+    WORD                m_LOD;
+    WORD                m_SurfaceID;        //  surface of the first chunk, 0xFFFF for texture pages
+    WORD                m_Width;
+    WORD                m_Height;
+    DWORD               m_Age;              //  frames since the last use
+}; // struct SpriteWarmStartFrame
+
 /*****************************************************************/
 /*  Struct:    PackageStub
 /*  Desc:    
@@ -409,12 +498,14 @@ public:
 
     bool                DrawWChunk         ( int gpID, int sprID, int chunkID, const Vector3D& pos, 
                                                 BaseMesh& geom, int cPoly, int nPoly, int cVert, int nVert, DWORD color );
+    virtual int         DrawSprites        ( const SpriteDrawItem* pItems, int nItems, bool bWorld = false );
     //  storage manipulation
     virtual    int      GetPackageID       ( const char* gpName );
     virtual    bool     LoadPackage        ( int gpID, const char* gpPath = NULL );
     virtual    void     SetPackagePath     ( int gpID, const char* gpPath );
     virtual    void     UnloadPackage      ( int gpID );
     virtual    void     Precache           ( int gpID );
+    virtual    bool     TranscodePackage   ( int gpID, DWORD color = 0 );
 
     //  drawing manipulation
     virtual void        EnableClipping      ( bool enable = true );
@@ -467,15 +558,43 @@ public:
     virtual void        OnCreateRS          () {}
 
     _inl FrameInstance* FindFrameInstance   ( int gpID, int sprID, DWORD color, WORD lod = 0 );
-    _inl int            AllocateQuad        ( int sidePow, WORD& ax, WORD& ay, FrameInstance* pInst, int prevID );
+    _inl int            AllocateQuad        ( int sidePow, WORD& ax, WORD& ay, FrameInstance* pInst, int prevID, int chunkIdx = 0 );
+    void                ReleaseFrameInstance( FrameInstance* pInst, int nChunks = -1 );
     FrameInstance*      AllocFrameInstance  ( int nExtraBytes ) { return m_InstanceAllocator.NewInstance( nExtraBytes ); }
     DWORD               AddFrameInstance    ( FrameInstance* pInst ) { return m_FrameReg.add( pInst->GetKey(), pInst ); }
     int                 GetSurfaceTexID     ( int surfID ) { return m_Surface[surfID].m_TexID; }
     void                AddSurfaceClient    ( int surfID, FrameInstance* pInst ) { m_Surface[surfID].AddFrameInstance( pInst ); }
     DWORD               GetDropStamp        ( int surfID ) const { return m_Surface[surfID].m_DropStamp; }
+    DWORD               GetFrameStamp       () const { return m_FrameStamp; }
     BYTE*               LockSurfRect        ( int surfID, const Rct& rect, int& pitch );
     void                UnlockSurfRect      ();
 
+    int                 Defragment          ( int budget = c_SpriteDefragBudget );
+    void                GetSurfaceStats     ( int surfID, SpriteSurfaceStats& stats ) const { m_Surface[surfID].GetStats( stats ); }
+    void                DumpSurfaceStats    () const;
+
+    //  warm start: frames cached in the previous session are laid out again 
+    //  before they are requested, package files are read ahead on the thread
+    virtual bool        SaveWarmStart       ( const char* fname );
+    virtual bool        LoadWarmStart       ( const char* fname );
+    virtual bool        WarmStartStep       ( float budgetMs );
+    bool                IsWarmStartDone     () const { return m_WarmCursor >= (int)m_WarmFrames.size(); }
+    virtual void        ResetStableFrame    ();
+    //  seconds from Init, LoadWarmStart or ResetStableFrame to the first frame 
+    //  run without the new frame layout, -1 until then
+    virtual float       GetTimeToStableFrame() const { return m_StableTime; }
+
+    //  records frame cache accesses for ReplayResourceTrace, NULL stops recording
+    void                SetResourceTrace    ( ResourceTrace* pTrace ) { m_pResTrace = pTrace; }
+    ResourceTrace*      GetResourceTrace    () const { return m_pResTrace; }
+
+    //  surfaces get system memory copies and are compacted only when their 
+    //  number is capped by the video memory, there fragmentation costs evictions
+    bool                IsDefragmenting     () const { return m_bDefragment; }
+
+    static bool         s_bDefragment;      //  allows surface compaction, read by Init
+    static bool         s_bStreamVertices;  //  generate sprite vertices right into the locked dynamic buffers
+
 protected:
 
     void                Drop                ( FrameInstance* frInst );
@@ -490,9 +609,19 @@ protected:
 
     _inl int            UnswizzleFrameIndex ( int gpID, int sprID );
     int                 GetNSurfaces        () const { return m_Surface.size(); }
+    int                 FindFreeSurface     ( int sidePow ) const;
+    void                WaitWarmRead        ();
+    bool                PollWarmRead        ();
+    void                TraceFrameAccess    ( FrameInstance* pInst );
+    void                UpdateStableFrame   ();
+    static DWORD WINAPI WarmReadProc        ( LPVOID pParam );
+    bool                EvictFromSurface    ( SpriteSurface* pSurface, int sidePow, WORD& ax, WORD& ay );
     
     void                DrawBatches         ();
     void                sse_DrawBatches     ();
+    void                stream_DrawBatches  ();
+    int                 AddRenderBits       ( FrameInstance* pInst, const Matrix4D& tm, DWORD color, VertexFormat vf );
+    void                SortRenderBits      ();
 
 private:
     
@@ -503,7 +632,8 @@ private:
     InstanceAllocator       m_InstanceAllocator;
 
     SpriteRenderBitArray    m_RenderBits;
-    PSpriteRenderBitArray   m_SortedRenderBits;
+    SpriteSortKeyArray      m_SortKeys;         //  render bits order, after SortRenderBits
+    SpriteSortKeyArray      m_SortKeysTmp;      //  radix sort scratch buffer
 
     float                   m_CurScale;
     DWORD                   m_CurDiffuse;
@@ -527,9 +657,25 @@ private:
     int                     m_CanvasTex;
 
     int                     m_CurSurface;
+    int                     m_DefragSurface;    //  surface being compacted, -1 when none
+    bool                    m_bDefragment;      //  surfaces have shadow copies, set by Init
+    DWORD                   m_FrameStamp;
 
     BaseMesh                m_Prim;
     Timer                   m_Timer;
+
+    std::vector<SpriteWarmStartFrame>   m_WarmFrames;   //  frames to lay out, package is remapped to gpID
+    int                     m_WarmCursor;
+    std::vector<std::string>    m_WarmPaths;        //  package files read ahead by the thread
+    HANDLE                  m_hWarmThread;
+    int                     m_NWarmLaidOut;
+
+    int                     m_NFrameMisses;     //  frame instances laid out in the current frame
+    int                     m_NStableFrames;    //  current run of frames without misses
+    float                   m_StartTime;
+    float                   m_StableTime;
+
+    ResourceTrace*          m_pResTrace;
     
     Rct                     m_ClipArea;
     Group*                  m_pSurfaces;
@@ -541,6 +687,10 @@ private:
 
 extern SpriteManager g_SpriteManager;
 
+//  times per sprite submission and vertex generation of nSprites frames of the
+//  package, with the old path and with the batched streaming one
+bool BenchmarkSprites( int gpID, int nSprites = 10000, int nFrames = 16 );
+
 #ifdef _INLINES
 #include "sgSpriteManager.inl"
 #endif // _INLINES
@@ -44,6 +44,17 @@ int SpriteSurface::AddFrameInstance( FrameInstance* pInstance )
 	return m_pFrameInstance.size() - 1;
 } // SpriteSurface::AddFrameInstance
 
+void SpriteSurface::AddChunk( FrameInstance* pInst, int chunkIdx, int sidePow, WORD x, WORD y )
+{
+	SurfaceChunk chunk;
+	chunk.m_pInst		= pInst;
+	chunk.m_X			= x;
+	chunk.m_Y			= y;
+	chunk.m_ChunkIdx	= chunkIdx;
+	chunk.m_SidePow		= sidePow;
+	m_Chunks.push_back( chunk );
+} // SpriteSurface::AddChunk
+
 /*****************************************************************/
 /*	SpriteManager implementation
 /*****************************************************************/
@@ -54,28 +65,47 @@ _inl FrameInstance*	SpriteManager::FindFrameInstance( int gpID, int sprID, DWORD
 	return m_FrameReg.elem( frameID );
 } // SpriteManager::FindFrameInstance
 
-_inl int SpriteManager::AllocateQuad( int sidePow, WORD& ax, WORD& ay, FrameInstance* pInst, int prevID )
+_inl int SpriteManager::AllocateQuad( int sidePow, WORD& ax, WORD& ay, FrameInstance* pInst, int prevID, int chunkIdx )
 {
 	SpriteSurface* pSurface = &m_Surface[m_CurSurface];
-	bool res = pSurface->m_Layout.AllocChunk( sidePow, ax, ay ); 
-	if (res && prevID != m_CurSurface) pSurface->AddFrameInstance( pInst );
+	bool res = !pSurface->m_pFrameInstance.full() && pSurface->m_Layout.AllocChunk( sidePow, ax, ay ); 
 	
 	if (!res) 
 	//  no more place on the current texture
 	{
-		DWORD frame = IRS->GetCurFrame();
-		bool bRes = false;
+		//  other surface may have the free quad
+		int surfID = FindFreeSurface( sidePow );
+		if (surfID >= 0)
+		{
+			m_CurSurface = surfID;
+			pSurface = &m_Surface[m_CurSurface];
+			res = pSurface->m_Layout.AllocChunk( sidePow, ax, ay );
+		}
+	}
+
+	if (!res)
+	//  free the place by dropping the least recently used frames, 
+	//  whole surface is dropped only when it does not help
+	{
         Flush();
+        for (int i = 0; i < m_Surface.size() && !res; i++)
+        {
+		    m_CurSurface = (m_CurSurface + 1) % m_Surface.size();
+		    pSurface = &m_Surface[m_CurSurface];
+			res = EvictFromSurface( pSurface, sidePow, ax, ay );
+        }
+		bool bRes = res;
         while (!bRes)
         {
 		    m_CurSurface = (m_CurSurface + 1) % m_Surface.size();
 		    pSurface = &m_Surface[m_CurSurface];
 		    bRes = pSurface->Free();
         }
-		res = pSurface->m_Layout.AllocChunk( sidePow, ax, ay );
+		if (!res) res = pSurface->m_Layout.AllocChunk( sidePow, ax, ay );
 		if (!res ) return -1;
-		pSurface->AddFrameInstance( pInst );
 	}	
+	if (prevID != m_CurSurface) pSurface->AddFrameInstance( pInst );
+	pSurface->AddChunk( pInst, chunkIdx, sidePow, ax, ay );
 	return m_CurSurface;
 } // SpriteManager::AllocateQuad
 
@@ -99,8 +129,10 @@ _inl FrameInstance* SpriteManager::GetFrameInstance( int& gpID, int& sprID, DWOR
 
     FrameInstance* pInst = FindFrameInstance( gpID, sprID, color, lod );
     //if (pInst && pInst->IsCached()) return pInst;
-    if (pInst) return pInst;
-    pInst = pPackage->PrecacheFrame( sprID, color, lod );
+    if (!pInst || !pInst->IsCached()) m_NFrameMisses++;
+    if (!pInst) pInst = pPackage->PrecacheFrame( sprID, color, lod );
+    if (pInst) pInst->SetUseStamp( m_FrameStamp );
+    if (m_pResTrace && pInst) TraceFrameAccess( pInst );
 	return pInst;
 } // SpriteManager::GetFrameInstance
 
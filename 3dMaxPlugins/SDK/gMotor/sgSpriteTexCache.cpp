@@ -0,0 +1,381 @@
+/*****************************************************************************/
+/*    File:    sgSpriteTexCache.cpp
+/*    Desc:    Transcoded form of the quad sprite packages
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#include "stdafx.h"
+#include "kHash.hpp"
+#include "kResource.h"
+#include "kTimer.h"
+#include "kQuadLayout.h"
+#include "kDXTCodec.h"
+#include "sgSpriteManager.h"
+#include "sgGQuad.h"
+#include "sgSpriteTexCache.h"
+#include <algorithm>
+
+bool                            SpriteTexCache::s_bEnabled = true;
+std::vector<SpriteTexCache*>    SpriteTexCache::s_Caches;
+
+//  expands 4444 texel to 8888
+inline DWORD Expand4444( WORD c )
+{
+    return  (DWORD( ((c >> 12) & 0xF)*17 ) << 24) |
+            (DWORD( ((c >> 8 ) & 0xF)*17 ) << 16) |
+            (DWORD( ((c >> 4 ) & 0xF)*17 ) << 8 ) |
+             DWORD( ( c        & 0xF)*17 );
+} // Expand4444
+
+/*****************************************************************************/
+/*    SpriteTexCache implementation
+/*****************************************************************************/
+SpriteTexCache::SpriteTexCache() 
+    :   m_SrcMagic  ( 0                     ), 
+        m_SrcSize   ( 0                     ), 
+        m_Color     ( 0                     ), 
+        m_PageSide  ( c_SpriteTexPageSide   )
+{
+    s_Caches.push_back( this );
+}
+
+SpriteTexCache::~SpriteTexCache()
+{
+    Clear();
+    s_Caches.erase( std::find( s_Caches.begin(), s_Caches.end(), this ) );
+}
+
+void SpriteTexCache::Clear()
+{
+    ReleaseTextures();
+    m_Frames.clear();
+    m_Chunks.clear();
+    m_Pages.clear();
+    m_Blocks.clear();
+    m_PageTexID.clear();
+} // SpriteTexCache::Clear
+
+void SpriteTexCache::GetFileName( const char* gpPath, DWORD color, char* fname )
+{
+    sprintf( fname, "%s.%08X.%s", gpPath, color, c_SpriteTexCacheExt );
+} // SpriteTexCache::GetFileName
+
+/*---------------------------------------------------------------------------*/
+/*    Func:    SpriteTexCache::Build
+/*    Desc:    Unpacks all frames of the package, lays out the chunks on the
+/*             pages and compresses the pages. Pages with binary alpha go to
+/*             DXT1, the rest to DXT5
+/*---------------------------------------------------------------------------*/
+bool SpriteTexCache::Build( QuadSpritePackage* pPackage, DWORD color, SpriteTexReport* pReport )
+{
+    Clear();
+    if (!pPackage) return false;
+    m_Name      = pPackage->GetName();
+    m_SrcMagic  = pPackage->GetMagic();
+    m_SrcSize   = pPackage->GetFileSize();
+    m_Color     = color;
+    m_PageSide  = c_SpriteTexPageSide;
+
+    int nFrames = pPackage->GetNFrames();
+    if (nFrames <= 0) return false;
+    m_Frames.resize( nFrames );
+
+    std::vector<QuadLayout>             layout;
+    std::vector< std::vector<DWORD> >   pagePix;
+    int     bytes4444   = 0;
+    double  decodeTime  = 0.0;
+    Timer   timer;
+    timer.start();
+
+    int sprID = 0;
+    while (sprID < nFrames)
+    {
+        DWORD nSegFrames, dataSize, firstInSeg, segIdx;
+        DWORD frameOffset[c_MaxFramesInPackedSegment];
+        double segStart = timer.seconds();
+        const BYTE* pData = pPackage->GetSegmentData( sprID, dataSize, segIdx, firstInSeg,
+                                                      nSegFrames, &frameOffset[0], color );
+        decodeTime += timer.seconds() - segStart;
+        if (!pData || nSegFrames == 0)
+        {
+            Log.Error( "Could not unpack pixel data in file %s", pPackage->GetPath() );
+            Clear();
+            return false;
+        }
+
+        for (int i = 0; i < nSegFrames; i++)
+        {
+            int frameID = firstInSeg + i;
+            if (frameID >= nFrames) break;
+            SpriteTexFrame& frame   = m_Frames[frameID];
+            frame.m_Width           = pPackage->GetFrameWidth   ( frameID );
+            frame.m_Height          = pPackage->GetFrameHeight  ( frameID );
+            frame.m_NChunks         = pPackage->GetFrameNSquares( frameID );
+            frame.m_SegIdx          = segIdx;
+            frame.m_FirstChunk      = m_Chunks.size();
+
+            const BYTE* pChunk = pData + frameOffset[i];
+            for (int j = 0; j < frame.m_NChunks; j++)
+            {
+                const FrameChunkHeader* pChunkHdr = (const FrameChunkHeader*)pChunk;
+                int side    = pChunkHdr->GetSide();
+                int sidePow = tmax( pChunkHdr->GetSidePow(), c_SpriteTexMinSidePow );
+
+                //  first fit over the pages
+                WORD ax = 0, ay = 0;
+                int pageID = 0;
+                while (pageID < layout.size() && !layout[pageID].AllocChunk( sidePow, ax, ay )) pageID++;
+                if (pageID == layout.size())
+                {
+                    layout.push_back( QuadLayout() );
+                    layout.back().Init( m_PageSide );
+                    pagePix.push_back( std::vector<DWORD>( m_PageSide*m_PageSide, 0 ) );
+                    if (!layout.back().AllocChunk( sidePow, ax, ay ))
+                    {
+                        Log.Error( "Sprite chunk does not fit texture page: %s", pPackage->GetName() );
+                        Clear();
+                        return false;
+                    }
+                }
+
+                SpriteTexChunk chunk;
+                chunk.m_X       = pChunkHdr->GetX();
+                chunk.m_Y       = pChunkHdr->GetY();
+                chunk.m_Side    = side;
+                chunk.m_Page    = pageID;
+                chunk.m_U       = ax;
+                chunk.m_V       = ay;
+                m_Chunks.push_back( chunk );
+
+                const WORD* pSrc = (const WORD*)pChunkHdr->GetPixelData();
+                DWORD*      pDst = &pagePix[pageID][ay*m_PageSide + ax];
+                for (int y = 0; y < side; y++)
+                {
+                    for (int x = 0; x < side; x++) pDst[x] = Expand4444( pSrc[x] );
+                    pSrc += side;
+                    pDst += m_PageSide;
+                }
+                bytes4444 += side*side*2;
+                pChunk += pChunkHdr->GetSizeBytes();
+            }
+        }
+        sprID = firstInSeg + nSegFrames;
+    }
+
+    //  compress the pages
+    int     nPages      = pagePix.size();
+    int     nDXT5       = 0;
+    double  sumPSNR     = 0.0;
+    double  minPSNR     = 0.0;
+    std::vector<DWORD> decoded( m_PageSide*m_PageSide );
+    for (int i = 0; i < nPages; i++)
+    {
+        const DWORD* pPix = &pagePix[i][0];
+        int nPix = m_PageSide*m_PageSide;
+        bool bDXT5 = false;
+        for (int j = 0; j < nPix && !bDXT5; j++)
+        {
+            DWORD a = pPix[j] >> 24;
+            bDXT5 = (a != 0 && a != 0xFF);
+        }
+
+        SpriteTexPage page;
+        page.m_Format       = bDXT5 ? cfDXT5 : cfDXT1;
+        page.m_Offset       = m_Blocks.size();
+        page.m_SizeBytes    = DXTGetImageSize( m_PageSide, m_PageSide, bDXT5 );
+        m_Pages.push_back( page );
+        m_Blocks.resize( page.m_Offset + page.m_SizeBytes );
+        DXTEncodeImage( pPix, m_PageSide, m_PageSide, &m_Blocks[page.m_Offset], bDXT5 );
+        if (bDXT5) nDXT5++;
+
+        if (pReport)
+        {
+            DXTDecodeImage( &m_Blocks[page.m_Offset], m_PageSide, m_PageSide, &decoded[0], bDXT5 );
+            double psnr = DXTCalcPSNR( pPix, &decoded[0], nPix );
+            sumPSNR += psnr;
+            minPSNR = (i == 0) ? psnr : tmin( minPSNR, psnr );
+        }
+    }
+    m_PageTexID.resize( nPages, -1 );
+
+    if (pReport)
+    {
+        pReport->m_NFrames      = nFrames;
+        pReport->m_NChunks      = m_Chunks.size();
+        pReport->m_NPages       = nPages;
+        pReport->m_NDXT5Pages   = nDXT5;
+        pReport->m_DecodeMs     = decodeTime*1000.0;
+        pReport->m_EncodeMs     = (timer.seconds() - decodeTime)*1000.0;
+        pReport->m_Bytes4444    = bytes4444;
+        pReport->m_BytesDXT     = m_Blocks.size();
+        pReport->m_MeanPSNR     = nPages ? sumPSNR/double( nPages ) : 0.0;
+        pReport->m_MinPSNR      = minPSNR;
+    }
+    return true;
+} // SpriteTexCache::Build
+
+bool SpriteTexCache::Save( const char* fname ) const
+{
+    if (!IsValid()) return false;
+    FOutStream os( fname );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write sprite texture cache <%s>", fname );
+        return false;
+    }
+    SpriteTexCacheHeader hdr;
+    hdr.m_Magic     = c_SpriteTexCacheMagic;
+    hdr.m_Version   = c_SpriteTexCacheVersion;
+    hdr.m_SrcMagic  = m_SrcMagic;
+    hdr.m_SrcSize   = m_SrcSize;
+    hdr.m_Color     = m_Color;
+    hdr.m_NFrames   = m_Frames.size();
+    hdr.m_NChunks   = m_Chunks.size();
+    hdr.m_NPages    = m_Pages.size();
+    hdr.m_PageSide  = m_PageSide;
+    os.Write( &hdr, sizeof( hdr ) );
+    os.Write( &m_Pages[0],  m_Pages.size()*sizeof( SpriteTexPage ) );
+    os.Write( &m_Frames[0], m_Frames.size()*sizeof( SpriteTexFrame ) );
+    if (m_Chunks.size() > 0) os.Write( &m_Chunks[0], m_Chunks.size()*sizeof( SpriteTexChunk ) );
+    if (m_Blocks.size() > 0) os.Write( &m_Blocks[0], m_Blocks.size() );
+    os.CloseFile();
+    return true;
+} // SpriteTexCache::Save
+
+bool SpriteTexCache::Load( const char* fname, QuadSpritePackage* pPackage, DWORD color )
+{
+    Clear();
+    //  color is kept for the failed loads too, so they are not retried
+    m_Color = color;
+    FInStream is( fname );
+    if (is.NoFile()) return false;
+    int fileSize = is.GetFileSize();
+    SpriteTexCacheHeader hdr;
+    if (is.Read( &hdr, sizeof( hdr ) ) != sizeof( hdr ) ||
+        hdr.m_Magic != c_SpriteTexCacheMagic || hdr.m_Version != c_SpriteTexCacheVersion)
+    {
+        Log.Warning( "Invalid sprite texture cache <%s>", fname );
+        return false;
+    }
+    //  source package is identified by magic and data size, so stale caches are skipped
+    if (hdr.m_SrcMagic != pPackage->GetMagic() || hdr.m_SrcSize != pPackage->GetFileSize() ||
+        hdr.m_NFrames != pPackage->GetNFrames() || hdr.m_Color != color ||
+        hdr.m_NPages <= 0 || hdr.m_PageSide != c_SpriteTexPageSide)
+    {
+        Log.Warning( "Sprite texture cache <%s> is out of date", fname );
+        return false;
+    }
+    //  tables are bounded by the file size before they are allocated
+    int nDataBytes = fileSize - sizeof( hdr );
+    if (hdr.m_NChunks < 0 || 
+        hdr.m_NPages  > nDataBytes/sizeof( SpriteTexPage ) ||
+        hdr.m_NFrames > nDataBytes/sizeof( SpriteTexFrame ) ||
+        hdr.m_NChunks > nDataBytes/sizeof( SpriteTexChunk ) ||
+        hdr.m_NPages*sizeof( SpriteTexPage ) + hdr.m_NFrames*sizeof( SpriteTexFrame ) + 
+            hdr.m_NChunks*sizeof( SpriteTexChunk ) > nDataBytes)
+    {
+        Log.Warning( "Sprite texture cache <%s> is corrupt", fname );
+        return false;
+    }
+
+    m_Pages.resize  ( hdr.m_NPages  );
+    m_Frames.resize ( hdr.m_NFrames );
+    m_Chunks.resize ( hdr.m_NChunks );
+    int nPageBytes  = m_Pages.size()*sizeof( SpriteTexPage );
+    int nFrameBytes = m_Frames.size()*sizeof( SpriteTexFrame );
+    int nChunkBytes = m_Chunks.size()*sizeof( SpriteTexChunk );
+    bool bOK = (is.Read( &m_Pages[0], nPageBytes ) == nPageBytes) &&
+               (is.Read( &m_Frames[0], nFrameBytes ) == nFrameBytes) &&
+               (nChunkBytes == 0 || is.Read( &m_Chunks[0], nChunkBytes ) == nChunkBytes);
+    if (!bOK)
+    {
+        Log.Warning( "Sprite texture cache <%s> is truncated", fname );
+        Clear();
+        return false;
+    }
+    //  pages have to lie in the block data left in the file and be of the page side size,
+    //  chunks and frames have to point to the existing pages and chunks
+    DWORD nBlockBytes = nDataBytes - nPageBytes - nFrameBytes - nChunkBytes;
+    DWORD nUsedBytes  = 0;
+    for (int i = 0; i < m_Pages.size() && bOK; i++)
+    {
+        const SpriteTexPage& page = m_Pages[i];
+        bOK = (page.m_Format == cfDXT1 || page.m_Format == cfDXT5) &&
+              page.m_SizeBytes == DXTGetImageSize( hdr.m_PageSide, hdr.m_PageSide, page.m_Format == cfDXT5 ) &&
+              page.m_Offset <= nBlockBytes && page.m_SizeBytes <= nBlockBytes - page.m_Offset;
+        nUsedBytes = tmax( nUsedBytes, page.m_Offset + page.m_SizeBytes );
+    }
+    for (int i = 0; i < m_Chunks.size() && bOK; i++)
+    {
+        const SpriteTexChunk& chunk = m_Chunks[i];
+        bOK = chunk.m_Page < m_Pages.size() && 
+              chunk.m_U + chunk.m_Side <= hdr.m_PageSide && chunk.m_V + chunk.m_Side <= hdr.m_PageSide;
+    }
+    for (int i = 0; i < m_Frames.size() && bOK; i++)
+    {
+        const SpriteTexFrame& frame = m_Frames[i];
+        bOK = frame.m_FirstChunk <= m_Chunks.size() && frame.m_NChunks <= m_Chunks.size() - frame.m_FirstChunk;
+    }
+    if (bOK)
+    {
+        m_Blocks.resize( nUsedBytes );
+        bOK = (is.Read( &m_Blocks[0], m_Blocks.size() ) == m_Blocks.size());
+    }
+    if (!bOK)
+    {
+        Log.Warning( "Sprite texture cache <%s> is corrupt", fname );
+        Clear();
+        return false;
+    }
+
+    m_Name      = pPackage->GetName();
+    m_SrcMagic  = hdr.m_SrcMagic;
+    m_SrcSize   = hdr.m_SrcSize;
+    m_PageSide  = hdr.m_PageSide;
+    m_PageTexID.resize( m_Pages.size(), -1 );
+    return true;
+} // SpriteTexCache::Load
+
+int SpriteTexCache::GetPageTexID( int pageID )
+{
+    int& texID = m_PageTexID[pageID];
+    if (texID != -1) return texID;
+
+    const SpriteTexPage& page = m_Pages[pageID];
+    char texName[_MAX_PATH];
+    sprintf( texName, "%s_%08X_%02d", m_Name.c_str(), m_Color, pageID );
+    texID = IRS->CreateTexture( texName, m_PageSide, m_PageSide, (ColorFormat)page.m_Format, 1, tmpManaged );
+    if (texID == -1)
+    {
+        Log.Error( "Could not create sprite texture page %s", texName );
+        return -1;
+    }
+
+    int pitch = 0;
+    BYTE* pBits = IRS->LockTexBits( texID, pitch );
+    if (!pBits) return texID;
+    int nRows       = m_PageSide/c_DXTBlockSide;
+    int rowBytes    = page.m_SizeBytes/nRows;
+    const BYTE* pSrc = &m_Blocks[page.m_Offset];
+    for (int i = 0; i < nRows; i++)
+    {
+        memcpy( pBits, pSrc, rowBytes );
+        pBits += pitch;
+        pSrc  += rowBytes;
+    }
+    IRS->UnlockTexBits( texID );
+    return texID;
+} // SpriteTexCache::GetPageTexID
+
+void SpriteTexCache::ReleaseTextures()
+{
+    for (int i = 0; i < m_PageTexID.size(); i++)
+    {
+        if (m_PageTexID[i] != -1) IRS->DeleteTexture( m_PageTexID[i] );
+        m_PageTexID[i] = -1;
+    }
+} // SpriteTexCache::ReleaseTextures
+
+void SpriteTexCache::CleanCache()
+{
+    for (int i = 0; i < s_Caches.size(); i++) s_Caches[i]->ReleaseTextures();
+} // SpriteTexCache::CleanCache
@@ -0,0 +1,136 @@
+/*****************************************************************************/
+/*    File:    sgSpriteTexCache.h
+/*    Desc:    Transcoded form of the quad sprite packages: chunks are laid out
+/*             offline on the DXT1/DXT5 texture pages, which are loaded
+/*             without unpacking and surface allocation
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __SGSPRITETEXCACHE_H__
+#define __SGSPRITETEXCACHE_H__
+
+class QuadSpritePackage;
+
+const DWORD c_SpriteTexCacheMagic   = 'CXTS';
+const DWORD c_SpriteTexCacheVersion = 1;
+const char  c_SpriteTexCacheExt[]   = "gtc";
+const int   c_SpriteTexPageSide     = 512;
+const int   c_SpriteTexMinSidePow   = 2;    //  chunks are padded to the DXT block side
+
+/*****************************************************************************/
+/*    Struct:  SpriteTexCacheHeader
+/*****************************************************************************/
+struct SpriteTexCacheHeader
+{
+    DWORD           m_Magic;        //  c_SpriteTexCacheMagic
+    DWORD           m_Version;      //  c_SpriteTexCacheVersion
+    DWORD           m_SrcMagic;     //  magic of the source package
+    DWORD           m_SrcSize;      //  pixel data size of the source package
+    DWORD           m_Color;        //  national color the package was unpacked with
+    int             m_NFrames;
+    int             m_NChunks;
+    int             m_NPages;
+    int             m_PageSide;
+}; // struct SpriteTexCacheHeader
+
+/*****************************************************************************/
+/*    Struct:  SpriteTexPage
+/*****************************************************************************/
+struct SpriteTexPage
+{
+    DWORD           m_Format;       //  cfDXT1 or cfDXT5
+    DWORD           m_Offset;       //  offset of the page blocks in the block data
+    DWORD           m_SizeBytes;
+}; // struct SpriteTexPage
+
+/*****************************************************************************/
+/*    Struct:  SpriteTexFrame
+/*****************************************************************************/
+struct SpriteTexFrame
+{
+    WORD            m_Width;
+    WORD            m_Height;
+    WORD            m_NChunks;
+    WORD            m_SegIdx;       //  pack segment of the frame in the source package
+    DWORD           m_FirstChunk;
+}; // struct SpriteTexFrame
+
+/*****************************************************************************/
+/*    Struct:  SpriteTexChunk
+/*****************************************************************************/
+struct SpriteTexChunk
+{
+    short           m_X;            //  chunk position in the frame
+    short           m_Y;
+    WORD            m_Side;         //  chunk side in the frame, before padding
+    WORD            m_Page;
+    WORD            m_U;            //  chunk position on the page, in texels
+    WORD            m_V;
+}; // struct SpriteTexChunk
+
+/*****************************************************************************/
+/*    Struct:  SpriteTexReport
+/*****************************************************************************/
+struct SpriteTexReport
+{
+    int             m_NFrames;
+    int             m_NChunks;
+    int             m_NPages;
+    int             m_NDXT5Pages;
+    float           m_DecodeMs;     //  time spent unpacking the source segments
+    float           m_EncodeMs;     //  time spent in the layout and block compression
+    int             m_Bytes4444;    //  texture memory of the chunks as 4444 texels
+    int             m_BytesDXT;     //  texture memory of the DXT pages
+    double          m_MeanPSNR;     //  dB, against the 4444 texels
+    double          m_MinPSNR;
+}; // struct SpriteTexReport
+
+/*****************************************************************************/
+/*    Class:   SpriteTexCache
+/*    Desc:    Texture pages of a quad sprite package, transcoded for a single
+/*             national color. Block data stays in memory, page textures are
+/*             created on first use and released by CleanCache
+/*****************************************************************************/
+class SpriteTexCache
+{
+public:
+                                SpriteTexCache  ();
+                                ~SpriteTexCache ();
+
+    void                        Clear           ();
+    bool                        Build           ( QuadSpritePackage* pPackage, DWORD color, SpriteTexReport* pReport = NULL );
+    bool                        Save            ( const char* fname ) const;
+    bool                        Load            ( const char* fname, QuadSpritePackage* pPackage, DWORD color );
+
+    bool                        IsValid         () const { return m_Frames.size() > 0; }
+    DWORD                       GetColor        () const { return m_Color; }
+    int                         GetPageSide     () const { return m_PageSide; }
+    int                         GetNPages       () const { return m_Pages.size(); }
+    int                         GetTextureBytes () const { return m_Blocks.size(); }
+
+    const SpriteTexFrame&       GetFrame        ( int frameID ) const { return m_Frames[frameID]; }
+    const SpriteTexChunk&       GetChunk        ( int chunkID ) const { return m_Chunks[chunkID]; }
+    int                         GetPageTexID    ( int pageID );
+    void                        ReleaseTextures ();
+
+    static void                 GetFileName     ( const char* gpPath, DWORD color, char* fname );
+    //  releases page textures of all the caches, blocks are uploaded again on demand
+    static void                 CleanCache      ();
+
+    static bool                 s_bEnabled;
+
+private:
+    std::vector<SpriteTexFrame> m_Frames;
+    std::vector<SpriteTexChunk> m_Chunks;
+    std::vector<SpriteTexPage>  m_Pages;
+    std::vector<BYTE>           m_Blocks;
+    std::vector<int>            m_PageTexID;
+    std::string                 m_Name;
+    DWORD                       m_SrcMagic;
+    DWORD                       m_SrcSize;
+    DWORD                       m_Color;
+    int                         m_PageSide;
+
+    static std::vector<SpriteTexCache*>     s_Caches;
+}; // class SpriteTexCache
+
+#endif // __SGSPRITETEXCACHE_H__
@@ -0,0 +1,308 @@
+/*****************************************************************************/
+/*    File:    vBillboardBatch.cpp
+/*    Desc:    Batched camera facing quads, expanded from the structure of
+/*             arrays streams into the multi-frame ring vertex buffer
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#include "stdafx.h"
+#include "rsVertex.h"
+#include "vBillboardBatch.h"
+#include <xmmintrin.h>
+
+BillboardRing g_BillboardRing;
+
+static __forceinline void StoreVec( float* p, __m128 v, bool bAligned )
+{
+    if (bAligned) _mm_stream_ps( p, v ); else _mm_storeu_ps( p, v );
+} // StoreVec
+
+//  texture coordinates of the quad corners, as (u, v, u2, v2)
+static __forceinline void StoreQuadUV( float* pOut, const Rct& uv, const Rct& uv2, bool bAligned )
+{
+    __declspec(align(16)) static const DWORD c_EvenMask[4] = { 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF, 0x00000000 };
+    __m128 r    = _mm_loadu_ps( &uv.x );
+    __m128 r2   = _mm_loadu_ps( &uv2.x );
+    __m128 lo   = _mm_movelh_ps( r, r2 );                                       //  x,  y,  x2,     y2
+    __m128 hi   = _mm_add_ps( lo, _mm_movehl_ps( _mm_movehl_ps( r2, r2 ), r ) );  //  x + w, ...
+    __m128 even = _mm_load_ps( (const float*)c_EvenMask );
+    StoreVec( pOut +  4, _mm_or_ps( _mm_and_ps( even, lo ), _mm_andnot_ps( even, hi ) ), bAligned );
+    StoreVec( pOut + 12, hi, bAligned );
+    StoreVec( pOut + 20, lo, bAligned );
+    StoreVec( pOut + 28, _mm_or_ps( _mm_and_ps( even, hi ), _mm_andnot_ps( even, lo ) ), bAligned );
+} // StoreQuadUV
+
+/*---------------------------------------------------------------------------*/
+/*  Func:   ExpandBillboards4
+/*  Desc:   Expands 4 quads starting at i. Quad corners are computed for all
+/*          four quads at once, lanes are quads, then transposed into the
+/*          vertices
+/*---------------------------------------------------------------------------*/
+static void ExpandBillboards4( float* pOut, const BillboardStreams& s, int i, const __m128* bs, bool bAligned )
+{
+    const __m128 zero = _mm_setzero_ps();
+    __m128 sx = _mm_loadu_ps( s.m_SizeX + i );
+    __m128 sy = _mm_loadu_ps( s.m_SizeY + i );
+    __m128 cr = _mm_set1_ps( 1.0f );
+    __m128 sr = zero;
+    if (s.m_Rot)
+    {
+        __declspec(align(16)) float c[4];
+        __declspec(align(16)) float sn[4];
+        for (int k = 0; k < 4; k++)
+        {
+            float rot = s.m_Rot[i + k];
+            c[k]  = 1.0f;
+            sn[k] = 0.0f;
+            if (fabs( rot ) > 0.0f)
+            {
+                c[k]  = cosf( rot );
+                sn[k] = sinf( rot );
+            }
+        }
+        cr = _mm_load_ps( c );
+        sr = _mm_load_ps( sn );
+    }
+
+    //  quad edges and the left top corner in the basis plane
+    __m128 ax = _mm_mul_ps( cr, sx );
+    __m128 ay = _mm_mul_ps( sr, sx );
+    __m128 bx = _mm_sub_ps( zero, _mm_mul_ps( sr, sy ) );
+    __m128 by = _mm_mul_ps( cr, sy );
+    __m128 ox = _mm_sub_ps( zero, _mm_add_ps( _mm_mul_ps( ax, bs[9] ), _mm_mul_ps( bx, bs[10] ) ) );
+    __m128 oy = _mm_sub_ps( zero, _mm_add_ps( _mm_mul_ps( ay, bs[9] ), _mm_mul_ps( by, bs[10] ) ) );
+
+    //  to the world space: bs[0..2] right, bs[3..5] up, bs[6..8] origin
+    __m128 e[3], f[3], o[3];
+    const float* pos[3] = { s.m_PosX + i, s.m_PosY + i, s.m_PosZ + i };
+    for (int c = 0; c < 3; c++)
+    {
+        e[c] = _mm_add_ps( _mm_mul_ps( ax, bs[c] ), _mm_mul_ps( ay, bs[c + 3] ) );
+        f[c] = _mm_add_ps( _mm_mul_ps( bx, bs[c] ), _mm_mul_ps( by, bs[c + 3] ) );
+        o[c] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, bs[c] ), _mm_mul_ps( oy, bs[c + 3] ) ),
+                           _mm_add_ps( _mm_loadu_ps( pos[c] ), bs[c + 6] ) );
+    }
+
+    __m128 color = _mm_loadu_ps( (const float*)(s.m_Color + i) );
+    for (int k = 0; k < 4; k++)
+    {
+        //  corners: left top, right top, left bottom, right bottom
+        __m128 x = o[0], y = o[1], z = o[2], w = color;
+        if (k & 1)
+        {
+            x = _mm_add_ps( x, e[0] );
+            y = _mm_add_ps( y, e[1] );
+            z = _mm_add_ps( z, e[2] );
+        }
+        if (k & 2)
+        {
+            x = _mm_add_ps( x, f[0] );
+            y = _mm_add_ps( y, f[1] );
+            z = _mm_add_ps( z, f[2] );
+        }
+        _MM_TRANSPOSE4_PS( x, y, z, w );
+        StoreVec( pOut + (0*4 + k)*8, x, bAligned );
+        StoreVec( pOut + (1*4 + k)*8, y, bAligned );
+        StoreVec( pOut + (2*4 + k)*8, z, bAligned );
+        StoreVec( pOut + (3*4 + k)*8, w, bAligned );
+    }
+
+    for (int q = 0; q < 4; q++)
+    {
+        const Rct& uv = s.m_UV[i + q];
+        StoreQuadUV( pOut + q*32, uv, s.m_UV2 ? s.m_UV2[i + q] : uv, bAligned );
+    }
+} // ExpandBillboards4
+
+void ExpandBillboards( Vertex2t* pOut, const BillboardStreams& s, int first, int n, const BillboardBasis& basis )
+{
+    __m128 bs[11];
+    bs[0]  = _mm_set1_ps( basis.m_Right.x  );
+    bs[1]  = _mm_set1_ps( basis.m_Right.y  );
+    bs[2]  = _mm_set1_ps( basis.m_Right.z  );
+    bs[3]  = _mm_set1_ps( basis.m_Up.x     );
+    bs[4]  = _mm_set1_ps( basis.m_Up.y     );
+    bs[5]  = _mm_set1_ps( basis.m_Up.z     );
+    bs[6]  = _mm_set1_ps( basis.m_Origin.x );
+    bs[7]  = _mm_set1_ps( basis.m_Origin.y );
+    bs[8]  = _mm_set1_ps( basis.m_Origin.z );
+    bs[9]  = _mm_set1_ps( basis.m_RefX     );
+    bs[10] = _mm_set1_ps( basis.m_RefY     );
+
+    float*  pDst        = (float*)pOut;
+    bool    bAligned    = (size_t( pDst ) & 0xF) == 0;
+    int     end         = first + n;
+    int     i           = first;
+    for (; i + 4 <= end; i += 4, pDst += 4*32)
+    {
+        ExpandBillboards4( pDst, s, i, bs, bAligned );
+    }
+
+    //  tail goes through the copy padded to 4 quads
+    int nRest = end - i;
+    if (nRest > 0)
+    {
+        float   posX[4], posY[4], posZ[4], sizeX[4], sizeY[4], rot[4];
+        DWORD   color[4];
+        Rct     uv[4], uv2[4];
+        for (int k = 0; k < 4; k++)
+        {
+            int j = i + tmin( k, nRest - 1 );
+            posX[k]  = s.m_PosX[j];
+            posY[k]  = s.m_PosY[j];
+            posZ[k]  = s.m_PosZ[j];
+            sizeX[k] = s.m_SizeX[j];
+            sizeY[k] = s.m_SizeY[j];
+            rot[k]   = s.m_Rot ? s.m_Rot[j] : 0.0f;
+            color[k] = s.m_Color[j];
+            uv[k]    = s.m_UV[j];
+            uv2[k]   = s.m_UV2 ? s.m_UV2[j] : s.m_UV[j];
+        }
+        BillboardStreams tail;
+        tail.m_NQuads   = 4;
+        tail.m_PosX     = posX;
+        tail.m_PosY     = posY;
+        tail.m_PosZ     = posZ;
+        tail.m_SizeX    = sizeX;
+        tail.m_SizeY    = sizeY;
+        tail.m_Rot      = rot;
+        tail.m_Color    = color;
+        tail.m_UV       = uv;
+        tail.m_UV2      = uv2;
+
+        __declspec(align(16)) float tmp[4*32];
+        ExpandBillboards4( tmp, tail, 0, bs, false );
+        memcpy( pDst, tmp, nRest*32*sizeof( float ) );
+    }
+    if (bAligned) _mm_sfence();
+} // ExpandBillboards
+
+/*****************************************************************************/
+/*  BillboardRing implementation
+/*****************************************************************************/
+BillboardRing::BillboardRing()
+{
+    m_VBID = -1;
+    ResetStats();
+} // BillboardRing::BillboardRing
+
+void BillboardRing::ResetStats()
+{
+    m_NQuads        = 0;
+    m_NWraps        = 0;
+    m_LastOffset    = 0;
+    m_Time          = 0.0;
+} // BillboardRing::ResetStats
+
+float BillboardRing::GetQuadsPerMs() const
+{
+    if (m_Time <= 0.0) return 0.0f;
+    return float( double( m_NQuads )/(m_Time*1000.0) );
+} // BillboardRing::GetQuadsPerMs
+
+/*---------------------------------------------------------------------------*/
+/*  Func:   BillboardRing::Draw
+/*  Desc:   Expands the quads right into the ring vertex buffer. Appends do
+/*          not overwrite the data, which can still be used by the device, so
+/*          the buffer is discarded only when it wraps, once in several frames
+/*  Ret:    Number of quads drawn
+/*---------------------------------------------------------------------------*/
+int BillboardRing::Draw( const BillboardStreams& s, const BillboardBasis& basis )
+{
+    if (s.m_NQuads <= 0) return 0;
+    if (m_VBID == -1) m_VBID = IRS->CreateVB( "BillboardRing", c_BillboardRingBytes, (int)vfVertex2t, true );
+    if (m_VBID == -1) return 0;
+
+    int maxQuads = tmin( c_MaxBillboardsPerDraw, c_BillboardRingBytes/int( 4*sizeof( Vertex2t ) ) );
+    for (int first = 0; first < s.m_NQuads; first += maxQuads)
+    {
+        int     n           = tmin( maxQuads, s.m_NQuads - first );
+        int     firstVert   = 0;
+        DWORD   stamp       = 0;
+
+        m_Timer.start();
+        IRS->SetVB( m_VBID, (int)vfVertex2t );
+        BYTE* pVert = IRS->LockAppendVB( m_VBID, n*4, firstVert, stamp );
+        if (!pVert) return first;
+        ExpandBillboards( (Vertex2t*)pVert, s, first, n, basis );
+        IRS->UnlockVB( m_VBID );
+        m_Time += m_Timer.seconds();
+
+        if (firstVert == 0 && m_LastOffset > 0) m_NWraps++;
+        m_LastOffset = firstVert + n*4;
+        m_NQuads += n;
+
+        IRS->SetVB( m_VBID, (int)vfVertex2t );
+        IRS->Draw( firstVert, n*4, 0, 0, ptQuadList );
+    }
+    INC_COUNTER( BillboardQuads, s.m_NQuads );
+    return s.m_NQuads;
+} // BillboardRing::Draw
+
+/*****************************************************************************/
+/*  BillboardQueue implementation
+/*****************************************************************************/
+void BillboardQueue::BeginRun( const BillboardBasis& basis )
+{
+    Run run;
+    run.m_Basis = basis;
+    run.m_First = (int)m_PosX.size();
+    //  previous run is empty, replace it
+    if (m_Runs.size() > 0 && m_Runs.back().m_First == run.m_First) m_Runs.pop_back();
+    m_Runs.push_back( run );
+} // BillboardQueue::BeginRun
+
+void BillboardQueue::Add( const Vector3D& pos, float sizeX, float sizeY, float rot,
+                          DWORD color, const Rct& uv, const Rct& uv2 )
+{
+    m_PosX.push_back    ( pos.x );
+    m_PosY.push_back    ( pos.y );
+    m_PosZ.push_back    ( pos.z );
+    m_SizeX.push_back   ( sizeX );
+    m_SizeY.push_back   ( sizeY );
+    m_Rot.push_back     ( rot   );
+    m_Color.push_back   ( color );
+    m_UV.push_back      ( uv    );
+    m_UV2.push_back     ( uv2   );
+} // BillboardQueue::Add
+
+int BillboardQueue::Draw()
+{
+    int nQuads  = GetNQuads();
+    int nRuns   = (int)m_Runs.size();
+    int nDrawn  = 0;
+    for (int i = 0; i < nRuns; i++)
+    {
+        const Run& run = m_Runs[i];
+        int end = (i + 1 < nRuns) ? m_Runs[i + 1].m_First : nQuads;
+        if (end <= run.m_First) continue;
+
+        BillboardStreams s;
+        s.m_NQuads  = end - run.m_First;
+        s.m_PosX    = &m_PosX [run.m_First];
+        s.m_PosY    = &m_PosY [run.m_First];
+        s.m_PosZ    = &m_PosZ [run.m_First];
+        s.m_SizeX   = &m_SizeX[run.m_First];
+        s.m_SizeY   = &m_SizeY[run.m_First];
+        s.m_Rot     = &m_Rot  [run.m_First];
+        s.m_Color   = &m_Color[run.m_First];
+        s.m_UV      = &m_UV   [run.m_First];
+        s.m_UV2     = &m_UV2  [run.m_First];
+        nDrawn += g_BillboardRing.Draw( s, run.m_Basis );
+    }
+    Clear();
+    return nDrawn;
+} // BillboardQueue::Draw
+
+void BillboardQueue::Clear()
+{
+    m_PosX.clear();
+    m_PosY.clear();
+    m_PosZ.clear();
+    m_SizeX.clear();
+    m_SizeY.clear();
+    m_Rot.clear();
+    m_Color.clear();
+    m_UV.clear();
+    m_UV2.clear();
+    m_Runs.clear();
+} // BillboardQueue::Clear
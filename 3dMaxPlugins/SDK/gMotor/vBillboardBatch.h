@@ -0,0 +1,117 @@
+/*****************************************************************************/
+/*    File:    vBillboardBatch.h
+/*    Desc:    Batched camera facing quads, expanded from the structure of
+/*             arrays streams into the multi-frame ring vertex buffer
+/*    Date:    18.10.2026
+/*****************************************************************************/
+#ifndef __VBILLBOARDBATCH_H__
+#define __VBILLBOARDBATCH_H__
+
+#include "kTimer.h"
+
+class Vertex2t;
+
+const int c_BillboardRingBytes      = 1024*1024*4;  //  ring vertex buffer, several frames of quads
+const int c_MaxBillboardsPerDraw    = 16384;        //  quad index buffer limit with WORD indices
+
+/*****************************************************************************/
+/*  Struct: BillboardBasis
+/*  Desc:   Orientation of the quads: right and up world axes, scaled when
+/*          the quads are scaled, offset added to all positions and the
+/*          reference point of the quad in its unit square
+/*****************************************************************************/
+struct BillboardBasis
+{
+    Vector3D        m_Right;
+    Vector3D        m_Up;
+    Vector3D        m_Origin;
+    float           m_RefX;
+    float           m_RefY;
+}; // struct BillboardBasis
+
+/*****************************************************************************/
+/*  Struct: BillboardStreams
+/*  Desc:   Quads data as the structure of arrays. Rotation and the second
+/*          texture coordinates streams are optional
+/*****************************************************************************/
+struct BillboardStreams
+{
+    int             m_NQuads;
+    const float*    m_PosX;
+    const float*    m_PosY;
+    const float*    m_PosZ;
+    const float*    m_SizeX;
+    const float*    m_SizeY;
+    const float*    m_Rot;      //  roll in radians, NULL for none
+    const DWORD*    m_Color;
+    const Rct*      m_UV;
+    const Rct*      m_UV2;      //  NULL to repeat the first ones
+}; // struct BillboardStreams
+
+//  expands quads [first, first + n) to 4*n vertices, in the order of AddQuad
+//  of the particle renderers: left top, right top, left bottom, right bottom
+void ExpandBillboards( Vertex2t* pOut, const BillboardStreams& s, int first, int n, const BillboardBasis& basis );
+
+/*****************************************************************************/
+/*  Class:  BillboardRing
+/*  Desc:   Writes expanded quads into the dynamic vertex buffer, appending
+/*          without overwrite until it wraps, and draws them as quad list
+/*          with the current shader and textures
+/*****************************************************************************/
+class BillboardRing
+{
+public:
+                    BillboardRing   ();
+
+    int             Draw            ( const BillboardStreams& s, const BillboardBasis& basis );
+
+    float           GetQuadsPerMs   () const;
+    int             GetNQuads       () const { return m_NQuads; }
+    int             GetNWraps       () const { return m_NWraps; }
+    void            ResetStats      ();
+
+private:
+    int             m_VBID;
+    int             m_NQuads;           //  quads drawn since the stats reset
+    int             m_NWraps;           //  buffer discards since the stats reset
+    int             m_LastOffset;
+    double          m_Time;             //  expansion and upload time, sec
+    Timer           m_Timer;
+}; // class BillboardRing
+
+/*****************************************************************************/
+/*  Class:  BillboardQueue
+/*  Desc:   Owns the streams, quads are added by runs with the same basis
+/*          and drawn together through the ring
+/*****************************************************************************/
+class BillboardQueue
+{
+public:
+    void            BeginRun        ( const BillboardBasis& basis );
+    void            Add             ( const Vector3D& pos, float sizeX, float sizeY, float rot,
+                                        DWORD color, const Rct& uv, const Rct& uv2 );
+    int             GetNQuads       () const { return (int)m_PosX.size(); }
+    int             Draw            ();
+    void            Clear           ();
+
+private:
+    struct Run
+    {
+        BillboardBasis  m_Basis;
+        int             m_First;
+    }; // struct Run
+
+    std::vector<float>  m_PosX, m_PosY, m_PosZ;
+    std::vector<float>  m_SizeX, m_SizeY, m_Rot;
+    std::vector<DWORD>  m_Color;
+    std::vector<Rct>    m_UV, m_UV2;
+    std::vector<Run>    m_Runs;
+}; // class BillboardQueue
+
+extern BillboardRing g_BillboardRing;
+
+//  times the particle billboards path quad by quad against the batched one,
+//  reports quads per millisecond
+bool BenchmarkBillboards( int nQuads = 10000, int nFrames = 16 );
+
+#endif // __VBILLBOARDBATCH_H__
@@ -8,6 +8,7 @@
 #include "sg.h"
 #include "vFontManager.h"
 #include "uiControl.h"
+#include "kTimer.h"
 
 //  global instance of the widget manager
 FontManager        g_WMgr;
@@ -18,149 +19,90 @@ IFontManager* IWM = &g_WMgr;
 IMPLEMENT_CLASS( FontManager );
 
 /*****************************************************************************/
-/*    BitmapFont implementation
+/*    GlyphAtlas implementation
 /*****************************************************************************/
-BitmapFont::BitmapFont() : m_StartCode(0), m_TexID(-1), m_NChars(0)
-{ 
-    m_Name[0] = 0; 
-    m_FreeSpace.Set( 0.0f, 0.0f, 0.0f, 0.0f );
-    m_FreeLine.Zero(); 
-    m_NCharInst = 0;
-    m_Type = ftUnknown;
-}
-
-int    BitmapFont::AllocateChar( BYTE code, float width, float height )
+bool GlyphAtlas::Allocate( float width, float height, Rct& ext )
 {
-    if (width == 0 || height == 0) return -1;
-    if (m_NChars == 256) return -1;
-    Char& ch = m_Char[m_NChars++];
-
-    if (m_FreeLine.w <= width + 8 || m_FreeLine.h < height)
+    float pw = width + c_GlyphPadding;
+    float ph = height + c_GlyphPadding;
+    if (m_FreeLine.w <= pw + 8 || m_FreeLine.h < ph)
     {
-        if (m_FreeSpace.h < height || m_FreeSpace.w < width) return NULL;
-        ch.m_Ext.x         = 0.0f;
-        ch.m_Ext.y         = m_FreeSpace.y;
-        ch.m_Ext.w         = width;
-        ch.m_Ext.h         = height;
-
-        m_FreeLine.w    =  m_FreeSpace.w;
-        m_FreeLine.h    =  height;
-        m_FreeLine.x    =  width;
+        if (m_FreeSpace.h < ph || m_FreeSpace.w < pw) return false;
+        ext.x           = 0.0f;
+        ext.y           = m_FreeSpace.y;
+
+        m_FreeLine.w    =  m_FreeSpace.w - pw;
+        m_FreeLine.h    =  ph;
+        m_FreeLine.x    =  pw;
         m_FreeLine.y    =  m_FreeSpace.y;
 
-        m_FreeSpace.y     += height;
-        m_FreeSpace.h     -= height;
+        m_FreeSpace.y   += ph;
+        m_FreeSpace.h   -= ph;
     }
     else
     {
-        ch.m_Ext.x         = m_FreeLine.x;
-        ch.m_Ext.y         = m_FreeLine.y;
-        ch.m_Ext.w         = width;
-        ch.m_Ext.h         = height;
+        ext.x           = m_FreeLine.x;
+        ext.y           = m_FreeLine.y;
 
-        m_FreeLine.w     -= width;
-        m_FreeLine.x     += width;
+        m_FreeLine.w    -= pw;
+        m_FreeLine.x    += pw;
     }
+    ext.w = width;
+    ext.h = height;
+    return true;
+} // GlyphAtlas::Allocate
 
-    ch.m_UV.x = ch.m_Ext.x / float( m_TexWidth );
-    ch.m_UV.w = ch.m_Ext.w / float( m_TexWidth );
-    ch.m_UV.y = ch.m_Ext.y / float( m_TexHeight );
-    ch.m_UV.h = ch.m_Ext.h / float( m_TexHeight );
-    
-    ch.m_Code = code;
-
-    return m_NChars - 1;
-} // BitmapFont::AllocateChar
-
+/*****************************************************************************/
+/*    BitmapFont implementation
+/*****************************************************************************/
+BitmapFont::BitmapFont() : m_StartCode(0), m_TexID(-1), m_NChars(0)
+{ 
+    m_Name[0] = 0; 
+    m_Type = ftUnknown;
+    m_TexWidth      = 0;
+    m_TexHeight     = 0;
+    m_hDC           = NULL;
+    m_hFont         = NULL;
+    m_hBitmap       = NULL;
+    m_hOldFont      = NULL;
+    m_hOldBitmap    = NULL;
+    m_pBitmapBits   = NULL;
+    m_BitmapW       = 0;
+    m_BitmapH       = 0;
+}
 
-const float c_HalfPixel = 0.5f;
-void BitmapFont::Flush()
+BitmapFont::~BitmapFont()
 {
-    if (m_NCharInst == 0) return;
-    static BaseMesh        s_BM;
-    static int shID    = IRS->GetShaderID( "text" );
-    if (s_BM.getNVert() == 0)
-    {
-        s_BM.create( c_MaxCharInst*4, c_MaxCharInst*6, vfVertexTnL );
-        WORD* pIdx = s_BM.getIndices();
-        int cV = 0;
-        for (int i = 0; i < c_MaxCharInst; i++)
-        {
-            pIdx[i*6 + 0] = cV;
-            pIdx[i*6 + 1] = cV + 1;
-            pIdx[i*6 + 2] = cV + 2;
-            pIdx[i*6 + 3] = cV + 2;
-            pIdx[i*6 + 4] = cV + 1;
-            pIdx[i*6 + 5] = cV + 3;
-            cV += 4;
-        }
-    }
-    
-    VertexTnL* v = (VertexTnL*) s_BM.getVertexData();
-    for (int i = 0; i < m_NCharInst; i++)
-    {
-        CharInst& ch = m_CharInst[i];
-        VertexTnL& v0 = v[i*4 + 0];
-        VertexTnL& v1 = v[i*4 + 1];
-        VertexTnL& v2 = v[i*4 + 2];
-        VertexTnL& v3 = v[i*4 + 3];
-        
-        float z = ch.m_Pos.z;
-
-        v0.x = ch.m_Pos.x - c_HalfPixel; 
-        v0.y = ch.m_Pos.y - c_HalfPixel; 
-        v0.z = z; 
-
-        v0.u = ch.m_UV.x; 
-        v0.v = ch.m_UV.y;
-
-        v1.x = v0.x + ch.w; 
-        v1.y = v0.y; 
-        v1.z = z;
-
-        v1.u = ch.m_UV.GetRight(); 
-        v1.v = ch.m_UV.y;
-
-        v2.x = v0.x; 
-        v2.y = v0.y + ch.h; 
-        v2.z = z;
-
-        v2.u = ch.m_UV.x; 
-        v2.v = ch.m_UV.GetBottom();
-
-        v3.x = v1.x; 
-        v3.y = v2.y; 
-        v3.z = z;
-
-        v3.u = v1.u; 
-        v3.v = v2.v;
-
-        v0.diffuse = ch.m_Color;
-        v1.diffuse = ch.m_Color;
-        v2.diffuse = ch.m_Color;
-        v3.diffuse = ch.m_Color;
+    ReleaseGDI();
+}
 
-        v0.w = 1.0f;
-        v1.w = 1.0f;
-        v2.w = 1.0f;
-        v3.w = 1.0f;
-    }
-    
-    s_BM.setNPri    ( m_NCharInst*2 );
-    s_BM.setNInd    ( m_NCharInst*6 );
-    s_BM.setNVert    ( m_NCharInst*4 );
-    s_BM.setTexture    ( m_TexID );
-    s_BM.setShader    ( shID );
-    DrawBM( s_BM );
-    m_NCharInst = 0;
-} // BitmapFont::Flush
+void BitmapFont::ReleaseGDI()
+{
+    if (!m_hDC) return;
+    if (m_hOldBitmap) SelectObject( m_hDC, m_hOldBitmap );
+    if (m_hOldFont) SelectObject( m_hDC, m_hOldFont );
+    if (m_hBitmap) DeleteObject( m_hBitmap );
+    if (m_hFont) DeleteObject( m_hFont );
+    DeleteDC( m_hDC );
+    m_hDC           = NULL;
+    m_hFont         = NULL;
+    m_hBitmap       = NULL;
+    m_hOldFont      = NULL;
+    m_hOldBitmap    = NULL;
+    m_pBitmapBits   = NULL;
+} // BitmapFont::ReleaseGDI
 
 /*****************************************************************************/
 /*    FontManager implementation
 /*****************************************************************************/
 FontManager::FontManager()
 {
-    m_NFonts = 0;
+    m_NFonts    = 0;
+    m_NAtlases  = 0;
+    m_NCharInst = 0;
+    m_NDraws    = 0;
+    m_Runs.reserve( c_MaxTextRuns );
+    memset( m_RunBucket, 0xFF, sizeof( m_RunBucket ) );
 }
 
 FontManager::~FontManager()
@@ -227,6 +169,97 @@ int    FontManager::CreateFont( const char* name )
     return m_NFonts - 1;
 } // FontManager::CreateFont
 
+/*---------------------------------------------------------------*
+/*  Func:    FontManager::RenderGlyph
+/*    Desc:    Renders glyph of the GDI font into the scratch bitmap
+/*          and copies it to the free place on the shared atlas
+/*---------------------------------------------------------------*/
+bool FontManager::RenderGlyph( BitmapFont* pFont, DWORD code, bool bWide, BitmapFont::Char& ch )
+{
+    HDC hDC = pFont->m_hDC;
+    ch.m_Code   = code;
+    ch.m_TexID  = -1;
+    ch.m_Ext.Zero();
+    ch.m_UV.Zero();
+    if (!hDC) return false;
+
+    wchar_t wstr[1] = { (wchar_t)code };
+    char    str[1]  = { (char)code };
+    SIZE size;
+    if (bWide) GetTextExtentPoint32W( hDC, wstr, 1, &size );
+    else GetTextExtentPoint32A( hDC, str, 1, &size );
+    if (size.cx > pFont->m_BitmapW) size.cx = pFont->m_BitmapW;
+    if (size.cy > pFont->m_BitmapH) size.cy = pFont->m_BitmapH;
+    if (size.cx <= 0 || size.cy <= 0) return true;
+
+    //  find place on the atlas pages, new page is started when the last one is full
+    Rct ext;
+    GlyphAtlas* pAtlas = m_NAtlases > 0 ? &m_Atlas[m_NAtlases - 1] : NULL;
+    if (!pAtlas || !pAtlas->Allocate( size.cx, size.cy, ext ))
+    {
+        if (m_NAtlases == c_MaxGlyphAtlases)
+        {
+            Log.Warning( "Glyph atlas is full, glyph %d of font %s is dropped.", code, pFont->m_Name );
+            return false;
+        }
+        char texName[64];
+        sprintf( texName, "GlyphAtlas%d", m_NAtlases );
+        pAtlas = &m_Atlas[m_NAtlases];
+        pAtlas->m_TexID = IRS->CreateTexture( texName, c_GlyphAtlasSide, c_GlyphAtlasSide, cfARGB4444, 1, tmpManaged );
+        if (pAtlas->m_TexID == -1)
+        {
+            Log.Error( "Could not create glyph atlas texture." );
+            return false;
+        }
+        pAtlas->m_FreeSpace.Set( 0.0f, 0.0f, c_GlyphAtlasSide, c_GlyphAtlasSide );
+        pAtlas->m_FreeLine.Zero();
+        m_NAtlases++;
+
+        //  clear the page, so the padding between glyphs is transparent
+        int pitch = 0;
+        BYTE* pDst = IRS->LockTexBits( pAtlas->m_TexID, pitch );
+        if (pDst)
+        {
+            for (int y = 0; y < c_GlyphAtlasSide; y++) memset( pDst + y*pitch, 0, c_GlyphAtlasSide*sizeof( WORD ) );
+            IRS->UnlockTexBits( pAtlas->m_TexID );
+        }
+        if (!pAtlas->Allocate( size.cx, size.cy, ext )) return false;
+    }
+
+    RECT rc = { 0, 0, size.cx, size.cy };
+    if (bWide) ExtTextOutW( hDC, 0, 0, ETO_OPAQUE|ETO_CLIPPED, &rc, wstr, 1, NULL );
+    else ExtTextOutA( hDC, 0, 0, ETO_OPAQUE|ETO_CLIPPED, &rc, str, 1, NULL );
+    GdiFlush();
+
+    //  write the alpha values for the set pixels
+    int pitch = 0;
+    BYTE* pDstRow = IRS->LockTexBits( pAtlas->m_TexID, ext, pitch );
+    if (pDstRow)
+    {
+        for (int y = 0; y < size.cy; y++)
+        {
+            WORD*   pDst16  = (WORD*)pDstRow;
+            DWORD*  pSrc    = pFont->m_pBitmapBits + pFont->m_BitmapW*y;
+            for (int x = 0; x < size.cx; x++)
+            {
+                BYTE bAlpha = (BYTE)((pSrc[x] & 0xff) >> 4);
+                pDst16[x] = bAlpha > 0 ? ((bAlpha << 12) | 0x0fff) : 0x0000;
+            }
+            pDstRow += pitch;
+        }
+        IRS->UnlockTexBits( pAtlas->m_TexID );
+    }
+
+    ch.m_TexID  = pAtlas->m_TexID;
+    ch.m_Ext    = ext;
+    ch.m_UV.x   = ext.x / float( c_GlyphAtlasSide );
+    ch.m_UV.w   = ext.w / float( c_GlyphAtlasSide );
+    ch.m_UV.y   = ext.y / float( c_GlyphAtlasSide );
+    ch.m_UV.h   = ext.h / float( c_GlyphAtlasSide );
+    INC_COUNTER( GlyphsRendered, 1 );
+    return true;
+} // FontManager::RenderGlyph
+
 int    FontManager::CreateFont( const char* name, int height, DWORD charset, bool bBold, bool bItalic )
 {
     char fullName[256];
@@ -234,6 +267,7 @@ int    FontManager::CreateFont( const char* name, int height, DWORD charset, boo
     int id = GetFontID( fullName );
     if (id != -1) return id;
     id = CreateFont( fullName );
+    if (id == -1) return -1;
     BitmapFont* pFont = m_Fonts[id];
 
     pFont->m_Type = ftGDIGenerated;
@@ -251,114 +285,54 @@ int    FontManager::CreateFont( const char* name, int height, DWORD charset, boo
     if (hFont == 0)
     {
         Log.Warning( "Couldn't create font %s.", fullName );
+        DeleteDC( hDC );
         return false;
     }
+    pFont->m_hDC    = hDC;
+    pFont->m_hFont  = hFont;
 
     // Set text properties
-    HGDIOBJ hOldFont = SelectObject( hDC, hFont    );
+    pFont->m_hOldFont = SelectObject( hDC, hFont );
     SetTextColor( hDC, RGB(255,255,255) );
     SetBkColor    ( hDC, 0x00000000        );
     SetTextAlign( hDC, TA_TOP            );
 
-    //  first find how much place our font will occupy on the texture
-    int texW = 256;
-    int texH = 128;
-    unsigned char str[2] = "x";
-    SIZE size;
-    for (int i = 32; i < 256; i++)
-    {
-        str[0] = i;
-        GetTextExtentPoint32( hDC, (LPCSTR)str, 1, &size );
-    }
-    
-    //  create texture for the font
-    int texID = IRS->CreateTexture( fullName, texW, texH, cfARGB4444, 1, tmpManaged );
-    pFont->m_TexID        = texID;
-    pFont->m_TexWidth    = texW;
-    pFont->m_TexHeight    = texH;
-    pFont->m_FreeSpace.Set( 0.0f, 0.0f, texW, texH );
-    if (pFont->m_TexID == -1) 
-    {
-        Log.Error( "Could not create texture for font %s", fullName );
-    }
+    //  scratch bitmap fits any single glyph of the font
+    TEXTMETRIC tm;
+    GetTextMetrics( hDC, &tm );
+    pFont->m_BitmapW = max( tm.tmMaxCharWidth, tm.tmHeight )*2;
+    pFont->m_BitmapH = tm.tmHeight;
 
-    DWORD*     pBitmapBits;
     BITMAPINFO bmi;
     ZeroMemory( &bmi.bmiHeader,  sizeof(BITMAPINFOHEADER) );
     bmi.bmiHeader.biSize        = sizeof(BITMAPINFOHEADER);
-    bmi.bmiHeader.biWidth       = texW;
-    bmi.bmiHeader.biHeight      = -texH;
+    bmi.bmiHeader.biWidth       = pFont->m_BitmapW;
+    bmi.bmiHeader.biHeight      = -pFont->m_BitmapH;
     bmi.bmiHeader.biPlanes      = 1;
     bmi.bmiHeader.biCompression = BI_RGB;
     bmi.bmiHeader.biBitCount    = 32;
 
     //  create bitmap
-    HBITMAP hBitmap      = CreateDIBSection( hDC, &bmi, DIB_RGB_COLORS, (VOID**)&pBitmapBits, NULL, 0 );
+    pFont->m_hBitmap = CreateDIBSection( hDC, &bmi, DIB_RGB_COLORS, (VOID**)&pFont->m_pBitmapBits, NULL, 0 );
+    if (!pFont->m_hBitmap)
+    {
+        Log.Error( "Could not create glyph bitmap for font %s", fullName );
+        pFont->ReleaseGDI();
+        return -1;
+    }
     SetMapMode( hDC, MM_TEXT );
+    pFont->m_hOldBitmap = SelectObject( hDC, pFont->m_hBitmap );
 
-    HGDIOBJ hOldBmp = SelectObject( hDC, hBitmap );
-    
+    //  byte codes are prerendered, other glyphs are added on demand
     pFont->m_StartCode = 32;
-    // Loop through all printable Glyphs and output them to the bitmap.
-    // Meanwhile, keep track of the corresponding tex coords for each Glyph.
-    DWORD x = 0;
-    DWORD y = 0;
     for (int i = 32; i < 256; i++)
     {
-        str[0] = i;
-        DWORD code = i;
-        GetTextExtentPoint32( hDC, (LPCSTR)str, 1, &size );
-        
-        int chID = pFont->AllocateChar( code, size.cx, size.cy );
-        if (chID < 0)
-        {
-            Log.Error( "Could not allocate all font chars." );
-            return -1;
-        }
-        BitmapFont::Char& ch = pFont->m_Char[chID];
-        ExtTextOut( hDC, ch.m_Ext.x, ch.m_Ext.y, ETO_OPAQUE, NULL, (LPCSTR)str, 1, NULL );
-    }
-
-    // Lock the surface and write the alpha values for the set pixels
-    int pitch = 0;
-    BYTE* pDstRow = IRS->LockTexBits( texID, pitch );
-
-    if (pDstRow)
-    {
-        WORD* pDst16;
-        BYTE bAlpha; // 4-bit measure of pixel intensity
-
-        for (y = 0; y < texH; y++)
-        {
-            pDst16 = (WORD*)pDstRow;
-            for (x = 0; x < texW; x++)
-            {
-                bAlpha = (BYTE)((pBitmapBits[texW * y + x] & 0xff) >> 4);
-                if (bAlpha > 0)
-                {
-                    *pDst16++ = (bAlpha << 12) | 0x0fff;
-                }
-                else
-                {
-                    *pDst16++ = 0x0000;
-                }
-            }
-            pDstRow += pitch;
-        }
-        IRS->UnlockTexBits( texID );
+        RenderGlyph( pFont, i, false, pFont->m_Char[i - 32] );
     }
-
-    // Clean up used GDI objects
-    SelectObject( hDC, hOldBmp );
-    SelectObject( hDC, hOldFont );
-
-    DeleteObject( hBitmap );
-    DeleteObject( hFont );
-
-    DeleteDC( hDC );
-
-    ///IRS->SaveTexture( texID, "c:\\dumps\\__font__.dds" );
-
+    pFont->m_NChars     = 256 - 32;
+    pFont->m_TexID      = pFont->m_Char['x' - 32].m_TexID;
+    pFont->m_TexWidth   = c_GlyphAtlasSide;
+    pFont->m_TexHeight  = c_GlyphAtlasSide;
     return id;
 } // FontManager::CreateFont
 
@@ -369,6 +343,7 @@ int    FontManager::CreateUniformFont( const char* texName, int charW, int charH
     int id = GetFontID( fullName );
     if (id != -1) return id;
     id = CreateFont( fullName );
+    if (id == -1) return -1;
     BitmapFont* pFont = m_Fonts[id];
     pFont->m_Type = ftUniform;
     
@@ -385,6 +360,7 @@ int    FontManager::CreateUniformFont( const char* texName, int charW, int charH
     {
         BitmapFont::Char& ch = pFont->m_Char[i];
         ch.m_Code = i;
+        ch.m_TexID = texID;
         ch.m_Ext = Rct( x, y, charW, charH );
 
         ch.m_UV.x = ch.m_Ext.x / float( texW );
@@ -406,19 +382,127 @@ int    FontManager::CreateUniformFont( const char* texName, int charW, int charH
     return id;
 } // FontManager::CreateUniformFont
 
-int    FontManager::GetStringWidth( int fontID, const char* str, int spacing )
+/*---------------------------------------------------------------*
+/*  Func:    FontManager::GetGlyph
+/*    Desc:    Finds glyph of the character code. Byte strings are in
+/*          the font codepage, wide ones are unicode - only ASCII
+/*          part of the byte table is shared between them
+/*---------------------------------------------------------------*/
+const BitmapFont::Char* FontManager::GetGlyph( BitmapFont* pFont, DWORD code, bool bWide )
+{
+    if (!bWide || code < 128 || (code < 256 && pFont->m_Type != ftGDIGenerated))
+    {
+        return code < 256 ? pFont->GetByteChar( BYTE( code ) ) : NULL;
+    }
+    if (pFont->m_Type != ftGDIGenerated) return NULL;
+
+    std::map<DWORD, BitmapFont::Char>::iterator it = pFont->m_Glyph.find( code );
+    if (it != pFont->m_Glyph.end()) return &it->second;
+
+    //  glyph which could not be rendered is kept empty, so it is not retried
+    BitmapFont::Char& ch = pFont->m_Glyph[code];
+    RenderGlyph( pFont, code, true, ch );
+    return &ch;
+} // FontManager::GetGlyph
+
+void FontManager::LayoutRun( BitmapFont* pFont, TextRun& run )
+{
+    int nCodes = run.m_Code.size();
+    run.m_Glyph.resize( nCodes );
+    int x = 0;
+    int nGlyphs = 0;
+    for (int i = 0; i < nCodes; i++)
+    {
+        const BitmapFont::Char* pChar = GetGlyph( pFont, run.m_Code[i], run.m_bWide );
+        if (!pChar && run.m_Code[i] >= 128) pChar = pFont->GetByteChar( '?' );
+        if (!pChar) continue;
+        if (pChar->m_TexID != -1 && pChar->m_Ext.w > 0.0f)
+        {
+            RunGlyph& g = run.m_Glyph[nGlyphs++];
+            g.x         = x;
+            g.w         = pChar->m_Ext.w;
+            g.h         = pChar->m_Ext.h;
+            g.m_UV      = pChar->m_UV;
+            g.m_TexID   = pChar->m_TexID;
+        }
+        x += int( pChar->m_Ext.w ) + run.m_Spacing;
+    }
+    run.m_Glyph.resize( nGlyphs );
+    run.m_Width = x;
+} // FontManager::LayoutRun
+
+/*---------------------------------------------------------------*
+/*  Func:    FontManager::GetTextRun
+/*    Desc:    Returns laid out string from the run cache, laying it
+/*          out on miss. Long strings go to the scratch run
+/*---------------------------------------------------------------*/
+const TextRun* FontManager::GetTextRun( int fontID, const DWORD* code, int nCodes, bool bWide, int spacing )
 {
-    if (fontID < 0 || fontID >= m_NFonts) return 0;
     BitmapFont* pFont = m_Fonts[fontID];
-    
-    int w = 0;
-    const char* ch = str;
-    while (*ch)
+    if (nCodes > c_MaxTextRunChars)
+    {
+        m_ScratchRun.m_FontID   = fontID;
+        m_ScratchRun.m_Spacing  = spacing;
+        m_ScratchRun.m_bWide    = bWide;
+        m_ScratchRun.m_Code.assign( code, code + nCodes );
+        LayoutRun( pFont, m_ScratchRun );
+        return &m_ScratchRun;
+    }
+
+    DWORD hash = 2166136261U;
+    hash = (hash ^ DWORD( fontID ))*16777619U;
+    hash = (hash ^ DWORD( spacing ))*16777619U;
+    hash = (hash ^ DWORD( bWide ))*16777619U;
+    for (int i = 0; i < nCodes; i++) hash = (hash ^ code[i])*16777619U;
+
+    for (int r = m_RunBucket[hash & (c_TextRunHashSize - 1)]; r >= 0; r = m_Runs[r].m_Next)
     {
-        w += pFont->GetCharW( *ch ) + spacing;
-        ch++;
+        const TextRun& run = m_Runs[r];
+        if (run.m_Hash != hash || run.m_FontID != fontID || run.m_Spacing != spacing || 
+            run.m_bWide != bWide || int( run.m_Code.size() ) != nCodes) continue;
+        if (nCodes > 0 && memcmp( &run.m_Code[0], code, nCodes*sizeof( DWORD ) ) != 0) continue;
+        INC_COUNTER( TextRunHits, 1 );
+        return &run;
     }
-    return w; 
+
+    INC_COUNTER( TextRunMisses, 1 );
+    if (int( m_Runs.size() ) == c_MaxTextRuns) ResetTextRuns();
+    int& head = m_RunBucket[hash & (c_TextRunHashSize - 1)];
+    m_Runs.push_back( TextRun() );
+    TextRun& run = m_Runs.back();
+    run.m_FontID    = fontID;
+    run.m_Spacing   = spacing;
+    run.m_bWide     = bWide;
+    run.m_Hash      = hash;
+    run.m_Next      = head;
+    run.m_Code.assign( code, code + nCodes );
+    LayoutRun( pFont, run );
+    head = m_Runs.size() - 1;
+    return &run;
+} // FontManager::GetTextRun
+
+void FontManager::ResetTextRuns()
+{
+    m_Runs.clear();
+    memset( m_RunBucket, 0xFF, sizeof( m_RunBucket ) );
+} // FontManager::ResetTextRuns
+
+int    FontManager::GetStringWidth( int fontID, const char* str, int spacing )
+{
+    if (fontID < 0 || fontID >= m_NFonts || !str) return 0;
+    m_Codes.clear();
+    for (const BYTE* ch = (const BYTE*)str; *ch; ch++) m_Codes.push_back( *ch );
+    if (m_Codes.size() == 0) return 0;
+    return GetTextRun( fontID, &m_Codes[0], m_Codes.size(), false, spacing )->m_Width; 
+} // FontManager::GetStringWidth
+
+int    FontManager::GetStringWidth( int fontID, const wchar_t* str, int spacing )
+{
+    if (fontID < 0 || fontID >= m_NFonts || !str) return 0;
+    m_Codes.clear();
+    for (const wchar_t* ch = str; *ch; ch++) m_Codes.push_back( *ch );
+    if (m_Codes.size() == 0) return 0;
+    return GetTextRun( fontID, &m_Codes[0], m_Codes.size(), true, spacing )->m_Width; 
 } // FontManager::GetStringWidth
 
 bool FontManager::DrawStringW( int fontID, const char* str, const Vector3D& pos, DWORD color, int spacing )
@@ -430,43 +514,67 @@ bool FontManager::DrawStringW( int fontID, const char* str, const Vector3D& pos,
     return DrawString( fontID, str, wpos, color, spacing );
 } // FontManager::DrawStringW
 
-bool FontManager::DrawString( int fontID, const char* str, const Vector3D& pos, DWORD color, int spacing )
+bool FontManager::AddRun( const TextRun* pRun, const Vector3D& pos, DWORD color )
 {
-    if (fontID < 0 || fontID >= m_NFonts) return false;
-    BitmapFont* pFont = m_Fonts[fontID];
-    Vector3D p( pos );
-    int ch = 0;
-    while (str[ch])
+    int nGlyphs = pRun->m_Glyph.size();
+    for (int i = 0; i < nGlyphs; i++)
     {
-        pFont->AddCharInst( str[ch], p, color );
-        p.x += pFont->GetCharW( str[ch] ) + spacing;
-        ch++;
+        const RunGlyph& g = pRun->m_Glyph[i];
+        AddCharInst( g.m_UV, g.m_TexID, Vector3D( pos.x + g.x, pos.y, pos.z ), g.w, g.h, color );
     }
-    return true; 
+    return true;
+} // FontManager::AddRun
+
+bool FontManager::DrawString( int fontID, const char* str, const Vector3D& pos, DWORD color, int spacing )
+{
+    if (fontID < 0 || fontID >= m_NFonts || !str) return false;
+    m_Codes.clear();
+    for (const BYTE* ch = (const BYTE*)str; *ch; ch++) m_Codes.push_back( *ch );
+    if (m_Codes.size() == 0) return true;
+    return AddRun( GetTextRun( fontID, &m_Codes[0], m_Codes.size(), false, spacing ), pos, color ); 
+} // FontManager::DrawString
+
+bool FontManager::DrawString( int fontID, const wchar_t* str, const Vector3D& pos, DWORD color, int spacing )
+{
+    if (fontID < 0 || fontID >= m_NFonts || !str) return false;
+    m_Codes.clear();
+    for (const wchar_t* ch = str; *ch; ch++) m_Codes.push_back( *ch );
+    if (m_Codes.size() == 0) return true;
+    return AddRun( GetTextRun( fontID, &m_Codes[0], m_Codes.size(), true, spacing ), pos, color ); 
 } // FontManager::DrawString
 
+bool FontManager::AddCharInst( const Rct& uv, int texID, const Vector3D& pos, float w, float h, DWORD color )
+{
+    if (m_NCharInst == c_MaxCharInst) FlushText();
+    CharInst& ch = m_CharInst[m_NCharInst++];
+    ch.m_UV     = uv;
+    ch.m_TexID  = texID;
+    ch.m_Pos    = pos;
+    ch.m_Color  = color;
+    ch.w        = w;
+    ch.h        = h;
+    return true;
+} // FontManager::AddCharInst
+
 bool FontManager::DrawChar( int fontID, const Vector3D& pos, BYTE ch, DWORD color )
 {
     if (fontID < 0 || fontID >= m_NFonts) return false;
-    BitmapFont* pFont = m_Fonts[fontID];
-    pFont->AddCharInst( ch, pos, color );
-    return true; 
+    const BitmapFont::Char* pChar = m_Fonts[fontID]->GetByteChar( ch );
+    if (!pChar || pChar->m_TexID == -1) return false;
+    return AddCharInst( pChar->m_UV, pChar->m_TexID, pos, pChar->m_Ext.w, pChar->m_Ext.h, color );
 } // FontManager::DrawChar 
 
 bool FontManager::DrawChar( int fontID, const Vector3D& pos, const Rct& uv, DWORD color )
 {
     if (fontID < 0 || fontID >= m_NFonts) return false;
     BitmapFont* pFont = m_Fonts[fontID];
-    pFont->AddCharInst( uv, pos, color );
-    return true; 
+    return AddCharInst( uv, pFont->m_TexID, pos, uv.w*pFont->m_TexWidth, uv.h*pFont->m_TexHeight, color );
 } // FontManager::DrawChar
 
 bool FontManager::DrawChar( int fontID, const Vector3D& pos, const Rct& uv, float w, float h, DWORD color )
 {
     if (fontID < 0 || fontID >= m_NFonts) return false;
-    BitmapFont* pFont = m_Fonts[fontID];
-    pFont->AddCharInst( uv, pos, w, h, color );
-    return true; 
+    return AddCharInst( uv, m_Fonts[fontID]->m_TexID, pos, w, h, color );
 } // FontManager::DrawChar
 
 int    FontManager::GetCharWidth( int fontID, BYTE ch )
@@ -483,15 +591,100 @@ int    FontManager::GetCharHeight( int fontID, BYTE ch )
     return pFont->GetCharH( ch );
 } // FontManager::GetCharHeight
 
+/*---------------------------------------------------------------*
+/*  Func:    FontManager::FlushText
+/*    Desc:    Draws the frame text batch. Consecutive characters on
+/*          the same texture go in a single draw call, so text of all
+/*          the GDI fonts on the shared atlas is drawn at once
+/*---------------------------------------------------------------*/
+const float c_HalfPixel = 0.5f;
 void FontManager::FlushText( int fontID )
 {
-    if (fontID < 0 || fontID >= m_NFonts) 
+    if (m_NCharInst == 0) return;
+    static BaseMesh        s_BM;
+    static int shID    = IRS->GetShaderID( "text" );
+    if (s_BM.getNVert() == 0)
+    {
+        s_BM.create( c_MaxCharInst*4, c_MaxCharInst*6, vfVertexTnL );
+        WORD* pIdx = s_BM.getIndices();
+        int cV = 0;
+        for (int i = 0; i < c_MaxCharInst; i++)
+        {
+            pIdx[i*6 + 0] = cV;
+            pIdx[i*6 + 1] = cV + 1;
+            pIdx[i*6 + 2] = cV + 2;
+            pIdx[i*6 + 3] = cV + 2;
+            pIdx[i*6 + 4] = cV + 1;
+            pIdx[i*6 + 5] = cV + 3;
+            cV += 4;
+        }
+    }
+    
+    VertexTnL* v = (VertexTnL*) s_BM.getVertexData();
+    int cInst = 0;
+    while (cInst < m_NCharInst)
     {
-        for (int i = 0; i < m_NFonts; i++) m_Fonts[i]->Flush();
-        return;
+        int texID = m_CharInst[cInst].m_TexID;
+        int nInst = 0;
+        for (; cInst < m_NCharInst && m_CharInst[cInst].m_TexID == texID; cInst++, nInst++)
+        {
+            CharInst& ch = m_CharInst[cInst];
+            VertexTnL& v0 = v[nInst*4 + 0];
+            VertexTnL& v1 = v[nInst*4 + 1];
+            VertexTnL& v2 = v[nInst*4 + 2];
+            VertexTnL& v3 = v[nInst*4 + 3];
+            
+            float z = ch.m_Pos.z;
+
+            v0.x = ch.m_Pos.x - c_HalfPixel; 
+            v0.y = ch.m_Pos.y - c_HalfPixel; 
+            v0.z = z; 
+
+            v0.u = ch.m_UV.x; 
+            v0.v = ch.m_UV.y;
+
+            v1.x = v0.x + ch.w; 
+            v1.y = v0.y; 
+            v1.z = z;
+
+            v1.u = ch.m_UV.GetRight(); 
+            v1.v = ch.m_UV.y;
+
+            v2.x = v0.x; 
+            v2.y = v0.y + ch.h; 
+            v2.z = z;
+
+            v2.u = ch.m_UV.x; 
+            v2.v = ch.m_UV.GetBottom();
+
+            v3.x = v1.x; 
+            v3.y = v2.y; 
+            v3.z = z;
+
+            v3.u = v1.u; 
+            v3.v = v2.v;
+
+            v0.diffuse = ch.m_Color;
+            v1.diffuse = ch.m_Color;
+            v2.diffuse = ch.m_Color;
+            v3.diffuse = ch.m_Color;
+
+            v0.w = 1.0f;
+            v1.w = 1.0f;
+            v2.w = 1.0f;
+            v3.w = 1.0f;
+        }
+        
+        s_BM.setNPri    ( nInst*2 );
+        s_BM.setNInd    ( nInst*6 );
+        s_BM.setNVert    ( nInst*4 );
+        s_BM.setTexture    ( texID );
+        s_BM.setShader    ( shID );
+        DrawBM( s_BM );
+        m_NDraws++;
     }
-    BitmapFont* pFont = m_Fonts[fontID];
-    pFont->Flush();
+    INC_COUNTER( TextChars, m_NCharInst );
+    m_NCharInst = 0;
 } // FontManager::FlushText
 
 void FontManager::OnDestroyRS()
@@ -510,4 +703,59 @@ void FontManager::OnDestroyRS()
     }
 } // FontManager::OnDestroyRS
 
+/*---------------------------------------------------------------*
+/*  Func:    BenchmarkTextLabels
+/*    Desc:    Times layout of the distinct labels with the cold and
+/*          warm run cache, and batched submission of them
+/*---------------------------------------------------------------*/
+bool BenchmarkTextLabels( int fontID, int nLabels, int nFrames )
+{
+    FontManager& fm = g_WMgr;
+    if (fm.GetStringWidth( fontID, "x" ) == 0)
+    {
+        Log.Warning( "Text benchmark: invalid font %d", fontID );
+        return false;
+    }
+    if (nLabels <= 0 || nFrames <= 0) return false;
+
+    std::vector<std::string> labels( nLabels );
+    char buf[64];
+    for (int i = 0; i < nLabels; i++)
+    {
+        sprintf( buf, "Unit #%d: %d/%d HP", i, (i*37)%1000, 1000 );
+        labels[i] = buf;
+    }
+
+    Timer timer;
+    double tCold = 0.0, tWarm = 0.0, tSubmit = 0.0;
+    int nDraws = 0;
+    for (int f = 0; f < nFrames; f++)
+    {
+        fm.ResetTextRuns();
+        timer.start();
+        for (int i = 0; i < nLabels; i++) fm.GetStringWidth( fontID, labels[i].c_str() );
+        tCold += timer.seconds();
+
+        timer.start();
+        for (int i = 0; i < nLabels; i++) fm.GetStringWidth( fontID, labels[i].c_str() );
+        tWarm += timer.seconds();
+
+        int drawsBefore = fm.GetNTextDraws();
+        timer.start();
+        for (int i = 0; i < nLabels; i++)
+        {
+            fm.DrawString( fontID, labels[i].c_str(), Vector3D( (i%8)*100.0f, (i/8)%64*12.0f, 0.0f ) );
+        }
+        fm.FlushText();
+        tSubmit += timer.seconds();
+        nDraws += fm.GetNTextDraws() - drawsBefore;
+    }
 
+    double scale = 1000.0*1000.0/double( nLabels*nFrames );
+    Log.Info( "Text benchmark: %d labels, %d frames, %d cached runs", nLabels, nFrames, fm.GetNTextRuns() );
+    Log.Info( "  layout, cold cache: %.3fms per 1K labels", tCold*scale );
+    Log.Info( "  layout, warm cache: %.3fms per 1K labels", tWarm*scale );
+    Log.Info( "  batched submission: %.3fms per 1K labels, %.1f draw calls per frame", 
+                tSubmit*scale, double( nDraws )/double( nFrames ) );
+    return true;
+} // BenchmarkTextLabels
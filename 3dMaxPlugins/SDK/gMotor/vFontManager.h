@@ -10,8 +10,14 @@
 #include "IFontManager.h"
 
 
-const int c_MaxFontName = 256;
-const int c_MaxCharInst    = 4096;
+const int c_MaxFontName         = 256;
+const int c_MaxCharInst         = 4096;     //  capacity of the frame text batch
+const int c_GlyphAtlasSide      = 512;      //  side of the shared glyph atlas page
+const int c_MaxGlyphAtlases     = 8;
+const int c_GlyphPadding        = 1;        //  gap between glyphs on the atlas page
+const int c_TextRunHashSize     = 1024;     //  power of two
+const int c_MaxTextRuns         = 2048;     //  run cache is reset when full
+const int c_MaxTextRunChars     = 256;      //  longer strings are laid out each call
 
 enum BitmapFontType
 {
@@ -21,6 +27,20 @@ enum BitmapFontType
     ftUniform        = 3
 }; // enum BitmapFontType
 
+/*****************************************************************************/
+/*    Struct:    GlyphAtlas
+/*    Desc:    Texture page shared by the GDI-generated fonts, glyphs are
+/*          rendered into it on demand and never moved
+/*****************************************************************************/
+struct GlyphAtlas
+{
+    int                 m_TexID;
+    Rct                 m_FreeSpace;    //  rectangle of the unfilled texture
+    Rct                 m_FreeLine;     //  unfilled rectangle to the end of the current line
+
+    bool                Allocate( float width, float height, Rct& ext );
+}; // struct GlyphAtlas
+
 /*****************************************************************************/
 /*    Class:    BitmapFont
 /*    Desc:    Bitmap font description
@@ -29,32 +49,25 @@ class BitmapFont
 {    
 public:
     BitmapFont();
+    ~BitmapFont();
 
 protected:
 
     //  character
     struct Char
     {
-        BYTE            m_Code;
+        DWORD           m_Code;
+        int             m_TexID;
         Rct                m_Ext;
         Rct                m_UV;
     }; // struct Char
 
-    //  character instance
-    struct CharInst
-    {
-        Rct                m_UV;
-        DWORD            m_Color;
-        Vector3D        m_Pos;
-        float            w, h;
-    }; // struct CharInst
-
     BitmapFontType        m_Type;
     Char                m_Char[256];
     int                    m_NChars;
 
-    CharInst            m_CharInst[c_MaxCharInst];
-    int                    m_NCharInst;
+    //  glyphs outside of the byte table, by unicode codepoint
+    std::map<DWORD, Char>   m_Glyph;
 
     BYTE                m_StartCode;
     int                    m_TexID;
@@ -62,62 +75,73 @@ protected:
     int                    m_TexHeight;
     char                m_Name[c_MaxFontName];
 
-    Rct                    m_FreeSpace;    //  rectangle of the unfilled texture
-    Rct                    m_FreeLine;        //  unfilled rectangle to the end of the 
-
-    
-    int                    AllocateChar( BYTE code, float width, float heigth );
-    bool                AddCharInst( BYTE code, const Vector3D& pos, DWORD color = 0xFFFFFFFF )
-    {
-        code -= m_StartCode;
-        if (m_NCharInst == c_MaxCharInst) return false;
-        CharInst& ch = m_CharInst[m_NCharInst++];
-        ch.m_UV        = m_Char[code].m_UV;
-        ch.m_Pos    = pos;
-        ch.m_Color    = color;
-        ch.w        = m_Char[code].m_Ext.w;
-        ch.h        = m_Char[code].m_Ext.h;
-        return true;
-    }
-
-    bool                AddCharInst( const Rct& uv, const Vector3D& pos, DWORD color = 0xFFFFFFFF )
+    //  GDI objects are kept alive to render missing glyphs
+    HDC                 m_hDC;
+    HFONT               m_hFont;
+    HBITMAP             m_hBitmap;
+    HGDIOBJ             m_hOldFont;
+    HGDIOBJ             m_hOldBitmap;
+    DWORD*              m_pBitmapBits;
+    int                 m_BitmapW;
+    int                 m_BitmapH;
+
+    const Char* GetByteChar( BYTE code ) const
     {
-        if (m_NCharInst == c_MaxCharInst) return false;
-        CharInst& ch = m_CharInst[m_NCharInst++];
-        ch.m_UV        = uv;
-        ch.m_Pos    = pos;
-        ch.m_Color    = color;
-        ch.w        = uv.w*m_TexWidth;
-        ch.h        = uv.h*m_TexHeight;
-        return true;
+        int idx = int( code ) - int( m_StartCode );
+        if (idx < 0 || idx >= m_NChars) return NULL;
+        return &m_Char[idx];
     }
 
-    bool                AddCharInst( const Rct& uv, const Vector3D& pos, float w, float h, DWORD color = 0xFFFFFFFF )
+    int GetCharW( BYTE code ) const
     {
-        if (m_NCharInst == c_MaxCharInst) return false;
-        CharInst& ch = m_CharInst[m_NCharInst++];
-        ch.m_UV        = uv;
-        ch.m_Pos    = pos;
-        ch.m_Color    = color;
-        ch.w        = w;
-        ch.h        = h;
-        return true;
+        const Char* pChar = GetByteChar( code );
+        return pChar ? pChar->m_Ext.w : 0;
     }
 
-    int GetCharW( BYTE code )
+    int GetCharH( BYTE code ) const
     {
-        return m_Char[code - m_StartCode].m_Ext.w;
-    }
-
-    int GetCharH( BYTE code )
-    {
-        return m_Char[code - m_StartCode].m_Ext.h;
+        const Char* pChar = GetByteChar( code );
+        return pChar ? pChar->m_Ext.h : 0;
     }
     
-    void                Flush();
+    void                ReleaseGDI();
     friend class FontManager;
 }; // class BitmapFont
 
+//  laid out glyph of the text run, relative to the run origin
+struct RunGlyph
+{
+    float               x;
+    float               w, h;
+    Rct                 m_UV;
+    int                 m_TexID;
+}; // struct RunGlyph
+
+/*****************************************************************************/
+/*    Struct:    TextRun
+/*    Desc:    Cached layout of the string, keyed by (font, text, spacing)
+/*****************************************************************************/
+struct TextRun
+{
+    int                     m_FontID;
+    int                     m_Spacing;
+    bool                    m_bWide;
+    DWORD                   m_Hash;
+    int                     m_Next;         //  next run in the hash bucket
+    int                     m_Width;
+    std::vector<DWORD>      m_Code;
+    std::vector<RunGlyph>   m_Glyph;
+}; // struct TextRun
+
+//  character instance of the frame text batch
+struct CharInst
+{
+    Rct                 m_UV;
+    DWORD               m_Color;
+    Vector3D            m_Pos;
+    float               w, h;
+    int                 m_TexID;
+}; // struct CharInst
 
 const int c_MaxFonts = 64;
 /*****************************************************************************/
@@ -136,7 +160,9 @@ public:
     virtual int        CreateFont            ( const char* name, int height, DWORD charset = DEFAULT_CHARSET, bool bBold = false, bool bItalic = false );
     virtual int        CreateUniformFont    ( const char* texName, int charW, int charH );
     virtual int        GetStringWidth        ( int fontID, const char* str, int spacing = 1 );
+    virtual int        GetStringWidth        ( int fontID, const wchar_t* str, int spacing = 1 );
     virtual bool    DrawString            ( int fontID, const char* str, const Vector3D& pos, DWORD color = 0xFFFFFFFF, int spacing = 1 );
+    virtual bool    DrawString            ( int fontID, const wchar_t* str, const Vector3D& pos, DWORD color = 0xFFFFFFFF, int spacing = 1 );
     virtual bool    DrawStringW            ( int fontID, const char* str, const Vector3D& pos, DWORD color = 0xFFFFFFFF, int spacing = 1 );
     virtual bool    DrawChar            ( int fontID, const Vector3D& pos, BYTE ch, DWORD color = 0xFFFFFFFF );
     virtual bool    DrawChar            ( int fontID, const Vector3D& pos, const Rct& uv, DWORD color = 0xFFFFFFFF );
@@ -150,19 +176,42 @@ public:
     virtual void    OnDestroyRS();
     virtual void    OnCreateRS(){}
 
+    //  drops all cached string layouts
+    void            ResetTextRuns        ();
+    int             GetNTextRuns        () const { return m_Runs.size(); }
+    int             GetNTextDraws        () const { return m_NDraws; }
+
     DECLARE_SCLASS(FontManager, SNode, WIDM);
 
 private:
     void            CreateFullFontName    ( char* fullName, const char* fontName, int height, DWORD charset, bool bBold, bool bItalic );
     void            CreateFullFontName    ( char* fullName, const char* fontName, int charW, int charH );
     int                CreateFont            ( const char* name );
+
+    bool            RenderGlyph         ( BitmapFont* pFont, DWORD code, bool bWide, BitmapFont::Char& ch );
+    const BitmapFont::Char* GetGlyph    ( BitmapFont* pFont, DWORD code, bool bWide );
+    const TextRun*  GetTextRun          ( int fontID, const DWORD* code, int nCodes, bool bWide, int spacing );
+    void            LayoutRun           ( BitmapFont* pFont, TextRun& run );
+    bool            AddRun              ( const TextRun* pRun, const Vector3D& pos, DWORD color );
+    bool            AddCharInst         ( const Rct& uv, int texID, const Vector3D& pos, float w, float h, DWORD color );
     
     BitmapFont*                m_Fonts[c_MaxFonts];
     int                        m_NFonts;
 
+    GlyphAtlas                 m_Atlas[c_MaxGlyphAtlases];
+    int                        m_NAtlases;
 
-}; // class FontManager
+    std::vector<TextRun>       m_Runs;
+    int                        m_RunBucket[c_TextRunHashSize];
+    TextRun                    m_ScratchRun;    //  layout of the strings which are not cached
+    std::vector<DWORD>         m_Codes;
 
+    CharInst                   m_CharInst[c_MaxCharInst];
+    int                        m_NCharInst;
+    int                        m_NDraws;        //  draw calls issued by the text batch flushes
+}; // class FontManager
 
+//  measures layout and submission of the text labels, per 1000 labels
+bool BenchmarkTextLabels( int fontID, int nLabels = 1000, int nFrames = 16 );
 
 #endif // __uiFontManager_H__
\ No newline at end of file
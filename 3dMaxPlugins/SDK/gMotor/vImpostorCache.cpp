@@ -11,11 +11,51 @@
 #include "kQuadLayout.h"
 #include "kHash.hpp"
 #include "kBlockCache.hpp"
+#include "kDirIterator.h"
+#include "IResourceManager.h"
 
 const int c_NumImpostorSurfaces     = 64;
 const int c_ImpostorSurfaceSide     = 512;
+const int c_ImpostorQuadSide        = 64;
 const int c_RenderQSize             = 4096;
 const int c_MaxAllocatedImpostors   = 2048;
+
+const DWORD c_ImpostorAtlasMagic    = 'SAMI';
+const DWORD c_ImpostorAtlasVersion  = 1;
+const char  c_ImpostorAtlasExt[]    = "ima";
+
+/*****************************************************************************/
+/*  Struct: ImpostorAtlasHeader
+/*  Desc:   Header of the prebaked impostor atlas index. Atlas pages are kept 
+/*          in <index name>_NN.dds files near the index
+/*****************************************************************************/
+struct ImpostorAtlasHeader
+{
+    DWORD       m_Magic;        //  c_ImpostorAtlasMagic
+    DWORD       m_Version;      //  c_ImpostorAtlasVersion
+    int         m_NPages;
+    int         m_NNames;       //  number of zero-terminated model names following the header
+    int         m_NEntries;
+    float       m_TimeQuant;    //  quantising the atlas was baked with
+    float       m_ThetaQuant;
+    float       m_PhiQuant;
+}; // struct ImpostorAtlasHeader
+
+/*****************************************************************************/
+/*  Struct: ImpostorAtlasEntry
+/*****************************************************************************/
+struct ImpostorAtlasEntry
+{
+    short       m_Model;        //  index in the name table
+    short       m_Anim;         //  index in the name table, -1 for static model
+    short       m_AnimTime;     //  quantized animation time
+    short       m_Theta;
+    short       m_Phi;
+    short       m_Page;
+    Rct         m_UV;
+    float       m_RefX, m_RefY;
+    float       m_ViewVol;
+}; // struct ImpostorAtlasEntry
 /*****************************************************************************/
 /*  Class:  ImpostorInstance
 /*  Desc:   Instance of the impostor
@@ -35,6 +75,7 @@ protected:
     float       m_RefX, m_RefY; //  projected pivot coordinates
     float       m_ViewVol;      //  view volume of the impostor camera
     int         m_SurfaceID;    //  id of the impostor surface
+    int         m_Page;         //  page of the prebaked atlas, -1 for live impostors
 
     friend class ImpostorCache;
     friend class ImpostorSurface;
@@ -49,7 +90,8 @@ public:
                             m_Theta     (theta      ),
                             m_QuadSide  (quadSide   ),
                             m_LastUsed  (0          ),
-                            m_SurfaceID (-1         ) {}
+                            m_SurfaceID (-1         ),
+                            m_Page      (-1         ) {}
 
                     ImpostorInstance( DWORD modelID, int theta, int phi, int quadSide )
                          :  m_ModelID   (modelID    ),
@@ -59,7 +101,8 @@ public:
                             m_Theta     (theta      ),
                             m_QuadSide  (quadSide   ),
                             m_LastUsed  (0          ),
-                            m_SurfaceID (-1         ) {}
+                            m_SurfaceID (-1         ),
+                            m_Page      (-1         ) {}
 
     unsigned int hash() const
     {
@@ -94,6 +137,7 @@ public:
         m_RefX      = el.m_RefX;
         m_RefY      = el.m_RefY;
         m_ViewVol   = el.m_ViewVol;
+        m_Page      = el.m_Page;
     }
 
 }; // class ImpostorInstance
@@ -114,6 +158,7 @@ struct ImpostorRenderTask
     float       m_RefX, m_RefY; //  projected pivot coordinates
     float       m_Side;         //  side of the impostor billboard, in world space
     int         m_SurfaceID;    //  id of the impostor surface
+    int         m_TexID;        //  impostor surface or prebaked atlas page texture
     float       m_Rotation;     //  rotation of the billboard in screen space
 }; // class ImpostorRenderTask
 
@@ -151,6 +196,8 @@ typedef BlockCache< ImpostorSurface,
 class ImpostorCache : public IImpostorCache
 {
     ImpostorHash            m_Hash;                     //  storage of impostor instance desriptors
+    ImpostorHash            m_Baked;                    //  impostors of the prebaked atlas
+    std::vector<int>        m_BakedPages;               //  prebaked atlas page textures
     bool                    m_bInited;                  //  true when cache is initialized
     ImpostorSurfaceCache    m_Cache;                    //  impostor render targets cache
     ImpostorRenderTask      m_RenderQ[c_RenderQSize];   //  render queue
@@ -162,6 +209,7 @@ class ImpostorCache : public IImpostorCache
     float                   m_PhiQuant;                 //  lattitude quantising ratio
     float                   m_PixelStretchRatio;        //  maximal ratio allowed for magnifying impostor pixels
     int                     m_NCreatedImpostors;        //  number of crated impostors on this frame
+    int                     m_NBakedHits;               //  number of impostors taken from the atlas on this frame
     int                     m_DepthID;                  //  depth buffer surface
     int                     m_LastRenderTarget;         //  last impostor render target used on this frame
 
@@ -174,16 +222,20 @@ public:
     virtual void        Draw            ( DWORD modelID, const Matrix4D& tm );
     virtual void        Draw            ( DWORD modelID, DWORD animID, float anmTime, const Matrix4D& tm );
     virtual void        DumpSurfaces    ();
+    virtual int         BakeAtlas       ( const char* fname, const ImpostorBakeItem* items, int nItems );
+    virtual bool        LoadAtlas       ( const char* fname );
     
     static int CmpRenderTasks( const void *e1, const void *e2 )
     {
         const ImpostorRenderTask* pTask1 = *((const ImpostorRenderTask**)e1);
         const ImpostorRenderTask* pTask2 = *((const ImpostorRenderTask**)e2);
-        return pTask1->m_SurfaceID - pTask2->m_SurfaceID;
+        return pTask1->m_TexID - pTask2->m_TexID;
     }
 
 protected:
     bool                CreateImpostor  ( ImpostorInstance& imp );
+    void                RenderImpostor  ( ImpostorInstance& imp );
+    bool                SaveAtlasPage   ( const char* fname, int page, int texID );
 
 }; // class ImpostorCache
 
@@ -231,6 +283,7 @@ ImpostorCache::ImpostorCache()
     m_ThetaQuant        = c_PI/8.0f;
     m_PhiQuant          = c_PI/8.0f;
     m_NCreatedImpostors = 0;
+    m_NBakedHits        = 0;
     m_PixelStretchRatio = 0.5f;
     m_DepthID           = -1;
     m_LastRenderTarget  = -1;
@@ -280,7 +333,7 @@ void ImpostorCache::DrawDebugInfo( int dbgSurf )
         if (dbgSurf < 0) cY += surfS + c_BorderW;
     }
 
-    DrawText( 10, 100, 0xFFFF0000, "CreatedImpostors:%d", m_NCreatedImpostors );
+    DrawText( 10, 100, 0xFFFF0000, "CreatedImpostors:%d BakedHits:%d", m_NCreatedImpostors, m_NBakedHits );
     rsRestoreShader();
     rsFlushLines2D();
     FlushText();
@@ -372,6 +425,7 @@ float EstimateScreenSpacePixels( const AABoundBox& aabb, const Vector3D& pos )
 void ImpostorCache::Flush()
 {
     if (m_RenderQSize == 0) return;
+    if (!Init()) return;
     ICamera* pCam = GetCamera();
     Matrix4D camTM      = pCam->GetWorldTM();
     Matrix4D prTM       = pCam->GetProjTM();
@@ -385,10 +439,11 @@ void ImpostorCache::Flush()
     //  precache animated models' impostors
     int cTask = 0;
     m_NCreatedImpostors = 0;
-    m_LastRenderTarget = -1;
+    m_NBakedHits        = 0;
+    m_LastRenderTarget  = -1;
     for (int i = 0; i < m_RenderQSize; i++)
     {
-        ImpostorRenderTask& rt = m_RenderQ[cTask];
+        ImpostorRenderTask& rt = m_RenderQ[i];
         //  calculate impostor attributes
         const Matrix4D& tm = rt.m_TM;
         Vector3D dir;
@@ -417,31 +472,48 @@ void ImpostorCache::Flush()
         int nTime       = rt.m_AnmTime/m_TimeQuant;
         int nTheta      = theta/m_ThetaQuant;
         int nPhi        = phi/m_PhiQuant;
-        int qSide       = 64;
+        int qSide       = c_ImpostorQuadSide;
 
-        //  look for an impostor instance in the cache
-        int hIdx = m_Hash.add( ImpostorInstance( rt.m_ModelID, rt.m_AnimID, nTime, nTheta, nPhi, qSide ) );
-        ImpostorInstance& hImp = m_Hash.elem( hIdx );        
-        if (hImp.m_SurfaceID == -1) 
+        //  look for an impostor in the prebaked atlas, render it live only when missing there
+        ImpostorInstance key( rt.m_ModelID, rt.m_AnimID, nTime, nTheta, nPhi, qSide );
+        int bIdx = (m_Baked.numElem() > 0) ? m_Baked.find( key ) : NO_ELEMENT;
+        const ImpostorInstance* pImp = NULL;
+        if (bIdx != NO_ELEMENT)
         {
-            if (!CreateImpostor( hImp )) continue;
-            m_NCreatedImpostors++;
+            pImp = &m_Baked.elem( bIdx );
+            rt.m_TexID = m_BakedPages[pImp->m_Page];
+            m_NBakedHits++;
         }
         else
         {
-            m_Cache.HitBlock( hImp.m_SurfaceID );
+            //  look for an impostor instance in the cache
+            int hIdx = m_Hash.add( key );
+            ImpostorInstance& hImp = m_Hash.elem( hIdx );        
+            if (hImp.m_SurfaceID == -1) 
+            {
+                if (!CreateImpostor( hImp )) continue;
+                m_NCreatedImpostors++;
+            }
+            else
+            {
+                m_Cache.HitBlock( hImp.m_SurfaceID );
+            }
+            pImp = &hImp;
+            rt.m_TexID = m_Cache.GetBlock( hImp.m_SurfaceID ).m_TextureID;
         }
-        rt.m_SurfaceID  = hImp.m_SurfaceID;
-        rt.m_UV         = hImp.m_UV; 
-        rt.m_RefX       = hImp.m_RefX;
-        rt.m_RefY       = hImp.m_RefY;
-        rt.m_Side       = hImp.m_ViewVol*scale;
+        rt.m_SurfaceID  = pImp->m_SurfaceID;
+        rt.m_UV         = pImp->m_UV; 
+        rt.m_RefX       = pImp->m_RefX;
+        rt.m_RefY       = pImp->m_RefY;
+        rt.m_Side       = pImp->m_ViewVol*scale;
         rt.m_Rotation   = rot;
         m_SortedRenderQ[cTask] = &rt;
         cTask++;
     }
     m_RenderQSize = cTask;
-    if (m_NCreatedImpostors > 0) 
+    INC_COUNTER( ImpostorsCreated,  m_NCreatedImpostors );
+    INC_COUNTER( ImpostorsBaked,    m_NBakedHits        );
+    if (m_LastRenderTarget != -1) 
     {
         IRS->PopRenderTarget();
         IRS->SetViewPort    ( viewPort );
@@ -450,6 +522,8 @@ void ImpostorCache::Flush()
 
     }
 
+    if (m_RenderQSize == 0) return;
+
     //  sort impostors by texture
     qsort( m_SortedRenderQ, m_RenderQSize, sizeof( ImpostorRenderTask* ), CmpRenderTasks );
     
@@ -464,7 +538,7 @@ void ImpostorCache::Flush()
 
     int cImp = 0;
     int nImp = 0;
-    int cSurf = m_SortedRenderQ[0]->m_SurfaceID;
+    int cTex = m_SortedRenderQ[0]->m_TexID;
     IRS->ResetWorldTM();
 
     bm.setNVert( 0 );
@@ -472,12 +546,10 @@ void ImpostorCache::Flush()
     while (cImp < m_RenderQSize)
     {
         const ImpostorRenderTask& rt = *m_SortedRenderQ[cImp]; 
-        int surfID = rt.m_SurfaceID;
-        if (surfID != cSurf && surfID != -1)
+        if (rt.m_TexID != cTex)
         //  render batch
         {
-            const ImpostorSurface& surf = m_Cache.GetBlock( cSurf );
-            bm.setTexture( surf.m_TextureID );
+            bm.setTexture( cTex );
             bm.setNVert( nImp*4 );
             bm.setNPri ( nImp*2 );
 
@@ -485,7 +557,7 @@ void ImpostorCache::Flush()
             
             bm.setNVert( 0 );
             bm.setNPri ( 0 );
-            cSurf = surfID;
+            cTex = rt.m_TexID;
             nImp = 0;
         }
         //  add billboard quad to the batch
@@ -499,8 +571,7 @@ void ImpostorCache::Flush()
     }
     
     //  last bucket pass
-    const ImpostorSurface& surf = m_Cache.GetBlock( cSurf );
-    bm.setTexture( surf.m_TextureID );
+    bm.setTexture( cTex );
     bm.setNVert( nImp*4 );
     bm.setNPri ( nImp*2 );
     DrawBM( bm );
@@ -521,10 +592,18 @@ bool ImpostorCache::CreateImpostor( ImpostorInstance& imp )
     const ImpostorSurface& surf = m_Cache.GetBlock( surfID );
     if (surf.m_TextureID != m_LastRenderTarget)
     {
+        if (m_LastRenderTarget != -1) IRS->PopRenderTarget();
         IRS->PushRenderTarget( surf.m_TextureID, m_DepthID );
         IRS->ClearDevice( 0, false, true );
         m_LastRenderTarget = surf.m_TextureID;
     }
+    RenderImpostor( imp );
+    return true;
+} // ImpostorCache::CreateImpostor
+
+//  renders impostor into its place on the current render target
+void ImpostorCache::RenderImpostor( ImpostorInstance& imp )
+{
     Rct vp( imp.m_UV );
     vp *= c_ImpostorSurfaceSide;
     IRS->SetViewPort( vp );
@@ -541,10 +620,8 @@ bool ImpostorCache::CreateImpostor( ImpostorInstance& imp )
     lookDir.y   = cosf( phi )*sinf( theta );
     lookDir.z   = sinf( phi );
 
-    ICamera* pCam = GetCamera();
     Matrix4D impViewTM, impProjTM;
     //  setup orthogonal camera
-    Matrix4D viewM = pCam->GetWorldTM();
     Vector3D vZ = lookDir;
     Vector3D vY = Vector3D::oZ; 
     Vector3D vX;
@@ -574,9 +651,7 @@ bool ImpostorCache::CreateImpostor( ImpostorInstance& imp )
     IMM->StartModel( imp.m_ModelID, Matrix4D::identity );
     IMM->AnimateModel( imp.m_AnimID, float( imp.m_AnimTime )*m_TimeQuant );
     IMM->DrawModel();
-
-    return true;
-} // ImpostorCache::CreateImpostor
+} // ImpostorCache::RenderImpostor
 
 void ImpostorCache::Draw( DWORD modelID, const Matrix4D& tm )
 {
@@ -617,6 +692,11 @@ bool ImpostorCache::Init()
     m_DepthID = IRS->CreateTexture( "ImpostorDepthBuffer", c_ImpostorSurfaceSide, c_ImpostorSurfaceSide, 
                                         cfUnknown, 1, tmpDefault, false, dsfD16 );
     m_bInited = true;
+
+    //  impostors of the prebaked atlas are not rendered at runtime
+    char atlasPath[_MAX_PATH];
+    GetImpostorAtlasPath( atlasPath );
+    LoadAtlas( atlasPath );
     return true;
 } // ImpostorCache::Init
 
@@ -632,3 +712,296 @@ void ImpostorCache::DumpSurfaces()
 
 
 
+
+//  atlas page file name is the index file name with page number
+static void GetAtlasPageName( const char* fname, int page, char* pageName )
+{
+    strcpy( pageName, fname );
+    char* pExt = strrchr( pageName, '.' );
+    if (pExt && !strchr( pExt, '\\' ) && !strchr( pExt, '/' )) *pExt = 0;
+    sprintf( pageName + strlen( pageName ), "_%02d.dds", page );
+} // GetAtlasPageName
+
+static int GetAtlasNameIdx( std::vector<std::string>& names, const char* name )
+{
+    if (!name) name = "";
+    for (int i = 0; i < names.size(); i++) if (names[i] == name) return i;
+    names.push_back( name );
+    return names.size() - 1;
+} // GetAtlasNameIdx
+
+//  compresses render target contents and saves them as the atlas page
+bool ImpostorCache::SaveAtlasPage( const char* fname, int page, int texID )
+{
+    IRS->Flush();
+    IRS->PopRenderTarget();
+
+    char pageName[_MAX_PATH];
+    GetAtlasPageName( fname, page, pageName );
+    int dxtID = IRS->CreateTexture( "ImpostorAtlasPage", c_ImpostorSurfaceSide, c_ImpostorSurfaceSide, 
+                                    cfDXT5, 1, tmpManaged );
+    bool bRes = false;
+    if (dxtID != -1)
+    {
+        IRS->CopyTexture( dxtID, texID );
+        bRes = IRS->SaveTexture( dxtID, pageName );
+        IRS->DeleteTexture( dxtID );
+    }
+    if (!bRes) Log.Warning( "Could not save impostor atlas page <%s>", pageName );
+    return bRes;
+} // ImpostorCache::SaveAtlasPage
+
+int ImpostorCache::BakeAtlas( const char* fname, const ImpostorBakeItem* items, int nItems )
+{
+    if (!Init()) return 0;
+    int pageID = IRS->CreateTexture( "ImpostorBakePage", c_ImpostorSurfaceSide, c_ImpostorSurfaceSide, 
+                                     cfARGB8888, 1, tmpDefault, true );
+    if (pageID == -1)
+    {
+        Log.Warning( "Could not create impostor bake render target" );
+        return 0;
+    }
+
+    Rct      viewPort   = IRS->GetViewPort();
+    Matrix4D viewTM     = IRS->GetViewTM();
+    Matrix4D projTM     = IRS->GetProjTM();
+
+    //  same quantization the runtime lookup uses: atan2 results truncated by the quants
+    int nThetaSide  = int( c_PI/m_ThetaQuant + 0.5f );
+    int nPhiSide    = int( c_PI*0.5f/m_PhiQuant + 0.5f );
+    int quadPower   = GetPower( (PowerOfTwo)c_ImpostorQuadSide );
+
+    std::vector<std::string>        names;
+    std::vector<ImpostorAtlasEntry> entries;
+    QuadLayout  layout;
+    int         nPages     = 0;
+    bool        bPageOpen  = false;
+    for (int i = 0; i < nItems; i++)
+    {
+        const ImpostorBakeItem& item = items[i];
+        bool bStatic = (item.m_AnimID == 0xFFFFFFFF);
+        int  modelIdx = GetAtlasNameIdx( names, IMM->GetModelFileName( item.m_ModelID ) );
+        int  animIdx  = bStatic ? -1 : GetAtlasNameIdx( names, IMM->GetModelFileName( item.m_AnimID ) );
+        int  nTimes   = bStatic ? 1 : int( IMM->GetAnimTime( item.m_AnimID )/m_TimeQuant ) + 1;
+
+        for (int t = 0; t < nTimes; t++)
+        {
+            for (int theta = -nThetaSide; theta <= nThetaSide; theta++)
+            {
+                for (int phi = -nPhiSide; phi <= nPhiSide; phi++)
+                {
+                    ImpostorInstance imp( item.m_ModelID, item.m_AnimID, t, theta, phi, c_ImpostorQuadSide );
+                    WORD ax, ay;
+                    if (bPageOpen && !layout.AllocChunk( quadPower, ax, ay ))
+                    {
+                        SaveAtlasPage( fname, nPages++, pageID );
+                        bPageOpen = false;
+                    }
+                    if (!bPageOpen)
+                    {
+                        layout.Init( c_ImpostorSurfaceSide );
+                        IRS->PushRenderTarget( pageID, m_DepthID );
+                        IRS->ClearDevice( 0x00000000, true, true );
+                        bPageOpen = true;
+                        layout.AllocChunk( quadPower, ax, ay );
+                    }
+                    imp.m_UV = Rct( ax, ay, c_ImpostorQuadSide, c_ImpostorQuadSide );
+                    imp.m_UV /= float( c_ImpostorSurfaceSide );
+                    RenderImpostor( imp );
+
+                    ImpostorAtlasEntry e;
+                    e.m_Model       = modelIdx;
+                    e.m_Anim        = animIdx;
+                    e.m_AnimTime    = t;
+                    e.m_Theta       = theta;
+                    e.m_Phi         = phi;
+                    e.m_Page        = nPages;
+                    e.m_UV          = imp.m_UV;
+                    e.m_RefX        = imp.m_RefX;
+                    e.m_RefY        = imp.m_RefY;
+                    e.m_ViewVol     = imp.m_ViewVol;
+                    entries.push_back( e );
+                }
+            }
+        }
+    }
+    if (bPageOpen) SaveAtlasPage( fname, nPages++, pageID );
+    IRS->DeleteTexture( pageID );
+    IRS->SetViewPort( viewPort );
+    IRS->SetViewTM  ( viewTM );
+    IRS->SetProjTM  ( projTM );
+
+    FOutStream os( fname );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write impostor atlas <%s>", fname );
+        return 0;
+    }
+    ImpostorAtlasHeader hdr;
+    hdr.m_Magic         = c_ImpostorAtlasMagic;
+    hdr.m_Version       = c_ImpostorAtlasVersion;
+    hdr.m_NPages        = nPages;
+    hdr.m_NNames        = names.size();
+    hdr.m_NEntries      = entries.size();
+    hdr.m_TimeQuant     = m_TimeQuant;
+    hdr.m_ThetaQuant    = m_ThetaQuant;
+    hdr.m_PhiQuant      = m_PhiQuant;
+    os.Write( &hdr, sizeof( hdr ) );
+    //  models are stored by name, their IDs differ between the sessions
+    for (int i = 0; i < names.size(); i++) os.Write( names[i].c_str(), names[i].size() + 1 );
+    if (entries.size() > 0) os.Write( &entries[0], entries.size()*sizeof( ImpostorAtlasEntry ) );
+    os.CloseFile();
+
+    Log.Info( "Baked impostor atlas <%s>: %d impostors, %d pages", fname, entries.size(), nPages );
+    return entries.size();
+} // ImpostorCache::BakeAtlas
+
+bool ImpostorCache::LoadAtlas( const char* fname )
+{
+    m_Baked.reset();
+    m_BakedPages.clear();
+
+    FInStream is( fname );
+    if (is.NoFile()) return false;
+    //  counts are bounded by the file size, every page holds at least one entry
+    int nDataBytes = is.GetFileSize() - sizeof( ImpostorAtlasHeader );
+    ImpostorAtlasHeader hdr;
+    if (is.Read( &hdr, sizeof( hdr ) ) != sizeof( hdr ) ||
+        hdr.m_Magic != c_ImpostorAtlasMagic || hdr.m_Version != c_ImpostorAtlasVersion ||
+        hdr.m_NNames < 0 || hdr.m_NNames > nDataBytes ||
+        hdr.m_NEntries < 0 || hdr.m_NEntries > (nDataBytes - hdr.m_NNames)/sizeof( ImpostorAtlasEntry ) ||
+        hdr.m_NPages < 0 || hdr.m_NPages > hdr.m_NEntries)
+    {
+        Log.Warning( "Invalid impostor atlas <%s>", fname );
+        return false;
+    }
+    if (hdr.m_TimeQuant != m_TimeQuant || hdr.m_ThetaQuant != m_ThetaQuant || hdr.m_PhiQuant != m_PhiQuant)
+    {
+        Log.Warning( "Impostor atlas <%s> was baked with different quantization, rebake it", fname );
+        return false;
+    }
+    std::vector<DWORD> ids;
+    for (int i = 0; i < hdr.m_NNames; i++)
+    {
+        std::string name;
+        char ch = 0;
+        while (is.Read( &ch, 1 ) == 1 && ch != 0) name += ch;
+        ids.push_back( name.size() ? IMM->GetModelID( name.c_str() ) : 0xFFFFFFFF );
+    }
+    std::vector<ImpostorAtlasEntry> entries( hdr.m_NEntries );
+    int nBytes = entries.size()*sizeof( ImpostorAtlasEntry );
+    if (nBytes > 0 && is.Read( &entries[0], nBytes ) != nBytes)
+    {
+        Log.Warning( "Impostor atlas <%s> is truncated", fname );
+        return false;
+    }
+
+    char pageName[_MAX_PATH];
+    for (int i = 0; i < hdr.m_NPages; i++)
+    {
+        GetAtlasPageName( fname, i, pageName );
+        int texID = IRS->GetTextureID( pageName );
+        //  uv of the entries are made for the surface side
+        if (texID != -1 && (IRS->GetTextureWidth( texID )  != c_ImpostorSurfaceSide || 
+                            IRS->GetTextureHeight( texID ) != c_ImpostorSurfaceSide))
+        {
+            Log.Warning( "Impostor atlas page <%s> is not %dx%d", pageName, c_ImpostorSurfaceSide, c_ImpostorSurfaceSide );
+            texID = -1;
+        }
+        m_BakedPages.push_back( texID );
+    }
+
+    int nBad = 0;
+    for (int i = 0; i < entries.size(); i++)
+    {
+        const ImpostorAtlasEntry& e = entries[i];
+        if (e.m_Page < 0 || e.m_Page >= hdr.m_NPages || m_BakedPages[e.m_Page] == -1) continue;
+        if (e.m_Model < 0 || e.m_Model >= hdr.m_NNames || e.m_Anim < -1 || e.m_Anim >= hdr.m_NNames ||
+            !(e.m_UV.x >= 0.0f && e.m_UV.y >= 0.0f && e.m_UV.w > 0.0f && e.m_UV.h > 0.0f &&
+              e.m_UV.x + e.m_UV.w <= 1.0f && e.m_UV.y + e.m_UV.h <= 1.0f))
+        {
+            nBad++;
+            continue;
+        }
+        DWORD mdlID  = ids[e.m_Model];
+        DWORD animID = (e.m_Anim >= 0) ? ids[e.m_Anim] : 0xFFFFFFFF;
+        if (mdlID == 0xFFFFFFFF) continue;
+
+        ImpostorInstance imp( mdlID, animID, e.m_AnimTime, e.m_Theta, e.m_Phi, c_ImpostorQuadSide );
+        imp.m_UV        = e.m_UV;
+        imp.m_RefX      = e.m_RefX;
+        imp.m_RefY      = e.m_RefY;
+        imp.m_ViewVol   = e.m_ViewVol;
+        imp.m_Page      = e.m_Page;
+        m_Baked.add( imp );
+    }
+    if (nBad > 0) Log.Warning( "Impostor atlas <%s>: %d corrupt entries skipped", fname, nBad );
+    Log.Info( "Loaded impostor atlas <%s>: %d impostors, %d pages", fname, m_Baked.numElem(), hdr.m_NPages );
+    return true;
+} // ImpostorCache::LoadAtlas
+
+void GetImpostorAtlasPath( char* path )
+{
+    sprintf( path, "%s\\Impostors\\impostors.%s", IRM->GetHomeDirectory(), c_ImpostorAtlasExt );
+} // GetImpostorAtlasPath
+
+int BakeImpostorAtlas( const char* root )
+{
+    //  models are grouped by directory, animations are the models with nonzero duration
+    std::vector<std::string> dirs;
+    std::vector< std::vector<DWORD> > models;
+    std::vector< std::vector<DWORD> > anims;
+    DirTreeIterator it( root );
+    it.AddFilter( "c2m" );
+    while (it)
+    {
+        const char* srcPath = it.GetFullFilePath();
+        DWORD mdlID = IMM->GetModelID( srcPath );
+        if (mdlID != 0xFFFFFFFF)
+        {
+            std::string dir( srcPath );
+            size_t slash = dir.find_last_of( "\\/" );
+            dir.resize( slash == std::string::npos ? 0 : slash );
+            int dirIdx = GetAtlasNameIdx( dirs, dir.c_str() );
+            models.resize( dirs.size() );
+            anims.resize( dirs.size() );
+            if (IMM->GetAnimTime( mdlID ) > 0.0f) anims[dirIdx].push_back( mdlID );
+            else models[dirIdx].push_back( mdlID );
+        }
+        else
+        {
+            Log.Warning( "Impostor atlas: could not load model <%s>", srcPath );
+        }
+        ++it;
+    }
+
+    std::vector<ImpostorBakeItem> items;
+    for (int i = 0; i < dirs.size(); i++)
+    {
+        for (int j = 0; j < models[i].size(); j++)
+        {
+            ImpostorBakeItem item;
+            item.m_ModelID  = models[i][j];
+            item.m_AnimID   = 0xFFFFFFFF;
+            items.push_back( item );
+            for (int k = 0; k < anims[i].size(); k++)
+            {
+                item.m_AnimID = anims[i][k];
+                items.push_back( item );
+            }
+        }
+    }
+    if (items.size() == 0)
+    {
+        Log.Warning( "Impostor atlas: no models found in <%s>", root );
+        return 0;
+    }
+
+    char path[_MAX_PATH];
+    sprintf( path, "%s\\Impostors", IRM->GetHomeDirectory() );
+    _mkdir( path );
+    GetImpostorAtlasPath( path );
+    int nBaked = IImpCache->BakeAtlas( path, &items[0], items.size() );
+    if (nBaked > 0) IImpCache->LoadAtlas( path );
+    return nBaked;
+} // BakeImpostorAtlas
@@ -26,6 +26,7 @@
 #include "vModelInstance.h"
 #include "sgConst.h"
 #include "sgAnimation.h"
+#include "sgModelBake.h"
 
 #include <map>
 
@@ -96,6 +97,7 @@ class MediaManager :    public Group,
     ModelRegistry       m_Models;
 
     ModelInstance*      m_pCurInstance;
+    ModelBatcher        m_Batcher;
     SNode*              m_pCurModel;
     Matrix4D            m_TM;
     DWORD               m_AttachedEffectMask;
@@ -106,6 +108,7 @@ public:
     virtual DWORD       GetModelID          ( const char* fname );
 	virtual void		ReloadModel			(DWORD idModel);
     virtual const char* GetModelFileName    ( DWORD modelID );
+    virtual DWORD       GetNodeModelID      ( DWORD nodeID );
     virtual void        SetVisible          ( DWORD nodeID, bool bVisible = true );
 	virtual void		GetModelBounds		(DWORD idModel, std::vector<AABoundBox> &Bounds, std::vector<Matrix4D> &Transforms);
 
@@ -167,6 +170,9 @@ public:
 
     virtual const char*     GetModelOfNodeName  ( DWORD NodeID );
 
+    virtual void            BeginModelBatch     () { m_Batcher.Begin(); }
+    virtual void            EndModelBatch       () { m_Batcher.End(); }
+
     DECLARE_SCLASS(MediaManager,Group,MMGI);
 private:
 
@@ -274,6 +280,18 @@ const char* MediaManager::GetModelFileName( DWORD modelID )
     return m_Models.elem( modelID ).m_ModelName.c_str();
 } // MediaManager::GetModelFileName
 
+DWORD MediaManager::GetNodeModelID( DWORD nodeID )
+{
+    if (nodeID == c_BadID) return c_BadID;
+    int nModels = m_Models.numElem();
+    for (int i = 0; i < nModels; i++)
+    {
+        const ModelStub& s = m_Models.elem( i );
+        if (s.m_bLoaded && !s.m_bNoFile && s.m_ModelID == nodeID) return i;
+    }
+    return c_BadID;
+} // MediaManager::GetNodeModelID
+
 void MediaManager::StartModel( DWORD modelID, const Matrix4D& tm, DWORD context )
 {
     m_pCurInstance  = NULL;
@@ -340,6 +358,12 @@ void MediaManager::DrawModel()
         }
         else if (m_pCurInstance)
         {
+            extern bool _dbgDrawBonesMode;
+            if (m_Batcher.IsActive() && !_dbgDrawBonesMode)
+            {
+                m_Batcher.Add( *m_pCurInstance );
+                return;
+            }
             m_pCurInstance->Render();
         }
         else
@@ -900,14 +924,19 @@ DWORD MediaManager::ModelToNodeID( DWORD id )
             Log.Error( "Could not load model <%s>", s.m_ModelName.c_str() );
             return c_BadID;
         }
-        InStream& is = IRM->LockResource( resPath.GetFullPath() );
-
         FilePath path( IRM->GetFullPath( resID ) );
         _chdir( path.GetDrive() );
         _chdir( path.GetDir() );
 
-        SNode* pRoot = SNode::UnserializeSubtree( is );            
-        is.Close();
+        //  prefer baked model, it is already compiled and needs no bounds pass
+        SNode* pRoot = LoadBakedModel( path.GetFullPath() );
+        bool bBaked = (pRoot != NULL);
+        if (!bBaked)
+        {
+            InStream& is = IRM->LockResource( resPath.GetFullPath() );
+            pRoot = SNode::UnserializeSubtree( is );            
+            is.Close();
+        }
 
         if (!pRoot) 
         {
@@ -919,7 +948,7 @@ DWORD MediaManager::ModelToNodeID( DWORD id )
 
         PrefetchTextures( pRoot, path );
 
-        pRoot = CompileModel( (SNode*)pRoot, path.GetFullPath() );
+        if (!bBaked) pRoot = CompileModel( (SNode*)pRoot, path.GetFullPath() );
 		//ConvertNodesToSkinGPU(pRoot);
 
         s.m_bLoaded = true;
@@ -929,8 +958,12 @@ DWORD MediaManager::ModelToNodeID( DWORD id )
         if (pModel) 
         {
             pModel->CreateShell();
-            AABoundBox aabb = CalculateAABB( pModel );
-            pModel->SetAABB( aabb );
+            //  baked model keeps bounds, calculated at bake time
+            if (!bBaked)
+            {
+                AABoundBox aabb = CalculateAABB( pModel );
+                pModel->SetAABB( aabb );
+            }
         }
         _chdir( IRM->GetHomeDirectory() );
         return s.m_ModelID;
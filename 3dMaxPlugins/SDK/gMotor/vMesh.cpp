@@ -39,6 +39,7 @@ Primitive::Primitive()
     setPriType( ptUnknown );
 
     flags        = 0;
+    inBlock      = false;
     devHandle    = 0;
 
     vbPos        = -1;
@@ -69,6 +70,7 @@ Primitive::Primitive( const Primitive& bm )
     setPriType( ptUnknown );
 
     flags       = 0;
+    inBlock     = false;
     devHandle   = 0;
 
     vbPos       = -1;
@@ -92,6 +94,7 @@ void Primitive::Swap(Primitive *pSrc) {
 	swap(_priType, pSrc->_priType);
 	swap(_vertFormat, pSrc->_vertFormat);
 	swap(flags, pSrc->flags);
+	swap(inBlock, pSrc->inBlock);
 	swap(ibPos, pSrc->ibPos);
 	swap(vbPos, pSrc->vbPos);
 	swap(indNum, pSrc->indNum);
@@ -113,8 +116,7 @@ void Primitive::Swap(Primitive *pSrc) {
 
 void Primitive::copy( const Primitive& bm )
 {
-    delete []ibuf;
-    aligned_delete_nodestruct( vbuf );
+    freeData();
 
     _priType    = bm._priType;
     _vertFormat = bm._vertFormat;
@@ -138,13 +140,59 @@ void Primitive::copy( const Primitive& bm )
 
 Primitive::~Primitive()
 {
-    delete []ibuf;
-    aligned_delete_nodestruct( vbuf );
-    ibuf = 0;
-    vbuf = 0;
+    freeData();
     s_NumPrimitives--;
 }
 
+void Primitive::freeData()
+{
+    if (!inBlock)
+    {
+        delete []ibuf;
+        aligned_delete_nodestruct( vbuf );
+    }
+    ibuf    = 0;
+    vbuf    = 0;
+    inBlock = false;
+} // Primitive::freeData
+
+//  moves data from the external block to own buffers before it is reallocated
+void Primitive::ownData()
+{
+    if (!inBlock) return;
+    WORD* pIdx  = (maxIndNum > 0) ? new WORD[maxIndNum] : NULL;
+    void* pVert = Vertex::CreateVBuf( getVertexFormat(), maxVertNum );
+    if (pIdx) memcpy( pIdx, ibuf, maxIndNum*sizeof( WORD ) );
+    memcpy( pVert, vbuf, maxVertNum*getVertexStride() );
+    ibuf    = pIdx;
+    vbuf    = pVert;
+    inBlock = false;
+} // Primitive::ownData
+
+int Primitive::getBlockSize( int numVert, int numInd, VertexFormat vformat )
+{
+    int vbSize = (numVert*Vertex::GetStride( vformat ) + 31)&~31;
+    return vbSize + numInd*sizeof( WORD );
+} // Primitive::getBlockSize
+
+void Primitive::createInBlock( int numVert, int numInd, VertexFormat vformat, PrimitiveType typePri, BYTE* pBlock )
+{
+    freeData();
+    indNum      = 0;
+    vertNum     = 0;
+    numPri      = 0; 
+    maxVertNum  = numVert;
+    maxIndNum   = numInd;
+    setPriType( typePri );
+    setVertexFormat( vformat );
+
+    //  block is 32-byte aligned, as Vertex::CreateVBuf memory
+    assert( (reinterpret_cast<UINT_PTR>( pBlock )&31) == 0 );
+    vbuf    = pBlock;
+    ibuf    = (numInd > 0) ? (WORD*)(pBlock + ((numVert*Vertex::GetStride( vformat ) + 31)&~31)) : NULL;
+    inBlock = true;
+} // Primitive::createInBlock
+
 void Primitive::OnResetDevice()
 {
     devHandle    = 0;
@@ -175,10 +223,7 @@ void Primitive::create( int numVert, int numInd, VertexFormat vformat, Primitive
 
     if (!sharedBuffer)
     {
-        delete []ibuf;
-        aligned_delete_nodestruct( vbuf );
-        ibuf        = NULL;
-        vbuf        = NULL;
+        freeData();
 
         if (maxIndNum > 0) ibuf = new WORD[maxIndNum];
         vbuf = Vertex::CreateVBuf( vformat, numVert );
@@ -188,6 +233,7 @@ void Primitive::create( int numVert, int numInd, VertexFormat vformat, Primitive
 
 void Primitive::replaceVertexPtr( void* ptr )
 {
+    ownData();
     aligned_delete_nodestruct( vbuf );
     vbuf = ptr;
 } // Primitive::replaceVertexPtr
@@ -363,6 +409,7 @@ bool Primitive::convertVF( VertexFormat to )
 {
     VertexFormat myVF = getVertexFormat();
     if (myVF == to) return true;
+    ownData();
     
     if (myVF == vfVertex2t && to == vfVertexN)
     {
@@ -854,6 +901,7 @@ Primitive& Primitive::operator +=( const Primitive& bm )
 {
     assert( this != &bm );
     assert( _priType == bm._priType && _vertFormat == bm._vertFormat );
+    ownData();
 
     if (maxIndNum < indNum + bm.indNum)
     //  recreate index buffer
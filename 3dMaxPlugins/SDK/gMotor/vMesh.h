@@ -130,6 +130,12 @@ public:
                                     VertexFormat vformat = vfVertex2t, 
                                       PrimitiveType typePri = ptTriangleList,
                                     bool sharedBuffer = false );
+    //  places vertex and index data into the external block of getBlockSize bytes,
+    //  which the primitive does not own (used by the baked model loader)
+    void                    createInBlock( int numVert, int numInd, VertexFormat vformat, 
+                                           PrimitiveType typePri, BYTE* pBlock );
+    static int              getBlockSize( int numVert, int numInd, VertexFormat vformat );
+    bool                    isInBlock() const { return inBlock; }
 
     //  construction tools
     void                    createLine( const Vector3D& orig, const Vector3D& dest );
@@ -210,6 +216,7 @@ protected:
     int                         maxIndNum;
 
     BYTE                        flags;        //  cached flags, static/dynamic etc
+    bool                        inBlock;      //  vbuf/ibuf lie in the external block, see createInBlock
 
     int                         vbPos;        //  position in the VB
     int                         ibPos;        //  position in the IB
@@ -221,6 +228,9 @@ protected:
 
     unsigned char               _vertFormat;
     unsigned char               _priType;
+
+    void                        freeData();
+    void                        ownData();
     
 }; // class Primitive
 
@@ -14,6 +14,9 @@
 #include "uiWidgetEditor.h"
 #include "uiFrameWindow.h"
 #include "uiKangaroo.h"
+#include "IMediaManager.h"
+
+#include <algorithm>
 
 /*****************************************************************************/
 /*  ModelInstance implementation
@@ -126,6 +129,7 @@ void ModelInstance::Render()
         rsFlush();
         rsEnableZ(true);        
     //}
+    INC_COUNTER( ModelFlushes, 2 );
     
     if (nB == 0)
     {
@@ -289,3 +293,170 @@ void ModelInstance::OnUpdateNode( SNode* pNode )
 {
 
 }
+
+/*****************************************************************************/
+/*  ModelBatcher implementation
+/*****************************************************************************/
+void ModelBatcher::ItemState::Capture()
+{
+    m_TFactor       = IRS->GetTextureFactor();
+    m_ColorConst    = IRS->GetColorConst();
+    for (int i = 0; i < 4; i++) m_ShaderConst[i] = IRS->GetShaderConst( i );
+    m_bZEnable      = IRS->GetZEnable();
+    m_bZWrite       = IRS->GetZWriteEnable();
+} // ModelBatcher::ItemState::Capture
+
+void ModelBatcher::ItemState::Apply() const
+{
+    IRS->SetTextureFactor( m_TFactor );
+    IRS->SetColorConst( m_ColorConst );
+    for (int i = 0; i < 4; i++) IRS->SetShaderConst( i, m_ShaderConst[i] );
+    IRS->SetZEnable( m_bZEnable );
+    IRS->SetZWriteEnable( m_bZWrite );
+} // ModelBatcher::ItemState::Apply
+
+bool ModelBatcher::ItemState::operator ==( const ItemState& st ) const
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (m_ShaderConst[i] != st.m_ShaderConst[i]) return false;
+    }
+    return m_TFactor == st.m_TFactor && m_ColorConst == st.m_ColorConst && 
+           m_bZEnable == st.m_bZEnable && m_bZWrite == st.m_bZWrite;
+} // ModelBatcher::ItemState::operator ==
+
+void ModelBatcher::Begin()
+{
+    m_Items.clear();
+    m_Palette.clear();
+    m_PaletteBones.clear();
+    m_bActive = true;
+} // ModelBatcher::Begin
+
+void ModelBatcher::Add( const ModelInstance& inst )
+{
+    if (!inst.m_pModel) return;
+    Item item;
+    item.m_pModel       = inst.m_pModel;
+    item.m_FirstBone    = m_Palette.size();
+    item.m_NBones       = inst.m_Bones.size();
+    item.m_Order        = m_Items.size();
+    item.m_RootTM       = inst.m_RootTM;
+    item.m_State.Capture();
+    for (int i = 0; i < item.m_NBones; i++)
+    {
+        const BoneInstance& bone = inst.m_Bones[i];
+        m_Palette.push_back( bone.m_TM );
+        m_PaletteBones.push_back( bone.m_pBone );
+    }
+    m_Items.push_back( item );
+} // ModelBatcher::Add
+
+void ModelBatcher::End()
+{
+    if (!m_bActive) return;
+    m_bActive = false;
+
+    Timer timer;
+    IRS->Flush();
+    rsFlush();
+
+    std::sort( m_Items.begin(), m_Items.end() );
+    m_NBatches   = 0;
+    m_NInstances = m_Items.size();
+
+    //  states are restored after the batch, as if the instances were drawn immediately
+    ItemState callerState;
+    callerState.Capture();
+
+    //  geometry nodes only queue their render tasks, whole group of the same model 
+    //  instances goes out in one flush, unless their render states differ
+    Geometry::SetDeferFlush( true );
+    for (int i = 0; i < m_NInstances; i++)
+    {
+        const Item& item = m_Items[i];
+        if (i == 0 || !(item.m_State == m_Items[i - 1].m_State)) item.m_State.Apply();
+        if (item.m_NBones == 0)
+        {
+            TransformNode::ResetTMStack( &item.m_RootTM );
+            item.m_pModel->Render();
+        }
+        else
+        {
+            for (int j = item.m_FirstBone; j < item.m_FirstBone + item.m_NBones; j++)
+            {
+                m_PaletteBones[j]->SetTopTM( m_Palette[j] );
+            }
+            TransformNode::SetCalcWorldTM( false );
+            item.m_pModel->Render();
+            TransformNode::SetCalcWorldTM( true );
+        }
+
+        if (i == m_NInstances - 1 || m_Items[i + 1].m_pModel != item.m_pModel ||
+            !(m_Items[i + 1].m_State == item.m_State))
+        {
+            IRS->Flush();
+            m_NBatches++;
+        }
+    }
+    Geometry::SetDeferFlush( false );
+    callerState.Apply();
+
+    m_SubmitTime = timer.seconds();
+    INC_COUNTER( ModelFlushes,          m_NBatches   );
+    INC_COUNTER( ModelBatches,          m_NBatches   );
+    INC_COUNTER( ModelBatchInstances,   m_NInstances );
+
+    m_Items.clear();
+    m_Palette.clear();
+    m_PaletteBones.clear();
+} // ModelBatcher::End
+
+void BenchmarkModelBatch( DWORD mdlID, DWORD animID )
+{
+    const int   c_NUnitsCases[] = { 100, 1000, 5000 };
+    const int   c_NFrames       = 16;
+    const float c_UnitSpacing   = 64.0f;
+
+    //  draw calls and state changes are counted by the null render system,
+    //  including the ones issued inside of the geometry nodes
+    bool bInstalled = !IsNullRenderSystemInstalled();
+    NullRenderSystem* pNullRS = bInstalled ? InstallNullRenderSystem() : GetNullRenderSystem();
+
+    for (int i = 0; i < sizeof( c_NUnitsCases )/sizeof( int ); i++)
+    {
+        int nUnits = c_NUnitsCases[i];
+        int nSide  = int( sqrtf( float( nUnits ) ) ) + 1;
+        for (int mode = 0; mode < 2; mode++)
+        {
+            bool  bBatched = (mode == 1);
+            float flushes  = GET_COUNTER( ModelFlushes );
+            pNullRS->ResetStats();
+            Timer timer;
+            for (int f = 0; f < c_NFrames; f++)
+            {
+                pNullRS->StartFrame();
+                if (bBatched) IMM->BeginModelBatch();
+                for (int j = 0; j < nUnits; j++)
+                {
+                    Matrix4D tm;
+                    tm.translation( c_UnitSpacing*(j%nSide), c_UnitSpacing*(j/nSide), 0.0f );
+                    IMM->StartModel( mdlID, tm, j + 1 );
+                    if (animID != 0xFFFFFFFF) IMM->AnimateModel( animID, float( f*40 ), 0.0f );
+                    IMM->DrawModel();
+                }
+                if (bBatched) IMM->EndModelBatch();
+                pNullRS->EndFrame();
+            }
+            double frameTime = timer.seconds()*1000.0/c_NFrames;
+            flushes = (GET_COUNTER( ModelFlushes ) - flushes)/c_NFrames;
+            const NullRenderStats& st = pNullRS->GetTotalStats();
+            Log.Info( "BenchmarkModelBatch: %d units, %s: %d draw calls/frame, %d state changes/frame, "
+                        "%d shader changes/frame, %.0f model flushes/frame, %.3f ms/frame", 
+                        nUnits, bBatched ? "batched" : "immediate", 
+                        st.m_NDrawCalls/c_NFrames, st.m_NStateChanges/c_NFrames, 
+                        st.m_NShaderChanges/c_NFrames, flushes, frameTime );
+        }
+    }
+    if (bInstalled) RestoreRenderSystem();
+} // BenchmarkModelBatch
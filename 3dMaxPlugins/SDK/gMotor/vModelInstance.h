@@ -38,6 +38,8 @@ struct SkinInstance
 /*****************************************************************************/
 class ModelInstance
 {
+    friend class ModelBatcher;
+
     SNode*                          m_pModel;
     std::vector<BoneInstance>       m_Bones;
     std::vector<SkinInstance>       m_Skin;
@@ -79,4 +81,75 @@ public:
 
 }; // class ModelInstance
 
+/*****************************************************************************/
+/*    Class:    ModelBatcher
+/*    Desc:    Crowd rendering path (deferred flush). Collects model instances 
+/*             drawn during the batch and submits instances of the same model 
+/*             together, with one render system flush per model instead of two 
+/*             per instance. This coalesces flushes only: every instance still 
+/*             issues its own draw calls, there is no hardware instancing.
+/*             Bone transforms of the queued instances are packed into the 
+/*             CPU side palette, so instances may be reused while batch is open.
+/*             Render states the caller may set between StartModel and DrawModel
+/*             (texture factor, color and shader constants, z test and write)
+/*             are captured per instance; a change of them splits the group.
+/*             Clip planes and state blocks are not captured, they must stay the 
+/*             same for the whole batch.
+/*****************************************************************************/
+class ModelBatcher
+{
+    struct ItemState
+    {
+        DWORD                       m_TFactor;
+        DWORD                       m_ColorConst;
+        float                       m_ShaderConst[4];
+        bool                        m_bZEnable;
+        bool                        m_bZWrite;
+
+        void Capture    ();
+        void Apply      () const;
+        bool operator ==( const ItemState& st ) const;
+    }; // struct ItemState
+
+    struct Item
+    {
+        SNode*                      m_pModel;
+        int                         m_FirstBone;    //  first bone in the palette
+        int                         m_NBones;
+        int                         m_Order;        //  submission order, keeps sort stable
+        Matrix4D                    m_RootTM;
+        ItemState                   m_State;        //  render states at DrawModel
+
+        bool operator <( const Item& item ) const 
+        { 
+            if (m_pModel != item.m_pModel) return m_pModel < item.m_pModel;
+            return m_Order < item.m_Order;
+        }
+    }; // struct Item
+
+    std::vector<Item>               m_Items;
+    std::vector<Matrix4D>           m_Palette;      //  bone transforms of all queued instances
+    std::vector<TransformNode*>     m_PaletteBones; //  bone nodes, parallel to m_Palette
+    bool                            m_bActive;
+
+    int                             m_NBatches;     //  last batch statistics
+    int                             m_NInstances;
+    double                          m_SubmitTime;   //  in seconds
+
+public:
+                    ModelBatcher    () : m_bActive(false), m_NBatches(0), m_NInstances(0), m_SubmitTime(0.0) {}
+    void            Begin           ();
+    void            Add             ( const ModelInstance& inst );
+    void            End             ();
+    bool            IsActive        () const { return m_bActive; }
+
+    int             GetNBatches     () const { return m_NBatches;   }
+    int             GetNInstances   () const { return m_NInstances; }
+    double          GetSubmitTime   () const { return m_SubmitTime; }
+}; // class ModelBatcher
+
+//  draws nUnits instances of the model per frame on the null render system, with and 
+//  without batching, and logs draw calls, state changes and submission time per frame
+void BenchmarkModelBatch( DWORD mdlID, DWORD animID = 0xFFFFFFFF );
+
 #endif // __VMODELINSTANCE_H__
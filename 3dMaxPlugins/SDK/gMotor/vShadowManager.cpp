@@ -8,9 +8,13 @@
 #include "IMediaManager.h"
 #include "kContext.h"
 #include "vShadowManager.h"
+#include "kFrameReplay.h"
 #include "ITerrain.h"
 #include "sgShader.h"
 #include "sgTexture.h"
+#include "kTimer.h"
+#include <algorithm>
+#include <xmmintrin.h>
 
 ShadowManager g_ShadowMgr;
 IShadowManager* IShadowMgr = &g_ShadowMgr;
@@ -33,6 +37,16 @@ ShadowManager::ShadowManager()
     m_ShadowQuality     = sqUnknown;
     m_ShadowMapTM       = Matrix4D::identity;
     m_UVPostProjTM      = Matrix4D::identity;
+    m_bCullCasters      = true;
+    m_bBatchCasters     = true;
+    m_bFitValid         = false;
+    m_bCanCull          = false;
+    m_FitMargin         = 0.0f;
+    m_NCulled           = 0;
+    m_NBatches          = 0;
+    m_bFitReused        = false;
+    m_CullMs            = 0.0;
+    m_FitMs             = 0.0;
 
     m_LightDir.normalize();
 } // ShadowManager::ShadowManager
@@ -50,6 +64,7 @@ void ShadowManager::SetShadowMapSide( int w, int h )
     if (m_SMapWidth == w && m_SMapHeight == h) return;
     m_SMapWidth  = w;
     m_SMapHeight = h;
+    m_bFitValid  = false;
     if (m_ShadowMapID != -1) IRS->DeleteTexture( m_ShadowMapID );
     if (m_ShadowMapID2 != -1) IRS->DeleteTexture( m_ShadowMapID2 );
 
@@ -168,47 +183,15 @@ void ShadowManager::Render()
 	//ITerra->Render();
 	//ITerra->SubstShader( -1 );
 
+    //  procedural casters draw themselves, so are neither culled nor batched
     for (int i = 0; i < nCasters; i++)
     {
         ShadowCaster& cst = m_Casters[i];
-
-        if (m_bClipToGround)
-        {
-            Plane plane;
-            Vector3D pos = cst.wTM.getTranslation();
-            float h = ITerra->GetH( pos.x, pos.y );
-            const Plane c_TopPlane = Plane( Vector3D( 0.0f, 0.0f, 10000.0f ), Vector3D( 0.0f, 0.0f, -1.0f ) );
-            if (h >= pos.z)
-            {
-                pos.z = h;
-                plane.fromPointNormal(  Vector3D( pos.x, pos.y, pos.z - m_ClipBias ), 
-                                        ITerra->GetNormal( pos.x, pos.y ) );
-                IRS->SetClipPlane( 0, plane );
-            }
-            else IRS->SetClipPlane( 0, c_TopPlane );
-        }
-		if(cst.CastCallback)
-		{
-            cst.CastCallback();
-		}
-		else
-		{
-			AABoundBox aabb = IMM->GetBoundBox( cst.mdlID );
-			aabb.Transform( cst.wTM );
-	        
-			SetEntityContext( cst.context );
-			IMM->StartModel( cst.mdlID, cst.wTM, CUR_CONTEXT );
-			IMM->DrawModel();
-
-            //debug:
-            //Vector4D c = aabb.GetCenter();
-            //c.w = 1.0f;
-            //c *= m_LightViewTM;
-            //c *= lightProjTM;
-            //c.normW();
-            int t = 0;
-		}        
+        if (!cst.CastCallback) continue;
+        if (m_bClipToGround) IRS->SetClipPlane( 0, GetGroundClipPlane( cst.wTM ) );
+        cst.CastCallback();
     }
+    DrawModelCasters();
 	//Shader::PopOverride();
     // draw simple casters
     //written by Drew
@@ -541,6 +524,7 @@ bool ShadowManager::AddCaster( DWORD modelID, const Matrix4D& tm )
 {
     if (!m_bEnabled) return false;
     if (modelID == 0xFFFFFFFF) return false;
+    if (FrameRecorder::s_bActive) FrameRecorder::RecordCaster( modelID, tm );
     ShadowCaster caster;
 	caster.CastCallback  = NULL;
     caster.frame    = IRS->GetCurFrame();
@@ -548,8 +532,7 @@ bool ShadowManager::AddCaster( DWORD modelID, const Matrix4D& tm )
     caster.wTM      = tm;
     caster.context  = GetEntityContext();
 
-	AddCastingBoundaryPoint(Vector3D(tm.e30,tm.e31,tm.e32));
-
+    //  caster position goes to the fit only if caster survives the culling
     m_Casters.push_back( caster );
     return true;
 } // ShadowManager::AddCaster
@@ -619,6 +602,31 @@ Matrix3D MapQuadToUnitSquare( const Vector2D& a, const Vector2D& b,
 const float c_MaxShadowMapDistance = 4000.0f;
 void ShadowManager::CalculateTSM()
 {
+    bool bNewFrame = UpdateLightFrame();
+    CullCasters();
+    FitShadowMap( bNewFrame );
+} // ShadowManager::CalculateTSM
+
+//  builds light view and projection and camera ground area in the light projection 
+//  space. Those depend on camera, light direction and shadow map size only, so are 
+//  kept while none of them changes. Returns true when recalculated.
+bool ShadowManager::UpdateLightFrame()
+{
+    const Matrix4D& viewTM = IRS->GetViewTM();
+    const Matrix4D& projTM = IRS->GetProjTM();
+    if (m_bFitValid &&
+        memcmp( &m_FitViewTM, &viewTM, sizeof( Matrix4D ) ) == 0 &&
+        memcmp( &m_FitProjTM, &projTM, sizeof( Matrix4D ) ) == 0 &&
+        m_FitLightDir.x == m_LightDir.x && 
+        m_FitLightDir.y == m_LightDir.y && 
+        m_FitLightDir.z == m_LightDir.z) 
+    {
+        return false;
+    }
+    m_FitViewTM   = viewTM;
+    m_FitProjTM   = projTM;
+    m_FitLightDir = m_LightDir;
+
     ICamera* pCam = GetCamera();
     
     //  get camera frustum
@@ -671,20 +679,6 @@ void ShadowManager::CalculateTSM()
         c[1]=Vector4D(cT+dcT*(0.5+otsHT));
         c[2]=Vector4D(cB-dcB*(0.5+otsHB));
         c[3]=Vector4D(cB+dcB*(0.5+otsHB));
-        /*
-		Vector3D D=pCam->GetDir();
-		D.z=0;
-		D.normalize();
-		Vector3D DD=D;
-		DD*=otsV;
-		swap(D.x,D.y);
-        float R1=c[0].distance(c[1]);
-        float R2=c[2].distance(c[3]);
-		D.y*=-1;
-		D*=R1*otsHT;
-		c[0]+=D;c[1]-=D;//c[2]-=D;c[3]+=D;
-		c[0]+=DD;c[1]+=DD;//c[2]-=DD;c[3]-=DD;
-        */
 	}
     c[0].w=1;
     c[1].w=1;
@@ -711,78 +705,261 @@ void ShadowManager::CalculateTSM()
     m_LightViewTM = m;
 
     //  create light projection matrix
-    Matrix4D lightProjTM;
     const float c_Radius = 1000.0f;
     OrthoProjectionTM( m_LightProjTM, c_Radius*2.0f, m_SMapWidth/m_SMapHeight, 
         -c_Radius*100.0f, c_Radius*100.0f );
 
     Matrix4D lightFullTM;
     lightFullTM.mul( m_LightViewTM, m_LightProjTM );
-    
-
-	int n=m_CastBounds.size();	
-	
-
-	for(int i=0;i<n;i++){
-        Vector4D v=m_CastBounds[i];
-		v*=lightFullTM;
-		v.normW();
-		m_CastBounds[i]=v;		
-		//AddDPoint(v.x,v.y,0xFFFFFFFF);
-	}	
 
     for (int i = 0; i < 4; i++)
     {
         c[i] *= lightFullTM;
         c[i].normW();
+        m_FitCorners[i] = c[i];
     }
 	float d1=c[0].distance(c[2]);
 	float d2=c[1].distance(c[3]);
 	d1=max(d1,d2)/2;
 	if(d1>1)d1=1;	
 	d1*=0.2f;
+    m_FitMargin = d1;
 
-	Vector3D N0(c[1].y-c[0].y,c[0].x-c[1].x,0);
-	N0.normalize();
-	Vector3D P0=PutLineOnPoints(m_CastBounds,N0,d1);
-	Vector3D N1(c[2].y-c[1].y,c[1].x-c[2].x,0);
-	N1.normalize();
-	Vector3D P1=PutLineOnPoints(m_CastBounds,N1,d1);
-	Vector3D N2(c[3].y-c[2].y,c[2].x-c[3].x,0);
-	N2.normalize();
-	Vector3D P2=PutLineOnPoints(m_CastBounds,N2,d1);
-	Vector3D N3(c[0].y-c[3].y,c[3].x-c[0].x,0);
-	N3.normalize();
-	Vector3D P3=PutLineOnPoints(m_CastBounds,N3,d1);
+    //  edge normals of the ground area, and the same edges turned inwards for culling
+    Vector3D center( 0.0f, 0.0f, 0.0f );
+    for (int i = 0; i < 4; i++) center.addWeighted( Vector3D( c[i].x, c[i].y, 0.0f ), 0.25f );
+    m_bCanCull = (nPt >= 4);
+    for (int i = 0; i < 4; i++)
+    {
+        const Vector4D& a = c[i];
+        const Vector4D& b = c[(i + 1)%4];
+        Vector3D& n = m_FitNormals[i];
+        n = Vector3D( b.y - a.y, a.x - b.x, 0.0f );
+        if (n.norm() < c_SmallEpsilon) m_bCanCull = false;
+        n.normalize();
+
+        float side = (center.x - a.x)*n.x + (center.y - a.y)*n.y;
+        float sign = (side < 0.0f) ? -1.0f : 1.0f;
+        m_CullLines[i] = Plane( n.x*sign, n.y*sign, 0.0f, -(a.x*n.x + a.y*n.y)*sign );
+    }
+    m_bFitValid = false;
+    return true;
+} // ShadowManager::UpdateLightFrame
 
-	
-	//AddDPoint(P0.x,P0.y,0xFFFF0000);
-	//AddDLine(P0.x,P0.y,P0.x+N0.x,P0.y+N0.y,0xFFFF0000);
-	//AddDPoint(P1.x,P1.y,0xFF00FF00);
-	//AddDLine(P1.x,P1.y,P1.x+N1.x,P1.y+N1.y,0xFF00FF00);
-	//AddDPoint(P2.x,P2.y,0xFF0000FF);
-	//AddDLine(P2.x,P2.y,P2.x+N2.x,P2.y+N2.y,0xFF0000FF);
-	//AddDPoint(P3.x,P3.y,0xFFFF00FF);
-	//AddDLine(P3.x,P3.y,P3.x+N3.x,P3.y+N3.y,0xFFFF00FF);	
-
-	//AddDLine(c[0].x,c[0].y,c[1].x,c[1].y,0xFFFF0000);
-	//AddDLine(c[1].x,c[1].y,c[2].x,c[2].y,0xFF00FF00);
-	//AddDLine(c[2].x,c[2].y,c[3].x,c[3].y,0xFF0000FF);
-	//AddDLine(c[3].x,c[3].y,c[0].x,c[0].y,0xFFFF00FF);
-	
+const Vector4D& ShadowManager::GetBoundSphere( DWORD mdlID )
+{
+    std::map<DWORD, Vector4D>::iterator it = m_BoundSpheres.find( mdlID );
+    if (it != m_BoundSpheres.end()) return it->second;
+    
+    AABoundBox aabb = IMM->GetBoundBox( mdlID );
+    Vector4D sphere( 0.0f, 0.0f, 0.0f, -1.0f );
+    if (aabb.minv.x <= aabb.maxv.x && aabb.minv.y <= aabb.maxv.y && aabb.minv.z <= aabb.maxv.z)
+    {
+        Vector3D c( aabb.GetCenter() );
+        sphere = Vector4D( c.x, c.y, c.z, aabb.GetDiagonal()*0.5f );
+    }
+    return m_BoundSpheres[mdlID] = sphere;
+} // ShadowManager::GetBoundSphere
+
+//  tests four caster spheres against the camera ground area edges in the light 
+//  projection space. Light projection is orthographic, so any point of the caster 
+//  shadow lies on the light ray through the caster, and has the same x, y there.
+//  Returns visibility bits in the low nibble.
+static __forceinline int CullCasters4( const float* sph, const __m128* tm, 
+                                       const __m128* lines, __m128 scale, __m128 band )
+{
+    __m128 x = _mm_loadu_ps( sph      );
+    __m128 y = _mm_loadu_ps( sph + 4  );
+    __m128 z = _mm_loadu_ps( sph + 8  );
+    __m128 r = _mm_loadu_ps( sph + 12 );
+
+    __m128 lx = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, tm[0] ), _mm_mul_ps( y, tm[1] ) ), 
+                            _mm_add_ps( _mm_mul_ps( z, tm[2] ), tm[3] ) );
+    __m128 ly = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, tm[4] ), _mm_mul_ps( y, tm[5] ) ), 
+                            _mm_add_ps( _mm_mul_ps( z, tm[6] ), tm[7] ) );
+    __m128 lr = _mm_add_ps( _mm_mul_ps( r, scale ), band );
+
+    __m128 outside = _mm_setzero_ps();
+    for (int i = 0; i < 4; i++)
+    {
+        const __m128* ln = lines + i*3;
+        __m128 d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ln[0], lx ), _mm_mul_ps( ln[1], ly ) ), 
+                               _mm_add_ps( ln[2], lr ) );
+        outside = _mm_or_ps( outside, _mm_cmplt_ps( d, _mm_setzero_ps() ) );
+    }
+    return (~_mm_movemask_ps( outside ))&0xF;
+} // CullCasters4
 
-	c[0]=IntersectLines(P0,N0,P3,N3);
-	c[1]=IntersectLines(P1,N1,P0,N0);
-	c[2]=IntersectLines(P2,N2,P1,N1);
-	c[3]=IntersectLines(P3,N3,P2,N2);
+Plane ShadowManager::GetGroundClipPlane( const Matrix4D& tm ) const
+{
+    const Plane c_TopPlane = Plane( Vector3D( 0.0f, 0.0f, 10000.0f ), Vector3D( 0.0f, 0.0f, -1.0f ) );
+    Vector3D pos = tm.getTranslation();
+    float h = ITerra->GetH( pos.x, pos.y );
+    if (h < pos.z) return c_TopPlane;
+    Plane plane;
+    plane.fromPointNormal( Vector3D( pos.x, pos.y, h - m_ClipBias ), ITerra->GetNormal( pos.x, pos.y ) );
+    return plane;
+} // ShadowManager::GetGroundClipPlane
+
+//  collects model casters whose shadow may fall into the camera ground area
+void ShadowManager::CullCasters()
+{
+    Timer timer;
+    int nCasters = m_Casters.size();
+    m_Visible.clear();
+    m_NCulled = 0;
+
+    //  caster bound spheres in world space, four-wide blocks
+    int nBlocks = (nCasters + 3)/4;
+    m_CullSpheres.resize( nBlocks*16 );
+    float* sph = nBlocks ? &m_CullSpheres[0] : NULL;
+    DWORD lastID = 0xFFFFFFFF;
+    Vector4D local;
+    for (int i = 0; i < nBlocks*4; i++)
+    {
+        float* blk = sph + (i/4)*16 + (i%4);
+        //  procedural casters and padding are never culled
+        blk[0] = blk[4] = blk[8] = 0.0f;
+        blk[12] = FLT_MAX;
+        if (i >= nCasters || m_Casters[i].CastCallback) continue;
+
+        const ShadowCaster& cst = m_Casters[i];
+        if (cst.mdlID != lastID) 
+        {
+            local  = GetBoundSphere( cst.mdlID );
+            lastID = cst.mdlID;
+        }
+        if (local.w < 0.0f) continue;
+
+        const Matrix4D& tm = cst.wTM;
+        blk[0]  = local.x*tm.e00 + local.y*tm.e10 + local.z*tm.e20 + tm.e30;
+        blk[4]  = local.x*tm.e01 + local.y*tm.e11 + local.z*tm.e21 + tm.e31;
+        blk[8]  = local.x*tm.e02 + local.y*tm.e12 + local.z*tm.e22 + tm.e32;
+        float s = tmax( tm.e00*tm.e00 + tm.e01*tm.e01 + tm.e02*tm.e02,
+                        tm.e10*tm.e10 + tm.e11*tm.e11 + tm.e12*tm.e12,
+                        tm.e20*tm.e20 + tm.e21*tm.e21 + tm.e22*tm.e22 );
+        blk[12] = local.w*sqrtf( s );
+    }
 
-	
-	//AddDLine(c[0].x,c[0].y,c[1].x,c[1].y,0x80FF0000);
-	//AddDLine(c[1].x,c[1].y,c[2].x,c[2].y,0x8000FF00);
-	//AddDLine(c[2].x,c[2].y,c[3].x,c[3].y,0x800000FF);
-	//AddDLine(c[3].x,c[3].y,c[0].x,c[0].y,0x80FF00FF);
-	
+    Matrix4D lightFullTM;
+    lightFullTM.mul( m_LightViewTM, m_LightProjTM );
+    __m128 tm[8];
+    tm[0] = _mm_set1_ps( lightFullTM.e00 ); tm[1] = _mm_set1_ps( lightFullTM.e10 );
+    tm[2] = _mm_set1_ps( lightFullTM.e20 ); tm[3] = _mm_set1_ps( lightFullTM.e30 );
+    tm[4] = _mm_set1_ps( lightFullTM.e01 ); tm[5] = _mm_set1_ps( lightFullTM.e11 );
+    tm[6] = _mm_set1_ps( lightFullTM.e21 ); tm[7] = _mm_set1_ps( lightFullTM.e31 );
+    __m128 lines[12];
+    for (int i = 0; i < 4; i++)
+    {
+        lines[i*3 + 0] = _mm_set1_ps( m_CullLines[i].a );
+        lines[i*3 + 1] = _mm_set1_ps( m_CullLines[i].b );
+        lines[i*3 + 2] = _mm_set1_ps( m_CullLines[i].d );
+    }
+    float scale = sqrtf( tmax( lightFullTM.e00*lightFullTM.e00 + lightFullTM.e10*lightFullTM.e10 + lightFullTM.e20*lightFullTM.e20,
+                               lightFullTM.e01*lightFullTM.e01 + lightFullTM.e11*lightFullTM.e11 + lightFullTM.e21*lightFullTM.e21 ) );
+    __m128 vScale = _mm_set1_ps( scale );
+    __m128 vBand  = _mm_set1_ps( c_ShadowCullBand*scale );
+    bool bCull = m_bCullCasters && m_bCanCull;
+
+    for (int b = 0; b < nBlocks; b++)
+    {
+        int visMask = bCull ? CullCasters4( sph + b*16, tm, lines, vScale, vBand ) : 0xF;
+        for (int j = 0; j < 4; j++)
+        {
+            int idx = b*4 + j;
+            if (idx >= nCasters) break;
+            const ShadowCaster& cst = m_Casters[idx];
+            if (cst.CastCallback) continue;
+            if ((visMask&(1 << j)) == 0) 
+            { 
+                m_NCulled++; 
+                continue; 
+            }
+            m_Visible.push_back( ShadowDrawItem() );
+            ShadowDrawItem& item = m_Visible.back();
+            item.m_Caster  = idx;
+            item.m_ModelID = cst.mdlID;
+            item.m_Clip    = m_bClipToGround ? GetGroundClipPlane( cst.wTM ) : Plane( 0.0f, 0.0f, 0.0f, 0.0f );
+        }
+    }
+    std::sort( m_Visible.begin(), m_Visible.end() );
+
+    m_CullMs = timer.seconds()*1000.0;
+    INC_COUNTER( ShadowCasters,         nCasters  );
+    INC_COUNTER( ShadowCastersCulled,   m_NCulled );
+} // ShadowManager::CullCasters
+
+//  widens the light projection space transform over the casters of this frame 
+//  by the edge normals of the camera ground area. When casters extents along the
+//  edges do not change noticeably, the previous transform is kept, which also 
+//  keeps the shadow map texels from swimming.
+static inline void AddSupportPoint( const Vector3D& p, const Matrix4D& tm, const Vector3D* n, float* sup )
+{
+    float x = p.x*tm.e00 + p.y*tm.e10 + p.z*tm.e20 + tm.e30;
+    float y = p.x*tm.e01 + p.y*tm.e11 + p.z*tm.e21 + tm.e31;
+    float w = p.x*tm.e03 + p.y*tm.e13 + p.z*tm.e23 + tm.e33;
+    float iw = 1.0f/w;
+    x *= iw;
+    y *= iw;
+    for (int i = 0; i < 4; i++)
+    {
+        float d = x*n[i].x + y*n[i].y;
+        if (d < sup[i]) sup[i] = d;
+    }
+} // AddSupportPoint
+
+void ShadowManager::FitShadowMap( bool bNewFrame )
+{
+    Timer timer;
+    Matrix4D lightFullTM;
+    lightFullTM.mul( m_LightViewTM, m_LightProjTM );
+
+    const float c_NoSupport = 10000000.0f;
+    float sup[4] = { c_NoSupport, c_NoSupport, c_NoSupport, c_NoSupport };
+    int nBounds = m_CastBounds.size();
+    for (int i = 0; i < nBounds; i++) AddSupportPoint( m_CastBounds[i], lightFullTM, m_FitNormals, sup );
+    int nVisible = m_Visible.size();
+    for (int i = 0; i < nVisible; i++) 
+    {
+        const Matrix4D& tm = m_Casters[m_Visible[i].m_Caster].wTM;
+        AddSupportPoint( Vector3D( tm.e30, tm.e31, tm.e32 ), lightFullTM, m_FitNormals, sup );
+    }
+    m_CastBounds.clear();
+
+    //  nothing to fit around, take the whole ground area
+    if (nBounds == 0 && nVisible == 0)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            AddSupportPoint( Vector3D( m_FitCorners[i] ), Matrix4D::identity, m_FitNormals, sup );
+        }
+    }
 
+    m_bFitReused = m_bFitValid && !bNewFrame;
+    for (int i = 0; i < 4 && m_bFitReused; i++)
+    {
+        if (fabs( sup[i] - m_FitSupport[i] ) > c_ShadowFitEpsilon) m_bFitReused = false;
+    }
+    if (m_bFitReused)
+    {
+        m_FitMs = timer.seconds()*1000.0;
+        INC_COUNTER( ShadowFitReused, 1 );
+        return;
+    }
+    for (int i = 0; i < 4; i++) m_FitSupport[i] = sup[i];
+
+    const Vector3D* N = m_FitNormals;
+    float d1 = m_FitMargin;
+	Vector3D P0=N[0]*(sup[0]-0.6*d1);
+	Vector3D P1=N[1]*(sup[1]-0.6*d1);
+	Vector3D P2=N[2]*(sup[2]-0.6*d1);
+	Vector3D P3=N[3]*(sup[3]-0.6*d1);
+
+    Vector4D c[4];
+	c[0]=IntersectLines(P0,N[0],P3,N[3]);
+	c[1]=IntersectLines(P1,N[1],P0,N[0]);
+	c[2]=IntersectLines(P2,N[2],P1,N[1]);
+	c[3]=IntersectLines(P3,N[3],P2,N[2]);
     
     m_LT = Vector2D( c[0].x, c[0].y );
     m_RT = Vector2D( c[1].x, c[1].y );
@@ -815,8 +992,40 @@ void ShadowManager::CalculateTSM()
                                       -sc,   sc, 0.0f,  1 );
     pm *= c_UVToProj;
     SetUVPostProjTM( pm );
-	m_CastBounds.clear();
-} // ShadowManager::CalculateTSM
+    m_bFitValid = true;
+    m_FitMs = timer.seconds()*1000.0;
+} // ShadowManager::FitShadowMap
+
+//  draws casters which survived the culling. Casters sharing the ground clip plane
+//  are submitted in one model batch, which groups instances of the same model 
+void ShadowManager::DrawModelCasters()
+{
+    m_NBatches = 0;
+    int nVisible = m_Visible.size();
+    int i = 0;
+    while (i < nVisible)
+    {
+        const Plane& clip = m_Visible[i].m_Clip;
+        int j = i + 1;
+        while (j < nVisible && 
+               m_Visible[j].m_Clip.a == clip.a && m_Visible[j].m_Clip.b == clip.b && 
+               m_Visible[j].m_Clip.c == clip.c && m_Visible[j].m_Clip.d == clip.d) j++;
+
+        if (m_bClipToGround) IRS->SetClipPlane( 0, clip );
+        if (m_bBatchCasters) IMM->BeginModelBatch();
+        for (int k = i; k < j; k++)
+        {
+            const ShadowCaster& cst = m_Casters[m_Visible[k].m_Caster];
+            if (k == i || m_Visible[k].m_ModelID != m_Visible[k - 1].m_ModelID) m_NBatches++;
+            SetEntityContext( cst.context );
+            IMM->StartModel( cst.mdlID, cst.wTM, CUR_CONTEXT );
+            IMM->DrawModel();
+        }
+        if (m_bBatchCasters) IMM->EndModelBatch();
+        i = j;
+    }
+    INC_COUNTER( ShadowBatches, m_NBatches );
+} // ShadowManager::DrawModelCasters
 void ShadowManager::AddSimpleCaster ( Vector3D Pos,Vector3D Direction,float Width,float Length,int IndexInPalette,bool Aligning,DWORD Color){
 	if (!m_bEnabled) return;
     SimpleCaster sc;
@@ -830,3 +1039,54 @@ void ShadowManager::AddSimpleCaster ( Vector3D Pos,Vector3D Direction,float Widt
     m_Simples.push_back(sc);
 	AddCastingBoundaryPoint(Pos);
 }
+
+void BenchmarkShadowCasters( DWORD mdlID )
+{
+    const int   c_NCastersCases[] = { 1000, 5000, 10000 };
+    const int   c_NFrames         = 16;
+    const float c_CasterSpacing   = 48.0f;
+
+    ICamera* pCam = GetCamera();
+    if (!pCam) return;
+    Vector3D center = pCam->GetPosition();
+    for (int i = 0; i < sizeof( c_NCastersCases )/sizeof( int ); i++)
+    {
+        int nCasters = c_NCastersCases[i];
+        int nSide    = int( sqrtf( float( nCasters ) ) ) + 1;
+        float orgX   = center.x - c_CasterSpacing*nSide*0.5f;
+        float orgY   = center.y - c_CasterSpacing*nSide*0.5f;
+        for (int mode = 0; mode < 2; mode++)
+        {
+            bool bFast = (mode == 1);
+            g_ShadowMgr.SetCullCasters ( bFast );
+            g_ShadowMgr.SetBatchCasters( bFast );
+            double cullMs = 0.0, fitMs = 0.0;
+            int nCulled = 0, nBatches = 0, nReused = 0;
+            Timer timer;
+            for (int f = 0; f < c_NFrames; f++)
+            {
+                for (int j = 0; j < nCasters; j++)
+                {
+                    Matrix4D tm;
+                    tm.translation( orgX + c_CasterSpacing*(j%nSide), orgY + c_CasterSpacing*(j/nSide), 0.0f );
+                    PushEntityContext( j + 1 );
+                    g_ShadowMgr.AddCaster( mdlID, tm );
+                    PopEntityContext();
+                }
+                g_ShadowMgr.Render();
+                cullMs   += g_ShadowMgr.GetCullMs();
+                fitMs    += g_ShadowMgr.GetFitMs();
+                nCulled  += g_ShadowMgr.GetNCulled();
+                nBatches += g_ShadowMgr.GetNBatches();
+                nReused  += g_ShadowMgr.IsFitReused() ? 1 : 0;
+            }
+            double frameTime = timer.seconds()*1000.0/c_NFrames;
+            Log.Info( "BenchmarkShadowCasters: %d casters, %s: %d culled, %d batches, fit reused %d/%d, "
+                      "cull %.3f ms, fit %.3f ms, pass %.3f ms/frame", 
+                        nCasters, bFast ? "culled+batched" : "immediate", nCulled/c_NFrames, nBatches/c_NFrames, 
+                        nReused, c_NFrames, cullMs/c_NFrames, fitMs/c_NFrames, frameTime );
+        }
+    }
+    g_ShadowMgr.SetCullCasters ( true );
+    g_ShadowMgr.SetBatchCasters( true );
+} // BenchmarkShadowCasters
@@ -6,6 +6,7 @@
 #ifndef __VSHADOWMANAGER_H__
 #define __VSHADOWMANAGER_H__
 #include "IShadowManager.h"
+#include <map>
 
 /*****************************************************************************/
 /*  Class:  ShadowCaster
@@ -31,7 +32,32 @@ struct SimpleCaster
     unsigned        TexFragmentIdx:31;
     unsigned        Aligning:1;//0-vertical,1-horisontal
 };
-const float c_MinShadowBoxRatio = 1.0f;
+
+/*****************************************************************************/
+/*  Struct: ShadowDrawItem
+/*  Desc:   Model caster which survived the culling. Items are sorted so that
+/*          casters sharing the ground clip plane go out in one model batch
+/*****************************************************************************/
+struct ShadowDrawItem
+{
+    int             m_Caster;   // index in the casters array
+    DWORD           m_ModelID;
+    Plane           m_Clip;     // ground clip plane
+
+    bool operator <( const ShadowDrawItem& item ) const
+    {
+        if (m_Clip.a != item.m_Clip.a) return m_Clip.a < item.m_Clip.a;
+        if (m_Clip.b != item.m_Clip.b) return m_Clip.b < item.m_Clip.b;
+        if (m_Clip.c != item.m_Clip.c) return m_Clip.c < item.m_Clip.c;
+        if (m_Clip.d != item.m_Clip.d) return m_Clip.d < item.m_Clip.d;
+        if (m_ModelID != item.m_ModelID) return m_ModelID < item.m_ModelID;
+        return m_Caster < item.m_Caster;
+    }
+}; // struct ShadowDrawItem
+
+const float c_MinShadowBoxRatio     = 1.0f;
+const float c_ShadowCullBand        = 256.0f;   //  world space padding of the receiver area, covers elevated ground
+const float c_ShadowFitEpsilon      = 0.001f;   //  light projection space tolerance for reusing the fit
 /*****************************************************************************/
 /*    Class:    ShadowManager
 /*    Desc:    Implementation of the shadow manager
@@ -64,6 +90,31 @@ class ShadowManager : public IShadowManager
 
     Vector2D                    m_LT, m_RT, m_LB, m_RB;
 
+    std::vector<ShadowDrawItem> m_Visible;          //  model casters which survived the culling
+    std::vector<float>          m_CullSpheres;      //  caster bound spheres, blocks of four x, four y, four z, four radii
+    std::map<DWORD, Vector4D>   m_BoundSpheres;     //  model space bound sphere per model id
+    bool                        m_bCullCasters;
+    bool                        m_bBatchCasters;
+
+    //  light space fit, camera dependent part is kept while camera and light do not move
+    bool                        m_bFitValid;
+    Matrix4D                    m_FitViewTM;
+    Matrix4D                    m_FitProjTM;
+    Vector3D                    m_FitLightDir;
+    Vector4D                    m_FitCorners[4];    //  camera ground area in the light projection space
+    Vector3D                    m_FitNormals[4];    //  its edge normals
+    Plane                       m_CullLines[4];     //  its inward edge lines, for culling
+    bool                        m_bCanCull;         //  whether the ground area is a proper quad
+    float                       m_FitMargin;
+    float                       m_FitSupport[4];    //  caster extents along the edge normals for the current fit
+
+    //  last frame statistics
+    int                         m_NCulled;
+    int                         m_NBatches;
+    bool                        m_bFitReused;
+    double                      m_CullMs;
+    double                      m_FitMs;
+
 public:
                                 ShadowManager   ();
     virtual void                Render          ();
@@ -75,6 +126,13 @@ public:
     virtual void                SetShadowColor  ( DWORD color );
     virtual DWORD               GetShadowColor  ( ) { return m_ShadowColor; }
     virtual void                SetLightDir     ( const Vector3D& dir );
+    void                        SetCullCasters  ( bool bCull ) { m_bCullCasters = bCull; }
+    void                        SetBatchCasters ( bool bBatch ) { m_bBatchCasters = bBatch; }
+    int                         GetNCulled      () const { return m_NCulled; }
+    int                         GetNBatches     () const { return m_NBatches; }
+    bool                        IsFitReused     () const { return m_bFitReused; }
+    double                      GetCullMs       () const { return m_CullMs; }
+    double                      GetFitMs        () const { return m_FitMs; }
     virtual int                 GetShadowMapID  () const { return m_ShadowMapID; }
     virtual const Matrix4D&     CalcShadowMapTM ();
     virtual void                Enable          ( bool bEnable = true ){ m_bEnabled = bEnable; }
@@ -89,7 +147,19 @@ public:
 
 protected:
     void                        CalculateTSM    ();
+    bool                        UpdateLightFrame();
+    void                        CullCasters     ();
+    void                        FitShadowMap    ( bool bNewFrame );
+    void                        DrawModelCasters();
+    Plane                       GetGroundClipPlane( const Matrix4D& tm ) const;
+    const Vector4D&             GetBoundSphere  ( DWORD mdlID );
     void                        BlurShadowMap   ();
 }; // class ShadowManager
 
+extern ShadowManager g_ShadowMgr;
+
+//  renders 1K, 5K and 10K shadow casters of the model per frame, culled and batched 
+//  versus immediate, and logs culling, fit and whole pass time per frame
+void BenchmarkShadowCasters( DWORD mdlID );
+
 #endif // __VSHADOWMANAGER_H__
\ No newline at end of file
@@ -14,6 +14,8 @@
 #include "vMesh.h"
 #include "IShadowManager.h"
 #include "kSSEUtils.h"
+#include "kTimer.h"
+#include <xmmintrin.h>
 #include "vStaticTerrain.h"
 #include <limits>
 #undef max
@@ -174,6 +176,32 @@ bool DefaultTerrainCore::CreateTexture( int texID, const Rct& mapExt )
     return true;
 }
 
+//  samples height, normal and lighting of the ground patch vertex
+static void BakeGroundVertex( VertexIterator& vit, const Rct& ext, float skirt )
+{
+    Vector3D ldir( 1, 1, 1 );
+    ldir.normalize();
+
+    Vector3D& v = vit.pos();
+    Vector3D  n = ITerra->GetNormal( v.x, v.y );
+    v.z = ITerra->GetH( v.x, v.y );
+    vit.normal() = n;
+    //  edges are compared loosely, patched vertices are not exactly on the grid lines
+    float eps = ext.w*0.0001f;
+    if (fabs( v.x - ext.x ) < eps || fabs( v.x - ext.GetRight()  ) < eps ||
+        fabs( v.y - ext.y ) < eps || fabs( v.y - ext.GetBottom() ) < eps)
+    {
+        v.z -= skirt;
+    }
+    ColorValue c( 0xFFEEEEEE );
+    Vector3D cv( c.r, c.g, c.b );
+    float dl = ldir.dot( n );
+    clamp( dl, 0.0f, 1.0f );
+    cv *= dl;
+    c.r = cv.x; c.g = cv.y; c.b = cv.z;
+    vit.diffuse() = c;
+} // BakeGroundVertex
+
 bool DefaultTerrainCore::CreateGeomery( const Rct& mapExt, int lod )
 {
     BaseMesh* pMesh = ITerra->AllocateGeometry();
@@ -187,31 +215,13 @@ bool DefaultTerrainCore::CreateGeomery( const Rct& mapExt, int lod )
     ext.w += skirt*2.0f;
     ext.h += skirt*2.0f;
 
-    CreatePatchGrid<TerrainVertex>( mesh, ext, 10, 10 );    
-
-    Vector3D ldir( 1, 1, 1 );
-    ldir.normalize();
+    CreatePatchGrid<TerrainVertex>( mesh, ext, c_GroundPatchSegments, c_GroundPatchSegments );    
 
     VertexIterator vit;
     vit << mesh;
     while (vit)
     {
-        Vector3D& v = vit.pos();
-        Vector3D  n = ITerra->GetNormal( v.x, v.y );
-        v.z = ITerra->GetH( v.x, v.y );
-        vit.normal() = n;
-        if (v.x == ext.x || v.x == ext.GetRight() ||
-            v.y == ext.y || v.y == ext.GetBottom())
-        {
-            v.z -= skirt;
-        }
-        ColorValue c( 0xFFEEEEEE );
-        Vector3D cv( c.r, c.g, c.b );
-        float dl = ldir.dot( n );
-        clamp( dl, 0.0f, 1.0f );
-        cv *= dl;
-        c.r = cv.x; c.g = cv.y; c.b = cv.z;
-        vit.diffuse() = c;
+        BakeGroundVertex( vit, ext, skirt );
         ++vit;
     }
 
@@ -222,15 +232,43 @@ bool DefaultTerrainCore::CreateGeomery( const Rct& mapExt, int lod )
     int tile = Pow2( lod );
     UVMapPlanar<TerrainVertex>( mesh, ttm, mapExt.w/tile, mapExt.h/tile );  
 
-    static int shID = IRS->GetShaderID( "terra_shadowed_hq" );
-    mesh.setShader( shID );
-
-    static int grTexID = IRS->GetTextureID( "defground.bmp" );
-    mesh.setTexture( grTexID, 0 );
+    if (m_ShaderID == -1)
+    {
+        m_GroundTexID = IRS->GetTextureID( "defground.bmp" );
+        m_ShaderID    = IRS->GetShaderID( "terra_shadowed_hq" );
+    }
+    mesh.setShader( m_ShaderID );
+    mesh.setTexture( m_GroundTexID, 0 );
 
     return true;
 }
 
+bool DefaultTerrainCore::PatchGeometry( BaseMesh& mesh, const Rct& mapExt, int lod, const Rct& dirty )
+{
+    if (mesh.getVertexFormat() != TerrainVertex::format()) return false;
+
+    Rct ext( mapExt );
+    float skirt = mapExt.w / 8.0f;
+    ext.x -= skirt;
+    ext.y -= skirt;
+    ext.w += skirt*2.0f;
+    ext.h += skirt*2.0f;
+
+    //  normals of the vertices next to the edited area change as well
+    Rct area( dirty );
+    area.Inflate( ext.w/c_GroundPatchSegments );
+
+    VertexIterator vit;
+    vit << mesh;
+    while (vit)
+    {
+        const Vector3D& v = vit.pos();
+        if (area.PtIn( v.x, v.y )) BakeGroundVertex( vit, ext, skirt );
+        ++vit;
+    }
+    return true;
+} // DefaultTerrainCore::PatchGeometry
+
 bool DefaultTerrainCore::GetAABB( const Rct& mapExt, AABoundBox& aabb )
 {
     aabb = AABoundBox( mapExt, std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
@@ -338,6 +376,83 @@ void DefaultTerrainCore::SetExtents( const Rct& rct )
 */
 
 
+/*****************************************************************************/
+/*    TerrainBaker implementation
+/*****************************************************************************/
+DWORD TerrainBaker::s_TlsIndex = TLS_OUT_OF_INDEXES;
+
+TerrainBaker::TerrainBaker()
+{
+    m_pCore = NULL;
+    if (s_TlsIndex == TLS_OUT_OF_INDEXES) s_TlsIndex = TlsAlloc();
+} // TerrainBaker::TerrainBaker
+
+void TerrainBaker::Start( ITerrainCore* pCore, int nThreads )
+{
+    if (m_pCore == pCore && GetNThreads() == nThreads) return;
+    Stop();
+    m_pCore = pCore;
+    StartThreads( nThreads );
+} // TerrainBaker::Start
+
+void TerrainBaker::Stop()
+{
+    StopThreads();
+    m_pCore = NULL;
+} // TerrainBaker::Stop
+
+bool TerrainBaker::Request( TerrainQuad* pQuad, float priority, DWORD epoch )
+{
+    TerrainBakeRequest* pReq = Allocate();
+    if (!pReq) return false;
+    pReq->m_QuadIndex   = pQuad->GetIndex();
+    pReq->m_Extents     = pQuad->GetExtents();
+    pReq->m_LOD         = pQuad->GetLOD();
+    pReq->m_GeomStamp   = pQuad->m_GeomStamp;
+    pReq->m_Epoch       = epoch;
+    pReq->m_Priority    = priority;
+    pReq->m_bResult     = false;
+    pReq->m_NMeshes     = 0;
+    Submit( pReq );
+    return true;
+} // TerrainBaker::Request
+
+void TerrainBaker::CancelPending( std::vector<int>& quads )
+{
+    static std::vector<TerrainBakeRequest*> s_Cancelled;
+    s_Cancelled.clear();
+    TerrainBakeQueue::CancelPending( s_Cancelled );
+    for (int i = 0; i < s_Cancelled.size(); i++)
+    {
+        quads.push_back( s_Cancelled[i]->m_QuadIndex );
+        Recycle( s_Cancelled[i] );
+    }
+} // TerrainBaker::CancelPending
+
+TerrainBakeRequest* TerrainBaker::GetThreadRequest()
+{
+    if (s_TlsIndex == TLS_OUT_OF_INDEXES) return NULL;
+    return (TerrainBakeRequest*)TlsGetValue( s_TlsIndex );
+} // TerrainBaker::GetThreadRequest
+
+int TerrainBaker::SelectPending( const std::vector<TerrainBakeRequest*>& pending ) const
+{
+    //  take the most urgent pending request
+    int best = 0;
+    for (int i = 1; i < pending.size(); i++)
+    {
+        if (pending[i]->m_Priority > pending[best]->m_Priority) best = i;
+    }
+    return best;
+} // TerrainBaker::SelectPending
+
+void TerrainBaker::Bake( TerrainBakeRequest* pReq, int worker )
+{
+    TlsSetValue( s_TlsIndex, pReq );
+    pReq->m_bResult = m_pCore->CreateGeomery( pReq->m_Extents, pReq->m_LOD );
+    TlsSetValue( s_TlsIndex, NULL );
+} // TerrainBaker::Bake
+
 /*****************************************************************************/
 /*    TerrainRenderer implementation
 /*****************************************************************************/
@@ -376,6 +491,28 @@ TerrainRenderer::TerrainRenderer()
     m_Quality           = 3.0f;
     m_SubstShader       = -1;
 
+    m_bCullTreeDirty    = true;
+    m_CullBoundsStamp   = 0;
+    m_bCulledValid      = false;
+    m_CulledLODBias     = 0.0f;
+    m_CulledMinLOD      = 0;
+    m_CulledStamp       = 0;
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo( &sysInfo );
+    SetNCullThreads( sysInfo.dwNumberOfProcessors );
+    SetNBakeThreads( sysInfo.dwNumberOfProcessors - 1 );
+    if (m_NBakeThreads == 0) m_NBakeThreads = 1;
+    m_BakeBudgetMs      = c_TerrainUploadBudgetMs;
+    m_BakeEpoch         = 0;
+
+
+    m_bPatchGeometry    = true;
+    m_NEditStrokes      = 0;
+    m_EditMsTotal       = 0.0f;
+    m_EditStrokeMs      = 0.0f;
+    m_EditQuadsPatched  = 0;
+    m_EditQuadsRebuilt  = 0;
+
     SetCore             ( &g_DefaultCore );
     SetPerSidePow        ( pow7 );
 
@@ -389,6 +526,7 @@ TerrainRenderer::TerrainRenderer()
 
 void TerrainRenderer::SetCore( ITerrainCore* pCore ) 
 { 
+    if (m_Baker.IsRunning()) m_Baker.Stop();
     m_pCore = pCore; 
     m_VDecl = m_pCore->GetVDecl();
     if (IRS) m_VDecl.m_TypeID = IRS->RegisterVType( m_VDecl );
@@ -402,6 +540,7 @@ void TerrainRenderer::InvalidateAABB( TerrainQuad* pQuad )
     aabb = AABoundBox( pQuad->GetExtents(), c_MinTerraHeight, c_MaxTerraHeight );
     //GetAABB( pQuad->GetExtents(), aabb );
     pQuad->SetQuadAABB( aabb );
+    UpdateCullBounds( pQuad );
 } // TerrainRenderer::InvalidateAABB
 
 
@@ -422,13 +561,19 @@ void TerrainRenderer::InvalidateGeometry( TerrainQuad* pQuad )
         if (itemID != TerrainQuad::c_BadID) m_GeometryCache[itemID].m_QuadIndex = -1;
     }
     pQuad->SetNGeoms( 0 );
+    pQuad->m_GeomStamp++;
+    NotifyGeometryChange( pQuad );
+} // TerrainRenderer::InvalidateGeometry
+
+void TerrainRenderer::NotifyGeometryChange( TerrainQuad* pQuad )
+{
     if(pQuad->m_LOD==0){
         AABoundBox AB=pQuad->GetQuadAABB();
         for(int i=0;i<m_InvalidateCallbacks.size();i++){        
             m_InvalidateCallbacks[i](Rct(AB.minv.x,AB.minv.y,AB.maxv.x-AB.minv.x,AB.maxv.y-AB.minv.y));
         }
     }
-} // TerrainRenderer::InvalidateGeometry
+} // TerrainRenderer::NotifyGeometryChange
 
 
 void TerrainRenderer::DrawGeomCache()
@@ -546,6 +691,331 @@ void TerrainRenderer::DrawCulling()
     FlushText();
 } // TerrainRenderer::DrawCulling
 
+/*****************************************************************************/
+/*    Struct:  TerrainCullParams
+/*    Desc:    Culling frustum planes and lod criterion splatted for the 
+/*             four-wide box tests
+/*****************************************************************************/
+struct TerrainCullParams
+{
+    __m128          m_PlA[6];
+    __m128          m_PlB[6];
+    __m128          m_PlC[6];
+    __m128          m_PlD[6];
+    __m128          m_ViewX, m_ViewY, m_ViewZ;
+    __m128          m_Quality;
+    __m128          m_Band;
+    __m128          m_Half;
+    __m128          m_Zero;
+
+    void Setup( const Frustum& fr, const Vector3D& vpos, float quality )
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            const Plane& pl = fr.GetPlane( i );
+            m_PlA[i] = _mm_set1_ps( pl.a );
+            m_PlB[i] = _mm_set1_ps( pl.b );
+            m_PlC[i] = _mm_set1_ps( pl.c );
+            m_PlD[i] = _mm_set1_ps( pl.d );
+        }
+        m_ViewX   = _mm_set1_ps( vpos.x );
+        m_ViewY   = _mm_set1_ps( vpos.y );
+        m_ViewZ   = _mm_set1_ps( vpos.z );
+        m_Quality = _mm_set1_ps( quality );
+        m_Band    = _mm_set1_ps( c_TerrainCullBand );
+        m_Half    = _mm_set1_ps( 0.5f );
+        m_Zero    = _mm_setzero_ps();
+    }
+}; // struct TerrainCullParams
+
+//  tests four boxes against the frustum and the lod criterion. Returns visibility 
+//  bits in the low nibble and "needs to be split" bits in the high nibble.
+//  Plane test picks the box corner farthest along the plane normal as max(a*min, a*max),
+//  boxes are padded by c_TerrainCullBand, same as the scalar test used to do
+static __forceinline int CullBoxes4( const TerrainCullParams& cp, 
+                                     const float* mnx, const float* mny, const float* mnz,
+                                     const float* mxx, const float* mxy, const float* mxz )
+{
+    __m128 x0 = _mm_load_ps( mnx );
+    __m128 y0 = _mm_load_ps( mny );
+    __m128 z0 = _mm_load_ps( mnz );
+    __m128 x1 = _mm_load_ps( mxx );
+    __m128 y1 = _mm_load_ps( mxy );
+    __m128 z1 = _mm_load_ps( mxz );
+
+    __m128 px0 = _mm_sub_ps( x0, cp.m_Band );
+    __m128 py0 = _mm_sub_ps( y0, cp.m_Band );
+    __m128 pz0 = _mm_sub_ps( z0, cp.m_Band );
+    __m128 px1 = _mm_add_ps( x1, cp.m_Band );
+    __m128 py1 = _mm_add_ps( y1, cp.m_Band );
+    __m128 pz1 = _mm_add_ps( z1, cp.m_Band );
+
+    __m128 outside = cp.m_Zero;
+    for (int i = 0; i < 6; i++)
+    {
+        __m128 dx = _mm_max_ps( _mm_mul_ps( cp.m_PlA[i], px0 ), _mm_mul_ps( cp.m_PlA[i], px1 ) );
+        __m128 dy = _mm_max_ps( _mm_mul_ps( cp.m_PlB[i], py0 ), _mm_mul_ps( cp.m_PlB[i], py1 ) );
+        __m128 dz = _mm_max_ps( _mm_mul_ps( cp.m_PlC[i], pz0 ), _mm_mul_ps( cp.m_PlC[i], pz1 ) );
+        __m128 d  = _mm_add_ps( _mm_add_ps( dx, dy ), _mm_add_ps( dz, cp.m_PlD[i] ) );
+        outside = _mm_or_ps( outside, _mm_cmplt_ps( d, cp.m_Zero ) );
+    }
+    int visMask = (~_mm_movemask_ps( outside ))&0xF;
+    if (visMask == 0) return 0;
+
+    //  same as TerrainQuad::SatisfiesLOD, on the unpadded boxes
+    __m128 qs = _mm_sub_ps( x1, x0 );
+    qs = _mm_mul_ps( qs, qs );
+    __m128 cx = _mm_sub_ps( _mm_mul_ps( _mm_add_ps( x0, x1 ), cp.m_Half ), cp.m_ViewX );
+    __m128 cy = _mm_sub_ps( _mm_mul_ps( _mm_add_ps( y0, y1 ), cp.m_Half ), cp.m_ViewY );
+    __m128 cz = _mm_sub_ps( _mm_mul_ps( _mm_add_ps( z0, z1 ), cp.m_Half ), cp.m_ViewZ );
+    __m128 d  = _mm_add_ps( _mm_add_ps( _mm_mul_ps( cx, cx ), _mm_mul_ps( cy, cy ) ), _mm_mul_ps( cz, cz ) );
+    d = _mm_sub_ps( d, qs );
+    int splitMask = _mm_movemask_ps( _mm_cmpngt_ps( d, _mm_mul_ps( qs, cp.m_Quality ) ) )&visMask;
+    return visMask|(splitMask << 4);
+} // CullBoxes4
+
+/*****************************************************************************/
+/*    Struct:  TerrainCullJob
+/*    Desc:    Range of the root quads culled by a single thread
+/*****************************************************************************/
+struct TerrainCullJob
+{
+    const TerrainCullParams*    m_pParams;
+    const float*                m_Bounds[6];
+    const int*                  m_pChild;
+    const int*                  m_pQuad;
+    TerrainQuad*                m_pQuads;
+    const int*                  m_pRoots;       //  flat nodes of the root quads
+    int                         m_NRoots;
+
+    TerrainQuad**               m_pOut;
+    int                         m_NOut;
+    int                         m_MaxOut;
+    int                         m_NTested;
+
+    void Emit( int node )
+    {
+        TerrainQuad* pQuad = &m_pQuads[m_pQuad[node]];
+        pQuad->SetAlreadyDrawn( false );
+        if (m_NOut < m_MaxOut) m_pOut[m_NOut++] = pQuad;
+    }
+
+    void ProcessGroup( int first )
+    {
+        int mask = CullBoxes4( *m_pParams, 
+                                m_Bounds[0] + first, m_Bounds[1] + first, m_Bounds[2] + first,
+                                m_Bounds[3] + first, m_Bounds[4] + first, m_Bounds[5] + first );
+        m_NTested += 4;
+        for (int i = 0; i < 4; i++)
+        {
+            if ((mask&(1 << i)) == 0) continue;
+            int node  = first + i;
+            int child = m_pChild[node];
+            if (child >= 0 && (mask&(16 << i))) ProcessGroup( child ); else Emit( node );
+        }
+    } // ProcessGroup
+
+    void Run()
+    {
+        m_NOut      = 0;
+        m_NTested   = 0;
+        //  roots are scattered over the flat tree, gather their bounds four at a time
+        __declspec(align(16)) float bounds[6][4];
+        for (int r = 0; r < m_NRoots; r += 4)
+        {
+            int nR = tmin( 4, m_NRoots - r );
+            for (int i = 0; i < 4; i++)
+            {
+                int node = m_pRoots[r + tmin( i, nR - 1 )];
+                for (int j = 0; j < 6; j++) bounds[j][i] = m_Bounds[j][node];
+            }
+            int mask = CullBoxes4( *m_pParams, bounds[0], bounds[1], bounds[2], 
+                                                bounds[3], bounds[4], bounds[5] );
+            m_NTested += nR;
+            for (int i = 0; i < nR; i++)
+            {
+                if ((mask&(1 << i)) == 0) continue;
+                int node  = m_pRoots[r + i];
+                int child = m_pChild[node];
+                if (child >= 0 && (mask&(16 << i))) ProcessGroup( child ); else Emit( node );
+            }
+        }
+    } // Run
+}; // struct TerrainCullJob
+
+/*****************************************************************************/
+/*    Class:   TerrainCullThreads
+/*    Desc:    Persistent worker threads for the terrain culling. Each worker 
+/*             waits for its start event, runs the job and signals done event
+/*****************************************************************************/
+class TerrainCullThreads
+{
+public:
+    TerrainCullThreads() : m_NThreads( 0 ), m_bQuit( false ) {}
+    //  workers are not waited for here: static destruction runs under the loader lock,
+    //  threads still alive at that point are killed with the process
+    ~TerrainCullThreads() { m_bQuit = true; }
+
+    int GetNThreads() const { return m_NThreads; }
+
+    void Start( int nThreads )
+    {
+        if (nThreads == m_NThreads) return;
+        Shutdown();
+        m_bQuit = false;
+        for (int i = 0; i < nThreads; i++)
+        {
+            Worker& w = m_Worker[i];
+            w.m_pOwner  = this;
+            w.m_pJob    = NULL;
+            w.m_hStart  = CreateEvent( NULL, FALSE, FALSE, NULL );
+            w.m_hDone   = CreateEvent( NULL, FALSE, FALSE, NULL );
+            w.m_hThread = CreateThread( NULL, 0, ThreadProc, &w, 0, NULL );
+            m_Done[i]   = w.m_hDone;
+        }
+        m_NThreads = nThreads;
+    } // Start
+
+    void Shutdown()
+    {
+        if (m_NThreads == 0) return;
+        m_bQuit = true;
+        HANDLE threads[c_MaxTerrainCullThreads];
+        for (int i = 0; i < m_NThreads; i++)
+        {
+            SetEvent( m_Worker[i].m_hStart );
+            threads[i] = m_Worker[i].m_hThread;
+        }
+        WaitForMultipleObjects( m_NThreads, threads, TRUE, INFINITE );
+        for (int i = 0; i < m_NThreads; i++)
+        {
+            CloseHandle( m_Worker[i].m_hThread );
+            CloseHandle( m_Worker[i].m_hStart );
+            CloseHandle( m_Worker[i].m_hDone );
+        }
+        m_NThreads = 0;
+    } // Shutdown
+
+    //  runs jobs on the workers, first one is run on the calling thread.
+    //  Only as many workers as there are jobs besides the first one are woken
+    void Run( TerrainCullJob* jobs, int nJobs )
+    {
+        int nWorkers = nJobs - 1;
+        assert( nWorkers <= m_NThreads );
+        for (int i = 0; i < nWorkers; i++)
+        {
+            m_Worker[i].m_pJob = &jobs[i + 1];
+            SetEvent( m_Worker[i].m_hStart );
+        }
+        jobs[0].Run();
+        if (nWorkers > 0) WaitForMultipleObjects( nWorkers, m_Done, TRUE, INFINITE );
+    } // Run
+
+private:
+    struct Worker
+    {
+        TerrainCullThreads*     m_pOwner;
+        TerrainCullJob*         m_pJob;
+        HANDLE                  m_hThread;
+        HANDLE                  m_hStart;
+        HANDLE                  m_hDone;
+    }; // struct Worker
+
+    static DWORD WINAPI ThreadProc( void* pParam )
+    {
+        Worker* pWorker = (Worker*)pParam;
+        for (;;)
+        {
+            WaitForSingleObject( pWorker->m_hStart, INFINITE );
+            if (pWorker->m_pOwner->m_bQuit) break;
+            pWorker->m_pJob->Run();
+            SetEvent( pWorker->m_hDone );
+        }
+        return 0;
+    } // ThreadProc
+
+    Worker                  m_Worker[c_MaxTerrainCullThreads];
+    HANDLE                  m_Done  [c_MaxTerrainCullThreads];
+    int                     m_NThreads;
+    volatile bool           m_bQuit;
+}; // class TerrainCullThreads
+
+static TerrainCullThreads   s_CullThreads;
+
+void TerrainRenderer::SetNCullThreads( int nThreads )
+{
+    clamp( nThreads, 1, c_MaxTerrainCullThreads );
+    m_NCullThreads = nThreads;
+} // TerrainRenderer::SetNCullThreads
+
+void TerrainRenderer::UpdateCullBounds( TerrainQuad* pQuad )
+{
+    if (m_bCullTreeDirty) return;
+    int node = m_QuadCullNode[pQuad->GetIndex()];
+    const AABoundBox& ab = pQuad->GetQuadAABB();
+    float b[6] = { ab.minv.x, ab.minv.y, ab.minv.z, ab.maxv.x, ab.maxv.y, ab.maxv.z };
+    bool bChanged = false;
+    for (int i = 0; i < 6; i++)
+    {
+        if (m_CullBounds[i][node] == b[i]) continue;
+        m_CullBounds[i][node] = b[i];
+        bChanged = true;
+    }
+    if (bChanged) m_CullBoundsStamp++;
+} // TerrainRenderer::UpdateCullBounds
+
+void TerrainRenderer::BuildCullTree()
+{
+    int nQuads = m_Quads.size();
+    //  root node goes to the slot 0, slots 1..3 are padding, so that every 
+    //  group of children starts at the multiple of four
+    int nNodes = nQuads + 3;
+    m_CullChild.resize( nNodes );
+    m_CullQuad.resize( nNodes );
+    m_QuadCullNode.resize( nQuads );
+    for (int i = 0; i < 6; i++) 
+    {
+        m_CullBounds[i].Resize( nNodes );
+        m_CullBounds[i].Reset( 0.0f );
+    }
+    for (int i = 0; i < nNodes; i++)
+    {
+        m_CullChild[i] = -1;
+        m_CullQuad[i]  = -1;
+    }
+
+    m_CullQuad[0]     = 0;
+    m_QuadCullNode[0] = 0;
+    int nAlloc = 4;
+    for (int cur = 0; cur < nAlloc; cur++)
+    {
+        int qIdx = m_CullQuad[cur];
+        if (qIdx < 0) continue;
+        TerrainQuad& q = m_Quads[qIdx];
+        const AABoundBox& ab = q.GetQuadAABB();
+        m_CullBounds[0][cur] = ab.minv.x;
+        m_CullBounds[1][cur] = ab.minv.y;
+        m_CullBounds[2][cur] = ab.minv.z;
+        m_CullBounds[3][cur] = ab.maxv.x;
+        m_CullBounds[4][cur] = ab.maxv.y;
+        m_CullBounds[5][cur] = ab.maxv.z;
+
+        if (!q.m_pChild[0] || !q.m_pChild[1] || !q.m_pChild[2] || !q.m_pChild[3]) continue;
+        m_CullChild[cur] = nAlloc;
+        for (int i = 0; i < 4; i++)
+        {
+            int cIdx = q.m_pChild[i]->GetIndex();
+            m_CullQuad[nAlloc]   = cIdx;
+            m_QuadCullNode[cIdx] = nAlloc;
+            nAlloc++;
+        }
+    }
+    assert( nAlloc <= nNodes );
+    m_bCullTreeDirty = false;
+    m_bCulledValid   = false;
+    m_CullBoundsStamp++;
+} // TerrainRenderer::BuildCullTree
+
 void TerrainRenderer::DoVisibilityCulling()
 {
     if (!RootQuad()) return;
@@ -553,6 +1023,30 @@ void TerrainRenderer::DoVisibilityCulling()
 
     ICamera* pCam = GetCamera();
     if (!pCam) return;
+    if (m_bCullTreeDirty) BuildCullTree();
+
+    //  reuse last frame result if nothing has changed since
+    const Matrix4D& viewTM = pCam->GetViewTM();
+    const Matrix4D& projTM = pCam->GetProjTM();
+    if (m_bCulledValid && 
+        m_CulledStamp   == m_CullBoundsStamp && 
+        m_CulledLODBias == m_LODBias && 
+        m_CulledMinLOD  == m_MinLOD &&
+        memcmp( &m_CulledViewTM, &viewTM, sizeof( Matrix4D ) ) == 0 &&
+        memcmp( &m_CulledProjTM, &projTM, sizeof( Matrix4D ) ) == 0)
+    {
+        int nCulled = m_QCulled.size();
+        for (int i = 0; i < nCulled; i++)
+        {
+            TerrainQuad* pQuad = m_QCulled[i];
+            pQuad->SetAlreadyDrawn( false );
+            m_QDrawn.push_back( pQuad );
+        }
+        m_bNeedPrecache = true;
+        INC_COUNTER( TerrainCullReused, 1 );
+        return;
+    }
+
     m_ViewerPos   = pCam->GetPosition();
     m_CullFrustum = pCam->GetFrustum();
 
@@ -593,47 +1087,88 @@ void TerrainRenderer::DoVisibilityCulling()
     clamp( qBegY, 0, ql.nSideQuads );
     clamp( qEndX, 0, ql.nSideQuads );
     clamp( qEndY, 0, ql.nSideQuads );
-        
+
+    static std::vector<int> roots;
+    roots.clear();
     for (int j = qBegY; j <= qEndY; j++)
     {
         for (int i = qBegX; i <= qEndX; i++)
         {
             int qIdx = i + j*ql.nSideQuads;
             if (qIdx >= ql.nQuads) continue;
-            TerrainQuad* pQuad = &m_Quads[ql.firstQuad + qIdx];
-            ProcessQuadCulling( pQuad );
+            roots.push_back( m_QuadCullNode[ql.firstQuad + qIdx] );
         }
     }    
-    m_bNeedPrecache = true;
-} // TerrainRenderer::DoVisibilityCulling
+    int nRoots = roots.size();
+
+    TerrainCullParams params;
+    params.Setup( m_CullFrustum, m_ViewerPos, m_LODBias );
+
+    //  split roots into coarse contiguous ranges, one per thread. Results are
+    //  concatenated in the range order, so the draw queue does not depend on 
+    //  the number of threads
+    int nJobs = tmin( m_NCullThreads, nRoots/c_MinRootsPerCullThread );
+    if (nJobs < 1) nJobs = 1;
+    static std::vector<TerrainQuad*> jobOut[c_MaxTerrainCullThreads];
+    TerrainCullJob jobs[c_MaxTerrainCullThreads];
+    int rootsPerJob = (nRoots + nJobs - 1)/nJobs;
+    for (int i = 0; i < nJobs; i++)
+    {
+        TerrainCullJob& job = jobs[i];
+        job.m_pParams = &params;
+        for (int j = 0; j < 6; j++) job.m_Bounds[j] = m_CullBounds[j].GetData();
+        job.m_pChild  = &m_CullChild[0];
+        job.m_pQuad   = &m_CullQuad[0];
+        job.m_pQuads  = &m_Quads[0];
+        int begRoot   = tmin( i*rootsPerJob, nRoots );
+        job.m_pRoots  = nRoots ? &roots[begRoot] : NULL;
+        job.m_NRoots  = tmin( rootsPerJob, nRoots - begRoot );
+        if (jobOut[i].size() < c_GeometryCacheSize*8) jobOut[i].resize( c_GeometryCacheSize*8 );
+        job.m_pOut    = &jobOut[i][0];
+        job.m_MaxOut  = c_GeometryCacheSize*8;
+    }
+    if (nJobs > 1)
+    {
+        //  pool is sized by the thread setting, so it is created once, not per job count
+        s_CullThreads.Start( m_NCullThreads - 1 );
+        s_CullThreads.Run( jobs, nJobs );
+    }
+    else
+    {
+        jobs[0].Run();
+    }
 
-void TerrainRenderer::ProcessQuadCulling( TerrainQuad* pQuad )
-{
-    if (!pQuad) return;
-    AABoundBox ab=pQuad->GetQuadAABB();
-    ab.minv+=Vector3D(-64,-64,-64);
-    ab.maxv+=Vector3D( 64, 64, 64);
-    if (!m_CullFrustum.Overlap( ab )) return;
-    if (pQuad->m_pChild[0] && 
-        //pQuad->GetLOD() < m_MaxLOD &&
-        !pQuad->SatisfiesLOD( m_ViewerPos, m_LODBias )) 
-        //  divide quad
-    {
-        ProcessQuadCulling( pQuad->m_pChild[0] );
-        ProcessQuadCulling( pQuad->m_pChild[1] );
-        ProcessQuadCulling( pQuad->m_pChild[2] );
-        ProcessQuadCulling( pQuad->m_pChild[3] );
-        return;
+    m_QCulled.clear();
+    int nTested = 0;
+    for (int i = 0; i < nJobs; i++)
+    {
+        const TerrainCullJob& job = jobs[i];
+        nTested += job.m_NTested;
+        for (int j = 0; j < job.m_NOut && !m_QDrawn.full(); j++)
+        {
+            m_QDrawn.push_back( job.m_pOut[j] );
+            m_QCulled.push_back( job.m_pOut[j] );
+        }
     }
+    INC_COUNTER( TerrainCullTests, nTested );
+
+    m_bCulledValid  = true;
+    m_CulledStamp   = m_CullBoundsStamp;
+    m_CulledLODBias = m_LODBias;
+    m_CulledMinLOD  = m_MinLOD;
+    m_CulledViewTM  = viewTM;
+    m_CulledProjTM  = projTM;
+    m_bNeedPrecache = true;
+} // TerrainRenderer::DoVisibilityCulling
 
-    pQuad->SetAlreadyDrawn( false );
-    if (m_QDrawn.full()) return;
-    m_QDrawn.push_back( pQuad );
-} // TerrainRenderer::ProcessQuadCulling
 
 
 BaseMesh* TerrainRenderer::AllocateGeometry()
 {
+    //  on the bake threads meshes go to the request back buffers
+    TerrainBakeRequest* pReq = TerrainBaker::GetThreadRequest();
+    if (pReq) return pReq->AllocateMesh();
+
     if (m_CurrentQuad <= 0) return NULL;
     TerrainQuad& quad = m_Quads[m_CurrentQuad];
     quad.m_LastFrame = IRS->GetCurFrame();
@@ -719,8 +1254,14 @@ bool TerrainRenderer::PrecacheGeometry( TerrainQuad* pQuad )
     bool res = m_pCore->CreateGeomery( pQuad->GetExtents(), pQuad->GetLOD() );
     int nGeom = pQuad->GetNGeoms();
     if (!res || nGeom <= 0) return false;
+    UpdateGeometryAABB( pQuad );
+    return true;
+} // TerrainRenderer::PrecacheGeometry
 
-    if (pQuad->GetNGeoms() == 0) return false;
+void TerrainRenderer::UpdateGeometryAABB( TerrainQuad* pQuad )
+{
+    int nGeom = pQuad->GetNGeoms();
+    if (nGeom == 0) return;
     int geomID = pQuad->GetGeometryID( 0 );
     const TerrainGeometryItem& item = m_GeometryCache[geomID];
     const BaseMesh& pri = item.m_Mesh;
@@ -744,8 +1285,138 @@ bool TerrainRenderer::PrecacheGeometry( TerrainQuad* pQuad )
     ///aabb.Union( AABoundBox( ext, aabb.minv.z, aabb.maxv.z ) );
     aabb = AABoundBox( ext, aabb.minv.z, aabb.maxv.z );
     pQuad->SetQuadAABB( aabb );
+    UpdateCullBounds( pQuad );
+} // TerrainRenderer::UpdateGeometryAABB
+
+void TerrainRenderer::SetNBakeThreads( int nThreads )
+{
+    clamp( nThreads, 0, c_MaxTerrainBakeThreads );
+    m_NBakeThreads = nThreads;
+} // TerrainRenderer::SetNBakeThreads
+
+bool TerrainRenderer::UseBakeThreads()
+{
+    if (m_NBakeThreads == 0 || !m_pCore->CanBakeAsync())
+    {
+        if (m_Baker.IsRunning()) m_Baker.Stop();
+        return false;
+    }
+    m_Baker.Start( m_pCore, m_NBakeThreads );
     return true;
-} // TerrainRenderer::PrecacheGeometry
+} // TerrainRenderer::UseBakeThreads
+
+void TerrainRenderer::UploadBakedGeometry()
+{
+    Timer timer;
+    timer.start();
+    DWORD frame = IRS->GetCurFrame();
+    int nQuads = m_Quads.size();
+    while (TerrainBakeRequest* pReq = m_Baker.PopDone())
+    {
+        int qIdx = pReq->m_QuadIndex;
+        TerrainQuad* pQuad = (pReq->m_Epoch == m_BakeEpoch && qIdx >= 0 && qIdx < nQuads) ? &m_Quads[qIdx] : NULL;
+        if (pQuad) pQuad->m_bBaking = false;
+        //  drop results of the quads invalidated while being built
+        if (pQuad && pReq->m_bResult && pReq->m_NMeshes > 0 && 
+            pReq->m_GeomStamp == pQuad->m_GeomStamp && pQuad->InvalidGeometry())
+        {
+            //  keeps own items from being evicted while allocating
+            pQuad->SetLastFrame( frame );
+            for (int i = 0; i < pReq->m_NMeshes; i++)
+            {
+                int geomID = AllocateGeometryItem();
+                if (geomID < 0) break;
+                TerrainGeometryItem& item = m_GeometryCache[geomID];
+                item.Free();
+                item.m_QuadIndex = qIdx;
+                item.m_Mesh.Swap( &pReq->m_Mesh[i] );
+                pQuad->AddGeometryID( geomID );
+            }
+            UpdateGeometryAABB( pQuad );
+            m_GeomCreated++;
+            INC_COUNTER( TerrainQuadsBaked, 1 );
+        }
+        m_Baker.Recycle( pReq );
+        if (timer.seconds()*1000.0 >= m_BakeBudgetMs) break;
+    }
+} // TerrainRenderer::UploadBakedGeometry
+
+void TerrainRenderer::QueueGeometryBakes()
+{
+    //  pending requests are re-queued each frame, so quads gone out of view are 
+    //  dropped and priorities follow the camera
+    static std::vector<int> cancelled;
+    cancelled.clear();
+    m_Baker.CancelPending( cancelled );
+    int nQuads = m_Quads.size();
+    for (int i = 0; i < cancelled.size(); i++)
+    {
+        if (cancelled[i] < nQuads) m_Quads[cancelled[i]].m_bBaking = false;
+    }
+
+    //  priority is the quad screen error estimate: world size over the distance
+    int nDrawn = m_QDrawn.size();
+    for (int i = 0; i < nDrawn; i++)
+    {
+        TerrainQuad* pQuad = m_QDrawn[i];
+        if (!pQuad->InvalidGeometry() || pQuad->m_bBaking) continue;
+        const AABoundBox& ab = pQuad->GetQuadAABB();
+        Vector3D c = ab.GetCenter();
+        c -= m_ViewerPos;
+        float priority = (ab.maxv.x - ab.minv.x)/tmax( c.norm(), 1.0f );
+        if (!m_Baker.Request( pQuad, priority, m_BakeEpoch )) break;
+        pQuad->m_bBaking = true;
+    }
+} // TerrainRenderer::QueueGeometryBakes
+
+void TerrainRenderer::SubstituteBakingQuads()
+{
+    //  quads still waiting for geometry are replaced by the closest ancestor that
+    //  has it. Anything under the substituted ancestor is not drawn, so that 
+    //  the pieces of different lods do not overlap
+    DWORD frame = IRS->GetCurFrame();
+    int nDrawn = m_QDrawn.size();
+    static std::vector<TerrainQuad*> fallback;
+    fallback.clear();
+    for (int i = 0; i < nDrawn; i++)
+    {
+        TerrainQuad* pQuad = m_QDrawn[i];
+        if (!pQuad->InvalidGeometry()) continue;
+        TerrainQuad* pAnc = pQuad->m_pParent;
+        while (pAnc && pAnc->InvalidGeometry()) pAnc = pAnc->m_pParent;
+        if (!pAnc || pAnc->m_FallbackFrame == frame) continue;
+        pAnc->m_FallbackFrame = frame;
+        fallback.push_back( pAnc );
+    }
+    if (fallback.size() == 0)
+    {
+        for (int i = 0; i < nDrawn; i++) 
+        {
+            if (m_QDrawn[i]->InvalidGeometry()) m_QDrawn[i]->SetAlreadyDrawn();
+        }
+        return;
+    }
+
+    for (int i = 0; i < nDrawn; i++) fallback.push_back( m_QDrawn[i] );
+    m_QDrawn.clear();
+    int nCand = fallback.size();
+    for (int i = 0; i < nCand; i++)
+    {
+        TerrainQuad* pQuad = fallback[i];
+        if (pQuad->InvalidGeometry()) continue;
+        bool bCovered = false;
+        for (TerrainQuad* pAnc = pQuad->m_pParent; pAnc && !bCovered; pAnc = pAnc->m_pParent)
+        {
+            bCovered = (pAnc->m_FallbackFrame == frame);
+        }
+        if (bCovered || m_QDrawn.full()) continue;
+        pQuad->SetAlreadyDrawn( false );
+        pQuad->SetLastFrame( frame );
+        m_QDrawn.push_back( pQuad );
+    }
+    INC_COUNTER( TerrainFallbackQuads, nCand - nDrawn );
+} // TerrainRenderer::SubstituteBakingQuads
+
 
 
 void TerrainRenderer::Init()
@@ -793,6 +1464,7 @@ void TerrainRenderer::Render()
     m_TexturesCreated    = 0;
     m_GeomCreated        = 0;
 
+    FlushDirtyRegions();
     DoVisibilityCulling();
 
     Rct vp = IRS->GetViewPort();
@@ -800,20 +1472,33 @@ void TerrainRenderer::Render()
     int nQuads = m_QDrawn.size();
     DWORD frame = IRS->GetCurFrame();
 
-    //  update dirty geometry pieces
-    for (int i = 0; i < nQuads; i++)
+    if (UseBakeThreads())
     {
-        TerrainQuad* pQuad = m_QDrawn[i];
-        if (pQuad->InvalidGeometry())
+        //  geometry is built on the bake threads, here finished quads are only
+        //  uploaded, missing ones are drawn with the coarser parent geometry
+        for (int i = 0; i < nQuads; i++) m_QDrawn[i]->SetLastFrame( frame );
+        UploadBakedGeometry();
+        QueueGeometryBakes();
+        SubstituteBakingQuads();
+        nQuads = m_QDrawn.size();
+    }
+    else
+    {
+        //  update dirty geometry pieces
+        for (int i = 0; i < nQuads; i++)
         {
-            bool res = PrecacheGeometry( pQuad );
-            if (!res) 
+            TerrainQuad* pQuad = m_QDrawn[i];
+            if (pQuad->InvalidGeometry())
             {
-                pQuad->SetAlreadyDrawn();
+                bool res = PrecacheGeometry( pQuad );
+                if (!res) 
+                {
+                    pQuad->SetAlreadyDrawn();
+                }
+                m_GeomCreated++;
             }
-            m_GeomCreated++;
+            pQuad->SetLastFrame( frame );
         }
-        pQuad->SetLastFrame( frame );
     }
 
     //  update dirty texture pieces
@@ -1060,6 +1745,15 @@ void TerrainRenderer::Expose( PropertyMap& pm )
 
     pm.f( "LODTreshold",        m_LODBias            );
     pm.f( "ForceLOD",             m_MinLOD            );
+    pm.p( "CullThreads", &TerrainRenderer::GetNCullThreads, &TerrainRenderer::SetNCullThreads );
+    pm.p( "BakeThreads", &TerrainRenderer::GetNBakeThreads, &TerrainRenderer::SetNBakeThreads );
+    pm.f( "BakeBudgetMs",       m_BakeBudgetMs      );
+    pm.f( "PatchGeometry",      m_bPatchGeometry    );
+    pm.f( "EditStrokes",        m_NEditStrokes      );
+    pm.f( "EditStrokeMs",       m_EditStrokeMs      );
+    pm.p( "EditStrokeAvgMs", &TerrainRenderer::GetEditStrokeAvgMs );
+    pm.f( "EditQuadsPatched",   m_EditQuadsPatched  );
+    pm.f( "EditQuadsRebuilt",   m_EditQuadsRebuilt  );
     pm.f( "DrawCulling",        m_bDrawCulling        );
     pm.f( "DrawGeomCache",        m_bDrawGeomCache    );
     pm.f( "DrawTexCache",        m_bDrawTexCache        );
@@ -1176,6 +1870,11 @@ void TerrainRenderer::SetExtents( const Rct& ext )
     {
         m_Quads[i].SetIndex( i );
     }    
+    m_bCullTreeDirty = true;
+    m_BakeEpoch++;
+    //  extents are set by the host for every loaded map, 
+    //  so time to the stable sprite cache is measured per map
+    if (ISM) ISM->ResetStableFrame();
 } // TerrainRenderer::SetExtents
 
 
@@ -1185,6 +1884,43 @@ void TerrainRenderer::SetHeightmapPow( int hpow )
 }
 
 
+static void UniteRct( Rct& rct, const Rct& r )
+{
+    float right  = tmax( rct.GetRight(),  r.GetRight()  );
+    float bottom = tmax( rct.GetBottom(), r.GetBottom() );
+    rct.x = tmin( rct.x, r.x );
+    rct.y = tmin( rct.y, r.y );
+    rct.w = right  - rct.x;
+    rct.h = bottom - rct.y;
+} // UniteRct
+
+//  adds rectangle to the pending list, merging it with the rectangles it touches,
+//  so repeated brush dabs in one frame end up as a single region
+static void AddDirtyRect( std::vector<Rct>& rects, const Rct& rct )
+{
+    Rct cur( rct );
+    int i = 0;
+    while (i < rects.size())
+    {
+        if (!rects[i].Overlap( cur ))
+        {
+            i++;
+            continue;
+        }
+        UniteRct( cur, rects[i] );
+        rects[i] = rects.back();
+        rects.pop_back();
+        //  grown rectangle may touch the ones already skipped
+        i = 0;
+    }
+    rects.push_back( cur );
+    if (rects.size() <= c_MaxTerrainDirtyRects) return;
+
+    //  too scattered edits, fall back to the bounding rectangle
+    for (i = 1; i < rects.size(); i++) UniteRct( rects[0], rects[i] );
+    rects.resize( 1 );
+} // AddDirtyRect
+
 void TerrainRenderer::InvalidateAABB( const Rct* rct )
 {
     if (rct == NULL)
@@ -1194,16 +1930,11 @@ void TerrainRenderer::InvalidateAABB( const Rct* rct )
         {
             InvalidateAABB( &m_Quads[i] );
         }
+        m_DirtyAABB.clear();
     }
     else
     {
-        RctQuery::rct = *rct;
-        QuadIterator<RctQuery> qit( RootQuad() );
-        while (qit)
-        {
-            InvalidateAABB( ((TerrainQuad*)qit) );
-            ++qit;
-        }
+        AddDirtyRect( m_DirtyAABB, *rct );
     }
 } // TerrainRenderer::InvalidateAABB
 
@@ -1216,32 +1947,13 @@ void TerrainRenderer::InvalidateGeometry( const Rct* rct )
         {
             InvalidateGeometry( &m_Quads[i] );
         }
+        m_DirtyGeom.clear();
+        m_QDrawn.clear();
     }
     else
     {
-        for (int i = 0; i < m_NQuadLevels; i++)
-        {
-            const QuadLevel& ql = m_QuadLevel[i];
-            DWORD frame = IRS->GetCurFrame();
-
-            int qBegX = (rct->x - m_Extents.x)/ql.qWidth - 1;
-            int qBegY = (rct->y - m_Extents.y)/ql.qHeight - 1;  
-            int qEndX = (rct->GetRight() - m_Extents.x)/ql.qWidth + 1;
-            int qEndY = (rct->GetBottom() - m_Extents.y)/ql.qHeight + 1; 
-
-            for (int j = qBegY; j < qEndY; j++)
-            {
-                for (int i = qBegX; i < qEndX; i++)
-                {
-                    int qIdx = i + j*ql.nSideQuads;
-                    if (qIdx < 0 || qIdx >= ql.nQuads) continue;
-                    TerrainQuad* pQuad = &m_Quads[ql.firstQuad + qIdx];
-                    if (rct->Overlap( pQuad->GetExtents() )) InvalidateGeometry( pQuad );
-                }
-            }    
-        }
+        AddDirtyRect( m_DirtyGeom, *rct );
     }
-    m_QDrawn.clear();
 } // TerrainRenderer::InvalidateGeometry
 
 
@@ -1251,33 +1963,145 @@ void TerrainRenderer::InvalidateTexture( const Rct* rct )
     {
         int nQuads = m_Quads.size();
         for (int i = 0; i < nQuads; i++) InvalidateTexture( &m_Quads[i] );
+        m_DirtyTex.clear();
+        m_QDrawn.clear();
     }
     else
     {
-        for (int i = 0; i < m_NQuadLevels; i++)
+        AddDirtyRect( m_DirtyTex, *rct );
+    }
+} // TerrainRenderer::InvalidateTexture
+
+void TerrainRenderer::GetQuadsInRect( int level, const Rct& rct, std::vector<TerrainQuad*>& quads )
+{
+    quads.clear();
+    const QuadLevel& ql = m_QuadLevel[level];
+
+    int qBegX = (rct.x - m_Extents.x)/ql.qWidth - 1;
+    int qBegY = (rct.y - m_Extents.y)/ql.qHeight - 1;  
+    int qEndX = (rct.GetRight() - m_Extents.x)/ql.qWidth + 1;
+    int qEndY = (rct.GetBottom() - m_Extents.y)/ql.qHeight + 1; 
+
+    for (int j = qBegY; j < qEndY; j++)
+    {
+        for (int i = qBegX; i < qEndX; i++)
         {
-            const QuadLevel& ql = m_QuadLevel[i];
-            DWORD frame = IRS->GetCurFrame();
+            int qIdx = i + j*ql.nSideQuads;
+            if (qIdx < 0 || qIdx >= ql.nQuads) continue;
+            TerrainQuad* pQuad = &m_Quads[ql.firstQuad + qIdx];
+            if (rct.Overlap( pQuad->GetExtents() )) quads.push_back( pQuad );
+        }
+    }
+} // TerrainRenderer::GetQuadsInRect
 
-            int qBegX = (rct->x - m_Extents.x)/ql.qWidth - 1;
-            int qBegY = (rct->y - m_Extents.y)/ql.qHeight - 1;  
-            int qEndX = (rct->GetRight() - m_Extents.x)/ql.qWidth + 1;
-            int qEndY = (rct->GetBottom() - m_Extents.y)/ql.qHeight + 1; 
+bool TerrainRenderer::PatchQuadGeometry( TerrainQuad* pQuad, const Rct& dirty )
+{
+    if (!m_bPatchGeometry || pQuad->InvalidGeometry()) return false;
+    Rct ext = pQuad->GetExtents();
+    int lod = pQuad->GetLOD();
+    int nGeom = pQuad->GetNGeoms();
+    for (int i = 0; i < nGeom; i++)
+    {
+        TerrainGeometryItem& item = m_GeometryCache[pQuad->GetGeometryID( i )];
+        if (!m_pCore->PatchGeometry( item.m_Mesh, ext, lod, dirty )) return false;
+        item.m_IBStamp = 0;
+        item.m_VBStamp = 0;
+    }
+    return true;
+} // TerrainRenderer::PatchQuadGeometry
 
-            for (int j = qBegY; j < qEndY; j++)
+void TerrainRenderer::RefreshQuadAABB( TerrainQuad* pQuad )
+{
+    if (!pQuad->InvalidGeometry())
+    {
+        UpdateGeometryAABB( pQuad );
+        return;
+    }
+
+    //  quad without geometry is bounded by its children, they are refreshed first
+    AABoundBox aabb;
+    bool bHasChildren = false;
+    for (int i = 0; i < 4; i++)
+    {
+        TerrainQuad* pChild = pQuad->GetChild( i );
+        if (!pChild) continue;
+        if (bHasChildren) aabb.Union( pChild->GetQuadAABB() ); else aabb = pChild->GetQuadAABB();
+        bHasChildren = true;
+    }
+    if (!bHasChildren)
+    {
+        InvalidateAABB( pQuad );
+        return;
+    }
+    pQuad->SetQuadAABB( AABoundBox( pQuad->GetExtents(), aabb.minv.z, aabb.maxv.z ) );
+    UpdateCullBounds( pQuad );
+} // TerrainRenderer::RefreshQuadAABB
+
+void TerrainRenderer::FlushDirtyRegions()
+{
+    if (m_DirtyGeom.size() == 0 && m_DirtyAABB.size() == 0 && m_DirtyTex.size() == 0) return;
+    Timer timer;
+    timer.start();
+
+    for (int r = 0; r < m_DirtyTex.size(); r++)
+    {
+        for (int i = 0; i < m_NQuadLevels; i++)
+        {
+            GetQuadsInRect( i, m_DirtyTex[r], m_EditQuads );
+            for (int j = 0; j < m_EditQuads.size(); j++) InvalidateTexture( m_EditQuads[j] );
+        }
+    }
+
+    //  touched vertices are patched in place, quads the core can't patch are rebuilt
+    int nPatched = 0;
+    int nRebuilt = 0;
+    for (int r = 0; r < m_DirtyGeom.size(); r++)
+    {
+        const Rct& rct = m_DirtyGeom[r];
+        for (int i = 0; i < m_NQuadLevels; i++)
+        {
+            GetQuadsInRect( i, rct, m_EditQuads );
+            for (int j = 0; j < m_EditQuads.size(); j++)
             {
-                for (int i = qBegX; i < qEndX; i++)
+                TerrainQuad* pQuad = m_EditQuads[j];
+                if (PatchQuadGeometry( pQuad, rct ))
                 {
-                    int qIdx = i + j*ql.nSideQuads;
-                    if (qIdx < 0 || qIdx >= ql.nQuads) continue;
-                    TerrainQuad* pQuad = &m_Quads[ql.firstQuad + qIdx];
-                    if (rct->Overlap( pQuad->GetExtents() )) InvalidateTexture( pQuad );
+                    NotifyGeometryChange( pQuad );
+                    nPatched++;
                 }
-            }    
+                else
+                {
+                    if (!pQuad->InvalidGeometry()) nRebuilt++;
+                    InvalidateGeometry( pQuad );
+                }
+            }
+        }
+        AddDirtyRect( m_DirtyAABB, rct );
+    }
+
+    //  bounds are refreshed bottom-up, so parents without geometry take the fresh child bounds
+    for (int r = 0; r < m_DirtyAABB.size(); r++)
+    {
+        for (int i = m_NQuadLevels - 1; i >= 0; i--)
+        {
+            GetQuadsInRect( i, m_DirtyAABB[r], m_EditQuads );
+            for (int j = 0; j < m_EditQuads.size(); j++) RefreshQuadAABB( m_EditQuads[j] );
         }
     }
+
     m_QDrawn.clear();
-} // TerrainRenderer::InvalidateTexture
+    m_DirtyGeom.clear();
+    m_DirtyAABB.clear();
+    m_DirtyTex.clear();
+
+    m_EditStrokeMs      = float( timer.seconds()*1000.0 );
+    m_EditMsTotal      += m_EditStrokeMs;
+    m_EditQuadsPatched  = nPatched;
+    m_EditQuadsRebuilt  = nRebuilt;
+    m_NEditStrokes++;
+    INC_COUNTER( TerrainQuadsPatched, nPatched );
+    INC_COUNTER( TerrainQuadsRebuilt, nRebuilt );
+} // TerrainRenderer::FlushDirtyRegions
 
 
 void TerrainRenderer::OnDestroyRS()
@@ -1544,6 +2368,11 @@ void TerrainRenderer::SubstShader( int shaderID )
 {
     m_SubstShader = shaderID;
 }
+
+void TerrainRenderer::LoadMapData( const char* mapFile )
+{
+    LoadMapTreesDB( mapFile );
+} // TerrainRenderer::LoadMapData
 void TerrainRenderer::SetInvalidateCallback( tpInvalidateQuadCallback* cb){
     m_InvalidateCallbacks.push_back( cb );
 }
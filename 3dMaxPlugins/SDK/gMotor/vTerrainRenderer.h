@@ -8,6 +8,7 @@
 #define __VTERRAINRENDERER_H__
 #include "ITerrain.h"
 #include "kStaticArray.hpp"
+#include "kBakeQueue.hpp"
 
 #include "mNoise.h"
 
@@ -32,6 +33,9 @@ public:
     TerrainQuad*            m_pParent;
 
     ITerrainChunk*          m_pChunk;                   //  pointer to the chunk client interface
+    DWORD                   m_GeomStamp;                //  incremented on geometry invalidation
+    bool                    m_bBaking;                  //  geometry is being built on the bake thread
+    DWORD                   m_FallbackFrame;            //  last frame quad was drawn instead of its children
     static const WORD       c_BadID = 0xFFFF;
 
 
@@ -107,6 +111,72 @@ struct CameraFrame
 const int c_TerrainIBufferBytes = 1024*1024*2;
 const int c_TerrainVBufferBytes = 1024*1024*16;
 
+const int   c_MaxTerrainDirtyRects      = 16;
+
+const int   c_MaxTerrainBakeThreads     = 4;
+const int   c_MaxTerrainBakeRequests    = 64;
+const float c_TerrainUploadBudgetMs     = 2.0f;
+
+/*****************************************************************************/
+/*    Struct:  TerrainBakeRequest
+/*    Desc:    Quad geometry built on the bake thread. Meshes are back buffers, 
+/*             they are swapped with the geometry cache items on upload, so 
+/*             the memory of evicted items is reused by the next bakes
+/*****************************************************************************/
+struct TerrainBakeRequest
+{
+    int                     m_QuadIndex;
+    Rct                     m_Extents;
+    int                     m_LOD;
+    DWORD                   m_GeomStamp;        //  quad geometry stamp at the moment of request
+    DWORD                   m_Epoch;            //  quadtree layout epoch
+    float                   m_Priority;
+    bool                    m_bResult;
+    int                     m_NMeshes;
+    BaseMesh                m_Mesh[c_MaxQuadGeoms];
+
+    BaseMesh*               AllocateMesh    () { return (m_NMeshes < c_MaxQuadGeoms) ? &m_Mesh[m_NMeshes++] : NULL; }
+}; // struct TerrainBakeRequest
+
+typedef BakeQueue<TerrainBakeRequest, c_MaxTerrainBakeRequests, c_MaxTerrainBakeThreads> TerrainBakeQueue;
+
+/*****************************************************************************/
+/*    Class:   TerrainBaker
+/*    Desc:    Worker threads building terrain quad geometry. Render thread 
+/*             requests quads and picks up finished ones, workers take pending 
+/*             requests in the order of priority
+/*****************************************************************************/
+class TerrainBaker : public TerrainBakeQueue
+{
+public:
+                            TerrainBaker    ();
+
+    void                    Start           ( ITerrainCore* pCore, int nThreads );
+    //  waits for the bakes in progress, pending and finished requests are dropped
+    void                    Stop            ();
+    ITerrainCore*           GetCore         () const { return m_pCore; }
+
+    bool                    Request         ( TerrainQuad* pQuad, float priority, DWORD epoch );
+    //  removes requests not yet taken by the workers, returns their quad indices
+    void                    CancelPending   ( std::vector<int>& quads );
+
+    //  request being built by the calling thread, NULL on non-bake threads
+    static TerrainBakeRequest* GetThreadRequest();
+
+protected:
+    virtual void            Bake            ( TerrainBakeRequest* pReq, int worker );
+    virtual int             SelectPending   ( const std::vector<TerrainBakeRequest*>& pending ) const;
+
+private:
+    ITerrainCore*                       m_pCore;
+
+    static DWORD                        s_TlsIndex;
+}; // class TerrainBaker
+
+const int   c_MaxTerrainCullThreads = 8;
+const int   c_MinRootsPerCullThread = 16;   //  do not split culling of less quads between the threads
+const float c_TerrainCullBand       = 64.0f;
+
 /*****************************************************************************/
 /*    Class:    PerlinHeightMap
 /*    Desc:    Simple procedural on-the-fly heightmap generator
@@ -300,10 +370,18 @@ class DefaultTerrainCore : public ITerrainCore
     PerlinHeightMap      m_HeightMap;
 
     typedef Vertex2t        TerrainVertex;
+    static const int    c_GroundPatchSegments = 10;
+
+    int                 m_ShaderID;
+    int                 m_GroundTexID;
 public:
+                                DefaultTerrainCore() : m_ShaderID( -1 ), m_GroundTexID( -1 ) {}
     virtual bool                CreateTexture    ( int texID, const Rct& mapExt );
     virtual bool                CreateGeomery    ( const Rct& mapExt, int lod );
+    //  shader and texture are looked up on the first, synchronous, call
+    virtual bool                CanBakeAsync    () const { return m_ShaderID != -1; }
     virtual bool                GetAABB         ( const Rct& mapExt, AABoundBox& aabb );
+    virtual bool                PatchGeometry   ( BaseMesh& mesh, const Rct& mapExt, int lod, const Rct& dirty );
     virtual float                GetHeight        ( float x, float y );
     virtual VertexDeclaration   GetVDecl        () const;
     virtual void                SetExtents      ( const Rct& rct );
@@ -373,10 +451,15 @@ public:
     int                    GetTextureCacheSize    () const { return m_TextureCache.size(); }
     
     void                DoVisibilityCulling    ();
-    void                ProcessQuadCulling  ( TerrainQuad* pQuad );
+    void                SetNCullThreads     ( int nThreads );
+    int                 GetNCullThreads     () const { return m_NCullThreads; }
+    void                SetNBakeThreads     ( int nThreads );
+    int                 GetNBakeThreads     () const { return m_NBakeThreads; }
+    float               GetEditStrokeAvgMs  () const { return m_NEditStrokes ? m_EditMsTotal/m_NEditStrokes : 0.0f; }
 
     virtual void        SetExtents            ( const Rct& ext );
     virtual void        SetHeightmapPow        ( int hpow );
+    virtual void        LoadMapData         ( const char* mapFile );
 
     virtual Rct            GetExtents            () const { return m_Extents; }
     _inl TerrainQuad*    RootQuad            () { return m_Quads.size() ? &m_Quads[0] : NULL; }
@@ -455,8 +538,11 @@ protected:
     void                    DrawNormals         ();
 
     void                    InvalidateAABB        ( TerrainQuad* pQuad );
+    void                    UpdateCullBounds    ( TerrainQuad* pQuad );
+    void                    BuildCullTree       ();
     void                    InvalidateTexture    ( TerrainQuad* pQuad ); 
     void                    InvalidateGeometry    ( TerrainQuad* pQuad );
+    void                    NotifyGeometryChange( TerrainQuad* pQuad );
 
     friend class            TerrainEditor;                         
 
@@ -464,6 +550,17 @@ private:
 
     bool                    CreateQuadTexture    ( int quadIdx, int geomID );
     void                    PrecacheQuad        ( TerrainQuad* pQ );
+    void                    UpdateGeometryAABB  ( TerrainQuad* pQuad );
+
+    void                    FlushDirtyRegions   ();
+    bool                    PatchQuadGeometry   ( TerrainQuad* pQuad, const Rct& dirty );
+    void                    RefreshQuadAABB     ( TerrainQuad* pQuad );
+    void                    GetQuadsInRect      ( int level, const Rct& rct, std::vector<TerrainQuad*>& quads );
+
+    bool                    UseBakeThreads      ();
+    void                    UploadBakedGeometry ();
+    void                    QueueGeometryBakes  ();
+    void                    SubstituteBakingQuads();
     TerrainQuad*            GetQuad             ( int lod, float x, float y )
     {
         const QuadLevel& ql = m_QuadLevel[lod];
@@ -505,6 +602,44 @@ private:
 
     int                     m_NTexVisible;
     int                     m_NPrecached;
+
+    //  flattened quadtree used for the visibility culling. Nodes are laid out 
+    //  breadth-first, four children of a node are stored contiguously at the 
+    //  aligned position, so they are tested against the frustum in one go
+    AlignedBuffer<float,16> m_CullBounds[6];        //  minx, miny, minz, maxx, maxy, maxz 
+    std::vector<int>        m_CullChild;            //  flat index of the first child, -1 for leafs
+    std::vector<int>        m_CullQuad;             //  quad index of the flat node, -1 for the padding
+    std::vector<int>        m_QuadCullNode;         //  flat node of the quad index
+    bool                    m_bCullTreeDirty;
+    DWORD                   m_CullBoundsStamp;      //  incremented when any quad bounds change
+    int                     m_NCullThreads;
+
+    //  last culling result, reused while camera, lod settings and bounds stay the same
+    QuadPVSArray            m_QCulled;
+    bool                    m_bCulledValid;
+    Matrix4D                m_CulledViewTM;
+    Matrix4D                m_CulledProjTM;
+    float                   m_CulledLODBias;
+    int                     m_CulledMinLOD;
+    DWORD                   m_CulledStamp;
+
+    //  background geometry building
+    TerrainBaker            m_Baker;
+    int                     m_NBakeThreads;
+    float                   m_BakeBudgetMs;         //  time per frame for the upload of finished quads
+    DWORD                   m_BakeEpoch;            //  incremented when quadtree is rebuilt
+
+    //  heightmap edits, merged during the frame and applied at the start of the next render
+    std::vector<Rct>        m_DirtyGeom;
+    std::vector<Rct>        m_DirtyAABB;
+    std::vector<Rct>        m_DirtyTex;
+    std::vector<TerrainQuad*> m_EditQuads;
+    bool                    m_bPatchGeometry;       //  patch cached quad vertices instead of rebuilding quads
+    int                     m_NEditStrokes;
+    float                   m_EditMsTotal;
+    float                   m_EditStrokeMs;         //  cost of the last applied edit
+    int                     m_EditQuadsPatched;
+    int                     m_EditQuadsRebuilt;
 }; // class TerrainRenderer
 
 #include "vTerrainRenderer.inl"
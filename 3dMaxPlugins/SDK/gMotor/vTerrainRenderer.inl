@@ -17,6 +17,9 @@ inline TerrainQuad::TerrainQuad()
     m_pChunk        = NULL;
     m_NGeoms        = 0;
     m_pParent       = NULL;
+    m_GeomStamp     = 0;
+    m_bBaking       = false;
+    m_FallbackFrame = 0xFFFFFFFF;
 
     SetAlreadyDrawn( false );
 } // TerrainQuad::TerrainQuad
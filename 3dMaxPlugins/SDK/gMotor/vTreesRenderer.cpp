@@ -8,34 +8,245 @@
 #include "IMediaManager.h"
 #include "vTerrainRenderer.h"
 #include "vTreesRenderer.h"
+#include "kFilePath.h"
+#include "kTimer.h"
+#include "vVertexIterator.h"
+#include <algorithm>
+#include <map>
 
 TreesRenderer g_TreesRenderer;
 TreesRenderer* ITrees = &g_TreesRenderer;
 
+/*****************************************************************************/
+/*  TreesBaker implementation
+/*****************************************************************************/
+TreesBaker::TreesBaker()
+{
+    m_pDB       = NULL;
+    m_pMeshes   = NULL;
+} // TreesBaker::TreesBaker
+
+void TreesBaker::Start( ITreesDataBase* pDB, TreesMeshTable* pMeshes, int nThreads )
+{
+    if (m_pDB == pDB && m_pMeshes == pMeshes && GetNThreads() == nThreads) return;
+    Stop();
+    m_pDB       = pDB;
+    m_pMeshes   = pMeshes;
+    StartThreads( nThreads );
+} // TreesBaker::Start
+
+void TreesBaker::Stop()
+{
+    StopThreads();
+    m_pDB       = NULL;
+    m_pMeshes   = NULL;
+} // TreesBaker::Stop
+
+bool TreesBaker::Request( const TreesBlock::Key& key )
+{
+    TreesBakeRequest* pReq = Allocate();
+    if (!pReq) return false;
+    pReq->m_Key     = key;
+    pReq->m_bResult = false;
+    pReq->m_NTrees  = 0;
+    Submit( pReq );
+    return true;
+} // TreesBaker::Request
+
+void TreesBaker::Bake( TreesBakeRequest* pReq, int worker )
+{
+    TreesArray& trees = m_Area[worker];
+    pReq->m_Geom.Clear();
+    pReq->m_Vert.clear();
+    pReq->m_bResult = m_pDB->GetTreesInArea( pReq->m_Key.m_Ext, trees );
+    int nTrees      = trees.size();
+    pReq->m_NTrees  = nTrees;
+    //  same lod split as in TreesRenderer::CreateTreesBlock
+    if (pReq->m_bResult && nTrees > 0)
+    {
+        if (pReq->m_Key.m_LOD <= 3) 
+        {
+            TreesRenderer::FillGeometry( &trees[0], nTrees, *m_pMeshes, pReq->m_Geom );
+        }
+        else if (pReq->m_Key.m_LOD <= 5)
+        {
+            pReq->m_Vert.resize( nTrees*4 );
+            TreesRenderer::FillBillboards( &pReq->m_Vert[0], &trees[0], nTrees );
+        }
+    }
+} // TreesBaker::Bake
+
+/*****************************************************************************/
+/*  TreesMeshTable implementation
+/*****************************************************************************/
+TreesMeshTable::TreesMeshTable()
+{
+    InitializeCriticalSection( &m_Lock );
+}
+
+TreesMeshTable::~TreesMeshTable()
+{
+    DeleteCriticalSection( &m_Lock );
+}
+
+bool TreesMeshTable::Find( int modelID, std::vector<const BaseMesh*>& meshes )
+{
+    EnterCriticalSection( &m_Lock );
+    std::map<int, std::vector<const BaseMesh*> >::const_iterator it = m_Meshes.find( modelID );
+    bool bFound = (it != m_Meshes.end());
+    if (bFound) meshes = it->second;
+    LeaveCriticalSection( &m_Lock );
+    return bFound;
+} // TreesMeshTable::Find
+
+void TreesMeshTable::Resolve( int modelID )
+{
+    std::vector<const BaseMesh*> meshes;
+    if (modelID >= 0)
+    {
+        int idx = 0;
+        while (const BaseMesh* pMesh = IMM->GetGeometry( modelID, idx++ )) meshes.push_back( pMesh );
+    }
+    //  models without meshes are kept too, so they are not looked up again
+    EnterCriticalSection( &m_Lock );
+    m_Meshes[modelID] = meshes;
+    LeaveCriticalSection( &m_Lock );
+} // TreesMeshTable::Resolve
+
+void TreesMeshTable::Clear()
+{
+    EnterCriticalSection( &m_Lock );
+    m_Meshes.clear();
+    LeaveCriticalSection( &m_Lock );
+} // TreesMeshTable::Clear
+
 /*****************************************************************************/
 /*  TreesRenderer implementation
 /*****************************************************************************/
 TreesRenderer::TreesRenderer()
 {
     m_NTreesRendered = 0;
+    m_NBakeThreads   = 1;
+    m_MaxBlocks      = c_MaxResidentTreeBlocks;
+    m_CurFrame       = 0xFFFFFFFF;
 }
 
+void TreesRenderer::SetNBakeThreads( int nThreads )
+{
+    clamp( nThreads, 0, c_MaxTreesBakeThreads );
+    m_NBakeThreads = nThreads;
+} // TreesRenderer::SetNBakeThreads
+
+bool TreesRenderer::UseBakeThreads()
+{
+    bool bAsync = (m_NBakeThreads > 0 && ITreesDB && ITreesDB->IsThreadSafe());
+    if (m_Baker.IsRunning() && (!bAsync || m_Baker.GetDB() != ITreesDB))
+    {
+        //  dropped requests have to be issued again
+        m_Baker.Stop();
+        TreesBlockHash::iterator it = m_BlockHash.begin();
+        while (it)
+        {
+            (*it).m_bBaking = false;
+            ++it;
+        }
+    }
+    if (bAsync && !m_Baker.IsRunning()) m_Baker.Start( ITreesDB, &m_Meshes, m_NBakeThreads );
+    return bAsync;
+} // TreesRenderer::UseBakeThreads
+
+void TreesRenderer::SetDataBase( ITreesDataBase* pDB )
+{
+    m_Baker.Stop();
+    m_BlockHash.reset();
+    m_Meshes.Clear();
+    ITreesDB = pDB;
+} // TreesRenderer::SetDataBase
+
+void TreesRenderer::UploadBakedBlocks()
+{
+    while (TreesBakeRequest* pReq = m_Baker.PopDone())
+    {
+        //  block may have been evicted while it was baked
+        int blockID = m_BlockHash.find( pReq->m_Key );
+        if (blockID != NO_ELEMENT)
+        {
+            TreesBlock& block = m_BlockHash.elem( blockID );
+            const TreesGeometry& geom = pReq->m_Geom;
+            block.m_bBaking = false;
+            block.m_bBuilt  = true;
+            block.m_NObj    = pReq->m_NTrees;
+            block.m_RenderBits.clear();
+            if (geom.m_Missing.size() > 0)
+            {
+                //  models are loaded here and the block is requested again on the next frame
+                for (int i = 0; i < geom.m_Missing.size(); i++) m_Meshes.Resolve( geom.m_Missing[i] );
+                block.m_bBuilt = false;
+            }
+            else if (pReq->m_bResult && pReq->m_Vert.size() > 0)
+            {
+                BakeTreesBillboards( block, &pReq->m_Vert[0], pReq->m_Vert.size()/4 );
+            }
+            else if (pReq->m_bResult && geom.m_Runs.size() > 0)
+            {
+                BakeTreesGeometry( block, geom );
+            }
+        }
+        m_Baker.Recycle( pReq );
+    }
+} // TreesRenderer::UploadBakedBlocks
+
+struct BlockRecencyCmp
+{
+    bool operator ()( const TreesBlock& l, const TreesBlock& r ) const { return l.m_LastFrame > r.m_LastFrame; }
+}; // struct BlockRecencyCmp
+
+void TreesRenderer::EvictBlocks()
+{
+    //  hash has no removal, so the most recently used half of the blocks 
+    //  is added back to the emptied table
+    static std::vector<TreesBlock> s_Keep;
+    s_Keep.clear();
+    TreesBlockHash::iterator it = m_BlockHash.begin();
+    while (it)
+    {
+        s_Keep.push_back( *it );
+        ++it;
+    }
+    std::sort( s_Keep.begin(), s_Keep.end(), BlockRecencyCmp() );
+    int nKeep = tmin( m_MaxBlocks/2, (int)s_Keep.size() );
+    m_BlockHash.reset();
+    for (int i = 0; i < nKeep; i++) m_BlockHash.add( s_Keep[i].m_Key, s_Keep[i] );
+    s_Keep.clear();
+} // TreesRenderer::EvictBlocks
+
 void TreesRenderer::RenderBlock( const Rct& ext, int LOD )
 {
+    DWORD frame = IRS->GetCurFrame();
+    bool bAsync = UseBakeThreads();
+    if (frame != m_CurFrame)
+    {
+        m_CurFrame = frame;
+        if (bAsync) UploadBakedBlocks();
+        if (m_BlockHash.numElem() >= m_MaxBlocks) EvictBlocks();
+    }
+
     TreesBlock::Key key( ext, LOD );
     int blockID = m_BlockHash.find( key );
     if (blockID == NO_ELEMENT)
     {
         blockID = m_BlockHash.add( key );
         TreesBlock* pBlock = &m_BlockHash.elem( blockID );
+        //  pool entries are reused after the eviction
+        *pBlock = TreesBlock();
         pBlock->m_Key = key;
-        CreateTreesBlock( *pBlock );
     }
     TreesBlock& block = m_BlockHash.elem( blockID );
+    block.m_LastFrame = frame;
     
     //  check whether trees block geometry buffers are still valid
     int nBits = block.m_RenderBits.size();
-    bool bValid = true;
+    bool bValid = block.m_bBuilt;
     for (int i = 0; i < nBits; i++)
     {
         if (!IRS->IsIBStampValid( block.m_RenderBits[i].m_IBufID, block.m_RenderBits[i].m_IBufStamp )) bValid = false;
@@ -43,9 +254,16 @@ void TreesRenderer::RenderBlock( const Rct& ext, int LOD )
     }
     if (!bValid) 
     {
-        CreateTreesBlock( block );
+        //  with the bake threads the block shows up when its request is done
+        if (!bAsync) CreateTreesBlock( block );
+        else
+        {
+            if (!block.m_bBaking) block.m_bBaking = m_Baker.Request( key );
+            return;
+        }
     }
     //  submit block to the renderer
+    nBits = block.m_RenderBits.size();
     for (int i = 0; i < nBits; i++)
     {
         IRS->AddTask() = block.m_RenderBits[i];
@@ -56,161 +274,173 @@ void TreesRenderer::RenderBlock( const Rct& ext, int LOD )
 const int c_TreesVBufferBytes  = 1024*1024*16;
 const int c_TreesIBufferBytes  = 1024*1024*4;
 
-struct TreeRenderBit
+struct TreeModelCmp
 {
-    const TreeObject*       m_pObj;
-    DWORD                   m_MeshID;
-    RenderTask              m_RB;
-
-    TreeRenderBit() : m_pObj(0), m_MeshID(0xFFFFFFFF) {}
-    TreeRenderBit( const TreeObject* pObj ) : m_pObj(pObj), m_MeshID(0xFFFFFFFF) {}
-}; // struct TreeRenderBit
+    bool operator ()( const TreeObject* l, const TreeObject* r ) const { return l->m_ModelID < r->m_ModelID; }
+}; // struct TreeModelCmp
 
-struct BitCompare
+void TreesRenderer::FillGeometry( const TreeObject* trees, int nTrees, TreesMeshTable& meshes, TreesGeometry& geom )
 {
-    bool operator ()( const TreeRenderBit* l, const TreeRenderBit* r ) { return (l->m_RB < r->m_RB); }
-}; // struct BitCompare
+    geom.Clear();
+    //  trees of the same model go together, so every mesh makes a single run
+    std::vector<const TreeObject*> sorted( nTrees );
+    for (int i = 0; i < nTrees; i++) sorted[i] = &trees[i];
+    std::sort( sorted.begin(), sorted.end(), TreeModelCmp() );
+
+    std::vector<const BaseMesh*> modelMeshes;
+    int first = 0;
+    while (first < nTrees)
+    {
+        int modelID = sorted[first]->m_ModelID;
+        int last = first + 1;
+        while (last < nTrees && sorted[last]->m_ModelID == modelID) last++;
+        if (!meshes.Find( modelID, modelMeshes ))
+        {
+            geom.m_Missing.push_back( modelID );
+            modelMeshes.clear();
+        }
+
+        for (int i = 0; i < modelMeshes.size(); i++)
+        {
+            const BaseMesh& mesh = *modelMeshes[i];
+            int nV = mesh.getNVert();
+            int nI = mesh.getNInd();
+            if (nV == 0 || nI == 0 || nV > 0xFFFF || mesh.getPriType() != ptTriangleList) continue;
+            VertexDeclaration vdecl = CreateVertexDeclaration( mesh.getVertexFormat() );
+            int  stride  = vdecl.m_VertexSize;
+            bool bNormal = false;
+            for (int j = 0; j < vdecl.m_NElements; j++) if (vdecl.m_Element[j].m_Usage == vcNormal) bNormal = true;
+
+            TreesGeomRun* pRun = NULL;
+            for (int j = first; j < last; j++)
+            {
+                //  indices are 16 bit, the run is split before they overflow
+                if (!pRun || pRun->m_NVert + nV > 0xFFFF)
+                {
+                    TreesGeomRun run;
+                    run.m_pMesh         = &mesh;
+                    run.m_VertOffset    = geom.m_Vert.size();
+                    run.m_NVert         = 0;
+                    run.m_FirstIdx      = geom.m_Idx.size();
+                    run.m_NIdx          = 0;
+                    geom.m_Runs.push_back( run );
+                    pRun = &geom.m_Runs.back();
+                }
+                int vOffset = geom.m_Vert.size();
+                geom.m_Vert.resize( vOffset + nV*stride );
+                BYTE* pVert = &geom.m_Vert[vOffset];
+                memcpy( pVert, mesh.getVertexData(), nV*stride );
+                const Matrix4D& tm = sorted[j]->m_TM;
+                VertexIterator vit( pVert, nV, vdecl );
+                while (vit)
+                {
+                    tm.transformPt( vit.pos() );
+                    if (bNormal)
+                    {
+                        tm.transformVec( vit.normal() );
+                        vit.normal().normalize();
+                    }
+                    ++vit;
+                }
+                const WORD* pIdx = mesh.getIndices();
+                for (int k = 0; k < nI; k++) geom.m_Idx.push_back( pIdx[k] + pRun->m_NVert );
+                pRun->m_NVert += nV;
+                pRun->m_NIdx  += nI;
+            }
+        }
+        first = last;
+    }
+} // TreesRenderer::FillGeometry
 
 bool TreesRenderer::BakeTreesGeometry( TreesBlock& block, const TreeObject* trees, int nTrees )
 {
-    //static int vbID = -1;
-    //static int ibID = -1;
-
-    //if (vbID == -1) vbID = IRS->CreateVB( "Trees", c_TreesVBufferBytes, -1, false );
-    //if (ibID == -1) ibID = IRS->CreateIB( "Trees", c_TreesIBufferBytes, isWORD, false );
-
-    //static static_array<TreeRenderBit, c_MaxTreesInArea*4> s_Bits;
-    //static static_array<TreeRenderBit*, c_MaxTreesInArea*4> s_pBits;
-    //s_Bits.clear();
-    //s_pBits.clear();
-
-    ////  scan through all trees in area, split them into render bits
-    //for (int i = 0; i < nTrees; i++)
-    //{
-    //    const TreeObject& obj = trees[i];
-    //    ModelObject* pModel = IModelMgr->GetModel( obj.m_ModelID );
-    //    if (!pModel) continue;
-    //    int nSub = pModel->GetNMeshes();
-    //    for (int j = 0; j < nSub; j++)
-    //    {
-    //        IMesh*          pMesh   = pModel->GetMesh( j );
-    //        TreeRenderBit&  trb     = s_Bits.push_back( TreeRenderBit( &obj, pMesh ) );
-    //        RenderTask&      rb      = trb.m_RB;
-    //        pMesh->GetRenderAttributes( rb );
-    //    }
-    //}
-    ////  sort render bits to enable batching
-    //int nBits = s_Bits.size();
-    //s_pBits.resize( nBits );
-    //for (int i = 0; i < nBits; i++) s_pBits[i] = &s_Bits[i];
-    //std::sort( s_pBits.begin(), s_pBits.end(), BitCompare() );
-
-    ////  bake trees geometry into static vertex/index buffers
-    //int nVert   = 0;
-    //int nInd    = 0;
-    //int lastBit = 0;
-    //RenderTask* pRB = NULL;
-    //for (int i = 0; i <= nBits; i++)
-    //{
-    //    const RenderTask& crb = (i == nBits) ? RenderTask::c_Invalid : s_pBits[i]->m_RB;
-    //    const RenderTask& prb = (i == 0)     ? RenderTask::c_Invalid : s_pBits[i - 1]->m_RB;
-    //    if (!(crb == prb))
-    //    //  need to create new baked render bit
-    //    {
-    //        if (pRB)
-    //        {
-    //            const VertexDeclaration& vDecl = s_pBits[lastBit]->m_pMesh->GetVDecl();
-    //            int vStride = vDecl.m_VertexSize;
-
-    //            pRB->m_NVert = nVert;
-    //            pRB->m_NIdx  = nInd;
-    //            pRB->m_VType = vDecl.m_TypeID;
-    //            IRS->SetVB( vbID, vDecl.m_TypeID );
-
-    //            static std::vector<WORD> pITmp;
-    //            static std::vector<BYTE> pVTmp;
-
-    //            int   nVBytes   = vStride*nVert;
-    //            int   nIBytes   = 2*nInd;
-
-    //            if (nInd > pITmp.size())    pITmp.resize( nInd );
-    //            if (nVBytes > pVTmp.size()) pVTmp.resize( nVBytes );
-
-    //            WORD* pCurI     = &pITmp[0];
-    //            BYTE* pCurV     = &pVTmp[0];
-
-    //            if (nVBytes > c_MaxTreesInArea*1024*32 || nInd > c_MaxTreesInArea*1024)
-    //            {
-    //                Log.Error( "Too much static objects when baking the area!" );
-    //                return false;
-    //            }
-    //            //  bake vertex and index data
-    //            int cV = 0;
-    //            for (int j = lastBit; j < i; j++)
-    //            {
-    //                TreeRenderBit& tb = *s_pBits[j];
-    //                //  caclulate render bit world transform
-    //                Matrix4D tm = tb.m_pObj->m_TM;
-    //                int hostBone = tb.m_pMesh->GetHostBone();
-    //                if (hostBone >= 0)
-    //                {
-    //                    tm *= tb.m_pMesh->GetModel()->m_Skeleton[hostBone].m_WorldTM;
-    //                }
-    //                //  copy indices
-    //                int cNIdx  = tb.m_RB.m_NIdx;
-    //                int cNVert = tb.m_RB.m_NVert;
-    //                tb.m_pMesh->InstanceIndices( (BYTE*)pCurI, NULL );
-    //                for (int k = 0; k < cNIdx; k++) pCurI[k] += cV;
-    //                tb.m_pMesh->InstanceVertices( pCurV, NULL );
-    //                VertexIterator vit;
-    //                vit.reset( pCurV, cNVert, vDecl );
-    //                while (vit)
-    //                {
-    //                    tm.transformPt( vit.pos() );
-    //                    tm.transformVec( vit.normal() );
-    //                    ++vit;
-    //                }
-    //                pCurV += cNVert*vStride;
-    //                pCurI += cNIdx;
-    //                cV    += cNVert;
-    //            }
-
-    //            WORD* pIdx = (WORD*)IRS->LockAppendIB( ibID, nInd, pRB->m_FirstIdx, pRB->m_IBufStamp );
-    //            if (!pIdx) return false;
-    //            memcpy( pIdx, &pITmp[0], nInd*2 );
-    //            IRS->UnlockIB( ibID );
-
-    //            BYTE* pVert = IRS->LockAppendVB( vbID, nVert, pRB->m_FirstVert, pRB->m_VBufStamp );
-    //            if (!pVert) return false;
-    //            memcpy( pVert, &pVTmp[0], nVBytes );
-    //            IRS->UnlockVB( vbID );
-
-    //            if (i == nBits) break;
-    //        }
-    //        block.m_RenderBits.push_back( crb );
-    //        pRB             = &block.m_RenderBits.back();
-    //        pRB->m_VBufID   = vbID;
-    //        pRB->m_IBufID   = ibID;
-    //        pRB->m_bHasTM   = true;
-    //        float cx = block.m_Key.m_Ext.GetCenterX();
-    //        float cy = block.m_Key.m_Ext.GetCenterY();
-    //        float cz = ITerra->GetH( cx, cy );
-    //        pRB->m_TM.translation( cx, cy, cz );
-
-    //        nVert   = crb.m_NVert;
-    //        nInd    = crb.m_NIdx;
-    //        lastBit = i;
-    //    }
-    //    else
-    //    {
-    //        nVert += crb.m_NVert;
-    //        nInd  += crb.m_NIdx;
-    //    }
-    //}
+    static TreesGeometry s_Geom;
+    FillGeometry( trees, nTrees, m_Meshes, s_Geom );
+    if (s_Geom.m_Missing.size() > 0)
+    {
+        for (int i = 0; i < s_Geom.m_Missing.size(); i++) m_Meshes.Resolve( s_Geom.m_Missing[i] );
+        FillGeometry( trees, nTrees, m_Meshes, s_Geom );
+    }
+    return BakeTreesGeometry( block, s_Geom );
+} // TreesRenderer::BakeTreesGeometry
+
+bool TreesRenderer::BakeTreesGeometry( TreesBlock& block, const TreesGeometry& geom )
+{
+    static int vbID = -1;
+    static int ibID = -1;
+
+    if (vbID == -1) vbID = IRS->CreateVB( "TreesGeometry", c_TreesVBufferBytes, -1, false );
+    if (ibID == -1) ibID = IRS->CreateIB( "TreesGeometry", c_TreesIBufferBytes, isWORD, false );
+
+    for (int i = 0; i < geom.m_Runs.size(); i++)
+    {
+        const TreesGeomRun& run  = geom.m_Runs[i];
+        const BaseMesh&     mesh = *run.m_pMesh;
+        VertexDeclaration vDecl  = CreateVertexDeclaration( mesh.getVertexFormat() );
+
+        block.m_RenderBits.push_back( RenderTask() );
+        RenderTask& rb = block.m_RenderBits.back();
+        rb.m_Pass           = 0;
+        rb.m_ShaderID       = mesh.getShader();
+        rb.m_TexID[0]       = mesh.getTexture( 0 );
+        rb.m_VBufID         = vbID;
+        rb.m_VType          = IRS->RegisterVType( vDecl );
+        rb.m_IBufID         = ibID;
+        rb.m_PriType        = ptTriangleList;
+        rb.m_bHasTM         = false;
+        rb.m_bTransparent   = false;
+        rb.m_Source         = "TreesGeometry";
+        rb.m_NVert          = run.m_NVert;
+        rb.m_NIdx           = run.m_NIdx;
+
+        IRS->SetVB( vbID, rb.m_VType );
+        BYTE* pVert = IRS->LockAppendVB( vbID, rb.m_NVert, rb.m_FirstVert, rb.m_VBufStamp );
+        if (!pVert) return false;
+        memcpy( pVert, &geom.m_Vert[run.m_VertOffset], rb.m_NVert*vDecl.m_VertexSize );
+        IRS->UnlockVB( vbID );
+
+        WORD* pIdx = (WORD*)IRS->LockAppendIB( ibID, rb.m_NIdx, rb.m_FirstIdx, rb.m_IBufStamp );
+        if (!pIdx) return false;
+        memcpy( pIdx, &geom.m_Idx[run.m_FirstIdx], rb.m_NIdx*sizeof( WORD ) );
+        IRS->UnlockIB( ibID );
+    }
     return true;
 } // TreesRenderer::BakeTreesGeometry
 
+void TreesRenderer::FillBillboards( Vertex2t* v, const TreeObject* trees, int nTrees )
+{
+    for (int i = 0; i < nTrees; i++)
+    {
+        const Matrix4D& tm = trees[i].m_TM;
+        Vector3D pos( tm.getTranslation() );
+        float scale = sqrtf( tm.e20*tm.e20 + tm.e21*tm.e21 + tm.e22*tm.e22 );
+        float hh = c_TreeBillboardHeight*scale;
+        float hw = hh*0.5f;
+
+        for (int j = 0; j < 4; j++)
+        {
+            v[j].x          = pos.x;
+            v[j].y          = pos.y;
+            v[j].z          = pos.z;
+            v[j].diffuse    = 0xFFFFFF00;
+            v[j].u          = float( j&1 );
+            v[j].v          = float( j >> 1 );
+            v[j].u2         = (j&1) ? hw : -hw;
+            v[j].v2         = (j >> 1) ? 0.0f : hh;
+        }
+        v += 4;
+    }
+} // TreesRenderer::FillBillboards
+
 bool TreesRenderer::BakeTreesBillboards( TreesBlock& block, const TreeObject* trees, int nTrees )
+{
+    static std::vector<Vertex2t> s_Vert;
+    s_Vert.resize( nTrees*4 );
+    FillBillboards( &s_Vert[0], trees, nTrees );
+    return BakeTreesBillboards( block, &s_Vert[0], nTrees );
+} // TreesRenderer::BakeTreesBillboards
+
+bool TreesRenderer::BakeTreesBillboards( TreesBlock& block, const Vertex2t* vert, int nTrees )
 {
     static int vbID = -1;
     static int ibID = -1;
@@ -243,59 +473,7 @@ bool TreesRenderer::BakeTreesBillboards( TreesBlock& block, const TreeObject* tr
     IRS->SetVB( rb.m_VBufID, rb.m_VType );
     BYTE* pVert         = IRS->LockAppendVB( rb.m_VBufID, rb.m_NVert, rb.m_FirstVert, rb.m_VBufStamp );
     if (!pVert) return false; 
-    Vertex2t* v = (Vertex2t*)pVert;
-    for (int i = 0; i < nTrees; i++)
-    {
-        const TreeObject& obj = trees[i];
-        Vector3D pos( obj.m_TM.getTranslation() );
-
-        /*
-        ModelObject* pModel = IModelMgr->GetModel( obj.m_ModelID );
-        if (!pModel) continue;
-        AABoundBox aabb = pModel->GetAABB();
-        aabb.Transform( obj.m_TM );
-        float hh = aabb.GetDY()*2.0f;
-        float hw = hh*0.5f;
-        
-        v[0].x  = pos.x;
-        v[0].y  = pos.y;
-        v[0].z  = pos.z;
-        v[0].diffuse = 0xFFFFFF00;
-        v[0].u  = 0.0f;
-        v[0].v  = 0.0f;
-        v[0].u2 = -hw;
-        v[0].v2 = hh;
-
-        v[1].x  = pos.x;
-        v[1].y  = pos.y;
-        v[1].z  = pos.z;
-        v[1].diffuse = 0xFFFFFF00;
-        v[1].u  = 1.0f;
-        v[1].v  = 0.0f;
-        v[1].u2 = hw;
-        v[1].v2 = hh;
-
-        v[2].x  = pos.x;
-        v[2].y  = pos.y;
-        v[2].z  = pos.z;
-        v[2].diffuse = 0xFFFFFF00;
-        v[2].u  = 0.0f;
-        v[2].v  = 1.0f;
-        v[2].u2 = -hw;
-        v[2].v2 = 0.0f;
-
-        v[3].x  = pos.x;
-        v[3].y  = pos.y;
-        v[3].z  = pos.z;
-        v[3].diffuse = 0xFFFFFF00;
-        v[3].u  = 1.0f;
-        v[3].v  = 1.0f;
-        v[3].u2 = hw;
-        v[3].v2 = 0.0f;
-        */
-
-        v += 4;
-    }
+    memcpy( pVert, vert, rb.m_NVert*vStride );
     IRS->UnlockVB( rb.m_VBufID );
 
     rb.m_NIdx           = nTrees*6;
@@ -321,6 +499,7 @@ bool TreesRenderer::BakeTreesBillboards( TreesBlock& block, const TreeObject* tr
 bool TreesRenderer::CreateTreesBlock( TreesBlock& block )
 {
     static TreesArray s_TreeList;
+    block.m_bBuilt = true;
     if (!ITreesDB) return false;
     ITreesDB->GetTreesInArea( block.m_Key.m_Ext, s_TreeList );
     block.m_RenderBits.clear();
@@ -392,4 +571,409 @@ void EcotopeTreesDB::Expose( PropertyMap& pm )
     pm.start( "EcotopeTreesDB", this );
 } // EcotopeTreesDB::Expose
 
+/*****************************************************************************/
+/*  TreesGridDB implementation
+/*****************************************************************************/
+TreesGridDB g_TreesGridDB;
 
+TreesGridDB::TreesGridDB()
+{
+    Clear();
+}
+
+void TreesGridDB::Clear()
+{
+    m_Extents   = Rct( 0.0f, 0.0f, 0.0f, 0.0f );
+    m_TileSide  = 0.0f;
+    m_NTilesX   = 0;
+    m_NTilesY   = 0;
+    m_Tiles.clear();
+    m_Trees.clear();
+    m_ModelID.clear();
+} // TreesGridDB::Clear
+
+void TreesGridDB::Encode( const Matrix4D& tm, const TreesTile& tile, float tx, float ty, TreeRecord& rec ) const
+{
+    float scale = sqrtf( tm.e20*tm.e20 + tm.e21*tm.e21 + tm.e22*tm.e22 );
+    float iscale = (scale > c_SpaceEpsilon) ? 1.0f/scale : 0.0f;
+    float ang = atan2f( tm.e01, tm.e00 );
+    if (ang < 0.0f) ang += c_DoublePI;
+
+    float fx = (tm.e30 - tx)*65535.0f/m_TileSide + 0.5f;
+    float fy = (tm.e31 - ty)*65535.0f/m_TileSide + 0.5f;
+    float fz = (tm.e32 - tile.m_MinZ)/tile.m_ZStep + 0.5f;
+    float fs = scale/c_TreeScaleStep + 0.5f;
+    float ftx = tm.e20*iscale/c_TreeTiltStep;
+    float fty = tm.e21*iscale/c_TreeTiltStep;
+    clamp( fx, 0.0f, 65535.0f );
+    clamp( fy, 0.0f, 65535.0f );
+    clamp( fz, 0.0f, 65535.0f );
+    clamp( fs, 0.0f, 255.0f );
+    clamp( ftx, -127.0f, 127.0f );
+    clamp( fty, -127.0f, 127.0f );
+
+    rec.m_X     = WORD( fx );
+    rec.m_Y     = WORD( fy );
+    rec.m_Z     = WORD( fz );
+    rec.m_Angle = BYTE( int( ang*256.0f/c_DoublePI + 0.5f )&0xFF );
+    rec.m_Scale = BYTE( fs );
+    rec.m_TiltX = char( ftx >= 0.0f ? ftx + 0.5f : ftx - 0.5f );
+    rec.m_TiltY = char( fty >= 0.0f ? fty + 0.5f : fty - 0.5f );
+} // TreesGridDB::Encode
+
+void TreesGridDB::Decode( const TreeRecord& rec, const TreesTile& tile, float tx, float ty, Matrix4D& tm ) const
+{
+    float scale = float( rec.m_Scale )*c_TreeScaleStep;
+    Vector3D up( float( rec.m_TiltX )*c_TreeTiltStep, float( rec.m_TiltY )*c_TreeTiltStep, 0.0f );
+    up.z = sqrtf( 1.0f - up.x*up.x - up.y*up.y );
+
+    //  heading is projected to the plane orthogonal to the tilted up axis
+    float ang = float( rec.m_Angle )*c_DoublePI/256.0f;
+    Vector3D ax( cosf( ang ), sinf( ang ), 0.0f );
+    ax.addWeighted( up, -ax.dot( up ) );
+    ax.normalize();
+    Vector3D ay;
+    ay.cross( up, ax );
+
+    float cs = m_TileSide/65535.0f;
+    tm = Matrix4D(  ax.x*scale, ax.y*scale, ax.z*scale, 0.0f,
+                    ay.x*scale, ay.y*scale, ay.z*scale, 0.0f,
+                    up.x*scale, up.y*scale, up.z*scale, 0.0f,
+                    tx + float( rec.m_X )*cs, 
+                    ty + float( rec.m_Y )*cs, 
+                    tile.m_MinZ + float( rec.m_Z )*tile.m_ZStep, 1.0f );
+} // TreesGridDB::Decode
+
+void TreesGridDB::Build( const TreeObject* trees, int nTrees, const Rct& ext, float tileSide )
+{
+    Clear();
+    if (tileSide <= 0.0f || ext.w <= 0.0f || ext.h <= 0.0f) return;
+    m_Extents   = ext;
+    m_TileSide  = tileSide;
+    m_NTilesX   = tmax( 1, int( ceilf( ext.w/tileSide ) ) );
+    m_NTilesY   = tmax( 1, int( ceilf( ext.h/tileSide ) ) );
+    int nTiles  = m_NTilesX*m_NTilesY;
+    m_Tiles.resize( nTiles );
+
+    //  trees are bucketed by tile with the counting sort, tile height range is found on the way
+    std::vector<int>    treeTile( nTrees );
+    std::vector<float>  maxZ( nTiles, -FLT_MAX );
+    std::map<int, int>  modelIdx;
+    for (int i = 0; i < nTiles; i++)
+    {
+        m_Tiles[i].m_First  = 0;
+        m_Tiles[i].m_NTrees = 0;
+        m_Tiles[i].m_MinZ   = FLT_MAX;
+        m_Tiles[i].m_ZStep  = 0.0f;
+    }
+    for (int i = 0; i < nTrees; i++)
+    {
+        const Matrix4D& tm = trees[i].m_TM;
+        int tx = int( floorf( (tm.e30 - ext.x)/tileSide ) );
+        int ty = int( floorf( (tm.e31 - ext.y)/tileSide ) );
+        if (tx < 0 || ty < 0 || tx >= m_NTilesX || ty >= m_NTilesY)
+        {
+            treeTile[i] = -1;
+            continue;
+        }
+        int tIdx = tx + ty*m_NTilesX;
+        TreesTile& tile = m_Tiles[tIdx];
+        treeTile[i] = tIdx;
+        tile.m_NTrees++;
+        if (tm.e32 < tile.m_MinZ) tile.m_MinZ = tm.e32;
+        if (tm.e32 > maxZ[tIdx])  maxZ[tIdx]  = tm.e32;
+        if (modelIdx.find( trees[i].m_ModelID ) == modelIdx.end())
+        {
+            modelIdx[trees[i].m_ModelID] = m_ModelID.size();
+            m_ModelID.push_back( trees[i].m_ModelID );
+        }
+    }
+
+    int nRecords = 0;
+    for (int i = 0; i < nTiles; i++)
+    {
+        TreesTile& tile = m_Tiles[i];
+        tile.m_First = nRecords;
+        nRecords += tile.m_NTrees;
+        if (tile.m_NTrees == 0) tile.m_MinZ = 0.0f;
+        tile.m_ZStep = tmax( (maxZ[i] - tile.m_MinZ)/65535.0f, c_SpaceEpsilon );
+        //  used as the fill cursor below
+        tile.m_NTrees = 0;
+    }
+
+    m_Trees.resize( nRecords );
+    for (int i = 0; i < nTrees; i++)
+    {
+        int tIdx = treeTile[i];
+        if (tIdx < 0) continue;
+        TreesTile& tile = m_Tiles[tIdx];
+        TreeRecord& rec = m_Trees[tile.m_First + tile.m_NTrees];
+        tile.m_NTrees++;
+        float tx = ext.x + float( tIdx%m_NTilesX )*tileSide;
+        float ty = ext.y + float( tIdx/m_NTilesX )*tileSide;
+        Encode( trees[i].m_TM, tile, tx, ty, rec );
+        rec.m_Model = WORD( modelIdx[trees[i].m_ModelID] );
+    }
+} // TreesGridDB::Build
+
+void TreesGridDB::Build( ITreesDataBase* pSrc, const Rct& ext, float tileSide )
+{
+    if (!pSrc || pSrc == this) return;
+    static TreesArray s_Area;
+    std::vector<TreeObject> trees;
+    int nTilesX = int( ceilf( ext.w/tileSide ) );
+    int nTilesY = int( ceilf( ext.h/tileSide ) );
+    for (int j = 0; j < nTilesY; j++)
+    {
+        for (int i = 0; i < nTilesX; i++)
+        {
+            Rct area( ext.x + i*tileSide, ext.y + j*tileSide, tileSide, tileSide );
+            if (!pSrc->GetTreesInArea( area, s_Area )) continue;
+            //  procedural sources may place trees outside of the queried area
+            for (int k = 0; k < s_Area.size(); k++)
+            {
+                const Matrix4D& tm = s_Area[k].m_TM;
+                if (tm.e30 < area.x || tm.e30 >= area.GetRight() ||
+                    tm.e31 < area.y || tm.e31 >= area.GetBottom()) continue;
+                trees.push_back( s_Area[k] );
+            }
+        }
+    }
+    Build( trees.size() ? &trees[0] : NULL, trees.size(), ext, tileSide );
+} // TreesGridDB::Build
+
+bool TreesGridDB::GetTreesInArea( const Rct& area, TreesArray& trees, int LOD )
+{
+    trees.clear();
+    if (m_Tiles.size() == 0) return false;
+
+    int tx0 = int( floorf( (area.x - m_Extents.x)/m_TileSide ) );
+    int ty0 = int( floorf( (area.y - m_Extents.y)/m_TileSide ) );
+    int tx1 = int( floorf( (area.GetRight()  - m_Extents.x)/m_TileSide ) );
+    int ty1 = int( floorf( (area.GetBottom() - m_Extents.y)/m_TileSide ) );
+    clamp( tx0, 0, m_NTilesX - 1 );
+    clamp( ty0, 0, m_NTilesY - 1 );
+    clamp( tx1, 0, m_NTilesX - 1 );
+    clamp( ty1, 0, m_NTilesY - 1 );
+
+    float cs = m_TileSide/65535.0f;
+    for (int j = ty0; j <= ty1; j++)
+    {
+        for (int i = tx0; i <= tx1; i++)
+        {
+            const TreesTile& tile = m_Tiles[i + j*m_NTilesX];
+            if (tile.m_NTrees == 0) continue;
+            float tx = m_Extents.x + float( i )*m_TileSide;
+            float ty = m_Extents.y + float( j )*m_TileSide;
+            //  areas are half-open, so the trees on the shared border go to one block only
+            bool bInside = (tx >= area.x && ty >= area.y && 
+                            tx + m_TileSide < area.GetRight() && ty + m_TileSide < area.GetBottom());
+            const TreeRecord* rec = &m_Trees[tile.m_First];
+            for (int k = 0; k < tile.m_NTrees; k++)
+            {
+                if (!bInside)
+                {
+                    float x = tx + float( rec[k].m_X )*cs;
+                    float y = ty + float( rec[k].m_Y )*cs;
+                    if (x < area.x || x >= area.GetRight() || y < area.y || y >= area.GetBottom()) continue;
+                }
+                if (trees.size() == trees.capacity()) return true;
+                TreeObject& obj = trees.push_back( TreeObject() );
+                obj.m_ModelID = m_ModelID[rec[k].m_Model];
+                Decode( rec[k], tile, tx, ty, obj.m_TM );
+            }
+        }
+    }
+    return true;
+} // TreesGridDB::GetTreesInArea
+
+int TreesGridDB::GetMemoryBytes() const
+{
+    return  m_Trees.size()*sizeof( TreeRecord ) + 
+            m_Tiles.size()*sizeof( TreesTile ) + 
+            m_ModelID.size()*sizeof( int );
+} // TreesGridDB::GetMemoryBytes
+
+bool TreesGridDB::Save( const char* fname ) const
+{
+    FOutStream os( fname );
+    if (os.NoFile())
+    {
+        Log.Warning( "Could not write trees database <%s>", fname );
+        return false;
+    }
+    TreesDBHeader hdr;
+    hdr.m_Magic     = c_TreesDBMagic;
+    hdr.m_Version   = c_TreesDBVersion;
+    hdr.m_Extents   = m_Extents;
+    hdr.m_TileSide  = m_TileSide;
+    hdr.m_NTilesX   = m_NTilesX;
+    hdr.m_NTilesY   = m_NTilesY;
+    hdr.m_NModels   = m_ModelID.size();
+    hdr.m_NTrees    = m_Trees.size();
+    os.Write( &hdr, sizeof( hdr ) );
+    //  models are stored by name, their IDs differ between the sessions
+    for (int i = 0; i < m_ModelID.size(); i++)
+    {
+        const char* name = (m_ModelID[i] >= 0) ? IMM->GetModelFileName( m_ModelID[i] ) : NULL;
+        if (!name) name = "";
+        os.Write( name, strlen( name ) + 1 );
+    }
+    if (m_Tiles.size() > 0) os.Write( &m_Tiles[0], m_Tiles.size()*sizeof( TreesTile ) );
+    if (m_Trees.size() > 0) os.Write( &m_Trees[0], m_Trees.size()*sizeof( TreeRecord ) );
+    os.CloseFile();
+    return true;
+} // TreesGridDB::Save
+
+bool TreesGridDB::Load( const char* fname )
+{
+    Clear();
+    FInStream is( fname );
+    if (is.NoFile()) return false;
+    //  counts are bounded by the file size before anything is allocated
+    int fileSize = is.GetFileSize();
+    TreesDBHeader hdr;
+    if (is.Read( &hdr, sizeof( hdr ) ) != sizeof( hdr ) ||
+        hdr.m_Magic != c_TreesDBMagic || hdr.m_Version != c_TreesDBVersion ||
+        hdr.m_NTilesX <= 0 || hdr.m_NTilesY <= 0 || hdr.m_TileSide <= 0.0f ||
+        hdr.m_NTilesX > fileSize/sizeof( TreesTile ) || 
+        hdr.m_NTilesY > fileSize/sizeof( TreesTile )/hdr.m_NTilesX ||
+        hdr.m_NTrees < 0 || hdr.m_NTrees > fileSize/sizeof( TreeRecord ) ||
+        hdr.m_NModels < 0 || hdr.m_NModels > fileSize - sizeof( hdr ))
+    {
+        Log.Warning( "Invalid trees database <%s>", fname );
+        return false;
+    }
+    for (int i = 0; i < hdr.m_NModels; i++)
+    {
+        std::string name;
+        char ch = 0;
+        while (is.Read( &ch, 1 ) == 1 && ch != 0) name += ch;
+        m_ModelID.push_back( name.size() ? (int)IMM->GetModelID( name.c_str() ) : -1 );
+    }
+    m_Tiles.resize( hdr.m_NTilesX*hdr.m_NTilesY );
+    m_Trees.resize( hdr.m_NTrees );
+    int nTileBytes = m_Tiles.size()*sizeof( TreesTile );
+    int nTreeBytes = m_Trees.size()*sizeof( TreeRecord );
+    if (is.Read( &m_Tiles[0], nTileBytes ) != nTileBytes ||
+        (nTreeBytes > 0 && is.Read( &m_Trees[0], nTreeBytes ) != nTreeBytes))
+    {
+        Log.Warning( "Trees database <%s> is truncated", fname );
+        Clear();
+        return false;
+    }
+    int nTrees  = m_Trees.size();
+    int nModels = m_ModelID.size();
+    bool bValid = true;
+    for (int i = 0; i < m_Tiles.size() && bValid; i++)
+    {
+        const TreesTile& tile = m_Tiles[i];
+        bValid = (tile.m_First >= 0 && tile.m_NTrees >= 0 && tile.m_NTrees <= nTrees - tile.m_First);
+        for (int j = 0; j < tile.m_NTrees && bValid; j++)
+        {
+            bValid = (m_Trees[tile.m_First + j].m_Model < nModels);
+        }
+    }
+    if (!bValid)
+    {
+        Log.Warning( "Trees database <%s> is corrupt", fname );
+        Clear();
+        return false;
+    }
+    m_Extents   = hdr.m_Extents;
+    m_TileSide  = hdr.m_TileSide;
+    m_NTilesX   = hdr.m_NTilesX;
+    m_NTilesY   = hdr.m_NTilesY;
+    return true;
+} // TreesGridDB::Load
+
+void TreesGridDB::Expose( PropertyMap& pm )
+{
+    pm.start( "TreesGridDB", this );
+    pm.p( "NumTrees",       &TreesGridDB::GetNTrees         );
+    pm.p( "MemoryBytes",    &TreesGridDB::GetMemoryBytes    );
+} // TreesGridDB::Expose
+
+bool LoadMapTreesDB( const char* mapFile )
+{
+    //  bake threads may be reading the grid database, it is detached before being rewritten
+    ITrees->SetDataBase( NULL );
+    FilePath path( mapFile );
+    path.SetExt( c_TreesDBExt );
+    if (!g_TreesGridDB.Load( path ))
+    {
+        ITrees->SetDataBase( &g_Ecotope );
+        return false;
+    }
+    Log.Info( "Loaded %d trees from <%s>", g_TreesGridDB.GetNTrees(), (const char*)path );
+    ITrees->SetDataBase( &g_TreesGridDB );
+    return true;
+} // LoadMapTreesDB
+
+bool BakeMapTreesDB( const char* mapFile )
+{
+    ITrees->SetDataBase( NULL );
+    FilePath path( mapFile );
+    path.SetExt( c_TreesDBExt );
+    Rct ext = ITerra ? ITerra->GetExtents() : Rct( 0.0f, 0.0f, 0.0f, 0.0f );
+    g_TreesGridDB.Build( &g_Ecotope, ext, c_TreesDBTileSide );
+    bool bRes = (g_TreesGridDB.GetNTrees() > 0 && g_TreesGridDB.Save( path ));
+    if (bRes) Log.Info( "Baked %d trees to <%s>", g_TreesGridDB.GetNTrees(), (const char*)path );
+    else Log.Warning( "Could not bake trees database <%s>", (const char*)path );
+    ITrees->SetDataBase( bRes ? (ITreesDataBase*)&g_TreesGridDB : (ITreesDataBase*)&g_Ecotope );
+    return bRes;
+} // BakeMapTreesDB
+
+void BenchmarkTreesDB( int nTrees, float mapSide, float blockSide )
+{
+    Rct ext( -mapSide*0.5f, -mapSide*0.5f, mapSide, mapSide );
+
+    //  deterministic random forest
+    std::vector<TreeObject> trees( nTrees );
+    rndInit( nTrees );
+    for (int i = 0; i < nTrees; i++)
+    {
+        Vector3D axis( rndValuef( -0.05f, 0.05f ), rndValuef( -0.05f, 0.05f ), 0.0f );
+        axis.z = sqrtf( 1.0f - axis.x*axis.x - axis.y*axis.y );
+        Vector3D pos( rndValuef( ext.x, ext.GetRight() ), rndValuef( ext.y, ext.GetBottom() ), rndValuef( 0.0f, 1000.0f ) );
+        trees[i].m_ModelID = i%4;
+        trees[i].m_TM.srt( rndValuef( 0.3f, 1.1f ), axis, rndValuef( 0.0f, c_DoublePI ), pos );
+    }
+
+    TreesGridDB db;
+    Timer timer;
+    timer.start();
+    db.Build( &trees[0], nTrees, ext, blockSide*0.5f );
+    float buildMs = float( timer.seconds()*1000.0 );
+
+    //  query every block of the map, as streaming the whole map in would do
+    static TreesArray s_Area;
+    int nBlocks = 0;
+    int nFound  = 0;
+    int nSide   = int( mapSide/blockSide );
+    timer.start();
+    for (int j = 0; j < nSide; j++)
+    {
+        for (int i = 0; i < nSide; i++)
+        {
+            db.GetTreesInArea( Rct( ext.x + i*blockSide, ext.y + j*blockSide, blockSide, blockSide ), s_Area );
+            nFound += s_Area.size();
+            nBlocks++;
+        }
+    }
+    float queryMs = float( timer.seconds()*1000.0 );
+
+    char fname[_MAX_PATH];
+    sprintf( fname, "trees_bench_%d.%s", nTrees, c_TreesDBExt );
+    db.Save( fname );
+    timer.start();
+    TreesGridDB loaded;
+    loaded.Load( fname );
+    float loadMs = float( timer.seconds()*1000.0 );
+    DeleteFile( fname );
+
+    Log.Info( "Trees database, %d trees: %d KB (%d KB unpacked), build %.1f ms, "
+              "%d blocks queried in %.1f ms (%.2f us/tree, %d found), load %.1f ms",
+              nTrees, db.GetMemoryBytes()/1024, int( nTrees*sizeof( TreeObject )/1024 ),
+              buildMs, nBlocks, queryMs, nFound ? queryMs*1000.0f/nFound : 0.0f, nFound, loadMs );
+} // BenchmarkTreesDB
@@ -9,6 +9,8 @@
 
 #include "kHash.hpp"
 #include "kStaticArray.hpp"
+#include "kBakeQueue.hpp"
+#include <map>
 
 /*****************************************************************************/
 /*  Struct: TreeObject
@@ -51,12 +53,117 @@ struct TreesBlock
     bool                            m_bEmpty;
     int                             m_NObj;
     std::vector<RenderTask>          m_RenderBits;
+    DWORD                           m_LastFrame;    //  last frame block was rendered at
+    bool                            m_bBaking;      //  block contents are being built on the bake thread
+    bool                            m_bBuilt;       //  block contents were created at least once
 
-    TreesBlock() : m_bEmpty(false), m_NObj(0) {}
+    TreesBlock() : m_bEmpty(false), m_NObj(0), m_LastFrame(0), m_bBaking(false), m_bBuilt(false) {}
 
 }; // class TreesBlock
 
 typedef StaticHash<TreesBlock, TreesBlock::Key>    TreesBlockHash;
+
+const int c_MaxTreesInArea = 16384;
+typedef static_array<TreeObject, c_MaxTreesInArea> TreesArray;
+
+const int   c_MaxTreesBakeThreads       = 2;
+const int   c_MaxTreesBakeRequests      = 16;
+const int   c_MaxResidentTreeBlocks     = 1024;
+const float c_TreeBillboardHeight       = 400.0f;   //  billboard height of the unscaled tree
+
+class BaseMesh;
+/*****************************************************************************/
+/*  Struct: TreesGeomRun
+/*  Desc:   Geometry of one tree mesh in the baked block, drawn with a single call
+/*****************************************************************************/
+struct TreesGeomRun
+{
+    const BaseMesh*             m_pMesh;        //  source mesh, gives shader, texture and vertex format
+    int                         m_VertOffset;   //  in bytes, vertex strides differ between the runs
+    int                         m_NVert;
+    int                         m_FirstIdx;
+    int                         m_NIdx;
+}; // struct TreesGeomRun
+
+/*****************************************************************************/
+/*  Struct: TreesGeometry
+/*  Desc:   World space meshes of the block trees, indices are run-relative
+/*****************************************************************************/
+struct TreesGeometry
+{
+    std::vector<BYTE>           m_Vert;
+    std::vector<WORD>           m_Idx;
+    std::vector<TreesGeomRun>   m_Runs;
+    std::vector<int>            m_Missing;      //  models which meshes were not resolved yet
+
+    void Clear() { m_Vert.clear(); m_Idx.clear(); m_Runs.clear(); m_Missing.clear(); }
+}; // struct TreesGeometry
+
+/*****************************************************************************/
+/*  Class:  TreesMeshTable
+/*  Desc:   Meshes of the tree models. Models are loaded on the render thread
+/*          only, bake threads look their meshes up and report the missing ones
+/*****************************************************************************/
+class TreesMeshTable
+{
+public:
+                                TreesMeshTable  ();
+                                ~TreesMeshTable ();
+
+    //  false when the model was not resolved yet, may be called from the bake threads
+    bool                        Find            ( int modelID, std::vector<const BaseMesh*>& meshes );
+    //  loads the model, render thread only
+    void                        Resolve         ( int modelID );
+    //  models may be reloaded, so the table is dropped together with the blocks
+    void                        Clear           ();
+
+private:
+    CRITICAL_SECTION                                m_Lock;
+    std::map<int, std::vector<const BaseMesh*> >    m_Meshes;
+}; // class TreesMeshTable
+
+/*****************************************************************************/
+/*  Struct: TreesBakeRequest
+/*  Desc:   Trees block contents built on the bake thread
+/*****************************************************************************/
+struct TreesBakeRequest
+{
+    TreesBlock::Key             m_Key;
+    bool                        m_bResult;
+    int                         m_NTrees;
+    TreesGeometry               m_Geom;         //  meshes of the geometry lods
+    std::vector<Vertex2t>       m_Vert;         //  billboard quads of the impostor lods
+}; // struct TreesBakeRequest
+
+typedef BakeQueue<TreesBakeRequest, c_MaxTreesBakeRequests, c_MaxTreesBakeThreads> TreesBakeQueue;
+
+class ITreesDataBase;
+/*****************************************************************************/
+/*  Class:  TreesBaker
+/*  Desc:   Worker threads querying the trees database and building blocks,
+/*          requests are taken in the order they came
+/*****************************************************************************/
+class TreesBaker : public TreesBakeQueue
+{
+public:
+                            TreesBaker      ();
+
+    void                    Start           ( ITreesDataBase* pDB, TreesMeshTable* pMeshes, int nThreads );
+    //  waits for the bakes in progress, pending and finished requests are dropped
+    void                    Stop            ();
+    ITreesDataBase*         GetDB           () const { return m_pDB; }
+
+    bool                    Request         ( const TreesBlock::Key& key );
+
+protected:
+    virtual void            Bake            ( TreesBakeRequest* pReq, int worker );
+
+private:
+    ITreesDataBase*                     m_pDB;
+    TreesMeshTable*                     m_pMeshes;
+    TreesArray                          m_Area[c_MaxTreesBakeThreads];  //  query buffers, too big for the worker stack
+}; // class TreesBaker
+
 /*****************************************************************************/
 /*    Class:    TreesRenderer
 /*    Desc:    
@@ -65,6 +172,11 @@ class TreesRenderer
 {
     TreesBlockHash  m_BlockHash;
     int             m_NTreesRendered;
+    TreesBaker      m_Baker;
+    TreesMeshTable  m_Meshes;
+    int             m_NBakeThreads;
+    int             m_MaxBlocks;        //  resident blocks limit, least recently used are evicted
+    DWORD           m_CurFrame;
 
 public:
                     TreesRenderer       ();
@@ -72,15 +184,32 @@ public:
     virtual int     GetNTreesRendered   () const { return m_NTreesRendered; }
     virtual void    Reset               () { m_NTreesRendered = 0; }
 
+    void            SetNBakeThreads     ( int nThreads );
+    int             GetNBakeThreads     () const { return m_NBakeThreads; }
+    void            SetMaxBlocks        ( int nBlocks ) { m_MaxBlocks = nBlocks; }
+    //  waits for the bake threads and drops the blocks, so the previous 
+    //  database may be modified once this returns
+    void            SetDataBase         ( ITreesDataBase* pDB );
+    int             GetNBlocks          () const { return m_BlockHash.numElem(); }
+
+    //  fills impostor quads of the trees, used by the bake threads as well
+    static void     FillBillboards      ( Vertex2t* v, const TreeObject* trees, int nTrees );
+    //  transforms meshes of the trees to the world space, used by the bake threads as well
+    static void     FillGeometry        ( const TreeObject* trees, int nTrees, TreesMeshTable& meshes, TreesGeometry& geom );
+
 protected:
     bool            CreateTreesBlock    ( TreesBlock& block );
     bool            BakeTreesBillboards ( TreesBlock& block, const TreeObject* trees, int nTrees );
+    bool            BakeTreesBillboards ( TreesBlock& block, const Vertex2t* vert, int nTrees );
     bool            BakeTreesGeometry   ( TreesBlock& block, const TreeObject* trees, int nTrees );
+    bool            BakeTreesGeometry   ( TreesBlock& block, const TreesGeometry& geom );
+
+    bool            UseBakeThreads      ();
+    void            UploadBakedBlocks   ();
+    void            EvictBlocks         ();
 
 }; // class TreesRenderer 
 
-const int c_MaxTreesInArea = 16384;
-typedef static_array<TreeObject, c_MaxTreesInArea> TreesArray;
 /*****************************************************************************/
 /*  Class:  ITreesDataBase
 /*  Desc:   Interface to the vegetation database
@@ -89,6 +218,8 @@ class ITreesDataBase
 {
 public:
     virtual bool GetTreesInArea( const Rct& area, TreesArray& trees, int LOD = 0 ) = 0;
+    //  true when GetTreesInArea may be called from the trees bake threads
+    virtual bool IsThreadSafe  () const { return false; }
 }; // class ITreesDataBase
 
 /*****************************************************************************/
@@ -104,6 +235,104 @@ public:
 
 }; // class ITreesDataBase
 
+/*****************************************************************************/
+/*  Struct: TreeRecord
+/*  Desc:   Quantized tree instance of the trees grid database
+/*****************************************************************************/
+struct TreeRecord
+{
+    WORD        m_X;        //  position in the tile, 1/65535 of the tile side
+    WORD        m_Y;
+    WORD        m_Z;        //  height in the tile height range
+    WORD        m_Model;    //  index in the database model table
+    BYTE        m_Angle;    //  rotation around the up axis, 1/256 of the full turn
+    BYTE        m_Scale;    //  uniform scale, c_TreeScaleStep units
+    char        m_TiltX;    //  up axis deviation from the vertical, c_TreeTiltStep units
+    char        m_TiltY;
+}; // struct TreeRecord
+
+const float c_TreeScaleStep     = 4.0f/255.0f;
+const float c_TreeTiltStep      = 0.25f/127.0f;
+
+/*****************************************************************************/
+/*  Struct: TreesTile
+/*****************************************************************************/
+struct TreesTile
+{
+    int         m_First;    //  first record of the tile
+    int         m_NTrees;
+    float       m_MinZ;
+    float       m_ZStep;
+}; // struct TreesTile
+
+const DWORD c_TreesDBMagic      = 'BDRT';
+const DWORD c_TreesDBVersion    = 1;
+const char  c_TreesDBExt[]      = "tdb";
+const float c_TreesDBTileSide   = 1024.0f;
+
+/*****************************************************************************/
+/*  Struct: TreesDBHeader
+/*****************************************************************************/
+struct TreesDBHeader
+{
+    DWORD       m_Magic;        //  c_TreesDBMagic
+    DWORD       m_Version;      //  c_TreesDBVersion
+    Rct         m_Extents;
+    float       m_TileSide;
+    int         m_NTilesX;
+    int         m_NTilesY;
+    int         m_NModels;      //  number of zero-terminated model names following the header
+    int         m_NTrees;
+}; // struct TreesDBHeader
+
+/*****************************************************************************/
+/*  Class:  TreesGridDB
+/*  Desc:   Persistent vegetation store. Trees are kept as quantized records
+/*          bucketed by the uniform grid of tiles, so area queries touch only
+/*          the overlapped tiles and the whole map takes 12 bytes per tree.
+/*          Database is read by the trees bake threads without locking, it is
+/*          changed only when it is not set to the renderer
+/*****************************************************************************/
+class TreesGridDB : public IReflected, public ITreesDataBase
+{
+public:
+                    TreesGridDB     ();
+    virtual bool    GetTreesInArea  ( const Rct& area, TreesArray& trees, int LOD = 0 );
+    virtual bool    IsThreadSafe    () const { return true; }
+    virtual void    Expose          ( PropertyMap& pm );
+
+    void            Clear           ();
+    void            Build           ( const TreeObject* trees, int nTrees, const Rct& ext, float tileSide );
+    //  bakes the other, e.g. procedural, database contents
+    void            Build           ( ITreesDataBase* pSrc, const Rct& ext, float tileSide );
+    bool            Save            ( const char* fname ) const;
+    bool            Load            ( const char* fname );
+
+    int             GetNTrees       () const { return m_Trees.size(); }
+    int             GetMemoryBytes  () const;
+
+private:
+    //  tile origin is passed in, so it is not recomputed for every record
+    void            Encode          ( const Matrix4D& tm, const TreesTile& tile, float tx, float ty, TreeRecord& rec ) const;
+    void            Decode          ( const TreeRecord& rec, const TreesTile& tile, float tx, float ty, Matrix4D& tm ) const;
+
+    Rct                         m_Extents;
+    float                       m_TileSide;
+    int                         m_NTilesX;
+    int                         m_NTilesY;
+    std::vector<TreesTile>      m_Tiles;
+    std::vector<TreeRecord>     m_Trees;
+    std::vector<int>            m_ModelID;      //  model table, record model index -> model ID
+}; // class TreesGridDB
+
+//  loads the trees database stored next to the map file and makes it current,
+//  when the map has none the procedural database stays in use
+bool    LoadMapTreesDB      ( const char* mapFile );
+//  bakes the procedural database over the terrain extents and saves it next to the map file
+bool    BakeMapTreesDB      ( const char* mapFile );
+//  builds random databases of the given size and logs build, query and load timings
+void    BenchmarkTreesDB    ( int nTrees, float mapSide = 65536.0f, float blockSide = 2048.0f );
+
 extern TreesRenderer*       ITrees;
 extern ITreesDataBase*      ITreesDB;
 
@@ -9,25 +9,24 @@
 #include "kHash.hpp"
 #include "IMediaManager.h"
 #include "IShadowManager.h"
+#include "kTimer.h"
 
 //  global water interface pointer
 IWaterscape*        IWater;
 
 struct WaterQuad
 {
-    DWORD           m_IBStamp;
     DWORD           m_VBStamp;
-
-    int             m_IBPos;
     int             m_VBPos;
 
+    bool            m_bBaked;       //  vertex colors are in the cache
     bool            m_bNoWater;
             
     WaterQuad() { Free(); }
     void    Free()
     {
-        m_IBStamp   = 0;
         m_VBStamp   = 0;
+        m_bBaked    = false;
         m_bNoWater  = false;
     }
 }; // struct WaterQuad
@@ -37,6 +36,33 @@ const int c_WaterVBufferBytes = 1024*1024*8;
 const int c_WaterHQuads = 128;
 const int c_WaterWQuads = 64;
 const int c_WaterGridResolution = 8;
+const int c_WaterTreeLevels = 7;    //  quads are the level 0, top level nodes cover 64x64 quads
+
+/*****************************************************************************/
+/*  Struct: WaterStats
+/*  Desc:   Water rendering statistics of the last frame
+/*****************************************************************************/
+struct WaterStats
+{
+    int             m_NTested;      //  frustum tests of the nodes or quads
+    int             m_NQuads;       //  quads drawn
+    int             m_NVert;        //  vertices drawn
+    int             m_NPri;         //  triangles drawn
+    int             m_NBaked;       //  quads with colors queried from the terrain
+    int             m_NUploaded;    //  quads copied to the vertex buffer
+    float           m_CPUTime;      //  time spent in Render, sec
+}; // struct WaterStats
+
+struct WaterRenderContext
+{
+    Frustum         m_Frustum;
+    Rct             m_Ext;
+    float           m_QW, m_QH;
+    int             m_BegX, m_BegY;     //  quads range around the visible water area
+    int             m_EndX, m_EndY;
+    int             m_Shader;
+    int             m_TexID[3];
+}; // struct WaterRenderContext
 
 /*****************************************************************************/
 /*  Class:  Waterscape
@@ -55,6 +81,13 @@ class Waterscape : public IWaterscape
     BaseMesh                    m_BaseGrid;
     WaterQuad                   m_Quads[c_WaterHQuads*c_WaterWQuads];
 
+    DWORD                       m_GridIBStamp;      //  grid indices, shared by all quads
+    int                         m_GridIBPos;
+    std::vector<DWORD>          m_Colors;           //  baked vertex colors of the quads
+    std::vector<WORD>           m_NDry[c_WaterTreeLevels];  //  dry quads under the node, level 0 is unused
+    WaterStats                  m_Stats;
+    Timer                       m_Timer;
+
     WaterColorCB                GetWaterColor;
 	
 	bool						m_OrthoModeIsEnabled;
@@ -78,10 +111,19 @@ public:
 	
 	virtual void				SetBoilingCoef(const float BoilingCoef) { m_BoilingCoef = BoilingCoef; }
 
+    const WaterStats&           GetStats        () const { return m_Stats; }
+
+    static bool                 s_bQuadTree;        //  cull through the quad tree, not the flat quads scan
+
 protected:
-   
+    void                        MarkDry         ( int qx, int qy, int delta );
+    bool                        IsNodeDry       ( int level, int nx, int ny ) const;
+    bool                        BakeQuad        ( int qIdx, const Rct& qrct );
+    void                        RenderNode      ( int level, int nx, int ny, bool bInside, const WaterRenderContext& ctx );
+    void                        RenderQuad      ( int qx, int qy, const WaterRenderContext& ctx );
 }; // class Waterscape
 Waterscape      g_Water;
+bool            Waterscape::s_bQuadTree = true;
 
 //-----------------------------------------------------------------------------
 // Waterscape::SetWaterline
@@ -119,6 +161,14 @@ Waterscape::Waterscape()
     m_Grid = m_BaseGrid;
 	m_OrthoModeIsEnabled = false;
 	m_Waterline = 0.0f;
+
+    m_GridIBStamp       = 0;
+    m_GridIBPos         = 0;
+    for (int i = 1; i < c_WaterTreeLevels; i++)
+    {
+        m_NDry[i].resize( (c_WaterWQuads >> i)*(c_WaterHQuads >> i), 0 );
+    }
+    memset( &m_Stats, 0, sizeof( m_Stats ) );
 } // Waterscape::Waterscape
 
 void Waterscape::OrthoModeEnable() {
@@ -135,8 +185,31 @@ void Waterscape::Reset()
 	{
 		m_Quads[i].Free();
 	}	
+    for (int i = 1; i < c_WaterTreeLevels; i++)
+    {
+        std::fill( m_NDry[i].begin(), m_NDry[i].end(), 0 );
+    }
 } // Waterscape::Reset
 
+//  adds delta to the dry quads counters of the tree nodes over the quad
+void Waterscape::MarkDry( int qx, int qy, int delta )
+{
+    for (int i = 1; i < c_WaterTreeLevels; i++)
+    {
+        m_NDry[i][(qx >> i) + (qy >> i)*(c_WaterWQuads >> i)] += delta;
+    }
+} // Waterscape::MarkDry
+
+bool Waterscape::IsNodeDry( int level, int nx, int ny ) const
+{
+    if (level == 0)
+    {
+        const WaterQuad& wq = m_Quads[nx + ny*c_WaterWQuads];
+        return wq.m_bBaked && wq.m_bNoWater;
+    }
+    return m_NDry[level][nx + ny*(c_WaterWQuads >> level)] == (1 << (level*2));
+} // Waterscape::IsNodeDry
+
 void Waterscape::Refresh( const Rct& area )
 {
     Rct ext = ITerra->GetExtents();
@@ -156,6 +229,7 @@ void Waterscape::Refresh( const Rct& area )
             int qIdx = i + j*c_WaterWQuads;
             if (qIdx >= c_WaterWQuads*c_WaterHQuads) continue;
             WaterQuad& wq = m_Quads[qIdx];
+            if (wq.m_bBaked && wq.m_bNoWater) MarkDry( i, j, -1 );
             wq.Free();
         }
     }
@@ -298,10 +372,10 @@ void Waterscape::Render()
     qEndX += 4;
     qEndY += 6;
 
-    clamp( qBegX, 0, c_WaterWQuads );
-    clamp( qBegY, 0, c_WaterHQuads );
-    clamp( qEndX, 0, c_WaterWQuads );
-    clamp( qEndY, 0, c_WaterHQuads );
+    clamp( qBegX, 0, c_WaterWQuads - 1 );
+    clamp( qBegY, 0, c_WaterHQuads - 1 );
+    clamp( qEndX, 0, c_WaterWQuads - 1 );
+    clamp( qEndY, 0, c_WaterHQuads - 1 );
 
     if (m_IBID == -1) m_IBID = IRS->CreateIB( "WaterRenderer", c_WaterIBufferBytes, isWORD, false );
     if (m_VBID == -1) 
@@ -312,102 +386,72 @@ void Waterscape::Render()
     IRS->SetIB( m_IBID );
     IRS->SetVB( m_VBID, m_VDecl.m_TypeID );
 
-    IRS->SetShader( -1 );
+    //  grid indices are the same for all quads, base vertex selects the quad
+    if (!IRS->IsIBStampValid( m_IBID, m_GridIBStamp ))
+    {
+        BYTE* pOut = IRS->LockAppendIB( m_IBID, m_Grid.getNInd(), m_GridIBPos, m_GridIBStamp );
+        if (pOut) 
+        {
+            memcpy( pOut, m_Grid.getIndices(), m_Grid.getNInd()*sizeof(WORD) );
+            IRS->UnlockIB( m_IBID );
+        }
+    }
 
-    int nQ = 0;
-    int nV = 0;
-    int nP = 0;
+    IRS->SetShader( -1 );
 
 	ICamera *pCam = GetCamera();
 	if(!pCam) {
 		return;
 	}
-	const Frustum Fr = pCam->GetFrustum();
 
-    for (int j = qBegY; j <= qEndY; j++)
+    m_Timer.start();
+    memset( &m_Stats, 0, sizeof( m_Stats ) );
+
+    WaterRenderContext ctx;
+    ctx.m_Frustum   = pCam->GetFrustum();
+    ctx.m_Ext       = ext;
+    ctx.m_QW        = qw;
+    ctx.m_QH        = qh;
+    ctx.m_BegX      = qBegX;
+    ctx.m_BegY      = qBegY;
+    ctx.m_EndX      = qEndX;
+    ctx.m_EndY      = qEndY;
+    ctx.m_Shader    = m_OrthoModeIsEnabled ? idWaterShOrtho : m_Shader;//shWater;
+    ctx.m_TexID[0]  = noiseTex;
+    ctx.m_TexID[1]  = reflTex;
+    ctx.m_TexID[2]  = shTex;
+
+    if (s_bQuadTree)
     {
-        for (int i = qBegX; i <= qEndX; i++)
+        int top = c_WaterTreeLevels - 1;
+        for (int j = 0; j < (c_WaterHQuads >> top); j++)
         {
-            int qIdx = i + j*c_WaterWQuads;
-            if (qIdx >= c_WaterHQuads*c_WaterWQuads) continue;
-            WaterQuad& wq = m_Quads[qIdx];
-            
-            Rct qrct( float( i )*qw + ext.x, float( j )*qh + ext.y, qw, qh );
-            AABoundBox aabb( qrct, -100.0f + GetWaterline(), 100.0f + GetWaterline());
-            if (!Fr.Overlap( aabb ) || wq.m_bNoWater) continue;
-            nQ++;
-            
-            bool bIBValid = IRS->IsIBStampValid( m_IBID, wq.m_IBStamp );
-            bool bVBValid = IRS->IsVBStampValid( m_VBID, wq.m_VBStamp );
-
-            if (!bIBValid || !bVBValid)
+            for (int i = 0; i < (c_WaterWQuads >> top); i++)
             {
-                int nVert = m_BaseGrid.getNVert();
-                WaterVertex* pSV = (WaterVertex*)m_BaseGrid.getVertexData();
-                WaterVertex* pDV = (WaterVertex*)m_Grid.getVertexData();
-                DWORD maxAlpha = 0;
-                for (int k = 0; k < nVert; k++)
-                {
-                    pDV[k].x = pSV[k].x*qw + qrct.x;
-                    pDV[k].y = pSV[k].y*qh + qrct.y;
-                    DWORD color = GetWaterColor( pDV[k].x, pDV[k].y );
-                    pDV[k].diffuse = color;
-                    color = (color&0xFF000000)>>24;
-                    if (color > maxAlpha) maxAlpha = color;
-                }
-                if (maxAlpha == 0) 
-                {
-                    wq.m_bNoWater = true;
-                    continue;
-                }
+                RenderNode( top, i, j, false, ctx );
             }
-
-            if (!bIBValid)
+        }
+    }
+    else
+    {
+        for (int j = qBegY; j <= qEndY; j++)
+        {
+            for (int i = qBegX; i <= qEndX; i++)
             {
-                BYTE* pOut = IRS->LockAppendIB( m_IBID, m_Grid.getNInd(), wq.m_IBPos, wq.m_IBStamp );
-                if (pOut) 
-                {
-                    memcpy( pOut, m_Grid.getIndices(), m_Grid.getNInd()*sizeof(WORD) );
-                    IRS->UnlockIB( m_IBID );
-                }
+                if (IsNodeDry( 0, i, j )) continue;
+                Rct qrct( float( i )*qw + ext.x, float( j )*qh + ext.y, qw, qh );
+                AABoundBox aabb( qrct, -100.0f + GetWaterline(), 100.0f + GetWaterline());
+                m_Stats.m_NTested++;
+                if (ctx.m_Frustum.Overlap( aabb )) RenderQuad( i, j, ctx );
             }
-
-            if (!bVBValid)
-            {   
-                BYTE* pOut  = IRS->LockAppendVB( m_VBID, m_Grid.getNVert(), wq.m_VBPos, wq.m_VBStamp );
-                if (pOut) 
-                {
-                    memcpy( pOut, m_Grid.getVertexData(), m_Grid.getNVert()*m_VDecl.m_VertexSize );
-                    IRS->UnlockVB( m_VBID );
-                }
-            }
-
-            RenderTask& rt = IRS->AddTask();
-            rt.m_bHasTM         = false;
-			rt.m_ShaderID       = m_OrthoModeIsEnabled ? idWaterShOrtho : m_Shader;//shWater;
-            rt.m_TexID[0]       = noiseTex;
-            rt.m_TexID[1]       = reflTex;
-            rt.m_TexID[2]       = shTex;
-            rt.m_TexID[3]       = -1;
-            rt.m_TexID[4]       = -1;
-            rt.m_TexID[5]       = -1;
-            rt.m_TexID[6]       = -1;
-            rt.m_TexID[7]       = -1;
-            rt.m_bTransparent   = true;
-            rt.m_VBufID         = m_VBID;
-            rt.m_FirstVert      = wq.m_VBPos;
-            rt.m_NVert          = m_Grid.getNVert();
-            rt.m_IBufID         = m_IBID;
-            rt.m_FirstIdx       = wq.m_IBPos;
-            rt.m_NIdx           = m_Grid.getNInd();
-            rt.m_VType          = m_VDecl.m_TypeID;
-            rt.m_bHasTM         = false;
-            rt.m_Source         = "Water";
-
-            nV += m_Grid.getNVert();
-            nP += m_Grid.getNPri();
         }
-    }    
+    }
+    m_Stats.m_CPUTime = m_Timer.seconds();
+
+    INC_COUNTER( WaterQuads, m_Stats.m_NQuads );
+    INC_COUNTER( WaterVerts, m_Stats.m_NVert );
+    INC_COUNTER( WaterBakes, m_Stats.m_NBaked );
+    INC_COUNTER( WaterTests, m_Stats.m_NTested );
 
     rsFlush();
 
@@ -420,6 +464,128 @@ void Waterscape::Render()
 
 } // Waterscape::Render
 
+/*---------------------------------------------------------------------------*/
+/*  Func:   Waterscape::RenderNode
+/*  Desc:   Culls the quad tree node against the visible range and frustum.
+/*          Dry nodes are skipped, children of the node inside the frustum
+/*          are not tested
+/*---------------------------------------------------------------------------*/
+void Waterscape::RenderNode( int level, int nx, int ny, bool bInside, const WaterRenderContext& ctx )
+{
+    int side = 1 << level;
+    int qx   = nx << level;
+    int qy   = ny << level;
+    if (qx > ctx.m_EndX || qx + side - 1 < ctx.m_BegX || 
+        qy > ctx.m_EndY || qy + side - 1 < ctx.m_BegY) return;
+    if (IsNodeDry( level, nx, ny )) return;
+
+    if (!bInside)
+    {
+        Rct rct( float( qx )*ctx.m_QW + ctx.m_Ext.x, float( qy )*ctx.m_QH + ctx.m_Ext.y, 
+                    float( side )*ctx.m_QW, float( side )*ctx.m_QH );
+        AABoundBox aabb( rct, -100.0f + GetWaterline(), 100.0f + GetWaterline() );
+        m_Stats.m_NTested++;
+        XStatus status = ctx.m_Frustum.Intersect( aabb );
+        if (status == xsOutside) return;
+        bInside = (status == xsInside);
+    }
+
+    if (level == 0) 
+    {
+        RenderQuad( qx, qy, ctx );
+        return;
+    }
+    nx <<= 1;
+    ny <<= 1;
+    RenderNode( level - 1, nx,     ny,     bInside, ctx );
+    RenderNode( level - 1, nx + 1, ny,     bInside, ctx );
+    RenderNode( level - 1, nx,     ny + 1, bInside, ctx );
+    RenderNode( level - 1, nx + 1, ny + 1, bInside, ctx );
+} // Waterscape::RenderNode
+
+//  queries water colors of the quad grid vertices, returns false for the dry quad
+bool Waterscape::BakeQuad( int qIdx, const Rct& qrct )
+{
+    int nVert = m_BaseGrid.getNVert();
+    if (m_Colors.size() == 0) m_Colors.resize( c_WaterWQuads*c_WaterHQuads*nVert );
+
+    WaterVertex* pSV = (WaterVertex*)m_BaseGrid.getVertexData();
+    DWORD* pColors = &m_Colors[qIdx*nVert];
+    DWORD maxAlpha = 0;
+    for (int k = 0; k < nVert; k++)
+    {
+        DWORD color = GetWaterColor( pSV[k].x*qrct.w + qrct.x, pSV[k].y*qrct.h + qrct.y );
+        pColors[k] = color;
+        color = (color&0xFF000000)>>24;
+        if (color > maxAlpha) maxAlpha = color;
+    }
+
+    WaterQuad& wq = m_Quads[qIdx];
+    wq.m_bBaked     = true;
+    wq.m_bNoWater   = (maxAlpha == 0);
+    wq.m_VBStamp    = 0;
+    m_Stats.m_NBaked++;
+    return !wq.m_bNoWater;
+} // Waterscape::BakeQuad
+
+void Waterscape::RenderQuad( int qx, int qy, const WaterRenderContext& ctx )
+{
+    int qIdx = qx + qy*c_WaterWQuads;
+    WaterQuad& wq = m_Quads[qIdx];
+    Rct qrct( float( qx )*ctx.m_QW + ctx.m_Ext.x, float( qy )*ctx.m_QH + ctx.m_Ext.y, ctx.m_QW, ctx.m_QH );
+    if (!wq.m_bBaked && !BakeQuad( qIdx, qrct ))
+    {
+        MarkDry( qx, qy, 1 );
+        return;
+    }
+
+    int nVert = m_Grid.getNVert();
+    if (!IRS->IsVBStampValid( m_VBID, wq.m_VBStamp ))
+    {
+        //  vertex buffer was overwritten, vertices are restored from the cached colors
+        WaterVertex* pSV = (WaterVertex*)m_BaseGrid.getVertexData();
+        WaterVertex* pDV = (WaterVertex*)m_Grid.getVertexData();
+        const DWORD* pColors = &m_Colors[qIdx*nVert];
+        for (int k = 0; k < nVert; k++)
+        {
+            pDV[k].x = pSV[k].x*qrct.w + qrct.x;
+            pDV[k].y = pSV[k].y*qrct.h + qrct.y;
+            pDV[k].diffuse = pColors[k];
+        }
+
+        BYTE* pOut  = IRS->LockAppendVB( m_VBID, nVert, wq.m_VBPos, wq.m_VBStamp );
+        if (!pOut) return;
+        memcpy( pOut, m_Grid.getVertexData(), nVert*m_VDecl.m_VertexSize );
+        IRS->UnlockVB( m_VBID );
+        m_Stats.m_NUploaded++;
+    }
+
+    RenderTask& rt = IRS->AddTask();
+    rt.m_bHasTM         = false;
+    rt.m_ShaderID       = ctx.m_Shader;
+    rt.m_TexID[0]       = ctx.m_TexID[0];
+    rt.m_TexID[1]       = ctx.m_TexID[1];
+    rt.m_TexID[2]       = ctx.m_TexID[2];
+    rt.m_TexID[3]       = -1;
+    rt.m_TexID[4]       = -1;
+    rt.m_TexID[5]       = -1;
+    rt.m_TexID[6]       = -1;
+    rt.m_TexID[7]       = -1;
+    rt.m_bTransparent   = true;
+    rt.m_VBufID         = m_VBID;
+    rt.m_FirstVert      = wq.m_VBPos;
+    rt.m_NVert          = nVert;
+    rt.m_IBufID         = m_IBID;
+    rt.m_FirstIdx       = m_GridIBPos;
+    rt.m_NIdx           = m_Grid.getNInd();
+    rt.m_VType          = m_VDecl.m_TypeID;
+    rt.m_Source         = "Water";
+
+    m_Stats.m_NQuads++;
+    m_Stats.m_NVert += nVert;
+    m_Stats.m_NPri  += m_Grid.getNPri();
+} // Waterscape::RenderQuad
+
 void Waterscape::SetShaderQuality( int Level ){
     static int idWaterShPersp = IRS->GetShaderID("ocean");
     static int idWaterShPerspLo = IRS->GetShaderID("low\\ocean");
@@ -441,3 +607,46 @@ void Waterscape::SetShaderQuality( int Level ){
 }
 
 
+
+/*---------------------------------------------------------------------------*/
+/*  Func:   BenchmarkWater
+/*  Desc:   Renders water from the current camera with the flat quads scan
+/*          and with the quad tree, cold (all quads baked) and warm, then
+/*          refreshes the area in the middle of the map and logs CPU time,
+/*          frustum tests, quads and vertices drawn
+/*---------------------------------------------------------------------------*/
+bool BenchmarkWater( int nFrames )
+{
+    if (!GetCamera() || nFrames <= 0) return false;
+    bool bQuadTree = Waterscape::s_bQuadTree;
+    Rct ext = ITerra->GetExtents();
+    Rct refreshArea( ext.x + ext.w*0.5f, ext.y + ext.h*0.5f, ext.w*0.125f, ext.h*0.125f );
+
+    for (int mode = 0; mode < 2; mode++)
+    {
+        Waterscape::s_bQuadTree = (mode == 1);
+        g_Water.Reset();
+        g_Water.Render();
+        WaterStats cold = g_Water.GetStats();
+
+        double warmTime = 0.0;
+        for (int i = 0; i < nFrames; i++)
+        {
+            g_Water.Render();
+            warmTime += g_Water.GetStats().m_CPUTime;
+        }
+        WaterStats warm = g_Water.GetStats();
+
+        g_Water.Refresh( refreshArea );
+        g_Water.Render();
+        const WaterStats& refresh = g_Water.GetStats();
+
+        Log.Info( "Water benchmark, %s:", mode == 1 ? "quad tree" : "flat scan" );
+        Log.Info( "  cold: %.3fms, %d quads baked", cold.m_CPUTime*1000.0f, cold.m_NBaked );
+        Log.Info( "  warm: %.3fms per frame, %d tests, %d quads, %d vertices, %d triangles", 
+                    warmTime*1000.0/double( nFrames ), warm.m_NTested, warm.m_NQuads, warm.m_NVert, warm.m_NPri );
+        Log.Info( "  refresh: %.3fms, %d quads baked", refresh.m_CPUTime*1000.0f, refresh.m_NBaked );
+    }
+    Waterscape::s_bQuadTree = bQuadTree;
+    return true;
+} // BenchmarkWater
@@ -49,7 +49,8 @@ public:
     virtual BYTE*       Lock                    ( int firstIdx, int numIdx, DWORD& stamp, bool bDiscard = false );
     virtual BYTE*       LockAppend              ( int numIdx, int& offset, DWORD& stamp );
     virtual bool        HasAppendSpace           ( int numIdx );
-    virtual bool        IsStampValid            ( DWORD stamp ) { return stamp >= m_FirstValidStamp; }
+    //  stamps with the high bit set come from the null render system and are never valid here
+    virtual bool        IsStampValid            ( DWORD stamp ) { return int( stamp ) >= m_FirstValidStamp; }
     void                Unlock                  ();
     virtual void        Purge                   ();
 	bool				IsFree					(){return m_Free;}
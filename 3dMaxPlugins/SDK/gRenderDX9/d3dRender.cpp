@@ -14,6 +14,7 @@
 
 #include "d3dTexture.h"
 #include "d3dShaderFX.h"
+#include "d3dShaderCache.h"
 #include "d3dIndexBuffer.h"
 #include "d3dVertexBuffer.h"
 #include "d3dFont.h"
@@ -65,6 +66,16 @@ IDirect3DSurface9* GetDirect3DSurface( int texID )
     return ((RenderSystemDX9*)GetRenderSystem())->GetSurface( texID );
 }
 
+DeviceStateFilter* GetStateFilter()
+{
+    return ((RenderSystemDX9*)GetRenderSystem())->GetStateFilter();
+}
+
+EffectStateManager* GetEffectStateManager()
+{
+    return ((RenderSystemDX9*)GetRenderSystem())->GetEffectStateManager();
+}
+
 //INT WINAPI WinMain( HINSTANCE hInst, HINSTANCE, LPSTR, INT )
 //{
 //    InitCommonControls();
@@ -99,6 +110,8 @@ RenderSystemDX9::RenderSystemDX9()
 
     m_FogDensity            = 0.00002f;
     m_TFactor               = 0xFFFFFFFF;
+    m_bZEnable              = true;
+    m_bZWrite               = true;
     m_ViewTM                = Matrix4D::identity;
     m_ProjTM                = Matrix4D::identity;
     m_WorldTM               = Matrix4D::identity;
@@ -151,6 +164,13 @@ HRESULT RenderSystemDX9::OneTimeSceneInit()
 //-----------------------------------------------------------------------------
 HRESULT RenderSystemDX9::InitDeviceObjects()
 {
+    m_StateDevice.SetDevice( m_pDevice );
+    m_StateFilter.SetDevice( &m_StateDevice );
+    m_EffectStateManager.Init( m_pDevice, &m_StateFilter );
+#ifdef _DEBUG
+    if (!TestDeviceStateFilter()) Log.Warning( "RenderSystemDX9: device state filter self-check failed." );
+#endif // _DEBUG
+
     CreateVTypeTable();
     CreateIB( "SharedDynamic",  c_DynIBufferBytes,      isWORD, true    );
     CreateIB( "SharedStatic",   c_StaticIBufferBytes,   isWORD, false   );
@@ -182,6 +202,8 @@ HRESULT RenderSystemDX9::InitDeviceObjects()
 HRESULT RenderSystemDX9::RestoreDeviceObjects()
 {
     HRESULT hr = S_OK;
+    //  device states are reset to defaults
+    m_StateFilter.Invalidate();
     for (int i = 0; i < m_Textures.size();  i++) m_Textures[i]->RestoreDeviceObjects();
     for (int i = 0; i < m_Shaders.size();   i++) m_Shaders[i]->RestoreDeviceObjects();
     for (int i = 0; i < m_VBuffers.size();  i++) m_VBuffers[i]->RestoreDeviceObjects();
@@ -317,6 +339,10 @@ void RenderSystemDX9::Init( HINSTANCE hInst, HWND hWnd )
     IRM->MountDataSource( "Models",         "Models"    );
     IRM->MountDataSource( "Textures",       "Textures"  );
     IRM->MountDataSource( "Scripts",        "Scripts"   );
+
+    //  effects are created lazily, on the first run the cache is filled beforehand so that they load from it
+    if (m_bInited && ShaderBinaryCache::s_bEnabled && ShaderBinaryCache::s_bPrewarm && 
+        ShaderBinaryCache::IsCold()) PrewarmShaderCache();
 } // RenderSystemDX9::Init
 
 void RenderSystemDX9::ShutDown()
@@ -509,12 +535,12 @@ void RenderSystemDX9::SetTextureTM( const Matrix4D& tmatr, int stage )
 void RenderSystemDX9::SetBumpTM( const Matrix3D& bmatr, int stage ) 
 {
     __beginT();
-    DX_CHK( m_pDevice->SetTextureStageState( stage, D3DTSS_BUMPENVMAT00, F2DW( bmatr.e00 ) ) );
-    DX_CHK( m_pDevice->SetTextureStageState( stage, D3DTSS_BUMPENVMAT10, F2DW( bmatr.e10 ) ) );
-    DX_CHK( m_pDevice->SetTextureStageState( stage, D3DTSS_BUMPENVMAT01, F2DW( bmatr.e01 ) ) );
-    DX_CHK( m_pDevice->SetTextureStageState( stage, D3DTSS_BUMPENVMAT11, F2DW( bmatr.e11 ) ) );
-    DX_CHK( m_pDevice->SetTextureStageState( stage, D3DTSS_BUMPENVLSCALE,  F2DW(bmatr.e22) ) );
-    DX_CHK( m_pDevice->SetTextureStageState( stage, D3DTSS_BUMPENVLOFFSET, F2DW(bmatr.e20) ) );
+    DX_CHK( m_StateFilter.SetTextureStageState( stage, D3DTSS_BUMPENVMAT00, F2DW( bmatr.e00 ) ) );
+    DX_CHK( m_StateFilter.SetTextureStageState( stage, D3DTSS_BUMPENVMAT10, F2DW( bmatr.e10 ) ) );
+    DX_CHK( m_StateFilter.SetTextureStageState( stage, D3DTSS_BUMPENVMAT01, F2DW( bmatr.e01 ) ) );
+    DX_CHK( m_StateFilter.SetTextureStageState( stage, D3DTSS_BUMPENVMAT11, F2DW( bmatr.e11 ) ) );
+    DX_CHK( m_StateFilter.SetTextureStageState( stage, D3DTSS_BUMPENVLSCALE,  F2DW(bmatr.e22) ) );
+    DX_CHK( m_StateFilter.SetTextureStageState( stage, D3DTSS_BUMPENVLOFFSET, F2DW(bmatr.e20) ) );
     __endT(OtherTime);
     m_BumpTM[stage] = bmatr;
 } // RenderSystemDX9::SetBumpTM(
@@ -634,6 +660,15 @@ void RenderSystemDX9::EndFrame()
     m_FPS = 1.0f/dt;
     s_Time = s_FPSTimer.seconds();
 
+    m_StateFilter.Commit();
+    m_StateFilter.OnFrame();
+    const StateFilterStats& stats = m_StateFilter.GetFrameStats();
+    INC_COUNTER( StatesIssued,      stats.GetNIssued() );
+    INC_COUNTER( StatesFiltered,    stats.GetNFiltered() );
+    INC_COUNTER( RStatesFiltered,   stats.m_NFiltered[scRender] );
+    INC_COUNTER( SStatesFiltered,   stats.m_NFiltered[scSampler] );
+    INC_COUNTER( TexBindsFiltered,  stats.m_NFiltered[scTexture] );
+
     //DX_CHK( m_pDevice->EndScene() );
 	
     // Show the frame on the primary surface.
@@ -1219,7 +1254,7 @@ void RenderSystemDX9::SetTextureFactor( DWORD tfactor )
 {
     if (m_TFactor == tfactor) return;
     __beginT();
-    DX_CHK( m_pDevice->SetRenderState( D3DRS_TEXTUREFACTOR, tfactor ) );	
+    DX_CHK( m_StateFilter.SetRenderState( D3DRS_TEXTUREFACTOR, tfactor ) );	
     __endT(SetTextureFactorTime);
     m_TFactor = tfactor;
 } // RenderSystemDX9::SetTextureFactor
@@ -1227,21 +1262,23 @@ void RenderSystemDX9::SetTextureFactor( DWORD tfactor )
 void RenderSystemDX9::SetZEnable( bool bEnable )
 {
     __beginT();
-    DX_CHK( m_pDevice->SetRenderState( D3DRS_ZENABLE, bEnable ? TRUE : FALSE ) );	
+    DX_CHK( m_StateFilter.SetRenderState( D3DRS_ZENABLE, bEnable ? TRUE : FALSE ) );	
     __endT(OtherTime);
+    m_bZEnable = bEnable;
 }
 
 void RenderSystemDX9::SetZWriteEnable( bool bEnable )
 {
     __beginT();
-    DX_CHK( m_pDevice->SetRenderState( D3DRS_ZWRITEENABLE, bEnable ? TRUE : FALSE ) );	
+    DX_CHK( m_StateFilter.SetRenderState( D3DRS_ZWRITEENABLE, bEnable ? TRUE : FALSE ) );	
     __endT(OtherTime);
+    m_bZWrite = bEnable;
 }
 
 void RenderSystemDX9::SetDitherEnable( bool bEnable )
 {
     __beginT();
-    DX_CHK( m_pDevice->SetRenderState( D3DRS_DITHERENABLE, bEnable ? TRUE : FALSE ) );
+    DX_CHK( m_StateFilter.SetRenderState( D3DRS_DITHERENABLE, bEnable ? TRUE : FALSE ) );
     __endT(OtherTime);
 }
 
@@ -1250,13 +1287,13 @@ void RenderSystemDX9::SetTexFilterEnable( bool bEnable )
     __beginT();
     if (bEnable)
     {
-        DX_CHK( m_pDevice->SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_LINEAR  ) );  
-        DX_CHK( m_pDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR  ) );  
+        DX_CHK( m_StateFilter.SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_LINEAR  ) );  
+        DX_CHK( m_StateFilter.SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR  ) );  
     }
     else
     {
-        DX_CHK( m_pDevice->SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_POINT  ) );  
-        DX_CHK( m_pDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_POINT  ) );  
+        DX_CHK( m_StateFilter.SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_POINT  ) );  
+        DX_CHK( m_StateFilter.SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_POINT  ) );  
     }
     __endT(OtherTime);
 } // RenderSystemDX9::SetTexFilterEnable     
@@ -1271,14 +1308,14 @@ DWORD RenderSystemDX9::GetColorConst()
 void RenderSystemDX9::SetWireframe( bool bEnable )
 {
     __beginT();
-    DX_CHK( m_pDevice->SetRenderState( D3DRS_FILLMODE, bEnable ? D3DFILL_WIREFRAME : D3DFILL_SOLID ) );	
+    DX_CHK( m_StateFilter.SetRenderState( D3DRS_FILLMODE, bEnable ? D3DFILL_WIREFRAME : D3DFILL_SOLID ) );	
     __endT(OtherTime);
 }
 
 void  RenderSystemDX9::SetAlphaRef( BYTE alphaRef )
 {
     __beginT();
-    DX_CHK( m_pDevice->SetRenderState( D3DRS_ALPHAREF, alphaRef ) );	
+    DX_CHK( m_StateFilter.SetRenderState( D3DRS_ALPHAREF, alphaRef ) );	
     __endT(OtherTime);
 }
 
@@ -1441,30 +1478,30 @@ void RenderSystemDX9::SetFog( DWORD FogColor,float FogStart,float FogEnd,float F
 	m_FogDensity=FogDensity; 
 	m_FogMode=FogMode;
 	if(FogColor){
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGCOLOR,m_FogColor)); 
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGSTART,*(DWORD *)(&m_FogStart))); 
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGEND,*(DWORD *)(&m_FogEnd))); 
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGDENSITY,*(DWORD *)(&m_FogDensity))); 
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGTABLEMODE,m_FogMode)); 	
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGVERTEXMODE,m_FogMode));
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGENABLE,0)); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGCOLOR,m_FogColor)); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGSTART,*(DWORD *)(&m_FogStart))); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGEND,*(DWORD *)(&m_FogEnd))); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGDENSITY,*(DWORD *)(&m_FogDensity))); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGTABLEMODE,m_FogMode)); 	
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGVERTEXMODE,m_FogMode));
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGENABLE,0)); 
 	}
 
 } // RenderSystemDX9::SetFog
 
 void RenderSystemDX9::ApplyFogStateBlock(){
-	if(!m_FogColor)DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGENABLE,0)); 
+	if(!m_FogColor)DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGENABLE,0)); 
 	/*
     __beginT();	
 	if(m_FogColor){        
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGCOLOR,m_FogColor)); 
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGSTART,*(DWORD *)(&m_FogStart))); 
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGEND,*(DWORD *)(&m_FogEnd))); 
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGDENSITY,*(DWORD *)(&m_FogDensity))); 
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGTABLEMODE,m_FogMode)); 	
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGVERTEXMODE,m_FogMode));
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGCOLOR,m_FogColor)); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGSTART,*(DWORD *)(&m_FogStart))); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGEND,*(DWORD *)(&m_FogEnd))); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGDENSITY,*(DWORD *)(&m_FogDensity))); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGTABLEMODE,m_FogMode)); 	
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGVERTEXMODE,m_FogMode));
 	}else{
-		DX_CHK( m_pDevice->SetRenderState(D3DRS_FOGENABLE,0)); 
+		DX_CHK( m_StateFilter.SetRenderState(D3DRS_FOGENABLE,0)); 
 	}
     __endT(OtherTime);
 	*/	
@@ -1538,7 +1575,9 @@ bool RenderSystemDX9::SetVB( int vbID, int vType, int stream, int frequency )
 
 bool RenderSystemDX9::DiscardVB( int vbID ) 
 { 
-    return false; 
+    if (vbID < 0 || vbID >= m_VBuffers.size()) return false;
+    if (m_VBuffers[vbID]->IsDynamic()) m_VBuffers[vbID]->Purge();
+    return true; 
 } // RenderSystemDX9::DiscardVB
 
 void RenderSystemDX9::UnlockVB( int vbID ) 
@@ -1711,8 +1750,9 @@ BYTE* RenderSystemDX9::LockIB( int ibID, int firstIdx, int numIdx, DWORD& stamp
 bool RenderSystemDX9::DiscardIB( int ibID )
 {
     if (ibID < 0 || ibID >= m_IBuffers.size()) return false;
-    return false;//m_IBuffers[ibID]->Discard();
-} // RenderSystemDX9::LockIB
+    if (m_IBuffers[ibID]->IsDynamic()) m_IBuffers[ibID]->Purge();
+    return true;
+} // RenderSystemDX9::DiscardIB
 
 void RenderSystemDX9::UnlockIB( int ibID )
 {
@@ -1847,6 +1887,8 @@ void RenderSystemDX9::Draw( int firstVert, int nVert, int firstIdx, int nIdx, Pr
 
     __beginT();
 
+    //  restore states left by the previous effect, unless they were set again
+    m_StateFilter.Commit();
     DX_CHK( m_pDevice->BeginScene() );
     if (bIndexed)
     {
@@ -2128,11 +2170,12 @@ struct TaskCompare
 int rt_compare( const void * elem1, const void * elem2 ){
 	RenderTask* rt1=*((RenderTask**)elem1);
 	RenderTask* rt2=*((RenderTask**)elem2);
-	if(rt1->m_ShaderID==rt2->m_ShaderID){	
-		if(rt1->m_TexID[0]==rt2->m_TexID[0]){			
-			return 0;
-		}else return rt1->m_TexID[0]<rt2->m_TexID[0] ? -1 : 1;
-	}else return rt1->m_ShaderID<rt2->m_ShaderID ? -1 : 1;
+	//  most expensive state changes go first: shader, textures, vertex buffer
+	if(rt1->m_ShaderID!=rt2->m_ShaderID) return rt1->m_ShaderID<rt2->m_ShaderID ? -1 : 1;
+	if(rt1->m_TexID[0]!=rt2->m_TexID[0]) return rt1->m_TexID[0]<rt2->m_TexID[0] ? -1 : 1;
+	if(rt1->m_TexID[1]!=rt2->m_TexID[1]) return rt1->m_TexID[1]<rt2->m_TexID[1] ? -1 : 1;
+	if(rt1->m_VBufID!=rt2->m_VBufID) return rt1->m_VBufID<rt2->m_VBufID ? -1 : 1;
+	return 0;
 }
 
 void RenderSystemDX9::SortTasks()
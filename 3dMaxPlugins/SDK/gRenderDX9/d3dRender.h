@@ -9,6 +9,7 @@
 
 #include <stack>
 #include "kStaticArray.hpp"
+#include "d3dStateFilter.h"
 
 /*****************************************************************************/
 /*  Struct: VertexTypeEntry
@@ -257,6 +258,8 @@ public:
     virtual void  		    SetAlphaRef		( BYTE alphaRef		  );
     virtual void  		    SetZEnable		( bool bEnable = true );
     virtual void  		    SetZWriteEnable	( bool bEnable = true );
+    virtual bool            GetZEnable      () const { return m_bZEnable; }
+    virtual bool            GetZWriteEnable () const { return m_bZWrite; }
     virtual void  		    SetDitherEnable	( bool bEnable = true );
     virtual void  		    SetWireframe	( bool bEnable = true );
     virtual void            SetTexFilterEnable( bool bEnable = true ); 
@@ -313,6 +316,8 @@ public:
     //  internal methods for Direct3D-aware clients
     IDirect3DDevice9*       GetDevice       () { return m_pDevice; }
     IDirect3DSurface9*      GetSurface      ( int texID );
+    DeviceStateFilter*      GetStateFilter  () { return &m_StateFilter; }
+    EffectStateManager*     GetEffectStateManager() { return &m_EffectStateManager; }
 
 	virtual void			ScreenShotBMP		(const char *pBMPFileName);
 	virtual void			ScreenShotJPG		(const char *pJPGFileName);
@@ -363,8 +368,14 @@ protected:
     bool                m_bSorted;
 
     DWORD               m_TFactor;
+    bool                m_bZEnable;             //  last values set with SetZEnable/SetZWriteEnable
+    bool                m_bZWrite;
     void                SortTasks();
 
+    StateDeviceDX9      m_StateDevice;          //  device side of the state filter
+    DeviceStateFilter   m_StateFilter;          //  drops redundant state changes
+    EffectStateManager  m_EffectStateManager;   //  routes effect states through the filter
+
 	bool m_TimeIsOverridden;
 	float m_secOverriddenTime;
 
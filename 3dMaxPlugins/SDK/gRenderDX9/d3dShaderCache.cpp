@@ -0,0 +1,383 @@
+/*****************************************************************************/
+/*	File:	d3dShaderCache.cpp
+/*  Desc:	Persistent cache of the compiled effect binaries
+/*	Date:	18.10.2026
+/*****************************************************************************/
+#include "gRenderPch.h"
+#include "d3dx9shader.h"
+#include "d3dShaderFX.h"
+#include "d3dShaderCache.h"
+#include "IMediaManager.h"
+
+IDirect3DDevice9* GetDirect3DDevice();
+
+bool ShaderBinaryCache::s_bEnabled = true;
+bool ShaderBinaryCache::s_bPrewarm = true;
+
+const char c_ShaderCacheDir[] = "Cache\\Shaders\\";
+
+static DWORD HashBytes( const BYTE* pData, int size, DWORD hash )
+{
+    //  FNV-1a
+    for (int i = 0; i < size; i++)
+    {
+        hash ^= pData[i];
+        hash *= 16777619;
+    }
+    return hash;
+} // HashBytes
+
+/*****************************************************************************/
+/*  ShaderBinaryCache implementation
+/*****************************************************************************/
+bool ShaderBinaryCache::Preprocess( const BYTE* pBuf, int size, ID3DXInclude* pInclude,
+                                    std::vector<BYTE>& text, std::string& errors )
+{
+    ID3DXBuffer* pText      = NULL;
+    ID3DXBuffer* pErrBuffer = NULL;
+    HRESULT hr = D3DXPreprocessShader( (LPCSTR)pBuf, size, NULL, pInclude, &pText, &pErrBuffer );
+    if (pErrBuffer)
+    {
+        errors = (const char*)pErrBuffer->GetBufferPointer();
+        pErrBuffer->Release();
+    }
+    if (FAILED( hr ) || !pText) return false;
+
+    const BYTE* pData = (const BYTE*)pText->GetBufferPointer();
+    text.assign( pData, pData + pText->GetBufferSize() );
+    pText->Release();
+    return true;
+} // ShaderBinaryCache::Preprocess
+
+ShaderCacheKey ShaderBinaryCache::GetKey( const std::vector<BYTE>& text, DWORD flags )
+{
+    ShaderCacheKey key;
+    const BYTE* pText = text.size() ? &text[0] : NULL;
+    int         size  = text.size();
+    key.m_Hash  = HashBytes( pText, size, 2166136261 );
+    key.m_Hash  = HashBytes( (const BYTE*)c_ShaderCacheTarget, sizeof( c_ShaderCacheTarget ), key.m_Hash );
+    key.m_Hash2 = HashBytes( pText, size, 0x7F4A7C15 );
+    key.m_SourceSize = size;
+    key.m_Flags      = flags;
+    return key;
+} // ShaderBinaryCache::GetKey
+
+bool ShaderBinaryCache::Compile( const std::vector<BYTE>& text, DWORD flags,
+                                 std::vector<BYTE>& bin, std::string& errors )
+{
+    if (text.size() == 0) return false;
+    ID3DXEffectCompiler*    pCompiler   = NULL;
+    ID3DXBuffer*            pErrBuffer  = NULL;
+    HRESULT hr = D3DXCreateEffectCompiler( (LPCSTR)&text[0], text.size(), NULL, NULL,
+                                            flags, &pCompiler, &pErrBuffer );
+    if (pErrBuffer)
+    {
+        errors = (const char*)pErrBuffer->GetBufferPointer();
+        pErrBuffer->Release();
+        pErrBuffer = NULL;
+    }
+    if (FAILED( hr ) || !pCompiler) return false;
+
+    ID3DXBuffer* pEffect = NULL;
+    hr = pCompiler->CompileEffect( flags, &pEffect, &pErrBuffer );
+    pCompiler->Release();
+    if (pErrBuffer)
+    {
+        errors = (const char*)pErrBuffer->GetBufferPointer();
+        pErrBuffer->Release();
+    }
+    if (FAILED( hr ) || !pEffect) return false;
+
+    const BYTE* pData = (const BYTE*)pEffect->GetBufferPointer();
+    bin.assign( pData, pData + pEffect->GetBufferSize() );
+    pEffect->Release();
+    return true;
+} // ShaderBinaryCache::Compile
+
+void ShaderBinaryCache::GetPath( const ShaderCacheKey& key, char* path )
+{
+    sprintf( path, "%s\\%s%08X%08X.fxo", IRM->GetHomeDirectory(), c_ShaderCacheDir,
+                key.m_Hash, key.m_Hash2 );
+} // ShaderBinaryCache::GetPath
+
+/*---------------------------------------------------------------*
+/*  Func:	ShaderBinaryCache::Load
+/*	Desc:	Reads the effect binary, if the file header matches the key,
+/*          the binary size and hash
+/*---------------------------------------------------------------*/
+bool ShaderBinaryCache::Load( const ShaderCacheKey& key, std::vector<BYTE>& bin )
+{
+    if (!s_bEnabled) return false;
+    char path[_MAX_PATH];
+    GetPath( key, path );
+    FILE* fp = fopen( path, "rb" );
+    if (!fp) return false;
+
+    ShaderCacheHeader hdr;
+    bool bValid = (fread( &hdr, sizeof( hdr ), 1, fp ) == 1 &&
+                    hdr.m_Magic      == c_ShaderCacheMagic &&
+                    hdr.m_Version    == c_ShaderCacheVersion &&
+                    hdr.m_SDKVersion == D3DX_SDK_VERSION &&
+                    hdr.m_Key        == key &&
+                    hdr.m_BinSize > 0);
+    if (bValid)
+    {
+        bin.resize( hdr.m_BinSize );
+        bValid = (fread( &bin[0], hdr.m_BinSize, 1, fp ) == 1 &&
+                    HashBytes( &bin[0], hdr.m_BinSize, 2166136261 ) == hdr.m_BinHash);
+    }
+    fclose( fp );
+
+    if (!bValid)
+    {
+        Log.Warning( "Shader cache entry %s is invalid, dropped.", path );
+        bin.clear();
+        Remove( key );
+    }
+    return bValid;
+} // ShaderBinaryCache::Load
+
+bool ShaderBinaryCache::Save( const ShaderCacheKey& key, const std::vector<BYTE>& bin )
+{
+    if (!s_bEnabled || bin.size() == 0) return false;
+    char path[_MAX_PATH];
+    sprintf( path, "%s\\Cache", IRM->GetHomeDirectory() );
+    CreateDirectory( path, NULL );
+    sprintf( path, "%s\\%s", IRM->GetHomeDirectory(), c_ShaderCacheDir );
+    CreateDirectory( path, NULL );
+
+    ShaderCacheHeader hdr;
+    hdr.m_Magic      = c_ShaderCacheMagic;
+    hdr.m_Version    = c_ShaderCacheVersion;
+    hdr.m_SDKVersion = D3DX_SDK_VERSION;
+    hdr.m_Key        = key;
+    hdr.m_BinSize    = bin.size();
+    hdr.m_BinHash    = HashBytes( &bin[0], bin.size(), 2166136261 );
+
+    //  write to the temporary file first, so that the interrupted write
+    //  does not leave the entry with the valid header
+    char tmpPath[_MAX_PATH];
+    GetPath( key, path );
+    sprintf( tmpPath, "%s.tmp", path );
+    FILE* fp = fopen( tmpPath, "wb" );
+    if (!fp) return false;
+    bool bOK = (fwrite( &hdr, sizeof( hdr ), 1, fp ) == 1 &&
+                fwrite( &bin[0], bin.size(), 1, fp ) == 1);
+    fclose( fp );
+    if (bOK) bOK = (MoveFileEx( tmpPath, path, MOVEFILE_REPLACE_EXISTING ) != FALSE);
+    if (!bOK) DeleteFile( tmpPath );
+    return bOK;
+} // ShaderBinaryCache::Save
+
+void ShaderBinaryCache::Remove( const ShaderCacheKey& key )
+{
+    char path[_MAX_PATH];
+    GetPath( key, path );
+    DeleteFile( path );
+} // ShaderBinaryCache::Remove
+
+//  cache is cold when there is no entry at all, i.e. on the first run or after
+//  the cache directory was wiped. Effects missing in the warm cache are compiled 
+//  on demand, so the renderer init does not scan and preprocess all of them
+bool ShaderBinaryCache::IsCold()
+{
+    char mask[_MAX_PATH];
+    sprintf( mask, "%s\\%s*.fxo", IRM->GetHomeDirectory(), c_ShaderCacheDir );
+    WIN32_FIND_DATA fd;
+    HANDLE hFind = FindFirstFile( mask, &fd );
+    if (hFind == INVALID_HANDLE_VALUE) return true;
+    FindClose( hFind );
+    return false;
+} // ShaderBinaryCache::IsCold
+
+/*****************************************************************************/
+/*  Cache prewarm
+/*****************************************************************************/
+struct ShaderPrewarmJob
+{
+    std::string             m_Name;
+    std::vector<BYTE>       m_Text;
+    ShaderCacheKey          m_Key;
+    bool                    m_bCompiled;
+    bool                    m_bFailed;
+    float                   m_Time;
+}; // struct ShaderPrewarmJob
+
+struct ShaderPrewarmQueue
+{
+    std::vector<ShaderPrewarmJob*>  m_Jobs;
+    volatile LONG                   m_Next;
+}; // struct ShaderPrewarmQueue
+
+static void CompilePrewarmJobs( ShaderPrewarmQueue* pQueue )
+{
+    int nJobs = pQueue->m_Jobs.size();
+    for (;;)
+    {
+        int idx = InterlockedIncrement( &pQueue->m_Next ) - 1;
+        if (idx >= nJobs) break;
+        ShaderPrewarmJob& job = *pQueue->m_Jobs[idx];
+
+        Timer timer;
+        std::vector<BYTE>   bin;
+        std::string         errors;
+        job.m_bCompiled = ShaderBinaryCache::Compile( job.m_Text, job.m_Key.m_Flags, bin, errors ) &&
+                            ShaderBinaryCache::Save( job.m_Key, bin );
+        job.m_bFailed   = !job.m_bCompiled;
+        job.m_Time      = timer.seconds();
+    }
+} // CompilePrewarmJobs
+
+static DWORD WINAPI PrewarmThreadProc( LPVOID pParam )
+{
+    CompilePrewarmJobs( (ShaderPrewarmQueue*)pParam );
+    return 0;
+} // PrewarmThreadProc
+
+//  names are relative to the root, as the resource manager expects them
+static void FindEffects( const char* root, const char* dir, std::vector<std::string>& names )
+{
+    char mask[_MAX_PATH];
+    sprintf( mask, "%s\\%s*", root, dir );
+    WIN32_FIND_DATA fd;
+    HANDLE hFind = FindFirstFile( mask, &fd );
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do
+    {
+        if (fd.cFileName[0] == '.') continue;
+        std::string path = std::string( dir ) + fd.cFileName;
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            FindEffects( root, (path + "\\").c_str(), names );
+        }
+        else
+        {
+            const char* ext = strrchr( fd.cFileName, '.' );
+            if (ext && !stricmp( ext, ".fx" )) names.push_back( path );
+        }
+    }
+    while (FindNextFile( hFind, &fd ));
+    FindClose( hFind );
+} // FindEffects
+
+/*---------------------------------------------------------------*
+/*  Func:	PrewarmShaderCache
+/*	Desc:	Sources are read and preprocessed on the calling thread,
+/*          since includes go through the resource manager. Effects
+/*          which are not in the cache yet are compiled on the worker
+/*          threads - the compiler does not need the device
+/*---------------------------------------------------------------*/
+bool PrewarmShaderCache( const char* shaderDir, int nThreads, ShaderPrewarmStats* pStats )
+{
+    ShaderPrewarmStats stats;
+    memset( &stats, 0, sizeof( stats ) );
+
+    std::vector<std::string> names;
+    FindEffects( IRM->GetHomeDirectory(), shaderDir, names );
+
+    DWORD flags = 0;
+#ifdef DEBUG_VS
+    flags |= D3DXSHADER_FORCE_VS_SOFTWARE_NOOPT;
+#endif
+#ifdef DEBUG_PS
+    flags |= D3DXSHADER_FORCE_PS_SOFTWARE_NOOPT;
+#endif
+
+    FXIncluder          includer;
+    std::vector<ShaderPrewarmJob> jobs( names.size() );
+    ShaderPrewarmQueue  queue;
+    queue.m_Next = 0;
+    for (int i = 0; i < (int)names.size(); i++)
+    {
+        ShaderPrewarmJob& job = jobs[i];
+        job.m_Name      = names[i];
+        job.m_bCompiled = false;
+        job.m_bFailed   = true;
+        job.m_Time      = 0.0f;
+
+        int resID = IRM->FindResource( job.m_Name.c_str() );
+        if (resID == -1) continue;
+        int   size  = 0;
+        BYTE* pData = IRM->LockData( resID, size );
+        std::string errors;
+        bool  bOK   = pData && ShaderBinaryCache::Preprocess( pData, size, &includer, job.m_Text, errors );
+        IRM->UnlockData( resID );
+        if (!bOK)
+        {
+            Log.Warning( "Could not preprocess shader %s: %s", job.m_Name.c_str(), errors.c_str() );
+            continue;
+        }
+        job.m_Key       = ShaderBinaryCache::GetKey( job.m_Text, flags );
+        job.m_bFailed   = false;
+
+        std::vector<BYTE> bin;
+        if (!ShaderBinaryCache::Load( job.m_Key, bin )) queue.m_Jobs.push_back( &job );
+    }
+
+    //  cold pass: compile missing effects in parallel
+    if (nThreads <= 0)
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo( &si );
+        nThreads = si.dwNumberOfProcessors;
+    }
+    nThreads = tmin( nThreads, c_MaxPrewarmThreads, (int)queue.m_Jobs.size() );
+
+    Timer coldTimer;
+    HANDLE  threads[c_MaxPrewarmThreads];
+    int     nStarted = 0;
+    for (int i = 1; i < nThreads; i++)
+    {
+        HANDLE hThread = CreateThread( NULL, 0, PrewarmThreadProc, &queue, 0, NULL );
+        if (hThread) threads[nStarted++] = hThread;
+    }
+    CompilePrewarmJobs( &queue );
+    if (nStarted > 0)
+    {
+        WaitForMultipleObjects( nStarted, threads, TRUE, INFINITE );
+        for (int i = 0; i < nStarted; i++) CloseHandle( threads[i] );
+    }
+    stats.m_ColdTime = coldTimer.seconds();
+
+    //  warm pass: create effects from the cache, as it is done on startup.
+    //  It is timed only when the stats are asked for
+    IDirect3DDevice9* pDevice = GetDirect3DDevice();
+    Timer warmTimer;
+    for (int i = 0; i < (int)jobs.size(); i++)
+    {
+        ShaderPrewarmJob& job = jobs[i];
+        stats.m_NShaders++;
+        if (job.m_bCompiled)
+        {
+            stats.m_NCompiled++;
+            stats.m_CompileTime += job.m_Time;
+        }
+        if (job.m_bFailed)
+        {
+            stats.m_NFailed++;
+            continue;
+        }
+        if (!pStats) continue;
+        std::vector<BYTE> bin;
+        if (!ShaderBinaryCache::Load( job.m_Key, bin ))
+        {
+            stats.m_NFailed++;
+            continue;
+        }
+        if (!pDevice) continue;
+        ID3DXEffect* pEffect = NULL;
+        if (SUCCEEDED( D3DXCreateEffect( pDevice, &bin[0], bin.size(), NULL, NULL,
+                                            job.m_Key.m_Flags, NULL, &pEffect, NULL ) ))
+        {
+            pEffect->Release();
+        }
+    }
+    stats.m_WarmTime = warmTimer.seconds();
+
+    Log.Info( "Shader cache prewarm: %d effects, %d compiled on %d threads, %d failed. "
+                "Cold: %.2fs (compile sum %.2fs), warm: %.2fs",
+                stats.m_NShaders, stats.m_NCompiled, tmax( nThreads, 1 ), stats.m_NFailed,
+                stats.m_ColdTime, stats.m_CompileTime, stats.m_WarmTime );
+    if (pStats) *pStats = stats;
+    return stats.m_NFailed == 0;
+} // PrewarmShaderCache
@@ -0,0 +1,95 @@
+/*****************************************************************************/
+/*	File:	d3dShaderCache.h
+/*  Desc:	Persistent cache of the compiled effect binaries
+/*	Date:	18.10.2026
+/*****************************************************************************/
+#ifndef __D3DSHADERCACHE_H__
+#define __D3DSHADERCACHE_H__
+
+const DWORD c_ShaderCacheMagic      = 'CXFG';
+const DWORD c_ShaderCacheVersion    = 1;
+const char  c_ShaderCacheTarget[]   = "fx_2_0";     //  effect profile the binaries are compiled for
+const int   c_MaxPrewarmThreads     = 16;
+
+/*****************************************************************************/
+/*  Struct: ShaderCacheKey
+/*  Desc:   Identifies compiled effect: hashes of the preprocessed source
+/*          (so the includes and defines are taken into account), compile
+/*          flags, target profile and the d3dx version
+/*****************************************************************************/
+struct ShaderCacheKey
+{
+    DWORD           m_Hash;
+    DWORD           m_Hash2;
+    DWORD           m_SourceSize;
+    DWORD           m_Flags;
+
+    bool operator ==( const ShaderCacheKey& k ) const
+    {
+        return m_Hash == k.m_Hash && m_Hash2 == k.m_Hash2 &&
+                m_SourceSize == k.m_SourceSize && m_Flags == k.m_Flags;
+    }
+}; // struct ShaderCacheKey
+
+/*****************************************************************************/
+/*  Struct: ShaderCacheHeader
+/*  Desc:   Header of the cache file, followed by the effect binary
+/*****************************************************************************/
+struct ShaderCacheHeader
+{
+    DWORD           m_Magic;
+    DWORD           m_Version;
+    DWORD           m_SDKVersion;
+    ShaderCacheKey  m_Key;
+    DWORD           m_BinSize;
+    DWORD           m_BinHash;
+}; // struct ShaderCacheHeader
+
+/*****************************************************************************/
+/*  Class:  ShaderBinaryCache
+/*  Desc:   Keeps compiled effects in the files under the home directory,
+/*          named by the key hash. Files which do not pass validation are
+/*          removed and the effect is compiled again
+/*****************************************************************************/
+class ShaderBinaryCache
+{
+public:
+    static bool     Preprocess  ( const BYTE* pBuf, int size, ID3DXInclude* pInclude,
+                                    std::vector<BYTE>& text, std::string& errors );
+    static ShaderCacheKey GetKey( const std::vector<BYTE>& text, DWORD flags );
+    static bool     Compile     ( const std::vector<BYTE>& text, DWORD flags,
+                                    std::vector<BYTE>& bin, std::string& errors );
+
+    static bool     Load        ( const ShaderCacheKey& key, std::vector<BYTE>& bin );
+    static bool     Save        ( const ShaderCacheKey& key, const std::vector<BYTE>& bin );
+    static void     Remove      ( const ShaderCacheKey& key );
+    static bool     IsCold      ();
+
+    static bool     s_bEnabled;
+    static bool     s_bPrewarm;     //  compile all effects on all processors at the renderer init, when the cache is cold
+
+private:
+    static void     GetPath     ( const ShaderCacheKey& key, char* path );
+}; // class ShaderBinaryCache
+
+/*****************************************************************************/
+/*  Struct: ShaderPrewarmStats
+/*  Desc:   Results of the cache prewarm
+/*****************************************************************************/
+struct ShaderPrewarmStats
+{
+    int             m_NShaders;         //  effects found
+    int             m_NCompiled;        //  compiled on cold cache
+    int             m_NFailed;          //  not compiled
+    float           m_ColdTime;         //  wall time of parallel compilation, sec
+    float           m_CompileTime;      //  sum of single effect compile times, sec
+    float           m_WarmTime;         //  time to create all effects from cache, sec
+}; // struct ShaderPrewarmStats
+
+//  compiles all effects under the directory (relative to the home one) on
+//  up to nThreads threads. When pStats is given, also times loading them back 
+//  from the cache. nThreads == 0 uses the number of processors
+bool PrewarmShaderCache( const char* shaderDir = "Shaders\\", int nThreads = 0,
+                            ShaderPrewarmStats* pStats = NULL );
+
+#endif // __D3DSHADERCACHE_H__
@@ -7,6 +7,8 @@
 #include "gRenderPch.h"
 #include "d3dx9shader.h"
 #include "d3dShaderFX.h"
+#include "d3dStateFilter.h"
+#include "d3dShaderCache.h"
 #include "direct.h"
 #include "IMediaManager.h"
 
@@ -546,6 +548,7 @@ bool ShaderFX::LoadFromFile( const char* fName )
         const char* pErrText = (const char*)pErrBuffer->GetBufferPointer();
         Log.Error( "Error in shader %s: %s", fName, pErrText );
     }
+    if (m_pEffect) m_pEffect->SetStateManager( GetEffectStateManager() );
     EnumerateVariables();
     EnumerateTechniques();
     return (hr == S_OK);
@@ -565,7 +568,32 @@ bool ShaderFX::LoadFromMemory( const BYTE* pBuf, int bufSize )
     ID3DXBuffer* pErrBuffer = NULL;
     IDirect3DDevice9* pDevice = GetDirect3DDevice();
     s_FXIncluder.SetCurShader( this );
-    hr = D3DXCreateEffect( pDevice, pBuf, bufSize, NULL, &s_FXIncluder, dwShaderFlags, NULL, &m_pEffect, &pErrBuffer );
+
+    //  preprocessed source is the cache key, so compilation is skipped 
+    //  when neither the effect nor its includes have changed
+    std::vector<BYTE> text, bin;
+    std::string errors;
+    if (ShaderBinaryCache::s_bEnabled && 
+        ShaderBinaryCache::Preprocess( pBuf, bufSize, &s_FXIncluder, text, errors ))
+    {
+        ShaderCacheKey key = ShaderBinaryCache::GetKey( text, dwShaderFlags );
+        bool bCached = ShaderBinaryCache::Load( key, bin );
+        if (!bCached && ShaderBinaryCache::Compile( text, dwShaderFlags, bin, errors ))
+        {
+            ShaderBinaryCache::Save( key, bin );
+        }
+        if (bin.size() > 0)
+        {
+            hr = D3DXCreateEffect( pDevice, &bin[0], bin.size(), NULL, NULL, dwShaderFlags, NULL, &m_pEffect, NULL );
+            if (hr != S_OK && bCached) ShaderBinaryCache::Remove( key );
+        }
+    }
+
+    //  compile from the source, also to get the error messages
+    if (!m_pEffect)
+    {
+        hr = D3DXCreateEffect( pDevice, pBuf, bufSize, NULL, &s_FXIncluder, dwShaderFlags, NULL, &m_pEffect, &pErrBuffer );
+    }
     
     if (hr != S_OK)
     {
@@ -585,6 +613,7 @@ bool ShaderFX::LoadFromMemory( const BYTE* pBuf, int bufSize )
         }
     }
     
+    if (m_pEffect) m_pEffect->SetStateManager( GetEffectStateManager() );
     EnumerateVariables();
     EnumerateTechniques();
     return (hr == S_OK);
@@ -593,7 +622,16 @@ bool ShaderFX::Begin()
 {
     if (!m_pEffect) return false;
     UINT nPasses = 0;
-    m_pEffect->Begin( &nPasses, 0 );
+    //  with the state filter effect does not save the states itself, filter restores 
+    //  the ones which are not set again by the next shader, fixed function ones are 
+    //  restored by the state manager on End
+    DWORD flags = 0;
+    if (DeviceStateFilter::s_bEnabled)
+    {
+        GetEffectStateManager()->BeginSave();
+        flags = D3DXFX_DONOTSAVESTATE;
+    }
+    m_pEffect->Begin( &nPasses, flags );
     return true;
 } // ShaderFX::Begin
 
@@ -615,6 +653,7 @@ bool ShaderFX::End()
 {
     if (!m_pEffect) return false;
     m_pEffect->End();
+    GetEffectStateManager()->EndSave();
     return true;
 } // ShaderFX::End
 
@@ -0,0 +1,605 @@
+/*****************************************************************************/
+/*	File:	d3dStateFilter.cpp
+/*  Desc:	Redundant device state change filter implementation
+/*	Date:	18.10.2026
+/*****************************************************************************/
+#include "gRenderPch.h"
+#include "d3dStateFilter.h"
+
+bool DeviceStateFilter::s_bEnabled = true;
+
+/*****************************************************************************/
+/*  StateFilterStats implementation
+/*****************************************************************************/
+int StateFilterStats::GetNIssued() const
+{
+    int n = 0;
+    for (int i = 0; i < scNumClasses; i++) n += m_NIssued[i];
+    return n;
+} // StateFilterStats::GetNIssued
+
+int StateFilterStats::GetNFiltered() const
+{
+    int n = 0;
+    for (int i = 0; i < scNumClasses; i++) n += m_NFiltered[i];
+    return n;
+} // StateFilterStats::GetNFiltered
+
+/*****************************************************************************/
+/*  StateDeviceStub implementation
+/*****************************************************************************/
+HRESULT StateDeviceStub::SetRenderState( D3DRENDERSTATETYPE state, DWORD value )
+{
+    m_NCalls++;
+    if (state < c_MaxFilterRS) m_Value[c_RSKeyBase + state] = value;
+    return S_OK;
+}
+
+HRESULT StateDeviceStub::SetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value )
+{
+    m_NCalls++;
+    if (stage < c_MaxFilterStages && type < c_MaxFilterTSS)
+    {
+        m_Value[c_TSSKeyBase + stage*c_MaxFilterTSS + type] = value;
+    }
+    return S_OK;
+}
+
+HRESULT StateDeviceStub::SetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value )
+{
+    m_NCalls++;
+    if (sampler < c_MaxFilterSamplers && type < c_MaxFilterSampStates)
+    {
+        m_Value[c_SampKeyBase + sampler*c_MaxFilterSampStates + type] = value;
+    }
+    return S_OK;
+}
+
+HRESULT StateDeviceStub::SetTexture( DWORD stage, IDirect3DBaseTexture9* pTexture )
+{
+    m_NCalls++;
+    if (stage < c_MaxFilterSamplers) m_Value[c_TexKeyBase + stage] = (UINT_PTR)pTexture;
+    return S_OK;
+}
+
+HRESULT StateDeviceStub::SetVertexShader( IDirect3DVertexShader9* pShader )
+{
+    m_NCalls++;
+    m_Value[c_VSKey] = (UINT_PTR)pShader;
+    return S_OK;
+}
+
+HRESULT StateDeviceStub::SetPixelShader( IDirect3DPixelShader9* pShader )
+{
+    m_NCalls++;
+    m_Value[c_PSKey] = (UINT_PTR)pShader;
+    return S_OK;
+}
+
+HRESULT StateDeviceStub::GetRenderState( D3DRENDERSTATETYPE state, DWORD* pValue )
+{
+    if (state >= c_MaxFilterRS) return E_FAIL;
+    *pValue = (DWORD)m_Value[c_RSKeyBase + state];
+    return S_OK;
+}
+
+HRESULT StateDeviceStub::GetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD* pValue )
+{
+    if (stage >= c_MaxFilterStages || type >= c_MaxFilterTSS) return E_FAIL;
+    *pValue = (DWORD)m_Value[c_TSSKeyBase + stage*c_MaxFilterTSS + type];
+    return S_OK;
+}
+
+HRESULT StateDeviceStub::GetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD* pValue )
+{
+    if (sampler >= c_MaxFilterSamplers || type >= c_MaxFilterSampStates) return E_FAIL;
+    *pValue = (DWORD)m_Value[c_SampKeyBase + sampler*c_MaxFilterSampStates + type];
+    return S_OK;
+}
+
+/*****************************************************************************/
+/*  DeviceStateFilter implementation
+/*****************************************************************************/
+DeviceStateFilter::DeviceStateFilter()
+{
+    m_pDevice       = NULL;
+    m_Stamp         = 1;
+    m_bSaving       = false;
+    m_SaveScope     = 1;
+    m_PendingScope  = 1;
+    memset( m_Value,        0, sizeof( m_Value        ) );
+    memset( m_ValidStamp,   0, sizeof( m_ValidStamp   ) );
+    memset( m_SavedScope,   0, sizeof( m_SavedScope   ) );
+    memset( m_Saved,        0, sizeof( m_Saved        ) );
+    memset( m_PendingStamp, 0, sizeof( m_PendingStamp ) );
+    memset( m_Pending,      0, sizeof( m_Pending      ) );
+    m_CurFrame.Reset();
+    m_LastFrame.Reset();
+} // DeviceStateFilter::DeviceStateFilter
+
+void DeviceStateFilter::Invalidate()
+{
+    m_Stamp++;
+    if (m_Stamp == 0)
+    {
+        memset( m_ValidStamp, 0, sizeof( m_ValidStamp ) );
+        m_Stamp = 1;
+    }
+    //  textures and shaders can not be read back, they are NULL on the new
+    //  or reset device, so the effects can restore them
+    for (int key = c_TexKeyBase; key < c_NStateKeys; key++)
+    {
+        m_Value[key]      = 0;
+        m_ValidStamp[key] = m_Stamp;
+    }
+    //  values to restore are not valid anymore, too
+    m_bSaving = false;
+    m_SaveScope++;
+    m_SavedKeys.clear();
+    m_PendingScope++;
+    m_PendingKeys.clear();
+} // DeviceStateFilter::Invalidate
+
+StateClass DeviceStateFilter::GetStateClass( int key )
+{
+    if (key < c_TSSKeyBase)  return scRender;
+    if (key < c_SampKeyBase) return scTexStage;
+    if (key < c_TexKeyBase)  return scSampler;
+    if (key < c_VSKey)       return scTexture;
+    return scShader;
+} // DeviceStateFilter::GetStateClass
+
+int DeviceStateFilter::GetSamplerSlot( DWORD sampler )
+{
+    if (sampler < 16) return sampler;
+    if (sampler >= D3DVERTEXTEXTURESAMPLER0 && sampler <= D3DVERTEXTEXTURESAMPLER3)
+    {
+        return 16 + sampler - D3DVERTEXTEXTURESAMPLER0;
+    }
+    return -1;
+} // DeviceStateFilter::GetSamplerSlot
+
+/*---------------------------------------------------------------*
+/*  Func:	DeviceStateFilter::Issue
+/*	Desc:	Passes state value to the device and updates the shadow
+/*---------------------------------------------------------------*/
+HRESULT DeviceStateFilter::Issue( int key, UINT_PTR value )
+{
+    HRESULT hr = E_FAIL;
+    if (key < c_TSSKeyBase)
+    {
+        hr = m_pDevice->SetRenderState( D3DRENDERSTATETYPE( key - c_RSKeyBase ), (DWORD)value );
+    }
+    else if (key < c_SampKeyBase)
+    {
+        int idx = key - c_TSSKeyBase;
+        hr = m_pDevice->SetTextureStageState( idx/c_MaxFilterTSS,
+                    D3DTEXTURESTAGESTATETYPE( idx%c_MaxFilterTSS ), (DWORD)value );
+    }
+    else if (key < c_TexKeyBase)
+    {
+        int idx  = key - c_SampKeyBase;
+        int slot = idx/c_MaxFilterSampStates;
+        DWORD sampler = slot < 16 ? slot : D3DVERTEXTEXTURESAMPLER0 + slot - 16;
+        hr = m_pDevice->SetSamplerState( sampler,
+                    D3DSAMPLERSTATETYPE( idx%c_MaxFilterSampStates ), (DWORD)value );
+    }
+    else if (key < c_VSKey)
+    {
+        int slot = key - c_TexKeyBase;
+        DWORD stage = slot < 16 ? slot : D3DVERTEXTEXTURESAMPLER0 + slot - 16;
+        hr = m_pDevice->SetTexture( stage, (IDirect3DBaseTexture9*)value );
+    }
+    else if (key == c_VSKey)
+    {
+        hr = m_pDevice->SetVertexShader( (IDirect3DVertexShader9*)value );
+    }
+    else
+    {
+        hr = m_pDevice->SetPixelShader( (IDirect3DPixelShader9*)value );
+    }
+
+    m_CurFrame.m_NIssued[GetStateClass( key )]++;
+    if (SUCCEEDED( hr ))
+    {
+        m_Value[key]      = value;
+        m_ValidStamp[key] = m_Stamp;
+    }
+    else
+    {
+        m_ValidStamp[key] = 0;
+    }
+    return hr;
+} // DeviceStateFilter::Issue
+
+/*---------------------------------------------------------------*
+/*  Func:	DeviceStateFilter::GetDeviceValue
+/*	Desc:	Current value of the state on the device. Textures and
+/*          shaders are not read back - false if they were set past 
+/*          the filter since the last Invalidate
+/*---------------------------------------------------------------*/
+bool DeviceStateFilter::GetDeviceValue( int key, UINT_PTR& value )
+{
+    if (m_ValidStamp[key] == m_Stamp)
+    {
+        value = m_Value[key];
+        return true;
+    }
+
+    DWORD   val = 0;
+    HRESULT hr  = E_FAIL;
+    if (key < c_TSSKeyBase)
+    {
+        hr = m_pDevice->GetRenderState( D3DRENDERSTATETYPE( key - c_RSKeyBase ), &val );
+    }
+    else if (key < c_SampKeyBase)
+    {
+        int idx = key - c_TSSKeyBase;
+        hr = m_pDevice->GetTextureStageState( idx/c_MaxFilterTSS,
+                    D3DTEXTURESTAGESTATETYPE( idx%c_MaxFilterTSS ), &val );
+    }
+    else if (key < c_TexKeyBase)
+    {
+        int idx  = key - c_SampKeyBase;
+        int slot = idx/c_MaxFilterSampStates;
+        DWORD sampler = slot < 16 ? slot : D3DVERTEXTEXTURESAMPLER0 + slot - 16;
+        hr = m_pDevice->GetSamplerState( sampler,
+                    D3DSAMPLERSTATETYPE( idx%c_MaxFilterSampStates ), &val );
+    }
+    if (FAILED( hr )) return false;
+
+    value             = val;
+    m_Value[key]      = val;
+    m_ValidStamp[key] = m_Stamp;
+    return true;
+} // DeviceStateFilter::GetDeviceValue
+
+/*---------------------------------------------------------------*
+/*  Func:	DeviceStateFilter::SaveState
+/*	Desc:	Remembers value to restore, on the first change of the
+/*          state in the save scope
+/*---------------------------------------------------------------*/
+void DeviceStateFilter::SaveState( int key )
+{
+    if (m_SavedScope[key] == m_SaveScope) return;
+    UINT_PTR value = 0;
+    if (m_PendingStamp[key] == m_PendingScope)
+    {
+        //  state is still to be restored from the previous scope
+        value = m_Pending[key];
+    }
+    else if (!GetDeviceValue( key, value ))
+    {
+        return;
+    }
+    m_SavedScope[key] = m_SaveScope;
+    m_Saved[key]      = value;
+    m_SavedKeys.push_back( key );
+} // DeviceStateFilter::SaveState
+
+HRESULT DeviceStateFilter::Set( int key, UINT_PTR value )
+{
+    if (m_bSaving) SaveState( key );
+
+    if (m_PendingStamp[key] == m_PendingScope)
+    {
+        //  restore is overridden by the new value
+        m_PendingStamp[key] = 0;
+        m_CurFrame.m_NFiltered[GetStateClass( key )]++;
+    }
+
+    if (m_ValidStamp[key] == m_Stamp && m_Value[key] == value)
+    {
+        m_CurFrame.m_NFiltered[GetStateClass( key )]++;
+        return S_OK;
+    }
+    return Issue( key, value );
+} // DeviceStateFilter::Set
+
+HRESULT DeviceStateFilter::SetRenderState( D3DRENDERSTATETYPE state, DWORD value )
+{
+    if (!s_bEnabled || state >= c_MaxFilterRS)
+    {
+        if (state < c_MaxFilterRS) m_ValidStamp[c_RSKeyBase + state] = 0;
+        m_CurFrame.m_NIssued[scRender]++;
+        return m_pDevice->SetRenderState( state, value );
+    }
+    return Set( c_RSKeyBase + state, value );
+} // DeviceStateFilter::SetRenderState
+
+HRESULT DeviceStateFilter::SetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value )
+{
+    bool bInRange = (stage < c_MaxFilterStages && type < c_MaxFilterTSS);
+    int  key      = c_TSSKeyBase + stage*c_MaxFilterTSS + type;
+    if (!s_bEnabled || !bInRange)
+    {
+        if (bInRange) m_ValidStamp[key] = 0;
+        m_CurFrame.m_NIssued[scTexStage]++;
+        return m_pDevice->SetTextureStageState( stage, type, value );
+    }
+    return Set( key, value );
+} // DeviceStateFilter::SetTextureStageState
+
+HRESULT DeviceStateFilter::SetSamplerState( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value )
+{
+    int  slot     = GetSamplerSlot( sampler );
+    bool bInRange = (slot >= 0 && type < c_MaxFilterSampStates);
+    int  key      = c_SampKeyBase + slot*c_MaxFilterSampStates + type;
+    if (!s_bEnabled || !bInRange)
+    {
+        if (bInRange) m_ValidStamp[key] = 0;
+        m_CurFrame.m_NIssued[scSampler]++;
+        return m_pDevice->SetSamplerState( sampler, type, value );
+    }
+    return Set( key, value );
+} // DeviceStateFilter::SetSamplerState
+
+HRESULT DeviceStateFilter::SetTexture( DWORD stage, IDirect3DBaseTexture9* pTexture )
+{
+    int slot = GetSamplerSlot( stage );
+    if (!s_bEnabled || slot < 0)
+    {
+        if (slot >= 0) m_ValidStamp[c_TexKeyBase + slot] = 0;
+        m_CurFrame.m_NIssued[scTexture]++;
+        return m_pDevice->SetTexture( stage, pTexture );
+    }
+    return Set( c_TexKeyBase + slot, (UINT_PTR)pTexture );
+} // DeviceStateFilter::SetTexture
+
+HRESULT DeviceStateFilter::SetVertexShader( IDirect3DVertexShader9* pShader )
+{
+    if (!s_bEnabled)
+    {
+        m_ValidStamp[c_VSKey] = 0;
+        m_CurFrame.m_NIssued[scShader]++;
+        return m_pDevice->SetVertexShader( pShader );
+    }
+    return Set( c_VSKey, (UINT_PTR)pShader );
+} // DeviceStateFilter::SetVertexShader
+
+HRESULT DeviceStateFilter::SetPixelShader( IDirect3DPixelShader9* pShader )
+{
+    if (!s_bEnabled)
+    {
+        m_ValidStamp[c_PSKey] = 0;
+        m_CurFrame.m_NIssued[scShader]++;
+        return m_pDevice->SetPixelShader( pShader );
+    }
+    return Set( c_PSKey, (UINT_PTR)pShader );
+} // DeviceStateFilter::SetPixelShader
+
+void DeviceStateFilter::BeginSave()
+{
+    //  pass switch of the same shader does not end the save scope
+    if (m_bSaving) return;
+    m_bSaving = true;
+    m_SaveScope++;
+    if (m_SaveScope == 0)
+    {
+        memset( m_SavedScope, 0, sizeof( m_SavedScope ) );
+        m_SaveScope = 1;
+    }
+    m_SavedKeys.clear();
+} // DeviceStateFilter::BeginSave
+
+/*---------------------------------------------------------------*
+/*  Func:	DeviceStateFilter::EndSave
+/*	Desc:	Saved states become pending restores. They are issued on
+/*          Commit, so that state set again by the next effect pass
+/*          goes to the device only once
+/*---------------------------------------------------------------*/
+void DeviceStateFilter::EndSave()
+{
+    if (!m_bSaving) return;
+    m_bSaving = false;
+    for (int i = 0; i < (int)m_SavedKeys.size(); i++)
+    {
+        int key = m_SavedKeys[i];
+        if (m_ValidStamp[key] == m_Stamp && m_Value[key] == m_Saved[key]) continue;
+        if (m_PendingStamp[key] != m_PendingScope) m_PendingKeys.push_back( key );
+        m_PendingStamp[key] = m_PendingScope;
+        m_Pending[key]      = m_Saved[key];
+    }
+    m_SavedKeys.clear();
+} // DeviceStateFilter::EndSave
+
+void DeviceStateFilter::Commit()
+{
+    if (m_PendingKeys.size() == 0) return;
+    for (int i = 0; i < (int)m_PendingKeys.size(); i++)
+    {
+        int key = m_PendingKeys[i];
+        if (m_PendingStamp[key] != m_PendingScope) continue;
+        m_PendingStamp[key] = 0;
+        if (m_ValidStamp[key] == m_Stamp && m_Value[key] == m_Pending[key]) continue;
+        Issue( key, m_Pending[key] );
+    }
+    m_PendingKeys.clear();
+    m_PendingScope++;
+    if (m_PendingScope == 0)
+    {
+        memset( m_PendingStamp, 0, sizeof( m_PendingStamp ) );
+        m_PendingScope = 1;
+    }
+} // DeviceStateFilter::Commit
+
+void DeviceStateFilter::OnFrame()
+{
+    m_LastFrame = m_CurFrame;
+    m_CurFrame.Reset();
+} // DeviceStateFilter::OnFrame
+
+/*****************************************************************************/
+/*  EffectStateManager implementation
+/*****************************************************************************/
+HRESULT EffectStateManager::QueryInterface( REFIID iid, LPVOID* ppv )
+{
+    if (iid == IID_IUnknown || iid == IID_ID3DXEffectStateManager)
+    {
+        *ppv = this;
+        AddRef();
+        return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+} // EffectStateManager::QueryInterface
+
+void EffectStateManager::BeginSave()
+{
+    if (m_pFilter->IsSaving()) return;
+    m_pFilter->BeginSave();
+    m_SavedTM.clear();
+    m_SavedLights.clear();
+    m_SavedLightEnable.clear();
+    m_bMaterialSaved    = false;
+    m_bFVFSaved         = false;
+    m_bNPatchSaved      = false;
+} // EffectStateManager::BeginSave
+
+/*---------------------------------------------------------------*
+/*  Func:	EffectStateManager::EndSave
+/*	Desc:	Filtered states become pending restores, the fixed function
+/*          ones are few and are restored right away, as D3DX did
+/*---------------------------------------------------------------*/
+void EffectStateManager::EndSave()
+{
+    if (!m_pFilter->IsSaving()) return;
+    m_pFilter->EndSave();
+    for (int i = 0; i < (int)m_SavedTM.size(); i++)
+    {
+        m_pDevice->SetTransform( m_SavedTM[i].m_State, &m_SavedTM[i].m_TM );
+    }
+    for (int i = 0; i < (int)m_SavedLights.size(); i++)
+    {
+        m_pDevice->SetLight( m_SavedLights[i].m_Index, &m_SavedLights[i].m_Light );
+    }
+    for (int i = 0; i < (int)m_SavedLightEnable.size(); i++)
+    {
+        m_pDevice->LightEnable( m_SavedLightEnable[i].m_Index, m_SavedLightEnable[i].m_bEnable );
+    }
+    if (m_bMaterialSaved)   m_pDevice->SetMaterial  ( &m_SavedMaterial );
+    if (m_bFVFSaved)        m_pDevice->SetFVF       ( m_SavedFVF );
+    if (m_bNPatchSaved)     m_pDevice->SetNPatchMode( m_SavedNPatch );
+} // EffectStateManager::EndSave
+
+HRESULT EffectStateManager::SetTransform( D3DTRANSFORMSTATETYPE state, CONST D3DMATRIX* pMatrix )
+{
+    if (m_pFilter->IsSaving())
+    {
+        bool bSaved = false;
+        for (int i = 0; i < (int)m_SavedTM.size() && !bSaved; i++) bSaved = (m_SavedTM[i].m_State == state);
+        SavedTransform st;
+        st.m_State = state;
+        if (!bSaved && SUCCEEDED( m_pDevice->GetTransform( state, &st.m_TM ) )) m_SavedTM.push_back( st );
+    }
+    return m_pDevice->SetTransform( state, pMatrix );
+} // EffectStateManager::SetTransform
+
+HRESULT EffectStateManager::SetMaterial( CONST D3DMATERIAL9* pMaterial )
+{
+    if (m_pFilter->IsSaving() && !m_bMaterialSaved)
+    {
+        m_bMaterialSaved = SUCCEEDED( m_pDevice->GetMaterial( &m_SavedMaterial ) );
+    }
+    return m_pDevice->SetMaterial( pMaterial );
+} // EffectStateManager::SetMaterial
+
+HRESULT EffectStateManager::SetLight( DWORD index, CONST D3DLIGHT9* pLight )
+{
+    if (m_pFilter->IsSaving())
+    {
+        bool bSaved = false;
+        for (int i = 0; i < (int)m_SavedLights.size() && !bSaved; i++) bSaved = (m_SavedLights[i].m_Index == index);
+        SavedLight sl;
+        sl.m_Index = index;
+        if (!bSaved && SUCCEEDED( m_pDevice->GetLight( index, &sl.m_Light ) )) m_SavedLights.push_back( sl );
+    }
+    return m_pDevice->SetLight( index, pLight );
+} // EffectStateManager::SetLight
+
+HRESULT EffectStateManager::LightEnable( DWORD index, BOOL enable )
+{
+    if (m_pFilter->IsSaving())
+    {
+        bool bSaved = false;
+        for (int i = 0; i < (int)m_SavedLightEnable.size() && !bSaved; i++) bSaved = (m_SavedLightEnable[i].m_Index == index);
+        SavedLightEnable se;
+        se.m_Index = index;
+        if (!bSaved && SUCCEEDED( m_pDevice->GetLightEnable( index, &se.m_bEnable ) )) m_SavedLightEnable.push_back( se );
+    }
+    return m_pDevice->LightEnable( index, enable );
+} // EffectStateManager::LightEnable
+
+HRESULT EffectStateManager::SetNPatchMode( FLOAT numSegments )
+{
+    if (m_pFilter->IsSaving() && !m_bNPatchSaved)
+    {
+        m_SavedNPatch   = m_pDevice->GetNPatchMode();
+        m_bNPatchSaved  = true;
+    }
+    return m_pDevice->SetNPatchMode( numSegments );
+} // EffectStateManager::SetNPatchMode
+
+HRESULT EffectStateManager::SetFVF( DWORD fvf )
+{
+    if (m_pFilter->IsSaving() && !m_bFVFSaved)
+    {
+        m_bFVFSaved = SUCCEEDED( m_pDevice->GetFVF( &m_SavedFVF ) );
+    }
+    return m_pDevice->SetFVF( fvf );
+} // EffectStateManager::SetFVF
+
+/*---------------------------------------------------------------*
+/*  Func:	TestDeviceStateFilter
+/*---------------------------------------------------------------*/
+bool TestDeviceStateFilter()
+{
+    StateDeviceStub     dev;
+    DeviceStateFilter   filter;
+    filter.SetDevice( &dev );
+
+    //  repeated value goes to the device once
+    filter.SetRenderState( D3DRS_ZENABLE, TRUE );
+    filter.SetRenderState( D3DRS_ZENABLE, TRUE );
+    filter.SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR );
+    filter.SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR );
+    if (dev.m_NCalls != 2) return false;
+
+    //  state changed by effect is restored on commit
+    filter.BeginSave();
+    filter.SetRenderState( D3DRS_ZENABLE, FALSE );
+    filter.SetRenderState( D3DRS_ALPHAREF, 0x80 );
+    filter.EndSave();
+    if (dev.m_NCalls != 4) return false;
+    filter.Commit();
+    if (dev.m_NCalls != 6) return false;
+    if (dev.m_Value[c_RSKeyBase + D3DRS_ZENABLE] != TRUE) return false;
+    if (dev.m_Value[c_RSKeyBase + D3DRS_ALPHAREF] != 0) return false;
+
+    //  restore overridden by the next effect is dropped
+    filter.BeginSave();
+    filter.SetRenderState( D3DRS_ZENABLE, FALSE );
+    filter.EndSave();
+    filter.BeginSave();
+    filter.SetRenderState( D3DRS_ZENABLE, FALSE );
+    filter.EndSave();
+    filter.Commit();
+    if (dev.m_NCalls != 8) return false;
+    if (dev.m_Value[c_RSKeyBase + D3DRS_ZENABLE] != TRUE) return false;
+
+    //  after invalidation values are passed again
+    filter.Invalidate();
+    filter.SetRenderState( D3DRS_ZENABLE, TRUE );
+    if (dev.m_NCalls != 9) return false;
+
+    //  shader set by effect right after invalidation is restored to NULL
+    filter.BeginSave();
+    filter.SetPixelShader( (IDirect3DPixelShader9*)1 );
+    filter.EndSave();
+    filter.Commit();
+    if (dev.m_NCalls != 11) return false;
+    if (dev.m_Value[c_PSKey] != 0) return false;
+
+    const StateFilterStats& stats = filter.GetCurStats();
+    return stats.GetNIssued() == dev.m_NCalls;
+} // TestDeviceStateFilter
@@ -0,0 +1,294 @@
+/*****************************************************************************/
+/*	File:	d3dStateFilter.h
+/*  Desc:	Shadow copy of the device state, which drops redundant render,
+/*          texture stage and sampler state changes
+/*	Date:	18.10.2026
+/*****************************************************************************/
+#ifndef __D3DSTATEFILTER_H__
+#define __D3DSTATEFILTER_H__
+
+const int c_MaxFilterRS         = 256;  //  D3DRS_* are below 256
+const int c_MaxFilterStages     = 8;
+const int c_MaxFilterTSS        = 64;   //  D3DTSS_* are below 64
+const int c_MaxFilterSamplers   = 20;   //  16 pixel samplers, then 4 vertex texture samplers
+const int c_MaxFilterSampStates = 16;   //  D3DSAMP_* are below 16
+
+//  offsets of the state groups in the state key space
+const int c_RSKeyBase           = 0;
+const int c_TSSKeyBase          = c_RSKeyBase + c_MaxFilterRS;
+const int c_SampKeyBase         = c_TSSKeyBase + c_MaxFilterStages*c_MaxFilterTSS;
+const int c_TexKeyBase          = c_SampKeyBase + c_MaxFilterSamplers*c_MaxFilterSampStates;
+const int c_VSKey               = c_TexKeyBase + c_MaxFilterSamplers;
+const int c_PSKey               = c_VSKey + 1;
+const int c_NStateKeys          = c_PSKey + 1;
+
+/*****************************************************************************/
+/*  Enum:   StateClass
+/*  Desc:   Kinds of the filtered device states, for the statistics
+/*****************************************************************************/
+enum StateClass
+{
+    scRender        = 0,
+    scTexStage      = 1,
+    scSampler       = 2,
+    scTexture       = 3,
+    scShader        = 4,
+    scNumClasses    = 5
+}; // enum StateClass
+
+/*****************************************************************************/
+/*  Struct: StateFilterStats
+/*  Desc:   Numbers of state changes passed to the device and dropped
+/*****************************************************************************/
+struct StateFilterStats
+{
+    int             m_NIssued   [scNumClasses];
+    int             m_NFiltered [scNumClasses];
+
+    void            Reset       () { memset( this, 0, sizeof( *this ) ); }
+    int             GetNIssued  () const;
+    int             GetNFiltered() const;
+}; // struct StateFilterStats
+
+/*****************************************************************************/
+/*  Class:  IStateDevice
+/*  Desc:   Device side of the state filter
+/*****************************************************************************/
+class IStateDevice
+{
+public:
+    virtual HRESULT SetRenderState      ( D3DRENDERSTATETYPE state, DWORD value ) = 0;
+    virtual HRESULT SetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value ) = 0;
+    virtual HRESULT SetSamplerState     ( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value ) = 0;
+    virtual HRESULT SetTexture          ( DWORD stage, IDirect3DBaseTexture9* pTexture ) = 0;
+    virtual HRESULT SetVertexShader     ( IDirect3DVertexShader9* pShader ) = 0;
+    virtual HRESULT SetPixelShader      ( IDirect3DPixelShader9* pShader ) = 0;
+
+    virtual HRESULT GetRenderState      ( D3DRENDERSTATETYPE state, DWORD* pValue ) = 0;
+    virtual HRESULT GetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD* pValue ) = 0;
+    virtual HRESULT GetSamplerState     ( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD* pValue ) = 0;
+}; // class IStateDevice
+
+/*****************************************************************************/
+/*  Class:  StateDeviceDX9
+/*  Desc:   Passes the state changes to the Direct3D9 device
+/*****************************************************************************/
+class StateDeviceDX9 : public IStateDevice
+{
+    IDirect3DDevice9*   m_pDevice;
+
+public:
+                    StateDeviceDX9      () : m_pDevice( NULL ) {}
+    void            SetDevice           ( IDirect3DDevice9* pDevice ) { m_pDevice = pDevice; }
+
+    virtual HRESULT SetRenderState      ( D3DRENDERSTATETYPE state, DWORD value )
+                        { return m_pDevice->SetRenderState( state, value ); }
+    virtual HRESULT SetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value )
+                        { return m_pDevice->SetTextureStageState( stage, type, value ); }
+    virtual HRESULT SetSamplerState     ( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value )
+                        { return m_pDevice->SetSamplerState( sampler, type, value ); }
+    virtual HRESULT SetTexture          ( DWORD stage, IDirect3DBaseTexture9* pTexture )
+                        { return m_pDevice->SetTexture( stage, pTexture ); }
+    virtual HRESULT SetVertexShader     ( IDirect3DVertexShader9* pShader )
+                        { return m_pDevice->SetVertexShader( pShader ); }
+    virtual HRESULT SetPixelShader      ( IDirect3DPixelShader9* pShader )
+                        { return m_pDevice->SetPixelShader( pShader ); }
+
+    virtual HRESULT GetRenderState      ( D3DRENDERSTATETYPE state, DWORD* pValue )
+                        { return m_pDevice->GetRenderState( state, pValue ); }
+    virtual HRESULT GetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD* pValue )
+                        { return m_pDevice->GetTextureStageState( stage, type, pValue ); }
+    virtual HRESULT GetSamplerState     ( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD* pValue )
+                        { return m_pDevice->GetSamplerState( sampler, type, pValue ); }
+}; // class StateDeviceDX9
+
+/*****************************************************************************/
+/*  Class:  StateDeviceStub
+/*  Desc:   Device which only keeps the state values and counts the calls,
+/*          used to check the filter without Direct3D
+/*****************************************************************************/
+class StateDeviceStub : public IStateDevice
+{
+public:
+    UINT_PTR        m_Value[c_NStateKeys];
+    int             m_NCalls;
+
+                    StateDeviceStub     () : m_NCalls( 0 ) { memset( m_Value, 0, sizeof( m_Value ) ); }
+
+    virtual HRESULT SetRenderState      ( D3DRENDERSTATETYPE state, DWORD value );
+    virtual HRESULT SetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value );
+    virtual HRESULT SetSamplerState     ( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value );
+    virtual HRESULT SetTexture          ( DWORD stage, IDirect3DBaseTexture9* pTexture );
+    virtual HRESULT SetVertexShader     ( IDirect3DVertexShader9* pShader );
+    virtual HRESULT SetPixelShader      ( IDirect3DPixelShader9* pShader );
+
+    virtual HRESULT GetRenderState      ( D3DRENDERSTATETYPE state, DWORD* pValue );
+    virtual HRESULT GetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD* pValue );
+    virtual HRESULT GetSamplerState     ( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD* pValue );
+}; // class StateDeviceStub
+
+/*****************************************************************************/
+/*  Class:  DeviceStateFilter
+/*  Desc:   Keeps shadow copy of the device states and passes to the device
+/*          only the changes of value.
+/*          Effects are run without saving the state: states touched between
+/*          BeginSave and EndSave are restored lazily, on the next Commit,
+/*          unless they are set again before it. Commit is called before
+/*          each draw call
+/*****************************************************************************/
+class DeviceStateFilter
+{
+public:
+                        DeviceStateFilter   ();
+
+    void                SetDevice           ( IStateDevice* pDevice ) { m_pDevice = pDevice; Invalidate(); }
+    IStateDevice*       GetDevice           () const { return m_pDevice; }
+
+    //  forgets the shadow state, e.g. after device reset
+    void                Invalidate          ();
+
+    HRESULT             SetRenderState      ( D3DRENDERSTATETYPE state, DWORD value );
+    HRESULT             SetTextureStageState( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value );
+    HRESULT             SetSamplerState     ( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value );
+    HRESULT             SetTexture          ( DWORD stage, IDirect3DBaseTexture9* pTexture );
+    HRESULT             SetVertexShader     ( IDirect3DVertexShader9* pShader );
+    HRESULT             SetPixelShader      ( IDirect3DPixelShader9* pShader );
+
+    //  states set while saving are restored after EndSave
+    void                BeginSave           ();
+    void                EndSave             ();
+    bool                IsSaving            () const { return m_bSaving; }
+    //  issues pending restores to the device
+    void                Commit              ();
+
+    //  finishes frame statistics
+    void                OnFrame             ();
+    const StateFilterStats& GetFrameStats   () const { return m_LastFrame; }
+    const StateFilterStats& GetCurStats     () const { return m_CurFrame; }
+
+    static bool         s_bEnabled;
+
+private:
+    HRESULT             Set                 ( int key, UINT_PTR value );
+    HRESULT             Issue               ( int key, UINT_PTR value );
+    bool                GetDeviceValue      ( int key, UINT_PTR& value );
+    void                SaveState           ( int key );
+    static StateClass   GetStateClass       ( int key );
+    static int          GetSamplerSlot      ( DWORD sampler );
+
+    IStateDevice*       m_pDevice;
+
+    UINT_PTR            m_Value     [c_NStateKeys];     //  value on the device
+    DWORD               m_ValidStamp[c_NStateKeys];     //  value is known when equal to m_Stamp
+    DWORD               m_Stamp;
+
+    bool                m_bSaving;
+    DWORD               m_SaveScope;
+    DWORD               m_SavedScope[c_NStateKeys];     //  state is saved in the current scope
+    UINT_PTR            m_Saved     [c_NStateKeys];     //  value to restore at the end of scope
+    std::vector<int>    m_SavedKeys;
+
+    DWORD               m_PendingStamp[c_NStateKeys];   //  restore is pending when equal to m_PendingScope
+    DWORD               m_PendingScope;
+    UINT_PTR            m_Pending   [c_NStateKeys];
+    std::vector<int>    m_PendingKeys;
+
+    StateFilterStats    m_CurFrame;
+    StateFilterStats    m_LastFrame;
+}; // class DeviceStateFilter
+
+/*****************************************************************************/
+/*  Class:  EffectStateManager
+/*  Desc:   Routes the state changes of the d3dx effects through the filter.
+/*          Fixed function states go to the device, the ones changed between
+/*          BeginSave and EndSave are read back and restored by EndSave
+/*****************************************************************************/
+class EffectStateManager : public ID3DXEffectStateManager
+{
+    struct SavedTransform
+    {
+        D3DTRANSFORMSTATETYPE   m_State;
+        D3DMATRIX               m_TM;
+    }; // struct SavedTransform
+
+    struct SavedLight
+    {
+        DWORD                   m_Index;
+        D3DLIGHT9               m_Light;
+    }; // struct SavedLight
+
+    struct SavedLightEnable
+    {
+        DWORD                   m_Index;
+        BOOL                    m_bEnable;
+    }; // struct SavedLightEnable
+
+    IDirect3DDevice9*               m_pDevice;
+    DeviceStateFilter*              m_pFilter;
+
+    std::vector<SavedTransform>     m_SavedTM;
+    std::vector<SavedLight>         m_SavedLights;
+    std::vector<SavedLightEnable>   m_SavedLightEnable;
+    D3DMATERIAL9                    m_SavedMaterial;
+    DWORD                           m_SavedFVF;
+    float                           m_SavedNPatch;
+    bool                            m_bMaterialSaved;
+    bool                            m_bFVFSaved;
+    bool                            m_bNPatchSaved;
+
+public:
+                        EffectStateManager  () : m_pDevice( NULL ), m_pFilter( NULL ), 
+                                                m_bMaterialSaved( false ), m_bFVFSaved( false ), m_bNPatchSaved( false ) {}
+    void                Init                ( IDirect3DDevice9* pDevice, DeviceStateFilter* pFilter )
+                                                { m_pDevice = pDevice; m_pFilter = pFilter; }
+
+    //  effect begins and ends without saving the state, these save and restore it
+    void                BeginSave           ();
+    void                EndSave             ();
+
+    //  lives as long as the render system, so reference counting is dummy
+    STDMETHOD(QueryInterface)           ( REFIID iid, LPVOID* ppv );
+    STDMETHOD_(ULONG, AddRef)           () { return 1; }
+    STDMETHOD_(ULONG, Release)          () { return 1; }
+
+    STDMETHOD(SetTransform)             ( D3DTRANSFORMSTATETYPE state, CONST D3DMATRIX* pMatrix );
+    STDMETHOD(SetMaterial)              ( CONST D3DMATERIAL9* pMaterial );
+    STDMETHOD(SetLight)                 ( DWORD index, CONST D3DLIGHT9* pLight );
+    STDMETHOD(LightEnable)              ( DWORD index, BOOL enable );
+    STDMETHOD(SetRenderState)           ( D3DRENDERSTATETYPE state, DWORD value )
+                                            { return m_pFilter->SetRenderState( state, value ); }
+    STDMETHOD(SetTexture)               ( DWORD stage, LPDIRECT3DBASETEXTURE9 pTexture )
+                                            { return m_pFilter->SetTexture( stage, pTexture ); }
+    STDMETHOD(SetTextureStageState)     ( DWORD stage, D3DTEXTURESTAGESTATETYPE type, DWORD value )
+                                            { return m_pFilter->SetTextureStageState( stage, type, value ); }
+    STDMETHOD(SetSamplerState)          ( DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value )
+                                            { return m_pFilter->SetSamplerState( sampler, type, value ); }
+    STDMETHOD(SetNPatchMode)            ( FLOAT numSegments );
+    STDMETHOD(SetFVF)                   ( DWORD fvf );
+    STDMETHOD(SetVertexShader)          ( LPDIRECT3DVERTEXSHADER9 pShader )
+                                            { return m_pFilter->SetVertexShader( pShader ); }
+    STDMETHOD(SetVertexShaderConstantF) ( UINT reg, CONST FLOAT* pData, UINT count )
+                                            { return m_pDevice->SetVertexShaderConstantF( reg, pData, count ); }
+    STDMETHOD(SetVertexShaderConstantI) ( UINT reg, CONST INT* pData, UINT count )
+                                            { return m_pDevice->SetVertexShaderConstantI( reg, pData, count ); }
+    STDMETHOD(SetVertexShaderConstantB) ( UINT reg, CONST BOOL* pData, UINT count )
+                                            { return m_pDevice->SetVertexShaderConstantB( reg, pData, count ); }
+    STDMETHOD(SetPixelShader)           ( LPDIRECT3DPIXELSHADER9 pShader )
+                                            { return m_pFilter->SetPixelShader( pShader ); }
+    STDMETHOD(SetPixelShaderConstantF)  ( UINT reg, CONST FLOAT* pData, UINT count )
+                                            { return m_pDevice->SetPixelShaderConstantF( reg, pData, count ); }
+    STDMETHOD(SetPixelShaderConstantI)  ( UINT reg, CONST INT* pData, UINT count )
+                                            { return m_pDevice->SetPixelShaderConstantI( reg, pData, count ); }
+    STDMETHOD(SetPixelShaderConstantB)  ( UINT reg, CONST BOOL* pData, UINT count )
+                                            { return m_pDevice->SetPixelShaderConstantB( reg, pData, count ); }
+}; // class EffectStateManager
+
+//  state filter and effect state manager of the render system
+DeviceStateFilter*      GetStateFilter();
+EffectStateManager*     GetEffectStateManager();
+
+//  runs scripted state sequence through the filter on the stub device
+//  and checks that the device ends up in the expected state
+bool                    TestDeviceStateFilter();
+
+#endif // __D3DSTATEFILTER_H__
@@ -6,6 +6,7 @@
 /*****************************************************************************/
 #include "gRenderPch.h"
 #include "d3dTexture.h"
+#include "d3dStateFilter.h"
 #include "d3dAdapt.h"
 #include "direct.h"
 extern int OtherTime;
@@ -124,7 +125,7 @@ void TextureDX9::Bind( int stage )
         Load();
     }
     __beginT();
-    DX_CHK( m_pDevice->SetTexture( stage, m_pBaseTexture ) );
+    DX_CHK( GetStateFilter()->SetTexture( stage, m_pBaseTexture ) );
     __endT(SetTextureTime);
 } // TextureDX9::Bind
 
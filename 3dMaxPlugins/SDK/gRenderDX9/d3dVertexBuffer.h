@@ -63,7 +63,8 @@ public:
     virtual bool            HasAppendSpace           ( int numV );
     
     virtual void            Unlock                  ();
-    virtual bool            IsStampValid            ( DWORD stamp ) { return (stamp >= m_FirstValidStamp); }
+    //  stamps with the high bit set come from the null render system and are never valid here
+    virtual bool            IsStampValid            ( DWORD stamp ) { return (int( stamp ) >= m_FirstValidStamp); }
 
     void                    SetStride               ( int stride ) { m_VStride = stride; }
     virtual void            Purge                   ();